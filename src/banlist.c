@@ -27,6 +27,7 @@
 #include "banlist.h"
 #include "buffer.h"
 #include "hash.h"
+#include "journal.h"
 
 #ifndef USE_WINDOWS
 #  ifdef HAVE_ARPA_INET_H
@@ -64,8 +65,29 @@ __inline__ unsigned int nicktolower (unsigned char *dest, unsigned char *source)
   return l;
 };
 
-banlist_entry_t *banlist_add (banlist_t * list, unsigned char *op, unsigned char *nick, uint32_t ip,
-			      uint32_t netmask, buffer_t * reason, unsigned long expire)
+/* unlink an entry without journaling it, used for replaced and expired bans */
+static unsigned int banlist_remove (banlist_t * list, banlist_entry_t * e)
+{
+  if (!e)
+    return 0;
+
+  ASSERT (list->netmask_inuse[netmask_to_numbits (e->netmask)]);
+  list->netmask_inuse[netmask_to_numbits (e->netmask)]--;
+
+  dllist_del ((dllist_entry_t *) (&e->list_ip));
+  dllist_del ((dllist_entry_t *) (&e->list_name));
+  if (e->message)
+    bf_free (e->message);
+
+  free (e);
+
+  return 1;
+}
+
+/* link a new entry without looking for an earlier ban of the same nick and ip */
+static banlist_entry_t *banlist_insert (banlist_t * list, unsigned char *op, unsigned char *nick,
+					uint32_t ip, uint32_t netmask, buffer_t * reason,
+					unsigned long expire)
 {
   banlist_entry_t *b;
   uint32_t i;
@@ -79,10 +101,6 @@ banlist_entry_t *banlist_add (banlist_t * list, unsigned char *op, unsigned char
 
   l = nicktolower (n, nick);
 
-  /* delete any earlier bans of this ip. */
-  if ((b = banlist_find_exact (list, nick, ip, netmask)))
-    banlist_del (list, b);
-
   /* alloc and clear new element */
   b = malloc (sizeof (banlist_entry_t));
 
@@ -111,22 +129,30 @@ banlist_entry_t *banlist_add (banlist_t * list, unsigned char *op, unsigned char
   return b;
 }
 
+banlist_entry_t *banlist_add (banlist_t * list, unsigned char *op, unsigned char *nick, uint32_t ip,
+			      uint32_t netmask, buffer_t * reason, unsigned long expire)
+{
+  banlist_entry_t *b;
+
+  /* delete any earlier bans of this ip. */
+  if ((b = banlist_find_exact (list, nick, ip, netmask)))
+    banlist_remove (list, b);
+
+  b = banlist_insert (list, op, nick, ip, netmask, reason, expire);
+  if (b)
+    journal_ban (list, b);
+
+  return b;
+}
+
 unsigned int banlist_del (banlist_t * list, banlist_entry_t * e)
 {
   if (!e)
     return 0;
 
-  ASSERT (list->netmask_inuse[netmask_to_numbits (e->netmask)]);
-  list->netmask_inuse[netmask_to_numbits (e->netmask)]--;
-
-  dllist_del ((dllist_entry_t *) (&e->list_ip));
-  dllist_del ((dllist_entry_t *) (&e->list_name));
-  if (e->message)
-    bf_free (e->message);
-
-  free (e);
+  journal_unban (list, e);
 
-  return 1;
+  return banlist_remove (list, e);
 }
 
 unsigned int banlist_del_byip (banlist_t * list, uint32_t ip, uint32_t netmask)
@@ -170,7 +196,7 @@ repeat:
     return NULL;
 
   if (e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -199,7 +225,7 @@ repeat:
     return NULL;
 
   if (e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -233,7 +259,7 @@ repeat:
     return NULL;
 
   if (e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -262,7 +288,7 @@ repeat:
     return NULL;
 
   if (e && e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -298,7 +324,7 @@ repeat:
     return NULL;
 
   if (e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -327,7 +353,7 @@ repeat:
     return NULL;
 
   if (e->expire && (now.tv_sec > e->expire)) {
-    banlist_del (list, e);
+    banlist_remove (list, e);
     e = NULL;
     goto repeat;
   }
@@ -359,32 +385,241 @@ unsigned int banlist_cleanup (banlist_t * list)
   return 0;
 }
 
-unsigned int banlist_save (banlist_t * list, xml_node_t * node)
+unsigned int banlist_save (banlist_t * list, xml_writer_t * w)
 {
   uint32_t i;
   banlist_entry_t *e;
   dllist_entry_t *l, *p, *n;
 
-  node = xml_node_add (node, "BanList");
+  xml_writer_start (w, "BanList");
   dlhashlist_foreach (&list->list_ip, i) {
     l = dllist_bucket (&list->list_ip, i);
     for (p = l->next; p != dllist_end (l); p = n) {
       n = p->next;
       e = (banlist_entry_t *) p;
       if (e->expire && (e->expire < now.tv_sec)) {
-	banlist_del (list, e);
+	banlist_remove (list, e);
 	continue;
       }
-      node = xml_node_add (node, "Ban");
-      xml_node_add_value (node, "IP", XML_TYPE_IP, &e->ip);
-      xml_node_add_value (node, "Netmask", XML_TYPE_IP, &e->netmask);
-      xml_node_add_value (node, "Nick", XML_TYPE_STRING, &e->nick);
-      xml_node_add_value (node, "OP", XML_TYPE_STRING, &e->op);
-      xml_node_add_value (node, "Expire", XML_TYPE_ULONG, &e->expire);
-      xml_node_add_value (node, "Message", XML_TYPE_STRING, e->message ? e->message->s : NULL);
-      node = xml_parent (node);
+      xml_writer_start (w, "Ban");
+      xml_writer_value (w, "IP", XML_TYPE_IP, &e->ip);
+      xml_writer_value (w, "Netmask", XML_TYPE_IP, &e->netmask);
+      xml_writer_value (w, "Nick", XML_TYPE_STRING, &e->nick);
+      xml_writer_value (w, "OP", XML_TYPE_STRING, &e->op);
+      xml_writer_value (w, "Expire", XML_TYPE_ULONG, &e->expire);
+      xml_writer_value (w, "Message", XML_TYPE_STRING, e->message ? e->message->s : NULL);
+      xml_writer_end (w);
     }
   }
+  xml_writer_end (w);
+  return 0;
+}
+
+#define BANLIST_PARSE_IP	1
+#define BANLIST_PARSE_NETMASK	2
+#define BANLIST_PARSE_NICK	4
+#define BANLIST_PARSE_OP	8
+#define BANLIST_PARSE_EXPIRE	16
+#define BANLIST_PARSE_MESSAGE	32
+#define BANLIST_PARSE_ALL	63
+
+static int banlist_parse_start (xml_parser_t * parser, unsigned char *name)
+{
+  banlist_parser_t *p = (banlist_parser_t *) parser;
+
+  /* the element we are registered for: start a new list */
+  if (!parser->depth) {
+    if (!p->scratch.list_ip.hashlist)
+      banlist_init (&p->scratch);
+    banlist_clear (&p->scratch);
+    p->present = 1;
+    return 0;
+  }
+
+  if (!strcmp (name, "Ban"))
+    p->found = 0;
+
+  return 0;
+}
+
+static int banlist_parse_value (xml_parser_t * parser, unsigned char *name, unsigned char *value)
+{
+  banlist_parser_t *p = (banlist_parser_t *) parser;
+
+  /* strings point into the parse buffer, they are copied by banlist_add */
+  if (!strcmp (name, "IP")) {
+    xml_value_get (value, XML_TYPE_IP, &p->ip);
+    p->found |= BANLIST_PARSE_IP;
+  } else if (!strcmp (name, "Netmask")) {
+    xml_value_get (value, XML_TYPE_IP, &p->netmask);
+    p->found |= BANLIST_PARSE_NETMASK;
+  } else if (!strcmp (name, "Nick")) {
+    p->nick = value;
+    p->found |= BANLIST_PARSE_NICK;
+  } else if (!strcmp (name, "OP")) {
+    p->op = value;
+    p->found |= BANLIST_PARSE_OP;
+  } else if (!strcmp (name, "Expire")) {
+    xml_value_get (value, XML_TYPE_LONG, &p->expire);
+    p->found |= BANLIST_PARSE_EXPIRE;
+  } else if (!strcmp (name, "Message")) {
+    p->message = value;
+    p->found |= BANLIST_PARSE_MESSAGE;
+  }
+
+  return 0;
+}
+
+static int banlist_parse_end (xml_parser_t * parser, unsigned char *name)
+{
+  banlist_parser_t *p = (banlist_parser_t *) parser;
+
+  if (strcmp (name, "Ban") || (p->found != BANLIST_PARSE_ALL))
+    return 0;
+
+  if (p->expire && (p->expire < now.tv_sec))
+    return 0;
+
+  banlist_add (&p->scratch, p->op, p->nick, p->ip, p->netmask, bf_buffer (p->message),
+	       p->expire);
+
+  return 0;
+}
+
+/* the buckets are allocated separately, so the lists can be swapped by value */
+static int banlist_parse_finish (xml_parser_t * parser, int ok)
+{
+  banlist_parser_t *p = (banlist_parser_t *) parser;
+  banlist_t old;
+
+  if (ok) {
+    if (p->present) {
+      old = *p->list;
+      *p->list = p->scratch;
+      p->scratch = old;
+    }
+    banlist_clear (p->present ? &p->scratch : p->list);
+  } else if (p->present) {
+    banlist_clear (&p->scratch);
+  }
+  p->present = 0;
+
+  return 0;
+}
+
+xml_parser_t *banlist_parser (banlist_parser_t * p, banlist_t * list)
+{
+  memset (p, 0, sizeof (banlist_parser_t));
+
+  p->parser.start = banlist_parse_start;
+  p->parser.value = banlist_parse_value;
+  p->parser.end = banlist_parse_end;
+  p->parser.finish = banlist_parse_finish;
+  p->list = list;
+
+  return &p->parser;
+}
+
+int banlist_snapshot_save (snapshot_t * s, unsigned char *name, banlist_t * list)
+{
+  banlist_snapshot_t header;
+  banlist_snapshot_entry_t entry;
+  banlist_entry_t *e;
+  dllist_entry_t *l, *p, *n;
+  uint32_t i;
+  uint64_t offset = 0;
+  unsigned long count = 0;
+
+  dlhashlist_foreach (&list->list_ip, i) {
+    l = dllist_bucket (&list->list_ip, i);
+    for (p = l->next; p != dllist_end (l); p = n) {
+      n = p->next;
+      e = (banlist_entry_t *) p;
+      if (e->expire && (e->expire < now.tv_sec)) {
+	banlist_remove (list, e);
+	continue;
+      }
+      count++;
+    }
+  }
+
+  memset (&header, 0, sizeof (banlist_snapshot_t));
+  header.recordsize = sizeof (banlist_snapshot_entry_t);
+  header.count = count;
+  header.strings = sizeof (banlist_snapshot_t) + count * sizeof (banlist_snapshot_entry_t);
+
+  snapshot_section_start (s, name);
+  snapshot_write (s, &header, sizeof (banlist_snapshot_t));
+
+  dlhashlist_foreach (&list->list_ip, i) {
+    l = dllist_bucket (&list->list_ip, i);
+    for (p = l->next; p != dllist_end (l); p = p->next) {
+      e = (banlist_entry_t *) p;
+      memset (&entry, 0, sizeof (banlist_snapshot_entry_t));
+      entry.ip = e->ip;
+      entry.netmask = e->netmask;
+      entry.expire = e->expire;
+      entry.message = offset;
+      memcpy (entry.nick, e->nick, NICKLENGTH);
+      memcpy (entry.op, e->op, NICKLENGTH);
+      snapshot_write (s, &entry, sizeof (banlist_snapshot_entry_t));
+      offset += (e->message ? bf_used (e->message) : 0) + 1;
+    }
+  }
+
+  dlhashlist_foreach (&list->list_ip, i) {
+    l = dllist_bucket (&list->list_ip, i);
+    for (p = l->next; p != dllist_end (l); p = p->next) {
+      e = (banlist_entry_t *) p;
+      if (e->message)
+	snapshot_write (s, e->message->s, bf_used (e->message));
+      snapshot_write (s, "", 1);
+    }
+  }
+
+  return snapshot_section_end (s, count);
+}
+
+/* the bans are copied out of the mapped file. they are unique, so they need no duplicate check. */
+int banlist_snapshot_load (snapshot_t * s, unsigned char *name, banlist_t * list)
+{
+  banlist_snapshot_t *header;
+  banlist_snapshot_entry_t *entry;
+  unsigned char *strings;
+  unsigned long length, size, i;
+
+  header = snapshot_section (s, name, &length);
+  if (!header)
+    return 0;
+
+  if ((length < sizeof (banlist_snapshot_t))
+      || (header->recordsize != sizeof (banlist_snapshot_entry_t))
+      || (header->strings < sizeof (banlist_snapshot_t)) || (header->strings > length)
+      || (header->count >
+	  ((header->strings - sizeof (banlist_snapshot_t)) / sizeof (banlist_snapshot_entry_t))))
+    return -1;
+
+  strings = (unsigned char *) header + header->strings;
+  size = length - header->strings;
+
+  /* check every record before the current bans are replaced */
+  entry = (banlist_snapshot_entry_t *) (header + 1);
+  for (i = 0; i < header->count; i++)
+    if ((entry[i].message >= size)
+	|| !memchr (strings + entry[i].message, 0, size - entry[i].message)
+	|| !memchr (entry[i].nick, 0, NICKLENGTH) || !memchr (entry[i].op, 0, NICKLENGTH))
+      return -1;
+
+  banlist_clear (list);
+
+  /* backwards, so the hash chains end up in their saved order */
+  for (i = header->count; i--;) {
+    if (entry[i].expire && (entry[i].expire < now.tv_sec))
+      continue;
+    banlist_insert (list, entry[i].op, entry[i].nick, entry[i].ip, entry[i].netmask,
+		    bf_buffer (strings + entry[i].message), entry[i].expire);
+  }
+
   return 0;
 }
 
@@ -483,6 +718,7 @@ void banlist_clear (banlist_t * list)
       ASSERT (list->netmask_inuse[netmask_to_numbits (e->netmask)]);
       list->netmask_inuse[netmask_to_numbits (e->netmask)]--;
       dllist_del ((dllist_entry_t *) e);
+      dllist_del ((dllist_entry_t *) & e->list_name);
       bf_free (e->message);
       free (e);
     }
@@ -33,6 +33,7 @@
 #include "buffer.h"
 #include "dllist.h"
 #include "xml.h"
+#include "snapshot.h"
 
 typedef struct banlist_entry {
   dllist_entry_t list_ip;
@@ -72,9 +73,44 @@ extern banlist_entry_t *banlist_find (banlist_t * list, unsigned char *, uint32_
 extern unsigned int banlist_cleanup (banlist_t * list);
 extern void banlist_clear (banlist_t * list);
 
-extern unsigned int banlist_save (banlist_t * list, xml_node_t *node);
+extern unsigned int banlist_save (banlist_t * list, xml_writer_t *);
 extern unsigned int banlist_load (banlist_t * list, xml_node_t *node);
 
+/* streaming loader, register it for the element that contains the <BanList>.
+ *  the bans are collected in scratch and only replace the list when the parse succeeds. */
+typedef struct banlist_parser {
+  xml_parser_t parser;
+
+  banlist_t *list;
+  banlist_t scratch;
+  unsigned int present;
+  unsigned int found;
+  unsigned long ip, netmask;
+  long expire;
+  unsigned char *nick, *op, *message;
+} banlist_parser_t;
+
+extern xml_parser_t *banlist_parser (banlist_parser_t * parser, banlist_t * list);
+
+/* binary snapshot section: a header, the bans and then their messages */
+typedef struct banlist_snapshot {
+  uint32_t recordsize;
+  uint32_t count;
+  uint64_t strings;		/* offset of the messages from the start of the section */
+} banlist_snapshot_t;
+
+typedef struct banlist_snapshot_entry {
+  uint32_t ip;
+  uint32_t netmask;
+  int64_t expire;
+  uint64_t message;		/* offset of the message from the start of the messages */
+  unsigned char nick[NICKLENGTH];
+  unsigned char op[NICKLENGTH];
+} banlist_snapshot_entry_t;
+
+extern int banlist_snapshot_save (snapshot_t * s, unsigned char *name, banlist_t * list);
+extern int banlist_snapshot_load (snapshot_t * s, unsigned char *name, banlist_t * list);
+
 extern void banlist_init (banlist_t * list);
 
 #endif /* _BANLIST_H_ */
@@ -120,23 +120,203 @@ unsigned int banlist_client_cleanup (banlist_client_t * list)
   return 0;
 }
 
-unsigned int banlist_client_save (banlist_client_t * list, xml_node_t * node)
+unsigned int banlist_client_save (banlist_client_t * list, xml_writer_t * w)
 {
   uint32_t i;
   banlist_client_entry_t *e, *lst;
 
-  node = xml_node_add (node, "ClientBanList");
+  xml_writer_start (w, "ClientBanList");
   dlhashlist_foreach (list, i) {
     lst = dllist_bucket (list, i);
     dllist_foreach (lst, e) {
-      node = xml_node_add (node, "ClientBan");
-      xml_node_add_value (node, "Client", XML_TYPE_STRING, e->client);
-      xml_node_add_value (node, "MinVersion", XML_TYPE_DOUBLE, &e->minVersion);
-      xml_node_add_value (node, "MaxVersion", XML_TYPE_DOUBLE, &e->maxVersion);
-      xml_node_add_value (node, "Message", XML_TYPE_STRING, e->message->s);
-      node = xml_parent (node);
+      xml_writer_start (w, "ClientBan");
+      xml_writer_value (w, "Client", XML_TYPE_STRING, e->client);
+      xml_writer_value (w, "MinVersion", XML_TYPE_DOUBLE, &e->minVersion);
+      xml_writer_value (w, "MaxVersion", XML_TYPE_DOUBLE, &e->maxVersion);
+      xml_writer_value (w, "Message", XML_TYPE_STRING, e->message->s);
+      xml_writer_end (w);
     }
   }
+  xml_writer_end (w);
+
+  return 0;
+}
+
+#define BANLIST_CLIENT_PARSE_CLIENT	1
+#define BANLIST_CLIENT_PARSE_MIN	2
+#define BANLIST_CLIENT_PARSE_MAX	4
+#define BANLIST_CLIENT_PARSE_MESSAGE	8
+#define BANLIST_CLIENT_PARSE_ALL	15
+
+static int banlist_client_parse_start (xml_parser_t * parser, unsigned char *name)
+{
+  banlist_client_parser_t *p = (banlist_client_parser_t *) parser;
+
+  if (!parser->depth) {
+    if (!p->scratch.hashlist)
+      banlist_client_init (&p->scratch);
+    banlist_client_clear (&p->scratch);
+    p->present = 1;
+    return 0;
+  }
+
+  if (!strcmp (name, "ClientBan"))
+    p->found = 0;
+
+  return 0;
+}
+
+static int banlist_client_parse_value (xml_parser_t * parser, unsigned char *name,
+				       unsigned char *value)
+{
+  banlist_client_parser_t *p = (banlist_client_parser_t *) parser;
+
+  if (!strcmp (name, "Client")) {
+    p->client = value;
+    p->found |= BANLIST_CLIENT_PARSE_CLIENT;
+  } else if (!strcmp (name, "MinVersion")) {
+    xml_value_get (value, XML_TYPE_DOUBLE, &p->min);
+    p->found |= BANLIST_CLIENT_PARSE_MIN;
+  } else if (!strcmp (name, "MaxVersion")) {
+    xml_value_get (value, XML_TYPE_DOUBLE, &p->max);
+    p->found |= BANLIST_CLIENT_PARSE_MAX;
+  } else if (!strcmp (name, "Message")) {
+    p->message = value;
+    p->found |= BANLIST_CLIENT_PARSE_MESSAGE;
+  }
+
+  return 0;
+}
+
+static int banlist_client_parse_end (xml_parser_t * parser, unsigned char *name)
+{
+  banlist_client_parser_t *p = (banlist_client_parser_t *) parser;
+
+  if (strcmp (name, "ClientBan") || (p->found != BANLIST_CLIENT_PARSE_ALL))
+    return 0;
+
+  banlist_client_add (&p->scratch, p->client, p->min, p->max, bf_buffer (p->message));
+
+  return 0;
+}
+
+/* a missing element empties the list */
+static int banlist_client_parse_finish (xml_parser_t * parser, int ok)
+{
+  banlist_client_parser_t *p = (banlist_client_parser_t *) parser;
+  banlist_client_t old;
+
+  if (ok) {
+    if (p->present) {
+      old = *p->list;
+      *p->list = p->scratch;
+      p->scratch = old;
+    }
+    banlist_client_clear (p->present ? &p->scratch : p->list);
+  } else if (p->present) {
+    banlist_client_clear (&p->scratch);
+  }
+  p->present = 0;
+
+  return 0;
+}
+
+xml_parser_t *banlist_client_parser (banlist_client_parser_t * p, banlist_client_t * list)
+{
+  memset (p, 0, sizeof (banlist_client_parser_t));
+
+  p->parser.start = banlist_client_parse_start;
+  p->parser.value = banlist_client_parse_value;
+  p->parser.end = banlist_client_parse_end;
+  p->parser.finish = banlist_client_parse_finish;
+  p->list = list;
+
+  return &p->parser;
+}
+
+int banlist_client_snapshot_save (snapshot_t * s, unsigned char *name, banlist_client_t * list)
+{
+  banlist_client_snapshot_t header;
+  banlist_client_snapshot_entry_t entry;
+  banlist_client_entry_t *e, *lst;
+  uint32_t i;
+  uint64_t offset = 0;
+  unsigned long count = 0;
+
+  dlhashlist_foreach (list, i) {
+    lst = dllist_bucket (list, i);
+    dllist_foreach (lst, e)
+      count++;
+  }
+
+  memset (&header, 0, sizeof (banlist_client_snapshot_t));
+  header.recordsize = sizeof (banlist_client_snapshot_entry_t);
+  header.count = count;
+  header.strings =
+    sizeof (banlist_client_snapshot_t) + count * sizeof (banlist_client_snapshot_entry_t);
+
+  snapshot_section_start (s, name);
+  snapshot_write (s, &header, sizeof (banlist_client_snapshot_t));
+
+  dlhashlist_foreach (list, i) {
+    lst = dllist_bucket (list, i);
+    dllist_foreach (lst, e) {
+      memset (&entry, 0, sizeof (banlist_client_snapshot_entry_t));
+      memcpy (entry.client, e->client, NICKLENGTH);
+      entry.minVersion = e->minVersion;
+      entry.maxVersion = e->maxVersion;
+      entry.message = offset;
+      snapshot_write (s, &entry, sizeof (banlist_client_snapshot_entry_t));
+      offset += bf_used (e->message) + 1;
+    }
+  }
+
+  dlhashlist_foreach (list, i) {
+    lst = dllist_bucket (list, i);
+    dllist_foreach (lst, e) {
+      snapshot_write (s, e->message->s, bf_used (e->message));
+      snapshot_write (s, "", 1);
+    }
+  }
+
+  return snapshot_section_end (s, count);
+}
+
+int banlist_client_snapshot_load (snapshot_t * s, unsigned char *name, banlist_client_t * list)
+{
+  banlist_client_snapshot_t *header;
+  banlist_client_snapshot_entry_t *entry;
+  unsigned char *strings;
+  unsigned long length, size, i;
+
+  header = snapshot_section (s, name, &length);
+  if (!header)
+    return 0;
+
+  if ((length < sizeof (banlist_client_snapshot_t))
+      || (header->recordsize != sizeof (banlist_client_snapshot_entry_t))
+      || (header->strings < sizeof (banlist_client_snapshot_t)) || (header->strings > length)
+      || (header->count >
+	  ((header->strings - sizeof (banlist_client_snapshot_t)) /
+	   sizeof (banlist_client_snapshot_entry_t))))
+    return -1;
+
+  strings = (unsigned char *) header + header->strings;
+  size = length - header->strings;
+
+  /* check every record before the current bans are replaced */
+  entry = (banlist_client_snapshot_entry_t *) (header + 1);
+  for (i = 0; i < header->count; i++)
+    if ((entry[i].message >= size)
+	|| !memchr (strings + entry[i].message, 0, size - entry[i].message)
+	|| !memchr (entry[i].client, 0, NICKLENGTH))
+      return -1;
+
+  banlist_client_clear (list);
+
+  for (i = header->count; i--;)
+    banlist_client_add (list, entry[i].client, entry[i].minVersion, entry[i].maxVersion,
+			bf_buffer (strings + entry[i].message));
 
   return 0;
 }
@@ -32,6 +32,8 @@
 #include "config.h"
 #include "buffer.h"
 #include "dllist.h"
+#include "xml.h"
+#include "snapshot.h"
 
 typedef struct banlist_client {
   dllist_entry_t dllist;
@@ -59,9 +61,43 @@ extern banlist_client_entry_t *banlist_client_find (banlist_client_t * list, uns
 extern unsigned int banlist_client_cleanup (banlist_client_t * list);
 extern void banlist_client_clear (banlist_client_t * list);
 
-extern unsigned int banlist_client_save (banlist_client_t * list, xml_node_t *);
+extern unsigned int banlist_client_save (banlist_client_t * list, xml_writer_t *);
 extern unsigned int banlist_client_load (banlist_client_t * list, xml_node_t *);
 
+/* streaming loader for <ClientBanList>, it replaces the list when the parse succeeds */
+typedef struct banlist_client_parser {
+  xml_parser_t parser;
+
+  banlist_client_t *list;
+  banlist_client_t scratch;
+  unsigned int present;
+  unsigned int found;
+  double min, max;
+  unsigned char *client, *message;
+} banlist_client_parser_t;
+
+extern xml_parser_t *banlist_client_parser (banlist_client_parser_t * parser,
+					    banlist_client_t * list);
+
+/* binary snapshot section: a header, the bans and then their messages */
+typedef struct banlist_client_snapshot {
+  uint32_t recordsize;
+  uint32_t count;
+  uint64_t strings;		/* offset of the messages from the start of the section */
+} banlist_client_snapshot_t;
+
+typedef struct banlist_client_snapshot_entry {
+  unsigned char client[NICKLENGTH];
+  double minVersion;
+  double maxVersion;
+  uint64_t message;		/* offset of the message from the start of the messages */
+} banlist_client_snapshot_entry_t;
+
+extern int banlist_client_snapshot_save (snapshot_t * s, unsigned char *name,
+					 banlist_client_t * list);
+extern int banlist_client_snapshot_load (snapshot_t * s, unsigned char *name,
+					 banlist_client_t * list);
+
 extern void banlist_client_init (banlist_client_t * list);
 
 #endif /* _BANLISTCLIENT_H_ */
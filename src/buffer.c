@@ -140,6 +140,20 @@ void bf_claim (buffer_t * buffer)
   bf_claim (buffer->next);
 }
 
+/* take a reference to a buffer that outlives the caller: the static buffer is copied. */
+buffer_t *bf_keep (buffer_t * buffer)
+{
+  if (!buffer)
+    return NULL;
+
+  if (buffer == &static_buf)
+    return bf_copy (buffer, 0);
+
+  bf_claim (buffer);
+
+  return buffer;
+}
+
 int bf_append_raw (buffer_t ** buffer, unsigned char *data, unsigned long size)
 {
   buffer_t *l, *b;
@@ -66,6 +66,7 @@ extern buffer_t *bf_alloc (unsigned long size);
 extern void bf_free (buffer_t * buffer);
 extern void bf_free_single (buffer_t * buffer);
 extern void bf_claim (buffer_t * buffer);
+extern buffer_t *bf_keep (buffer_t * buffer);
 extern void bf_verify (buffer_t *buffer);
 
 extern int bf_append_raw (buffer_t ** buffer, unsigned char *data, unsigned long size);
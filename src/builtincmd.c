@@ -61,6 +61,7 @@ GeoIP *gi;
 
 unsigned int MinPwdLength;
 unsigned long AutoSaveInterval;
+unsigned long AutoSaveBackground;
 unsigned char *ReportTarget;
 unsigned long KickMaxBanTime;
 unsigned int KickNoBanMayBan;
@@ -1000,6 +1001,7 @@ unsigned long handler_rightdestroy (plugin_user_t * user, buffer_t * output, voi
 
 /* user handling */
 #include "user.h"
+#include "journal.h"
 extern account_t *accounts;
 extern account_type_t *accountTypes;
 
@@ -1094,6 +1096,7 @@ unsigned long handler_groupcap (plugin_user_t * user, buffer_t * output, void *p
 
   type->rights |= cap;
   type->rights &= ~ncap;
+  journal_group (type);
 
   bf_printf (output, _("Group %s modified. Current rights:"), argv[1]);
   flags_print ((Capabilities + CAP_PRINT_OFFSET), output, type->rights);
@@ -1240,6 +1243,7 @@ unsigned long handler_useradd (plugin_user_t * user, buffer_t * output, void *pr
 
   account = account_add (type, user->nick, argv[1]);
   account->rights |= cap;
+  journal_account (account);
 
   bf_printf (output, _("User %s created with group %s.\nCurrent rights:"), account->nick,
 	     type->name);
@@ -1316,6 +1320,7 @@ unsigned long handler_usercap (plugin_user_t * user, buffer_t * output, void *pr
 
   account->rights |= cap;
   account->rights &= ~ncap;
+  journal_account (account);
 
   /* warn if rights could not be successfully deleted. */
   if (account->classp->rights & ncap) {
@@ -2028,7 +2033,7 @@ unsigned long handler_save (plugin_user_t * user, buffer_t * output, void *priv,
 unsigned long handler_load (plugin_user_t * user, buffer_t * output, void *priv, unsigned int argc,
 			    unsigned char **argv)
 {
-  unsigned long retval = plugin_config_load ();
+  unsigned long retval = plugin_config_load (output);
 
   bf_printf (output, _("Data reloaded."));
 
@@ -2040,21 +2045,32 @@ unsigned long handler_autosave (plugin_user_t * user, void *ctxt, unsigned long
   buffer_t *output;
   unsigned int l;
 
+  output = bf_alloc (1024);
+  bf_printf (output, _("Errors during autosave:\n"));
+  l = bf_used (output);
+
+  /* collect the result of a previous background save */
+  if (plugin_config_save_check (output))
+    goto leave;
+
   if (!AutoSaveInterval)
-    return 0;
+    goto leave;
 
   if (now.tv_sec > (savetime.tv_sec + (time_t) AutoSaveInterval)) {
     savetime = now;
-    output = bf_alloc (1024);
-    bf_printf (output, _("Errors during autosave:\n"));
-    l = bf_used (output);
-    plugin_config_save (output);
-    if (bf_used (output) != l) {
-      plugin_report (output);
+    if (AutoSaveBackground) {
+      plugin_config_save_background (output);
+    } else {
+      plugin_config_save (output);
     }
-    bf_free (output);
   }
 
+leave:
+  if (bf_used (output) != l) {
+    plugin_report (output);
+  }
+  bf_free (output);
+
   return 0;
 }
 
@@ -2065,12 +2081,14 @@ int builtincmd_init ()
   /* *INDENT-OFF* */
   MinPwdLength        = DEFAULT_MINPWDLENGTH;
   AutoSaveInterval    = DEFAULT_AUTOSAVEINTERVAL;
+  AutoSaveBackground  = DEFAULT_AUTOSAVEBACKGROUND;
   ReportTarget      = strdup (DEFAULT_REPORTTARGET);
   KickMaxBanTime      = 0;
   KickNoBanMayBan      = 0;
   
   config_register ("MinPwdLength",     CFG_ELEM_UINT,   &MinPwdLength,     _("Minimum length of a password."));
   config_register ("AutoSaveInterval", CFG_ELEM_ULONG,  &AutoSaveInterval, _("Period for autosaving settings, set to 0 to disable."));
+  config_register ("AutoSaveBackground", CFG_ELEM_ULONG, &AutoSaveBackground, _("Autosave from a background process so the hub does not wait for it. Set to 0 to save from the hub itself."));
   config_register ("ReportTarget",     CFG_ELEM_STRING, &ReportTarget,     _("User to send report to. Can be a chatroom."));
   config_register ("kickmaxbantime",   CFG_ELEM_ULONG,  &KickMaxBanTime,   _("This is the maximum bantime you can give with a kick (and using _ban_). This does not affect someone with the ban right."));
   config_register ("kicknobanmayban",  CFG_ELEM_UINT,   &KickNoBanMayBan,  _("If set, then a user without the ban right can use _ban_ to ban anyway. The maximum time can be set with kickmaxbantime."));
@@ -138,21 +138,59 @@ int cap_custom_remove (unsigned char *name) {
 	return 0;
 }
 
-int cap_save (xml_node_t *node) {
+int cap_save (xml_writer_t *w) {
 	unsigned int i;
 	
-	node = xml_node_add (node, "CustomRights");
+	xml_writer_start (w, "CustomRights");
 
 	for (i = CAP_CUSTOM_OFFSET; i < CAP_CUSTOM_MAX; i++) {
 		if (!Capabilities[i].flag) continue;
-		node = xml_node_add (node, "Right");
-			xml_node_add_value (node, "Name", XML_TYPE_STRING, Capabilities[i].name);
-			xml_node_add_value (node, "Help", XML_TYPE_STRING, Capabilities[i].help);
-		node = xml_parent (node);
+		xml_writer_start (w, "Right");
+			xml_writer_value (w, "Name", XML_TYPE_STRING, Capabilities[i].name);
+			xml_writer_value (w, "Help", XML_TYPE_STRING, Capabilities[i].help);
+		xml_writer_end (w);
 	}
+	xml_writer_end (w);
 	return 0;
 }
 
+/* streaming loader for <CustomRights> */
+typedef struct cap_parser {
+	xml_parser_t parser;
+	unsigned char *name, *help;
+} cap_parser_t;
+
+static cap_parser_t capparser;
+
+static int cap_parse_start (xml_parser_t *parser, unsigned char *name) {
+	capparser.name = NULL;
+	capparser.help = NULL;
+	return 0;
+}
+
+static int cap_parse_value (xml_parser_t *parser, unsigned char *name, unsigned char *value) {
+	if (!strcmp (name, "Name"))
+		capparser.name = value;
+	else if (!strcmp (name, "Help"))
+		capparser.help = value;
+	return 0;
+}
+
+static int cap_parse_end (xml_parser_t *parser, unsigned char *name) {
+	if (strcmp (name, "Right") || !capparser.name || !capparser.help)
+		return 0;
+	cap_custom_add (capparser.name, capparser.help);
+	return 0;
+}
+
+xml_parser_t *cap_parser () {
+	memset (&capparser, 0, sizeof (cap_parser_t));
+	capparser.parser.start = cap_parse_start;
+	capparser.parser.value = cap_parse_value;
+	capparser.parser.end = cap_parse_end;
+	return &capparser.parser;
+}
+
 int cap_load (xml_node_t *node) {
 	unsigned char *name = NULL, *help = NULL;
 	
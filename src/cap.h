@@ -71,6 +71,7 @@ extern flag_t Capabilities[];
 extern flag_t *cap_custom_add (unsigned char *name, unsigned char *help);
 extern int cap_custom_remove (unsigned char *name);
 
-extern int cap_save (xml_node_t *);
+extern int cap_save (xml_writer_t *);
+extern xml_parser_t *cap_parser ();
 
 #endif
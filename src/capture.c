@@ -0,0 +1,261 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Records the tokens users send to the hub, so the traffic can be fed back
+ *  into a test hub with tools/aqreplay. Only connections made after the
+ *  capture started are recorded, a replay needs their logins. Passwords are
+ *  left out unless Capture.Passwords is set.
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aqtime.h"
+#include "defaults.h"
+#include "capture.h"
+#include "cap.h"
+#include "config.h"
+#include "stats.h"
+#include "commands.h"
+
+#define CAPTURE_BUFFERSIZE	65536
+
+unsigned int CapturePasswords;
+unsigned long CaptureMaxSize;
+
+capture_stats_t capturestats;
+
+unsigned long capturefirst = ULONG_MAX;
+unsigned long capturenext = 1;
+
+FILE *capturefp = NULL;
+unsigned char capturefile[NAME_MAX + 1];
+struct timeval capturelast;
+struct timeval capturestart;
+
+/******************************* WRITING *******************************************/
+
+static void capture_write (unsigned long id, unsigned int type, unsigned char *data,
+			   unsigned long length)
+{
+  capture_record_t record;
+  long long delta;
+
+  delta = (now.tv_sec - capturelast.tv_sec) * 1000000LL + (now.tv_usec - capturelast.tv_usec);
+  if (delta < 0)
+    delta = 0;
+  if (delta > 0xffffffffLL)
+    delta = 0xffffffffLL;
+  capturelast = now;
+
+  record.delta = delta;
+  record.id = id - capturefirst + 1;
+  record.type = type;
+  record.length = length;
+
+  if ((fwrite (&record, sizeof (capture_record_t), 1, capturefp) != 1)
+      || (length && (fwrite (data, length, 1, capturefp) != 1))) {
+    capture_stop (NULL);
+    return;
+  }
+
+  capturestats.records++;
+  capturestats.bytes += sizeof (capture_record_t) + length;
+
+  if (CaptureMaxSize && (capturestats.bytes >= CaptureMaxSize))
+    capture_stop (NULL);
+}
+
+/* returns the id of the new connection, 0 if nothing is captured */
+unsigned long capture_connect ()
+{
+  if (!capturefp)
+    return 0;
+
+  capturestats.connections++;
+  capture_write (capturenext, CAPTURE_CONNECT, NULL, 0);
+
+  return capturenext++;
+}
+
+void capture_token (unsigned long id, buffer_t * token)
+{
+  unsigned long length;
+
+  if (!capturefp || !capture_active (id))
+    return;
+
+  length = bf_used (token);
+  if (!CapturePasswords && (length > 8) && !strncmp (token->s, "$MyPass ", 8))
+    length = 8;
+
+  capture_write (id, CAPTURE_TOKEN, token->s, length);
+}
+
+void capture_disconnect (unsigned long id)
+{
+  if (!capturefp || !capture_active (id))
+    return;
+
+  capture_write (id, CAPTURE_DISCONNECT, NULL, 0);
+}
+
+/******************************* CONTROL *******************************************/
+
+int capture_start (unsigned char *filename, buffer_t * output)
+{
+  capture_header_t header;
+  unsigned char name[NAME_MAX + 1];
+  int fd;
+
+  if (capturefp) {
+    bf_printf (output, _("Already capturing to %s.\n"), capturefile);
+    return -1;
+  }
+
+  /* captures stay in the hub directory, under their own prefix, and never replace a file */
+  if (!*filename || strchr (filename, '/') || strchr (filename, '\\')
+      || (strlen (filename) > NAME_MAX - strlen (CAPTURE_PREFIX))) {
+    bf_printf (output, _("Please use a plain file name.\n"));
+    return -1;
+  }
+  snprintf (name, sizeof (name), CAPTURE_PREFIX "%s", filename);
+
+  fd = open (name, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    bf_printf (output, _("Error opening capture %s: %s\n"), name, strerror (errno));
+    return -1;
+  }
+  capturefp = fdopen (fd, "wb");
+  if (!capturefp) {
+    bf_printf (output, _("Error opening capture %s: %s\n"), name, strerror (errno));
+    close (fd);
+    return -1;
+  }
+  setvbuf (capturefp, NULL, _IOFBF, CAPTURE_BUFFERSIZE);
+
+  memset (&header, 0, sizeof (capture_header_t));
+  memcpy (header.magic, CAPTURE_MAGIC, sizeof (header.magic));
+  header.version = CAPTURE_VERSION;
+  header.byteorder = CAPTURE_BYTEORDER;
+  header.start = ((uint64_t) now.tv_sec) * 1000000 + now.tv_usec;
+
+  if (fwrite (&header, sizeof (capture_header_t), 1, capturefp) != 1) {
+    bf_printf (output, _("Error writing capture %s: %s\n"), name, strerror (errno));
+    fclose (capturefp);
+    capturefp = NULL;
+    return -1;
+  }
+
+  strcpy (capturefile, name);
+  memset (&capturestats, 0, sizeof (capture_stats_t));
+  capturestats.bytes = sizeof (capture_header_t);
+  capturefirst = capturenext;
+  capturelast = now;
+  capturestart = now;
+
+  bf_printf (output, _("Capturing new connections to %s.\n"), capturefile);
+
+  return 0;
+}
+
+int capture_stop (buffer_t * output)
+{
+  int retval;
+
+  if (!capturefp) {
+    if (output)
+      bf_printf (output, _("Not capturing.\n"));
+    return -1;
+  }
+
+  retval = fclose (capturefp);
+  capturefp = NULL;
+  capturefirst = ULONG_MAX;
+
+  if (!output)
+    return retval;
+
+  if (retval) {
+    bf_printf (output, _("Error closing capture %s: %s\n"), capturefile, strerror (errno));
+  } else {
+    bf_printf (output, _("Capture %s closed: %lu connections, %lu records, %llu bytes.\n"),
+	       capturefile, capturestats.connections, capturestats.records, capturestats.bytes);
+  }
+
+  return retval;
+}
+
+unsigned long handler_capture (plugin_user_t * user, buffer_t * output, void *priv,
+			       unsigned int argc, unsigned char **argv)
+{
+  if (argc < 2) {
+    if (!capturefp) {
+      bf_printf (output, _("Not capturing.\n"));
+      return 0;
+    }
+    bf_printf (output,
+	       _("Capturing to %s for %lu seconds: %lu connections, %lu records, %llu bytes.\n"),
+	       capturefile, now.tv_sec - capturestart.tv_sec, capturestats.connections,
+	       capturestats.records, capturestats.bytes);
+    return 0;
+  }
+
+  if (!strcmp (argv[1], "stop")) {
+    capture_stop (output);
+    return 0;
+  }
+
+  capture_start (argv[1], output);
+
+  return 0;
+}
+
+int capture_init ()
+{
+  memset (&capturestats, 0, sizeof (capture_stats_t));
+
+  CapturePasswords = DEFAULT_CAPTURE_PASSWORDS;
+  CaptureMaxSize = DEFAULT_CAPTURE_MAXSIZE;
+
+  config_register ("Capture.Passwords", CFG_ELEM_UINT, &CapturePasswords,
+		   _("Include passwords in traffic captures. Only enable this to replay against a copy of the accounts."));
+  config_register ("Capture.MaxSize", CFG_ELEM_MEMSIZE, &CaptureMaxSize,
+		   _("A traffic capture is stopped when it reaches this size. 0 means no limit."));
+
+  stats_register ("capture.connections", VAL_ELEM_ULONG, &capturestats.connections,
+		  _("Connections recorded in the current traffic capture."));
+  stats_register ("capture.records", VAL_ELEM_ULONG, &capturestats.records,
+		  _("Records written to the current traffic capture."));
+  stats_register ("capture.bytes", VAL_ELEM_ULONGLONG, &capturestats.bytes,
+		  _("Size of the current traffic capture."));
+
+  command_register ("capture", &handler_capture, CAP_ADMIN,
+		    _("Record the traffic of new connections for tools/aqreplay. Use \"capture <name>\" to start writing to a new file capture-<name>, \"capture stop\" to stop and \"capture\" to show the status."));
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "../config.h"
+#if HAVE_INTTYPES_H
+# include <inttypes.h>
+#else
+# if HAVE_STDINT_H
+#  include <stdint.h>
+# endif
+#endif
+
+#include "buffer.h"
+
+#define CAPTURE_MAGIC		"AQCAPT\r\n"
+#define CAPTURE_PREFIX		"capture-"	/* capture files are named capture-<name> */
+#define CAPTURE_VERSION		1
+#define CAPTURE_BYTEORDER	0x01020304
+
+#define CAPTURE_CONNECT		1
+#define CAPTURE_TOKEN		2	/* followed by the token, without the | */
+#define CAPTURE_DISCONNECT	3
+
+/*
+ * A capture file is a header followed by records in the order they were
+ *  received. Every record carries the time since the previous one, so the
+ *  traffic can be replayed with the original timing. Like snapshots, the
+ *  file is only valid on hosts with the same byte order.
+ */
+typedef struct capture_header {
+  unsigned char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint64_t start;		/* unix time in microseconds */
+} capture_header_t;
+
+typedef struct capture_record {
+  uint32_t delta;		/* microseconds since the previous record */
+  uint32_t id;			/* connection */
+  uint32_t type;
+  uint32_t length;		/* of the data following the record */
+} capture_record_t;
+
+typedef struct capture_stats {
+  unsigned long connections;
+  unsigned long records;
+  unsigned long long bytes;
+} capture_stats_t;
+
+extern capture_stats_t capturestats;
+extern unsigned long capturefirst;
+
+/* connections allocated before this id are not part of the current capture */
+#define capture_active(id)	((id) && ((id) >= capturefirst))
+
+extern unsigned long capture_connect ();
+extern void capture_token (unsigned long id, buffer_t * token);
+extern void capture_disconnect (unsigned long id);
+
+extern int capture_start (unsigned char *filename, buffer_t * output);
+extern int capture_stop (buffer_t * output);
+
+extern int capture_init ();
+
+#endif /* _CAPTURE_H_ */
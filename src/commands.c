@@ -31,6 +31,8 @@ plugin_t *cmdplug;
 command_t cmd_hashtable[COMMAND_HASHTABLE];
 command_t cmd_sorted;
 
+plugin_latency_t cmd_latency;
+
 /* FIXME check for duplicates */
 int command_register (unsigned char *name, command_handler_t * handler, unsigned long long cap,
 		      unsigned char *help)
@@ -232,8 +234,21 @@ unsigned long cmd_parser (plugin_user_t * user, plugin_user_t * target, void *pr
       && (!cmd->req_cap || ((user->rights & cmd->req_cap) == cmd->req_cap)
 	  || (user->rights & CAP_OWNER))) {
     buffer_t *output = bf_alloc (10240);
+    command_t *c;
+    struct timeval start;
+    unsigned long usec;
 
+    gettimeofday (&start, NULL);
     cmd->handler (user, output, priv, argc, argv);
+    usec = plugin_latency_since (&start);
+    plugin_latency_add (&cmd_latency, usec);
+
+    /* the handler may have unregistered the command */
+    for (c = list->next; c != list; c = c->next)
+      if (c == cmd) {
+	plugin_latency_add (&cmd->latency, usec);
+	break;
+      }
     if (bf_used (output)) {
       if (target) {
 	plugin_user_priv (target, user, NULL, output, 1);
@@ -332,5 +347,8 @@ int command_init ()
   cmd_sorted.onext = &cmd_sorted;
   cmd_sorted.oprev = &cmd_sorted;
 
+  memset (&cmd_latency, 0, sizeof (plugin_latency_t));
+  plugin_latency_register ("command", &cmd_latency);
+
   return 0;
 }
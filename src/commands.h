@@ -40,8 +40,13 @@ typedef struct command {
   command_handler_t *handler;
   unsigned long long req_cap;
   unsigned char *help;
+
+  plugin_latency_t latency;
 } command_t;
 
+extern command_t cmd_sorted;
+extern plugin_latency_t cmd_latency;
+
 extern int command_init ();
 extern int command_setup ();
 extern int command_register (unsigned char *name, command_handler_t * handler, unsigned long long cap,
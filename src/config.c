@@ -42,9 +42,9 @@ void *config_retrieve (unsigned char *name)
   return value_retrieve (configvalues, name);
 }
 
-int config_save (xml_node_t * base)
+int config_save (xml_writer_t * w)
 {
-  return value_save (configvalues, base);
+  return value_save (configvalues, w);
 }
 
 int config_load (xml_node_t * node)
@@ -42,7 +42,7 @@ extern config_element_t *config_register (unsigned char *name, config_type_t typ
 extern int config_unregister (unsigned char *name);
 extern config_element_t *config_find (unsigned char *name);
 extern void *config_retrieve (unsigned char *name);
-extern int config_save (xml_node_t *);
+extern int config_save (xml_writer_t *);
 extern int config_load (xml_node_t *);
 
 #endif /* _CONFIG_H_ */
@@ -34,12 +34,19 @@
 extern int ndelay;
 extern unsigned int blockonoverflow;
 extern unsigned int disconnectontimeout;
+extern unsigned int listenbacklog;
+extern unsigned int listensockets;
+extern unsigned int deferaccept;
 
 #ifdef USE_IOCP
 extern unsigned long iocpFragments;
 extern unsigned long iocpSendBuffer;
 #endif
 
+#ifdef USE_EPOLL
+extern unsigned int epollEdgeTriggered;
+#endif
+
 config_t config;
 
 int core_config_init ()
@@ -138,9 +145,16 @@ int core_config_init ()
   config_register ("hub.BufferBlockOnOverflow", CFG_ELEM_UINT, &blockonoverflow, _("This turns on or off input processing for users in overflow mode."));
   config_register ("hub.BufferDisconnectOnTimeout", CFG_ELEM_UINT, &disconnectontimeout, _("This turns on or off disconnecting users on buffering timeout."));
 
+  config_register ("hub.ListenBacklog", CFG_ELEM_UINT, &listenbacklog, _("Length of the queue of connections waiting to be accepted. The system may cap it (net.core.somaxconn on Linux). Takes effect after a restart."));
+  config_register ("hub.ListenSockets", CFG_ELEM_UINT, &listensockets, _("Number of listening sockets per port, using SO_REUSEPORT where available. Each has its own accept queue, which helps with reconnect storms. Takes effect after a restart."));
+  config_register ("hub.DeferAccept", CFG_ELEM_UINT, &deferaccept, _("Seconds the system may hold a new connection until the client sends data (TCP_DEFER_ACCEPT). NMDC clients wait for the hub to speak first, so on NMDC ports this delays every login. 0 disables it. Takes effect after a restart."));
+
 #ifdef USE_IOCP
   config_register ("socket.fragments", CFG_ELEM_ULONG, &iocpFragments, _("Maximum number of outstanding data buffers per user."));
   config_register ("socket.sendbuffer", CFG_ELEM_ULONG, &iocpSendBuffer, _("Set this to 0 to enable the send buffer."));
+#endif
+#ifdef USE_EPOLL
+  config_register ("socket.edgetriggered", CFG_ELEM_UINT, &epollEdgeTriggered, _("Use edge triggered epoll for user connections, so starting and stopping to buffer costs no system calls. Only affects new connections."));
 #endif
   /* *INDENT-ON* */
 
@@ -167,9 +181,42 @@ int core_stats_init ()
 		  _("Total bytes send by hub since startup."));
   stats_register ("hub.TotalBytesSend", VAL_ELEM_ULONGLONG, &hubstats.TotalBytesSend,
 		  _("Total bytes send by hub since startup."));
+  stats_register ("hub.Accepted", VAL_ELEM_ULONG, &hubstats.Accepted,
+		  _("Connections accepted since startup, including those rejected right after."));
+  stats_register ("hub.AcceptErrors", VAL_ELEM_ULONG, &hubstats.AcceptErrors,
+		  _("Failed accept calls, for example when the hub ran out of file descriptors."));
+  stats_register ("hub.RejectedHardban", VAL_ELEM_ULONG, &hubstats.RejectedHardban,
+		  _("Connections closed because the IP is hardbanned."));
+  stats_register ("hub.RejectedReconnect", VAL_ELEM_ULONG, &hubstats.RejectedReconnect,
+		  _("Connections refused because the IP reconnected within hub.reconnectperiod."));
+  stats_register ("hub.RejectedBusy", VAL_ELEM_ULONG, &hubstats.RejectedBusy,
+		  _("Connections refused because the hub was out of memory or full."));
   stats_register ("hub.buffering", VAL_ELEM_ULONG, &buffering, _("Number of buffering users."));
   stats_register ("hub.buffermemory", VAL_ELEM_ULONG, &buf_mem,
 		  _("Total of all data waiting to be written."));
+  stats_register ("buffer.size", VAL_ELEM_ULONGLONG, &bufferstats.size,
+		  _("Memory allocated to buffers."));
+  stats_register ("buffer.peak", VAL_ELEM_ULONGLONG, &bufferstats.peak,
+		  _("Peak memory allocated to buffers."));
+  stats_register ("buffer.count", VAL_ELEM_ULONG, &bufferstats.count,
+		  _("Number of allocated buffers."));
+  stats_register ("buffer.max", VAL_ELEM_ULONG, &bufferstats.max,
+		  _("Peak number of allocated buffers."));
+
+#ifdef USE_EPOLL
+  stats_register ("epoll.waits", VAL_ELEM_ULONG, &esocketstats.waits,
+		  _("Calls to epoll_wait, one per main loop iteration."));
+  stats_register ("epoll.empty", VAL_ELEM_ULONG, &esocketstats.empty,
+		  _("Calls to epoll_wait that returned no events."));
+  stats_register ("epoll.events", VAL_ELEM_ULONG, &esocketstats.events,
+		  _("Events returned by epoll_wait. Divide by epoll.waits for the average batch."));
+  stats_register ("epoll.maxbatch", VAL_ELEM_ULONG, &esocketstats.maxbatch,
+		  _("Most events returned by a single epoll_wait."));
+  stats_register ("epoll.ctl", VAL_ELEM_ULONG, &esocketstats.ctl,
+		  _("Calls to epoll_ctl."));
+  stats_register ("epoll.readied", VAL_ELEM_ULONG, &esocketstats.readied,
+		  _("Edge triggered sockets handled from the ready list instead of an epoll event."));
+#endif
 
 #ifdef USE_WINDOWS
   stats_register ("iocp.outstanding", VAL_ELEM_ULONG, &outstanding,
@@ -97,6 +97,17 @@
 #define DEFAULT_RESEARCH_PERIOD		7200
 #define DEFAULT_RESEARCH_MAXCOUNT	120
 
+/*
+ * Load governor: the pressure thresholds for level 1, every doubling
+ *  of a signal adds a level.
+ */
+#define DEFAULT_GOVERNOR_ENABLE		0
+#define DEFAULT_GOVERNOR_MEMORY		25	/* percent of hub.BufferTotalLimit */
+#define DEFAULT_GOVERNOR_BUFFERING	5	/* percent of the users */
+#define DEFAULT_GOVERNOR_FLUSHTIME	50	/* milliseconds */
+#define DEFAULT_GOVERNOR_RELAX		10	/* calm flushes before dropping a level */
+#define DEFAULT_GOVERNOR_NICKLIST	2	/* level at which $GetNickList is deferred */
+
 /*
  * Default settings for listening port, ip and address.
  */
@@ -105,6 +116,14 @@
 #define DEFAULT_ADDRESS	      "localhost"
 #define NMDC_EXTRA_PORTS      ""
 
+/*
+ * The metrics listener is off by default and only listens locally.
+ */
+#define DEFAULT_METRICS_PORT		0
+#define DEFAULT_METRICS_ADDRESS		"127.0.0.1"
+#define DEFAULT_METRICS_TIMEOUT		5000
+#define DEFAULT_METRICS_MAXCLIENTS	8
+
 /*
  * Hub security defaults.
  */
@@ -119,6 +138,7 @@
 #define DEFAULT_HARDBANFILE	"hardban.conf"
 #define DEFAULT_SOFTBANFILE	"softban.conf"
 #define DEFAULT_ACCOUNTSFILE	"accounts.conf"
+#define DEFAULT_SNAPSHOTFILE	HUBSOFT_NAME ".snapshot"
 
 #define DEFAULT_REDIRECT	""
 
@@ -146,6 +166,27 @@
 #define DEFAULT_KICKPERIOD		300
 
 #define DEFAULT_AUTOSAVEINTERVAL	300
+#ifndef USE_WINDOWS
+#define DEFAULT_AUTOSAVEBACKGROUND	1
+#else
+#define DEFAULT_AUTOSAVEBACKGROUND	0
+#endif
+
+#define DEFAULT_JOURNAL			1
+#define DEFAULT_JOURNALSYNC		0
+
+#define DEFAULT_BINARYSNAPSHOT		0
+
+#define DEFAULT_CAPTURE_PASSWORDS	0
+#define DEFAULT_CAPTURE_MAXSIZE		(1024*1024*1024)
+
+#define DEFAULT_IOTHREADS		0
+
+#define DEFAULT_LISTEN_BACKLOG		1024
+#define DEFAULT_LISTEN_SOCKETS		1
+#define DEFAULT_DEFER_ACCEPT		0
+
+#define DEFAULT_ASYNCQUEUEMAX		10000
 
 #define DEFAULT_MINPWDLENGTH		4
 
@@ -156,6 +197,10 @@
 
 #define DEFAULT_MAXLUASCRIPTS		25
 
+#define DEFAULT_LUABUDGETINSTRUCTIONS	0
+#define DEFAULT_LUABUDGETTIME		0
+#define DEFAULT_LUABUDGETSTRIKES	5
+
 #define DEFAULT_PASSWDRETRY		3
 #define DEFAULT_PASSWDBANTIME		300
 
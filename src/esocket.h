@@ -129,6 +129,8 @@ typedef enum {
 #define ESOCKET_EVENT_ERR	0x0008
 #define ESOCKET_EVENT_HUP	0x0010
 
+#define ESOCKET_EVENT_EDGE	0
+
 #else
 
 #define ESOCKET_EVENT_IN	EPOLLIN
@@ -136,6 +138,10 @@ typedef enum {
 #define ESOCKET_EVENT_ERR	EPOLLERR
 #define ESOCKET_EVENT_HUP	EPOLLHUP
 
+/* type flag: the handlers read until EAGAIN or call esocket_ready, so
+ *  socket.edgetriggered may use edge triggered epoll for them. */
+#define ESOCKET_EVENT_EDGE	EPOLLET
+
 #endif
 
 #ifndef USE_WINDOWS
@@ -202,6 +208,18 @@ struct esocket {
 
   struct esockethandler *handler;
 
+#ifdef USE_POLL
+  int slot;			/* index in the poll array, -1 if not polled */
+#endif
+
+#ifdef USE_EPOLL
+  uint32_t registered;		/* events epoll is watching for */
+  unsigned int edge;		/* edge triggered */
+  uint32_t ready;		/* edge triggered: readiness not handled yet */
+  unsigned int listed;		/* on a ready list */
+  struct esocket *rnext, *rprev;
+#endif
+
 #ifdef USE_IOCP
   /* connect polling */
   etimer_t     timer;
@@ -248,6 +266,13 @@ typedef struct esockethandler {
   int ni, no, ne;
 #endif
 
+#ifdef USE_POLL
+  /* persistent poll array, kept up to date as sockets change */
+  struct pollfd *pollfds;
+  esocket_t **pollsockets;
+  unsigned int pollcount, pollsize;
+#endif
+
 #ifdef USE_EPOLL
   int epfd;
 #endif
@@ -262,6 +287,19 @@ typedef struct esockethandler {
   int n;
 } esocket_handler_t;
 
+#ifdef USE_EPOLL
+typedef struct esocket_stats {
+  unsigned long waits;		/* epoll_wait calls, one per main loop */
+  unsigned long empty;		/* calls that returned no events */
+  unsigned long events;		/* events returned */
+  unsigned long maxbatch;	/* most events returned by one call */
+  unsigned long ctl;		/* epoll_ctl calls */
+  unsigned long readied;	/* sockets handled from the ready list */
+} esocket_stats_t;
+
+extern esocket_stats_t esocketstats;
+#endif
+
 /* function prototypes */
 extern esocket_handler_t *esocket_create_handler (unsigned int numtypes);
 extern int esocket_add_type (esocket_handler_t * h, unsigned int events,
@@ -286,6 +324,15 @@ extern int esocket_setevents (esocket_t * s, unsigned int events);
 extern int esocket_addevents (esocket_t * s, unsigned int events);
 extern int esocket_clearevents (esocket_t * s, unsigned int events);
 
+/* a handler stopped before the socket ran dry: call it again next loop */
+#ifdef USE_EPOLL
+extern int esocket_ready (esocket_t * s, unsigned int events);
+#define esocket_edge(s)		((s)->edge)
+#else
+#define esocket_ready(s,e)	((void) 0)
+#define esocket_edge(s)		0
+#endif
+
 #ifndef USE_IOCP
 extern int esocket_accept (esocket_t *s, struct sockaddr *addr, int *addrlen);
 #else
@@ -17,7 +17,13 @@
  *  
  */
 
+/* accept4 */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include "esocket.h"
+#include "pool.h"
 #include "etimer.h"
 
 #ifdef HAVE_NETINET_IN_H
@@ -50,6 +56,21 @@
 
 esocket_t *freelist = NULL;
 
+pool_t esocketpool;
+
+/*
+ * With socket.edgetriggered, sockets of types flagged ESOCKET_EVENT_EDGE are
+ *  registered once for input and output. Changing the events only changes
+ *  s->events, readiness that nobody asked for yet is kept in s->ready and the
+ *  socket goes on the ready list when someone does.
+ */
+unsigned int epollEdgeTriggered = 0;
+
+esocket_stats_t esocketstats;
+
+esocket_t *readylist = NULL;	/* listed 1: handled next loop */
+esocket_t *readynow = NULL;	/* listed 2: being handled */
+
 /*
  * Handler functions
  */
@@ -69,6 +90,9 @@ esocket_handler_t *esocket_create_handler (unsigned int numtypes)
   }
   memset (h->types, 0, sizeof (esocket_type_t) * numtypes);
   h->numtypes = numtypes;
+
+  if (!esocketpool.size)
+    pool_setup (&esocketpool, "esocket", sizeof (esocket_t), 64);
   h->epfd = epoll_create (ESOCKET_MAX_FDS);
 
 #ifdef USE_PTHREADDNS
@@ -99,60 +123,94 @@ int esocket_add_type (esocket_handler_t * h, unsigned int events,
  * Socket functions
  */
 
-int esocket_setevents (esocket_t * s, unsigned int events)
+static void esocket_readylist_add (esocket_t * s)
 {
-  esocket_handler_t *h = s->handler;
-
-  if (events != s->events) {
-    struct epoll_event ee;
+  if (s->listed)
+    return;
+
+  s->rprev = NULL;
+  s->rnext = readylist;
+  if (s->rnext)
+    s->rnext->rprev = s;
+  readylist = s;
+  s->listed = 1;
+}
 
-    ee.events = events;
-    ee.data.ptr = s;
-    epoll_ctl (h->epfd,
-	       events ? (s->
-			 events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL, s->socket, &ee);
-    s->events = events;
+static void esocket_readylist_del (esocket_t * s)
+{
+  if (!s->listed)
+    return;
+
+  if (s->rnext)
+    s->rnext->rprev = s->rprev;
+  if (s->rprev) {
+    s->rprev->rnext = s->rnext;
+  } else if (s->listed == 1) {
+    readylist = s->rnext;
+  } else {
+    readynow = s->rnext;
   }
-
-  return 0;
+  s->rnext = s->rprev = NULL;
+  s->listed = 0;
 }
 
-int esocket_addevents (esocket_t * s, unsigned int events)
+/* set the events we want and only tell epoll if that changes what it watches */
+static int esocket_arm (esocket_t * s, uint32_t events)
 {
   esocket_handler_t *h = s->handler;
+  uint32_t want = events;
 
-  if ((events | s->events) != s->events) {
+  if (s->edge && events)
+    want = EPOLLIN | EPOLLOUT | EPOLLET;
+
+  if (want != s->registered) {
     struct epoll_event ee;
 
     memset (&ee, 0, sizeof (ee));
-    ee.events = s->events | events;
+    ee.events = want;
     ee.data.ptr = s;
     epoll_ctl (h->epfd,
-	       ee.events ? (s->
-			    events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) :
-	       EPOLL_CTL_DEL, s->socket, &ee);
-    s->events = ee.events;
+	       want ? (s->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) : EPOLL_CTL_DEL,
+	       s->socket, &ee);
+    s->registered = want;
+    esocketstats.ctl++;
+  }
+
+  if (!want) {
+    s->ready = 0;
+    esocket_readylist_del (s);
+  } else if (s->ready & events & ~s->events) {
+    /* it became ready before anyone was interested */
+    esocket_readylist_add (s);
   }
+  s->events = events;
 
   return 0;
 }
 
+int esocket_setevents (esocket_t * s, unsigned int events)
+{
+  return esocket_arm (s, events);
+}
+
+int esocket_addevents (esocket_t * s, unsigned int events)
+{
+  return esocket_arm (s, s->events | events);
+}
+
 int esocket_clearevents (esocket_t * s, unsigned int events)
 {
-  esocket_handler_t *h = s->handler;
+  return esocket_arm (s, s->events & ~events);
+}
 
-  if (events & s->events) {
-    struct epoll_event ee;
+int esocket_ready (esocket_t * s, unsigned int events)
+{
+  if (!s->edge)
+    return 0;
 
-    memset (&ee, 0, sizeof (ee));
-    ee.events = s->events & ~events;
-    ee.data.ptr = s;
-    epoll_ctl (h->epfd,
-	       ee.events ? (s->
-			    events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) :
-	       EPOLL_CTL_DEL, s->socket, &ee);
-    s->events = ee.events;
-  }
+  s->ready |= events;
+  if (s->ready & s->events)
+    esocket_readylist_add (s);
 
   return 0;
 }
@@ -204,7 +262,8 @@ int esocket_update_state (esocket_t * s, unsigned int newstate)
       break;
     case SOCKSTATE_CONNECTED:
       /* add according to requested callbacks */
-      events |= h->types[s->type].default_events;
+      events |= h->types[s->type].default_events & ~ESOCKET_EVENT_EDGE;
+      s->edge = epollEdgeTriggered && (h->types[s->type].default_events & ESOCKET_EVENT_EDGE);
 
       break;
     case SOCKSTATE_CLOSING:
@@ -217,19 +276,7 @@ int esocket_update_state (esocket_t * s, unsigned int newstate)
       break;
   }
 
-  if (events != s->events) {
-    struct epoll_event ee;
-
-    ee.events = events;
-    ee.data.ptr = s;
-    epoll_ctl (h->epfd,
-	       ee.events ? (s->
-			    events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD) :
-	       EPOLL_CTL_DEL, s->socket, &ee);
-    s->events = events;
-  }
-
-  return 0;
+  return esocket_arm (s, events);
 }
 
 esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s, uintptr_t context)
@@ -239,7 +286,7 @@ esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s,
   if (type >= h->curtypes)
     return NULL;
 
-  socket = malloc (sizeof (esocket_t));
+  socket = pool_alloc (&esocketpool);
   if (!socket)
     return NULL;
 
@@ -284,7 +331,7 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
     return NULL;
   };
 
-  s = malloc (sizeof (esocket_t));
+  s = pool_alloc (&esocketpool);
   if (!s)
     return NULL;
 
@@ -432,6 +479,7 @@ int esocket_remove_socket (esocket_t * s)
     close (s->socket);
     s->socket = INVALID_SOCKET;
   }
+  esocket_readylist_del (s);
 
   /* remove from list */
   if (s->next)
@@ -492,9 +540,32 @@ int esocket_send (esocket_t * s, buffer_t * buf, unsigned long offset)
 }
 
 
+/* the new socket is non-blocking */
 int esocket_accept (esocket_t * s, struct sockaddr *addr, int *addrlen)
 {
-  return accept (s->socket, addr, addrlen);
+  int fd;
+
+#ifdef SOCK_NONBLOCK
+  static int noaccept4 = 0;
+
+  if (!noaccept4) {
+    fd = accept4 (s->socket, addr, addrlen, SOCK_NONBLOCK);
+    if ((fd >= 0) || (errno != ENOSYS))
+      return fd;
+    noaccept4 = 1;
+  }
+#endif
+
+  fd = accept (s->socket, addr, addrlen);
+  if (fd < 0)
+    return fd;
+
+  if (fcntl (fd, F_SETFL, O_NONBLOCK)) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
 }
 
 int esocket_listen (esocket_t * s, int num, int family, int type, int protocol)
@@ -509,10 +580,91 @@ int esocket_listen (esocket_t * s, int num, int family, int type, int protocol)
 **
 ************************************************************************/
 
+static void esocket_dispatch (esocket_handler_t * h, esocket_t * s, uint32_t activity)
+{
+  uint32_t ready;
+
+  if (s->state == SOCKSTATE_FREED)
+    return;
+
+  /* keep what nobody is interested in yet */
+  if (s->edge) {
+    ready = s->ready | (activity & (EPOLLIN | EPOLLOUT));
+    activity = (activity & (EPOLLERR | EPOLLHUP)) | (ready & s->events);
+    s->ready = ready & ~activity;
+  }
+
+  if (activity & EPOLLHUP) {
+    int err;
+    unsigned int len;
+
+    len = sizeof (s->error);
+    err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
+    ASSERT (!err);
+
+    if (h->types[s->type].error)
+      h->types[s->type].error (s);
+
+    ASSERT (s->state == SOCKSTATE_FREED);
+    return;
+  }
+  if (activity & EPOLLERR) {
+    int err;
+    unsigned int len;
+
+    len = sizeof (s->error);
+    err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
+    ASSERT (!err);
+
+    if (h->types[s->type].error)
+      h->types[s->type].error (s);
+    if (s->state == SOCKSTATE_FREED)
+      return;
+    if (s->socket < 0)
+      return;
+  }
+  if (activity & EPOLLIN) {
+    if (h->types[s->type].input)
+      h->types[s->type].input (s);
+    if (s->state == SOCKSTATE_FREED)
+      return;
+    if (s->socket < 0)
+      return;
+  }
+  if (activity & EPOLLOUT) {
+    switch (s->state) {
+      case SOCKSTATE_CONNECTED:
+	if (h->types[s->type].output)
+	  h->types[s->type].output (s);
+	break;
+      case SOCKSTATE_CONNECTING:
+	{
+	  int err;
+	  unsigned int len;
+
+	  len = sizeof (s->error);
+	  err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
+	  ASSERT (!err);
+	  esocket_update_state (s, !s->error ? SOCKSTATE_CONNECTED : SOCKSTATE_ERROR);
+	  if (s->error) {
+	    if (h->types[s->type].error)
+	      h->types[s->type].error (s);
+	  } else {
+	    if (h->types[s->type].output)
+	      h->types[s->type].output (s);
+	  }
+	}
+	break;
+      case SOCKSTATE_FREED:
+      default:
+	ASSERT (0);
+    }
+  }
+}
+
 int esocket_select (esocket_handler_t * h, struct timeval *to)
 {
-  int num, i;
-  uint32_t activity;
+  int num, i, timeout;
   esocket_t *s;
   struct epoll_event events[ESOCKET_ASK_FDS];
 
@@ -520,90 +672,35 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
   struct addrinfo *res;
 #endif
 
-  num = epoll_wait (h->epfd, events, ESOCKET_ASK_FDS, to->tv_sec * 1000 + to->tv_usec / 1000);
+  /* do not sleep on sockets that are still ready */
+  timeout = readylist ? 0 : to->tv_sec * 1000 + to->tv_usec / 1000;
+  num = epoll_wait (h->epfd, events, ESOCKET_ASK_FDS, timeout);
   if (num < 0) {
     perror ("ESocket: epoll_wait: ");
     return -1;
   }
 
-  for (i = 0; i < num; i++) {
-    activity = events[i].events;
-    s = events[i].data.ptr;
-    if (s->state == SOCKSTATE_FREED)
-      continue;
-
-    if (activity & EPOLLHUP) {
-      int err;
-      unsigned int len;
-
-      len = sizeof (s->error);
-      err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
-      ASSERT (!err);
-
-      if (h->types[s->type].error)
-	h->types[s->type].error (s);
-
-      ASSERT (s->state == SOCKSTATE_FREED);
-      continue;
-    }
-    if (activity & EPOLLERR) {
-      int err;
-      unsigned int len;
-
-      len = sizeof (s->error);
-      err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
-      ASSERT (!err);
-
-      if (h->types[s->type].error)
-	h->types[s->type].error (s);
-      if (s->state == SOCKSTATE_FREED)
-	continue;
-      if (s->socket < 0)
-	continue;
-    }
-    if (activity & EPOLLIN) {
-      if (h->types[s->type].input)
-	h->types[s->type].input (s);
-      if (s->state == SOCKSTATE_FREED)
-	continue;
-      if (s->socket < 0)
-	continue;
-    }
-    if (activity & EPOLLOUT) {
-      switch (s->state) {
-	case SOCKSTATE_CONNECTED:
-	  if (h->types[s->type].output)
-	    h->types[s->type].output (s);
-	  break;
-	case SOCKSTATE_CONNECTING:
-	  {
-	    int err;
-	    unsigned int len;
-
-	    len = sizeof (s->error);
-	    err = getsockopt (s->socket, SOL_SOCKET, SO_ERROR, &s->error, &len);
-	    ASSERT (!err);
-	    esocket_update_state (s, !s->error ? SOCKSTATE_CONNECTED : SOCKSTATE_ERROR);
-	    if (s->error) {
-	      if (h->types[s->type].error)
-		h->types[s->type].error (s);
-	    } else {
-	      if (h->types[s->type].output)
-		h->types[s->type].output (s);
-	    }
-	  }
-	  break;
-	case SOCKSTATE_FREED:
-	default:
-	  ASSERT (0);
-      }
-      if (s->state == SOCKSTATE_FREED)
-	continue;
-      if (s->socket < 0)
-	continue;
-    }
+  esocketstats.waits++;
+  esocketstats.events += num;
+  if (!num)
+    esocketstats.empty++;
+  if ((unsigned long) num > esocketstats.maxbatch)
+    esocketstats.maxbatch = num;
+
+  /* readiness left over from earlier loops */
+  readynow = readylist;
+  readylist = NULL;
+  for (s = readynow; s; s = s->rnext)
+    s->listed = 2;
+  while ((s = readynow)) {
+    esocket_readylist_del (s);
+    esocketstats.readied++;
+    esocket_dispatch (h, s, 0);
   }
 
+  for (i = 0; i < num; i++)
+    esocket_dispatch (h, events[i].data.ptr, events[i].events);
+
 #ifdef USE_PTHREADDNS
   /* dns stuff */
   while ((s = dns_retrieve (h->dns, &res))) {
@@ -623,7 +720,7 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
       freeaddrinfo (s->addr);
       s->addr = NULL;
     }
-    free (s);
+    pool_free (&esocketpool, s);
   }
 
   return 0;
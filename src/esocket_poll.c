@@ -17,7 +17,13 @@
  *  
  */
 
+/* accept4 */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include "esocket.h"
+#include "pool.h"
 
 #ifdef HAVE_NETINET_IN_H
 #  include <netinet/in.h>
@@ -50,6 +56,75 @@
 
 esocket_t *freelist = NULL;
 
+pool_t esocketpool;
+
+/*
+ * Poll array
+ *
+ *  Connecting and connected sockets have a slot in h->pollfds that is kept
+ *  up to date when their events or state change, so esocket_select can hand
+ *  it to poll () as is. A socket leaving takes the last slot's place.
+ */
+
+/* make room for count sockets, so adding a slot can not fail later */
+static int esocket_poll_reserve (esocket_handler_t * h, unsigned int count)
+{
+  struct pollfd *pollfds;
+  esocket_t **pollsockets;
+  unsigned int size;
+
+  if (count <= h->pollsize)
+    return 0;
+
+  size = h->pollsize + 256;
+  if (size < count)
+    size = count;
+
+  pollfds = realloc (h->pollfds, sizeof (struct pollfd) * size);
+  if (!pollfds)
+    return -1;
+  h->pollfds = pollfds;
+
+  pollsockets = realloc (h->pollsockets, sizeof (esocket_t *) * size);
+  if (!pollsockets)
+    return -1;
+  h->pollsockets = pollsockets;
+
+  h->pollsize = size;
+
+  return 0;
+}
+
+static void esocket_poll_sync (esocket_t * s)
+{
+  esocket_handler_t *h = s->handler;
+  int last, polled;
+
+  polled = ((s->state == SOCKSTATE_CONNECTING) || (s->state == SOCKSTATE_CONNECTED))
+    && (s->socket != INVALID_SOCKET);
+
+  if (polled && (s->slot < 0)) {
+    ASSERT (h->pollcount < h->pollsize);
+    s->slot = h->pollcount++;
+    h->pollsockets[s->slot] = s;
+    h->pollfds[s->slot].revents = 0;
+  } else if (!polled && (s->slot >= 0)) {
+    last = --h->pollcount;
+    if (s->slot != last) {
+      h->pollfds[s->slot] = h->pollfds[last];
+      h->pollsockets[s->slot] = h->pollsockets[last];
+      h->pollsockets[s->slot]->slot = s->slot;
+    }
+    s->slot = -1;
+    return;
+  }
+
+  if (s->slot >= 0) {
+    h->pollfds[s->slot].fd = s->socket;
+    h->pollfds[s->slot].events = s->events;
+  }
+}
+
 
 /*
  * Handler functions
@@ -71,6 +146,9 @@ esocket_handler_t *esocket_create_handler (unsigned int numtypes)
   memset (h->types, 0, sizeof (esocket_type_t) * numtypes);
   h->numtypes = numtypes;
 
+  if (!esocketpool.size)
+    pool_setup (&esocketpool, "esocket", sizeof (esocket_t), 64);
+
 #ifdef USE_PTHREADDNS
   h->dns = dns_init ();
 #endif
@@ -103,6 +181,7 @@ int esocket_add_type (esocket_handler_t * h, unsigned int events,
 int esocket_setevents (esocket_t * s, unsigned int events)
 {
   s->events = events;
+  esocket_poll_sync (s);
 
   return 0;
 }
@@ -110,6 +189,7 @@ int esocket_setevents (esocket_t * s, unsigned int events)
 int esocket_addevents (esocket_t * s, unsigned int events)
 {
   s->events |= events;
+  esocket_poll_sync (s);
 
   return 0;
 }
@@ -117,6 +197,7 @@ int esocket_addevents (esocket_t * s, unsigned int events)
 int esocket_clearevents (esocket_t * s, unsigned int events)
 {
   s->events = s->events & ~events;
+  esocket_poll_sync (s);
 
   return 0;
 }
@@ -176,6 +257,8 @@ int esocket_update_state (esocket_t * s, unsigned int newstate)
       break;
   }
 
+  esocket_poll_sync (s);
+
   return 0;
 }
 
@@ -186,7 +269,10 @@ esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s,
   if (type >= h->curtypes)
     return NULL;
 
-  socket = malloc (sizeof (esocket_t));
+  if (esocket_poll_reserve (h, h->n + 1))
+    return NULL;
+
+  socket = pool_alloc (&esocketpool);
   if (!socket)
     return NULL;
 
@@ -198,6 +284,7 @@ esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s,
   socket->state = SOCKSTATE_INIT;
   socket->addr = NULL;
   socket->events = 0;
+  socket->slot = -1;
 
   socket->prev = NULL;
   socket->next = h->sockets;
@@ -205,10 +292,6 @@ esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s,
     socket->next->prev = socket;
   h->sockets = socket;
 
-
-  if (s == -1)
-    return socket;
-
   ++(h->n);
 
   return socket;
@@ -223,6 +306,9 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
   if (etype >= h->curtypes)
     return NULL;
 
+  if (esocket_poll_reserve (h, h->n + 1))
+    return NULL;
+
   fd = socket (domain, type, protocol);
   if (fd < 0)
     return NULL;
@@ -232,7 +318,7 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
     close (fd);
     return NULL;
   };
-  s = malloc (sizeof (esocket_t));
+  s = pool_alloc (&esocketpool);
   if (!s)
     return NULL;
 
@@ -244,6 +330,7 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
   s->state = SOCKSTATE_INIT;
   s->events = 0;
   s->addr = NULL;
+  s->slot = -1;
 
   s->prev = NULL;
   s->next = h->sockets;
@@ -251,10 +338,6 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
     s->next->prev = s;
   h->sockets = s;
 
-
-  if (fd == -1)
-    return s;
-
   ++(h->n);
 
   return s;
@@ -432,6 +515,7 @@ int esocket_remove_socket (esocket_t * s)
     close (s->socket);
     s->socket = INVALID_SOCKET;
   }
+  esocket_poll_sync (s);
 
   /* remove from list */
   if (s->next)
@@ -495,9 +579,32 @@ int esocket_send (esocket_t * s, buffer_t * buf, unsigned long offset)
 }
 
 
+/* the new socket is non-blocking */
 int esocket_accept (esocket_t * s, struct sockaddr *addr, int *addrlen)
 {
-  return accept (s->socket, addr, addrlen);
+  int fd;
+
+#ifdef SOCK_NONBLOCK
+  static int noaccept4 = 0;
+
+  if (!noaccept4) {
+    fd = accept4 (s->socket, addr, addrlen, SOCK_NONBLOCK);
+    if ((fd >= 0) || (errno != ENOSYS))
+      return fd;
+    noaccept4 = 1;
+  }
+#endif
+
+  fd = accept (s->socket, addr, addrlen);
+  if (fd < 0)
+    return fd;
+
+  if (fcntl (fd, F_SETFL, O_NONBLOCK)) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
 }
 
 int esocket_listen (esocket_t * s, int num, int family, int type, int protocol)
@@ -513,37 +620,16 @@ int esocket_listen (esocket_t * s, int num, int family, int type, int protocol)
 
 int esocket_select (esocket_handler_t * h, struct timeval *to)
 {
-  int i, n;
-  struct pollfd *pfd, *pfdi;
-  esocket_t *s, **l, **li;
+  int n;
+  unsigned int i;
+  short revents;
+  esocket_t *s;
 
 #ifdef USE_PTHREADDNS
   struct addrinfo *res;
 #endif
 
-  pfd = malloc ((sizeof (struct pollfd) * h->n) + (sizeof (esocket_t *) * h->n));
-  if (!pfd)
-    return -1;
-  l = (esocket_t **) (((char *) pfd) + (sizeof (struct pollfd) * h->n));
-
-  s = h->sockets;
-  for (i = 0, pfdi = pfd, li = l; i < h->n; ++i, ++pfdi, ++li) {
-    /* a socket in init mode generates a POLLHUP */
-    if (s->state < SOCKSTATE_CONNECTING) {
-      pfdi->fd = 0;
-      pfdi->events = 0;
-      pfdi->revents = 0;
-      *li = NULL;
-      continue;
-    }
-    pfdi->fd = s->socket;
-    pfdi->events = s->events;
-    pfdi->revents = 0;
-    *li = s;
-    s = s->next;
-  };
-
-  n = poll (pfd, h->n, to->tv_sec * 1000 + to->tv_usec / 1000);
+  n = poll (h->pollfds, h->pollcount, to->tv_sec * 1000 + to->tv_usec / 1000);
   if (n < 0) {
     perror ("esocket_select: poll:");
     goto leave;
@@ -551,19 +637,23 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
   if (!n)
     goto leave;
 
-  /* h->n will grow when we accept users... */
-  n = h->n;
-  for (i = 0, pfdi = pfd, li = l; i < n; ++i, ++pfdi, ++li) {
-    if (!pfdi->revents)
+  /*
+   * Walk down: a socket that leaves is replaced by the last one, which was
+   *  handled already. New sockets are added at the end with no revents.
+   */
+  for (i = h->pollcount; i--;) {
+    if (i >= h->pollcount)
       continue;
+    revents = h->pollfds[i].revents;
+    if (!revents)
+      continue;
+    h->pollfds[i].revents = 0;
 
-    s = *li;
-    if (!s) continue;
-
+    s = h->pollsockets[i];
     if (s->state == SOCKSTATE_FREED)
       continue;
 
-    if (pfdi->revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
       int err;
       unsigned int len;
 
@@ -578,7 +668,7 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
       if (s->socket < 0)
 	continue;
     }
-    if (pfdi->revents & POLLIN) {
+    if (revents & POLLIN) {
       if (h->types[s->type].input)
 	h->types[s->type].input (s);
       if (s->state == SOCKSTATE_FREED)
@@ -586,7 +676,7 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
       if (s->socket < 0)
 	continue;
     }
-    if (pfdi->revents & POLLOUT) {
+    if (revents & POLLOUT) {
       switch (s->state) {
 	case SOCKSTATE_CONNECTED:
 	  if (h->types[s->type].output)
@@ -623,8 +713,6 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
   }
 
 leave:
-  free (pfd);
-
 #ifdef USE_PTHREADDNS
   /* dns stuff */
   while ((s = dns_retrieve (h->dns, &res))) {
@@ -644,7 +732,7 @@ leave:
       freeaddrinfo (s->addr);
       s->addr = NULL;
     }
-    free (s);
+    pool_free (&esocketpool, s);
   }
   return 0;
 }
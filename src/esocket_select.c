@@ -17,7 +17,13 @@
  *  
  */
 
+/* accept4 */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include "esocket.h"
+#include "pool.h"
 
 #ifdef HAVE_NETINET_IN_H
 #  include <netinet/in.h>
@@ -49,6 +55,8 @@
 
 esocket_t *freelist = NULL;
 
+pool_t esocketpool;
+
 /*
  * Handler functions
  */
@@ -69,6 +77,9 @@ esocket_handler_t *esocket_create_handler (unsigned int numtypes)
   memset (h->types, 0, sizeof (esocket_type_t) * numtypes);
   h->numtypes = numtypes;
 
+  if (!esocketpool.size)
+    pool_setup (&esocketpool, "esocket", sizeof (esocket_t), 64);
+
 #ifdef USE_PTHREADDNS
   h->dns = dns_init ();
 #endif
@@ -261,7 +272,7 @@ esocket_t *esocket_add_socket (esocket_handler_t * h, unsigned int type, int s,
   if (s >= FD_SETSIZE)
     return NULL;
 
-  socket = malloc (sizeof (esocket_t));
+  socket = pool_alloc (&esocketpool);
   if (!socket)
     return NULL;
 
@@ -309,7 +320,7 @@ esocket_t *esocket_new (esocket_handler_t * h, unsigned int etype, int domain, i
     return NULL;
   };
 
-  s = malloc (sizeof (esocket_t));
+  s = pool_alloc (&esocketpool);
   if (!s)
     return NULL;
 
@@ -537,9 +548,32 @@ int esocket_send (esocket_t * s, buffer_t * buf, unsigned long offset)
 }
 
 
+/* the new socket is non-blocking */
 int esocket_accept (esocket_t * s, struct sockaddr *addr, int *addrlen)
 {
-  return accept (s->socket, addr, addrlen);
+  int fd;
+
+#ifdef SOCK_NONBLOCK
+  static int noaccept4 = 0;
+
+  if (!noaccept4) {
+    fd = accept4 (s->socket, addr, addrlen, SOCK_NONBLOCK);
+    if ((fd >= 0) || (errno != ENOSYS))
+      return fd;
+    noaccept4 = 1;
+  }
+#endif
+
+  fd = accept (s->socket, addr, addrlen);
+  if (fd < 0)
+    return fd;
+
+  if (fcntl (fd, F_SETFL, O_NONBLOCK)) {
+    close (fd);
+    return -1;
+  }
+
+  return fd;
 }
 
 int esocket_listen (esocket_t * s, int num, int family, int type, int protocol)
@@ -679,7 +713,7 @@ int esocket_select (esocket_handler_t * h, struct timeval *to)
       freeaddrinfo (s->addr);
       s->addr = NULL;
     }
-    free (s);
+    pool_free (&esocketpool, s);
   }
   return 0;
 }
@@ -19,10 +19,13 @@
 
 #include "etimer.h"
 #include "defaults.h"
+#include "pool.h"
 
 rbt_t *root = NULL;
 unsigned long timercnt = 0;
 
+pool_t etimerpool;
+
 /************************************************************************
 **
 **                             TIMERS
@@ -110,7 +113,7 @@ etimer_t *etimer_alloc (etimer_handler_t * handler, void *ctxt)
 {
   etimer_t *timer;
 
-  timer = malloc (sizeof (etimer_t));
+  timer = pool_alloc (&etimerpool);
   if (!timer)
     return NULL;
 
@@ -126,7 +129,7 @@ void etimer_free (etimer_t * timer)
   if (timer->tovalid)
     deleteNode (&root, &timer->rbt);
 
-  free (timer);
+  pool_free (&etimerpool, timer);
 };
 
 
@@ -173,5 +176,6 @@ int etimer_checktimers ()
 int etimer_start ()
 {
   initRoot (&root);
+  pool_setup (&etimerpool, "etimer", sizeof (etimer_t), 64);
   return 0;
 }
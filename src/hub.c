@@ -49,8 +49,12 @@
 #include "core_config.h"
 #include "iplist.h"
 #include "aqtime.h"
+#include "iothread.h"
+#include "pool.h"
 
 #define HUB_INPUTBUFFER_SIZE	4096
+#define HUB_INPUTREADS		16	/* reads per input event, so one flooding client cannot stall the loop */
+#define HUB_IOTHREAD_INPUTSIZE	16384
 
 /* local hub cache */
 
@@ -61,16 +65,29 @@ unsigned long buf_mem = 0;
 unsigned int ndelay = 1;
 unsigned int blockonoverflow = 1;
 unsigned int disconnectontimeout = 1;
+unsigned int listenbacklog = DEFAULT_LISTEN_BACKLOG;
+unsigned int listensockets = DEFAULT_LISTEN_SOCKETS;
+unsigned int deferaccept = DEFAULT_DEFER_ACCEPT;
 
 /* banlist */
 banlist_t hardbanlist, softbanlist;
 
 iplist_t lastlist;
 
+pool_t clientpool;
+
 unsigned int es_type_server, es_type_listen;
 
 hub_statistics_t hubstats;
 
+/* clients with deferred system calls */
+client_t **iopending = NULL;
+unsigned long iocount = 0, iosize = 0;
+
+/* write batch in progress and its results */
+unsigned int iodeferwrites = 0;
+unsigned long iowritebuffering = 0, iowritefailures = 0;
+
 int server_disconnect_user (client_t *, char *);
 
 /*****************************************************************************
@@ -92,6 +109,48 @@ int server_handle_timeout (client_t * cl)
   return server_disconnect_user (cl, __ ("Buffering Timeout"));
 }
 
+/* returns the ms spent in a state, including the current period */
+unsigned long server_statetime (client_t * cl, unsigned int state)
+{
+  long elapsed = 0;
+
+  if (cl->state == state) {
+    elapsed =
+      (now.tv_sec - cl->stats.since.tv_sec) * 1000 + (now.tv_usec / 1000) -
+      (cl->stats.since.tv_usec / 1000);
+    if (elapsed < 0)
+      elapsed = 0;
+  }
+
+  switch (state) {
+    case HUB_STATE_BUFFERING:
+      return cl->stats.buffering + elapsed;
+    case HUB_STATE_OVERFLOW:
+      return cl->stats.overflow + elapsed;
+  }
+  return elapsed;
+}
+
+__inline__ void server_setstate (client_t * cl, unsigned int state)
+{
+  switch (cl->state) {
+    case HUB_STATE_BUFFERING:
+      cl->stats.buffering = server_statetime (cl, HUB_STATE_BUFFERING);
+      break;
+    case HUB_STATE_OVERFLOW:
+      cl->stats.overflow = server_statetime (cl, HUB_STATE_OVERFLOW);
+      break;
+  }
+  cl->state = state;
+  cl->stats.since = now;
+}
+
+__inline__ void server_setpeak (client_t * cl)
+{
+  if (cl->outgoing.size > cl->stats.peak)
+    cl->stats.peak = cl->outgoing.size;
+}
+
 __inline__ int server_settimer (client_t * cl, unsigned long timeout)
 {
   if (!cl->timer && timeout)
@@ -103,72 +162,86 @@ __inline__ int server_settimer (client_t * cl, unsigned long timeout)
 
 /****************************** DATA SOCKETS *********************************/
 
-int server_handle_output (esocket_t * es)
+/*
+ * write as much queued output as possible. this only touches the socket and
+ *  the send counter, so it can run on an I/O thread.
+ */
+static unsigned long server_output_send (client_t * cl, int *error)
 {
-  client_t *cl = (client_t *) es->context;
+  string_list_entry_t *e;
   buffer_t *b;
-  long w;
   unsigned long t, l, o;
-  string_list_entry_t *e;
-
-  /* duplicate event */
-  if (!cl->outgoing.count)
-    return 0;
+  long w;
 
-  BUF_DPRINTF (" %p Writing output (%u, %lu)...", cl->user, cl->outgoing.count, cl->offset);
-  w = 0;
+  *error = 0;
   t = 0;
-  b = NULL;
-
-  buf_mem -= cl->outgoing.size;
-
-  /* write out as much data as possible */
   o = cl->offset;
-  for (e = cl->outgoing.first; e; e = cl->outgoing.first) {
-    b = e->data;
-    /* skip buffers we wrote already */
-    while (b && (bf_used (b) < o)) {
-      o -= bf_used (b);
-      b = b->next;
-    }
-    ASSERT (b);
-    /* write out data in buffer chain */
-    for (; b; b = b->next) {
-      l = bf_used (b) - o;
-      w = esocket_send (es, b, o);
+  for (e = cl->outgoing.first; e; e = e->next) {
+    /* write out data in buffer chain, skipping what we wrote already */
+    for (b = e->data; b; b = b->next) {
+      l = bf_used (b);
+      if (o >= l) {
+	o -= l;
+	continue;
+      }
+      w = esocket_send (cl->es, b, o);
+      cl->stats.sends++;
       if (w < 0) {
-	switch (errno) {
-	  case EAGAIN:
-	  case ENOMEM:
-	    break;
-	  case EPIPE:
-#ifndef USE_WINDOWS
-	  case ECONNRESET:
-#endif
-	    buf_mem += cl->outgoing.size;
-	    server_disconnect_user (cl, __ ("Connection closed."));
-	    return -1;
-	  default:
-	    buf_mem += cl->outgoing.size;
-	    return -1;
-	}
-	w = 0;
-	break;
+	if ((errno != EAGAIN) && (errno != ENOMEM))
+	  *error = errno;
+	return t;
       }
       t += w;
-      cl->offset += w;
-      hubstats.TotalBytesSend += w;
-      if ((unsigned) w != l)
-	break;
+      if ((unsigned long) w != (l - o))
+	return t;
       o = 0;
     }
-    if (b)
-      break;
+  }
 
-    /* prepare for next buffer */
-    cl->offset = 0;
+  return t;
+}
+
+/* drop the buffers that are completely written */
+static void server_output_consume (client_t * cl, unsigned long t)
+{
+  string_list_entry_t *e;
+  unsigned long l;
+
+  hubstats.TotalBytesSend += t;
+  cl->stats.bytesout += t;
+
+  cl->offset += t;
+  for (e = cl->outgoing.first; e; e = cl->outgoing.first) {
+    l = bf_size (e->data);
+    if (cl->offset < l)
+      break;
+    cl->offset -= l;
     string_list_del (&cl->outgoing, e);
   }
+}
+
+/* account for t bytes written by server_output_send */
+static int server_output_done (client_t * cl, unsigned long t, int error)
+{
+  buf_mem -= cl->outgoing.size;
+
+  server_output_consume (cl, t);
+
+  switch (error) {
+    case 0:
+      break;
+    case EPIPE:
+#ifndef USE_WINDOWS
+    case ECONNRESET:
+#endif
+      buf_mem += cl->outgoing.size;
+      server_disconnect_user (cl, __ ("Connection closed."));
+      return -1;
+    default:
+      buf_mem += cl->outgoing.size;
+      return -1;
+  }
+
   if (cl->credit) {
     if (cl->credit > t) {
       cl->credit -= t;
@@ -179,11 +252,11 @@ int server_handle_output (esocket_t * es)
   STRINGLIST_VERIFY (&cl->outgoing);
 
   /* still not all data written */
-  if (b) {
+  if (cl->outgoing.count) {
     if ((cl->state == HUB_STATE_OVERFLOW)
 	&& ((cl->outgoing.size - cl->offset) < (config.BufferSoftLimit + cl->credit))) {
       server_settimer (cl, config.TimeoutBuffering);
-      cl->state = HUB_STATE_BUFFERING;
+      server_setstate (cl, HUB_STATE_BUFFERING);
     }
 
     buf_mem += cl->outgoing.size;
@@ -196,12 +269,115 @@ int server_handle_output (esocket_t * es)
   BUF_DPRINTF (" wrote %lu, ALL CLEAR (%u, %lu)!!\n", t, cl->outgoing.count, cl->offset);
 
   /* all data was written, we don't need the output event anymore */
-  ASSERT (!cl->outgoing.count);
+  ASSERT (!cl->offset);
 
   esocket_clearevents (cl->es, ESOCKET_EVENT_OUT);
   server_settimer (cl, 0);
   buffering--;
-  cl->state = HUB_STATE_NORMAL;
+  server_setstate (cl, HUB_STATE_NORMAL);
+
+  return 0;
+}
+
+/* account for a write queued by server_write during a write batch */
+static int server_write_done (client_t * cl, unsigned long t, int error)
+{
+  server_output_consume (cl, t);
+
+  if (error) {
+    string_list_clear (&cl->outgoing);
+    cl->offset = 0;
+    iowritefailures++;
+    switch (error) {
+      case EPIPE:
+#ifndef USE_WINDOWS
+      case ECONNRESET:
+#endif
+	server_disconnect_user (cl, __ ("Connection closed."));
+	break;
+    }
+    return -1;
+  }
+
+  if (cl->credit) {
+    if (cl->credit > t) {
+      cl->credit -= t;
+    } else {
+      cl->credit = 0;
+    };
+  }
+
+  if (!cl->outgoing.count)
+    return t;
+
+  /* not everything was written, start buffering like server_write does */
+  buffering++;
+  iowritebuffering++;
+  buf_mem += cl->outgoing.size;
+  server_setpeak (cl);
+  esocket_addevents (cl->es, ESOCKET_EVENT_OUT);
+
+  if (cl->state == HUB_STATE_NORMAL) {
+    if ((cl->outgoing.size - cl->offset) < (config.BufferSoftLimit + cl->credit)) {
+      server_setstate (cl, HUB_STATE_BUFFERING);
+      server_settimer (cl, config.TimeoutBuffering);
+    } else {
+      server_setstate (cl, HUB_STATE_OVERFLOW);
+      server_settimer (cl, config.TimeoutOverflow);
+    }
+  }
+
+  return t;
+}
+
+/* apply the result of a write done by an I/O thread */
+static int server_iosettle (client_t * cl)
+{
+  if (!(cl->io.pending & CLIENT_IO_SENT))
+    return 0;
+
+  if (cl->io.pending & CLIENT_IO_WRITE) {
+    cl->io.pending &= ~(CLIENT_IO_SENT | CLIENT_IO_WRITE);
+    return server_write_done (cl, cl->io.sent, cl->io.serror);
+  }
+
+  cl->io.pending &= ~CLIENT_IO_SENT;
+  return server_output_done (cl, cl->io.sent, cl->io.serror);
+}
+
+int server_handle_output (esocket_t * es)
+{
+  client_t *cl = (client_t *) es->context;
+  unsigned long t;
+  int error;
+
+  if (server_iosettle (cl) < 0)
+    return -1;
+
+  /* duplicate event */
+  if (!cl->outgoing.count)
+    return 0;
+
+  BUF_DPRINTF (" %p Writing output (%u, %lu)...", cl->user, cl->outgoing.count, cl->offset);
+
+  t = server_output_send (cl, &error);
+
+  return server_output_done (cl, t, error);
+}
+
+/* handle the data read into cl->buffers */
+static int server_input_done (client_t * cl)
+{
+  if (blockonoverflow && (cl->state == HUB_STATE_OVERFLOW)) {
+    bf_free (cl->buffers);
+    cl->buffers = NULL;
+    cl->proto->handle_input (cl->user, NULL);
+    return 0;
+  }
+
+  gettime ();
+  if (cl->buffers)
+    cl->proto->handle_input (cl->user, &cl->buffers);
 
   return 0;
 }
@@ -210,30 +386,39 @@ int server_handle_input (esocket_t * s)
 {
   client_t *cl = (client_t *) s->context;
   buffer_t *b;
-  int n, first;
+  int n, first, reads;
 
   ASSERT (cl->es == s);
 
   /* read available data */
   first = 1;
-  for (;;) {
+  for (reads = 1;; reads++) {
     /* alloc new buffer and read data in it. break loop if no data available */
     b = bf_alloc (HUB_INPUTBUFFER_SIZE);
     if (!b)
       return -1;
 
     n = recv (s->socket, b->s, HUB_INPUTBUFFER_SIZE, 0);
+    cl->stats.recvs++;
     if (n <= 0)
       break;
 
     hubstats.TotalBytesReceived += n;
+    cl->stats.bytesin += n;
     first = 0;
     /* init buffer and store */
     b->e = b->s + n;
     bf_append (&cl->buffers, b);
 
-    if (n < HUB_INPUTBUFFER_SIZE)
+    /* edge triggered: a short read can still leave an EOF behind */
+    if ((n < HUB_INPUTBUFFER_SIZE) && !esocket_edge (s))
       break;
+
+    /* read budget used up: come back for the rest next loop */
+    if (reads == HUB_INPUTREADS) {
+      esocket_ready (s, ESOCKET_EVENT_IN);
+      break;
+    }
   };
   if (n <= 0) {
     bf_free (b);
@@ -252,20 +437,207 @@ int server_handle_input (esocket_t * s)
     return -1;
   }
 
-  if (blockonoverflow && (cl->state == HUB_STATE_OVERFLOW)) {
-    bf_free (cl->buffers);
-    cl->buffers = NULL;
-    cl->proto->handle_input (cl->user, NULL);
-    return 0;
-  }
+  /* the data came with an EOF or error: handle the close next loop */
+#ifndef USE_WINDOWS
+  if (!n || ((n < 0) && (errno != EAGAIN)))
+    esocket_ready (s, ESOCKET_EVENT_IN);
+#endif
 
-  gettime ();
-  if (cl->buffers)
-    cl->proto->handle_input (cl->user, &cl->buffers);
+  return server_input_done (cl);
+}
+
+/****************************** I/O THREADS *********************************/
+
+/*
+ * With hub.IOThreads set, socket events only mark the client. After
+ *  esocket_select returns, server_iobatch has the I/O threads do the recv
+ *  and send calls of all marked clients at once and then handles the
+ *  results here, on the main thread.
+ */
+
+static int server_iodefer (client_t * cl, unsigned int what)
+{
+  client_t **list;
+
+  if (!(cl->io.pending & CLIENT_IO_LISTED)) {
+    if (iocount == iosize) {
+      list = realloc (iopending, (iosize + 256) * sizeof (client_t *));
+      if (!list)
+	return -1;
+      iopending = list;
+      iosize += 256;
+    }
+    cl->io.slot = iocount;
+    iopending[iocount++] = cl;
+  }
+  cl->io.pending |= what | CLIENT_IO_LISTED;
 
   return 0;
 }
 
+/* a client in the pending list is going away */
+static void server_iocancel (client_t * cl)
+{
+  if (!(cl->io.pending & CLIENT_IO_LISTED))
+    return;
+
+  iopending[cl->io.slot] = NULL;
+
+  /* these buffers were never counted as buffered */
+  if (cl->io.pending & CLIENT_IO_WRITE) {
+    string_list_clear (&cl->outgoing);
+    cl->offset = 0;
+  }
+  cl->io.pending = 0;
+  if (cl->io.input) {
+    bf_free (cl->io.input);
+    cl->io.input = NULL;
+  }
+}
+
+/* runs on an I/O thread */
+static void server_iojob (void *job)
+{
+  client_t *cl = job;
+  buffer_t *b;
+  long n;
+
+  if (cl->io.pending & (CLIENT_IO_OUTPUT | CLIENT_IO_WRITE))
+    cl->io.sent = server_output_send (cl, &cl->io.serror);
+
+  if (!(b = cl->io.input))
+    return;
+
+  /* fill the buffer, a full buffer leaves the rest for the next loop */
+  cl->io.rerror = 0;
+  while (b->e < (b->buffer + b->size)) {
+    n = recv (cl->es->socket, b->e, (b->buffer + b->size) - b->e, 0);
+    cl->stats.recvs++;
+    if (n <= 0) {
+      cl->io.rerror = n ? errno : EPIPE;
+      break;
+    }
+    b->e += n;
+  }
+  cl->io.received = bf_used (b);
+}
+
+static int server_handle_input_event (esocket_t * s)
+{
+  if (!iothread_active ())
+    return server_handle_input (s);
+
+  return server_iodefer ((client_t *) s->context, CLIENT_IO_INPUT);
+}
+
+static int server_handle_output_event (esocket_t * s)
+{
+  if (!iothread_active ())
+    return server_handle_output (s);
+
+  return server_iodefer ((client_t *) s->context, CLIENT_IO_OUTPUT);
+}
+
+void server_iobatch ()
+{
+  client_t *cl;
+  buffer_t *b;
+  unsigned long i;
+
+  if (!iocount)
+    return;
+
+  /* prepare the jobs */
+  for (i = 0; i < iocount; i++) {
+    if (!(cl = iopending[i]))
+      continue;
+    if (!cl->outgoing.count)
+      cl->io.pending &= ~CLIENT_IO_OUTPUT;
+    cl->io.sent = 0;
+    cl->io.serror = 0;
+    if (cl->io.pending & CLIENT_IO_INPUT) {
+      cl->io.input = bf_alloc (HUB_IOTHREAD_INPUTSIZE);
+      if (!cl->io.input) {
+	cl->io.pending &= ~CLIENT_IO_INPUT;
+	esocket_ready (cl->es, ESOCKET_EVENT_IN);
+      }
+    }
+    if (cl->io.pending & (CLIENT_IO_INPUT | CLIENT_IO_OUTPUT | CLIENT_IO_WRITE))
+      iothread_queue (cl->es->socket, cl);
+  }
+
+  iothread_run (server_iojob);
+
+  /* until it is settled, a client's queue does not match what was sent */
+  for (i = 0; i < iocount; i++) {
+    if (!(cl = iopending[i]) || !(cl->io.pending & (CLIENT_IO_OUTPUT | CLIENT_IO_WRITE)))
+      continue;
+    cl->io.pending = (cl->io.pending & ~CLIENT_IO_OUTPUT) | CLIENT_IO_SENT;
+  }
+
+  /* first finish all output: handling input can write to any client */
+  for (i = 0; i < iocount; i++)
+    if ((cl = iopending[i]))
+      server_iosettle (cl);
+
+  /* handle input. this can disconnect clients further down the list */
+  for (i = 0; i < iocount; i++) {
+    if (!(cl = iopending[i]))
+      continue;
+    cl->io.pending = 0;
+    iopending[i] = NULL;
+
+    if (!(b = cl->io.input))
+      continue;
+    cl->io.input = NULL;
+
+    if (!cl->io.received) {
+      bf_free (b);
+      if (cl->io.rerror == EAGAIN)
+	continue;
+      server_disconnect_user (cl, __ ("Error on read."));
+      continue;
+    }
+
+    /* the buffer filled up, there may be more. after an EOF or error, the
+     *  next loop reads nothing and closes the client */
+    if (cl->io.rerror != EAGAIN)
+      esocket_ready (cl->es, ESOCKET_EVENT_IN);
+
+    hubstats.TotalBytesReceived += cl->io.received;
+    cl->stats.bytesin += cl->io.received;
+    bf_append (&cl->buffers, b);
+
+    server_input_done (cl);
+  }
+
+  iocount = 0;
+}
+
+/*
+ * Between these calls, server_write only queues the data and the sends are
+ *  done in one batch by the I/O threads. Used for the fan-out of the cache
+ *  flush.
+ */
+void server_writebatch_begin ()
+{
+  iodeferwrites = (iothread_active () != 0);
+  iowritebuffering = 0;
+  iowritefailures = 0;
+}
+
+/* returns the number of clients that started buffering and failed writes */
+void server_writebatch_end (unsigned long *started, unsigned long *failures)
+{
+  if (iodeferwrites) {
+    iodeferwrites = 0;
+    server_iobatch ();
+  }
+
+  *started += iowritebuffering;
+  *failures += iowritefailures;
+}
+
 int server_error (esocket_t * s)
 {
   char buffer[256];
@@ -306,10 +678,9 @@ int accept_new_user (esocket_t * s)
   client_t *cl = NULL;
 
   gettime ();
-#ifndef USE_WINDOWS
-  for (;;)
-#endif
-  {
+
+  /* drain the accept queue, IOCP hands us one connection per call */
+  for (;;) {
     l = sizeof (client_address);
     memset (&client_address, 0, l);
     r = esocket_accept (s, (struct sockaddr *) &client_address, &l);
@@ -317,52 +688,23 @@ int accept_new_user (esocket_t * s)
     if (r == INVALID_SOCKET) {
       if (errno == EAGAIN)
 	return 0;
+      hubstats.AcceptErrors++;
       perror ("accept:");
       return -1;
     }
+    hubstats.Accepted++;
     l = 0;
 
-#ifndef USE_WINDOWS
-    if (ndelay) {
-      if (setsockopt (r, IPPROTO_TCP, TCP_NODELAY, (char *) &yes, sizeof (yes)) < 0) {
-	DPRINTF ("setsockopt (TCP_NODELAY): %s\n", strerror (errno));
-	shutdown (r, SHUT_RDWR);
-	close (r);
-	return -1;
-      }
-    }
-#endif
-
     /* before all else, test hardban */
     if (banlist_find_byip (&hardbanlist, client_address.sin_addr.s_addr)) {
-      shutdown (r, SHUT_RDWR);
-      close (r);
-      return -1;
-    }
-
-    /* make socket non-blocking */
-#ifndef USE_IOCP
-    if (fcntl (r, F_SETFL, O_NONBLOCK)) {
-      perror ("ioctl(O_NONBLOCK):");
-      close (r);
-      return -1;
-    };
-#else
-    {
-      DWORD yes = 1;
-      DWORD bytes = 0;
-
-      if (WSAIoctl (r, FIONBIO, &yes, sizeof (yes), NULL, 0, &bytes, NULL, NULL)) {
-	perror ("WSAIoctl (FIONBIO):");
-	close (r);
-	return -1;
-      }
+      hubstats.RejectedHardban++;
+      goto error;
     }
-#endif
 
     /* check last connection list */
     if (iplist_interval) {
       if (iplist_find (&lastlist, client_address.sin_addr.s_addr)) {
+	hubstats.RejectedReconnect++;
 	l = snprintf (buffer, sizeof (buffer), __ ("<%s> Don't reconnect so fast.|"), HUBSOFT_NAME);
 	goto error;
       }
@@ -371,15 +713,39 @@ int accept_new_user (esocket_t * s)
 
     /* check available memory */
     if (buf_mem > config.BufferTotalLimit) {
+      hubstats.RejectedBusy++;
       l =
 	snprintf (buffer, sizeof (buffer),
 		  __ ("<%s> This hub is too busy, please try again later.|"), HUBSOFT_NAME);
       goto error;
     }
 
+#ifndef USE_WINDOWS
+    if (ndelay) {
+      if (setsockopt (r, IPPROTO_TCP, TCP_NODELAY, (char *) &yes, sizeof (yes)) < 0) {
+	DPRINTF ("setsockopt (TCP_NODELAY): %s\n", strerror (errno));
+	goto error;
+      }
+    }
+#endif
+
+    /* make socket non-blocking, esocket_accept did that for the others */
+#ifdef USE_IOCP
+    {
+      DWORD yes = 1;
+      DWORD bytes = 0;
+
+      if (WSAIoctl (r, FIONBIO, &yes, sizeof (yes), NULL, 0, &bytes, NULL, NULL)) {
+	perror ("WSAIoctl (FIONBIO):");
+	goto error;
+      }
+    }
+#endif
+
     /* client */
-    cl = malloc (sizeof (client_t));
+    cl = pool_alloc (&clientpool);
     if (!cl) {
+      hubstats.RejectedBusy++;
       l =
 	snprintf (buffer, sizeof (buffer),
 		  __ ("<%s> This hub is too busy, please try again later.|"), HUBSOFT_NAME);
@@ -391,10 +757,12 @@ int accept_new_user (esocket_t * s)
     /* create new context */
     cl->proto = (proto_t *) s->context;
     cl->state = HUB_STATE_NORMAL;
+    cl->stats.since = now;
     cl->user = cl->proto->user_alloc (cl);
 
     /* user connection refused. */
     if (!cl->user) {
+      hubstats.RejectedBusy++;
       l =
 	snprintf (buffer, sizeof (buffer),
 		  __ ("<%s> This hub is too busy, please try again later.|"), HUBSOFT_NAME);
@@ -407,6 +775,7 @@ int accept_new_user (esocket_t * s)
     cl->es = esocket_add_socket (s->handler, es_type_server, r, (uintptr_t) cl);
 
     if (!cl->es) {
+      hubstats.RejectedBusy++;
       l =
 	snprintf (buffer, sizeof (buffer),
 		  __ ("<%s> This hub is too busy, please try again later.|"), HUBSOFT_NAME);
@@ -425,50 +794,56 @@ int accept_new_user (esocket_t * s)
 
     /* don't free this client if something goes wrong in the next loop! */
     cl = NULL;
-  }
-
-  return 0;
+#ifdef USE_WINDOWS
+    break;
+#endif
+    continue;
 
-error:
+  error:
 #ifndef USE_WINDOWS
-  /* if message, write it out */
-  if (l)
-    write (r, buffer, l);
+    /* if message, write it out */
+    if (l)
+      write (r, buffer, l);
 
-  /* shut the socket down */
-  shutdown (r, SHUT_RDWR);
-  close (r);
+    /* shut the socket down */
+    shutdown (r, SHUT_RDWR);
+    close (r);
 #else
-  {
-    esocket_t *es = esocket_add_socket (s->handler, es_type_server, r, 0);
-
-    if (es) {
-      buffer_t *buf = bf_alloc (l);
-
-      if (buf) {
-	bf_memcpy (buf, buffer, l);
-	es->state = SOCKSTATE_CONNECTED;
-	if (l)
-	  esocket_send (es, buf, 0);
-	bf_free (buf);
+    {
+      esocket_t *es = esocket_add_socket (s->handler, es_type_server, r, 0);
+
+      if (es) {
+	buffer_t *buf = bf_alloc (l);
+
+	if (buf) {
+	  bf_memcpy (buf, buffer, l);
+	  es->state = SOCKSTATE_CONNECTED;
+	  if (l)
+	    esocket_send (es, buf, 0);
+	  bf_free (buf);
+	}
+	esocket_remove_socket (es);
+      } else {
+	close (r);
       }
-      esocket_remove_socket (es);
-    } else {
-      close (r);
     }
-  }
 #endif
 
-  /* free any memory allocated */
-  if (!cl)
-    return -1;
-
-  if (cl->user)
-    cl->proto->user_free (cl->user);
+    /* free any memory allocated */
+    if (cl) {
+      if (cl->user)
+	cl->proto->user_free (cl->user);
+      pool_free (&clientpool, cl);
+      cl = NULL;
+    }
 
-  free (cl);
+    /* a rejected connection must not stop the others */
+#ifdef USE_WINDOWS
+    return -1;
+#endif
+  }
 
-  return -1;
+  return 0;
 }
 
 /*****************************************************************************
@@ -499,6 +874,21 @@ esocket_t *setup_incoming_socket (proto_t * proto, esocket_handler_t * h, unsign
     esocket_remove_socket (es);
     return NULL;
   }
+#ifdef SO_REUSEPORT
+  /* the kernel spreads the connections over the listeners of a port */
+  if ((listensockets > 1)
+      && (setsockopt (es->socket, SOL_SOCKET, SO_REUSEPORT, (char *) &yes, sizeof (yes)) < 0)) {
+    perror ("setsockopt (SO_REUSEPORT):");
+    esocket_remove_socket (es);
+    return NULL;
+  }
+#endif
+#ifdef TCP_DEFER_ACCEPT
+  if (deferaccept
+      && (setsockopt (es->socket, IPPROTO_TCP, TCP_DEFER_ACCEPT, (char *) &deferaccept,
+		      sizeof (deferaccept)) < 0))
+    perror ("setsockopt (TCP_DEFER_ACCEPT):");
+#endif
 #endif
 
   if (esocket_bind (es, address, port)) {
@@ -507,7 +897,7 @@ esocket_t *setup_incoming_socket (proto_t * proto, esocket_handler_t * h, unsign
   }
 
   /* start listening on the port */
-  esocket_listen (es, 10, AF_INET, SOCK_STREAM, 0);
+  esocket_listen (es, listenbacklog, AF_INET, SOCK_STREAM, 0);
 
   esocket_update_state (es, SOCKSTATE_CONNECTED);
   esocket_setevents (es, ESOCKET_EVENT_IN);
@@ -523,7 +913,19 @@ esocket_t *setup_incoming_socket (proto_t * proto, esocket_handler_t * h, unsign
 
 int server_isbuffering (client_t * cl)
 {
-  return cl->outgoing.count != 0;
+  return cl->outgoing.count && !(cl->io.pending & CLIENT_IO_WRITE);
+}
+
+/* the protocol replaced the user object of this connection */
+void server_setuser (client_t * cl, user_t * user)
+{
+  string_list_entry_t *e;
+
+  for (e = cl->outgoing.first; e; e = e->next)
+    if (e->user == cl->user)
+      e->user = user;
+
+  cl->user = user;
 }
 
 int server_write_credit (client_t * cl, buffer_t * b)
@@ -551,6 +953,16 @@ int server_write (client_t * cl, buffer_t * b)
   if (!bf_used (b))
     return 0;
 
+  if (server_iosettle (cl) < 0)
+    return -1;
+
+  /* during a write batch, queue the data for the I/O threads */
+  if (iodeferwrites && (!cl->outgoing.count || (cl->io.pending & CLIENT_IO_WRITE))
+      && !server_iodefer (cl, CLIENT_IO_WRITE)) {
+    string_list_add (&cl->outgoing, cl->user, b);
+    return bf_size (b);
+  }
+
   /* if data is queued, queue this after it */
   if (cl->outgoing.count) {
     /* if we are still below max buffer per user, queue buffer */
@@ -559,17 +971,20 @@ int server_write (client_t * cl, buffer_t * b)
       buf_mem -= cl->outgoing.size;
       string_list_add (&cl->outgoing, cl->user, b);
       buf_mem += cl->outgoing.size;
+      server_setpeak (cl);
       BUF_DPRINTF (" %p Buffering %d buffers, %lu (%s).\n", cl->user, cl->outgoing.count,
 		   cl->outgoing.size, cl->user->nick);
       /* if we are over the softlimit, we go into quick timeout mode */
       if ((cl->state == HUB_STATE_BUFFERING)
 	  && ((cl->outgoing.size - cl->offset) >= (config.BufferSoftLimit + cl->credit))) {
-	cl->state = HUB_STATE_OVERFLOW;
+	server_setstate (cl, HUB_STATE_OVERFLOW);
 	server_settimer (cl, config.TimeoutOverflow);
       }
     }
 
     /* try sending some of that data */
+    if (iodeferwrites && !server_iodefer (cl, CLIENT_IO_OUTPUT))
+      return 0;
     return server_handle_output (s);
   }
 
@@ -578,6 +993,7 @@ int server_write (client_t * cl, buffer_t * b)
   for (e = b; e; e = e->next) {
     l = bf_used (e);
     w = esocket_send (s, e, 0);
+    cl->stats.sends++;
     if (w < 0) {
       switch (errno) {
 	case EAGAIN:
@@ -598,6 +1014,7 @@ int server_write (client_t * cl, buffer_t * b)
       break;
     }
     hubstats.TotalBytesSend += w;
+    cl->stats.bytesout += w;
     if (w != l)
       break;
     t += l;
@@ -622,15 +1039,16 @@ int server_write (client_t * cl, buffer_t * b)
     string_list_add (&cl->outgoing, cl->user, e);
     buffering++;
     buf_mem += cl->outgoing.size;
+    server_setpeak (cl);
     cl->offset = w;
     esocket_addevents (s, ESOCKET_EVENT_OUT);
 
     if (cl->state == HUB_STATE_NORMAL) {
       if ((cl->outgoing.size - cl->offset) < (config.BufferSoftLimit + cl->credit)) {
-	cl->state = HUB_STATE_BUFFERING;
+	server_setstate (cl, HUB_STATE_BUFFERING);
 	server_settimer (cl, config.TimeoutBuffering);
       } else {
-	cl->state = HUB_STATE_OVERFLOW;
+	server_setstate (cl, HUB_STATE_OVERFLOW);
 	server_settimer (cl, config.TimeoutOverflow);
       }
     }
@@ -661,6 +1079,9 @@ int server_disconnect_user (client_t * cl, char *reason)
     cl->timer = NULL;
   }
 
+  /* forget deferred system calls */
+  server_iocancel (cl);
+
   /* close the real socket */
   if (cl->es) {
     esocket_close (cl->es);
@@ -687,21 +1108,33 @@ int server_disconnect_user (client_t * cl, char *reason)
   /* free user */
   cl->proto->user_free (cl->user);
 
-  free (cl);
+  pool_free (&clientpool, cl);
 
   return 0;
 }
 
 int server_add_port (esocket_handler_t * h, proto_t * proto, unsigned long address, int port)
 {
-  return setup_incoming_socket (proto, h, es_type_listen, address, port) != NULL;
+  unsigned int i, count = 1;
+
+#ifdef SO_REUSEPORT
+  if (listensockets > 1)
+    count = listensockets;
+#endif
+
+  for (i = 0; i < count; i++)
+    if (!setup_incoming_socket (proto, h, es_type_listen, address, port))
+      return i > 0;
+
+  return 1;
 }
 
 int server_setup (esocket_handler_t * h)
 {
   es_type_listen = esocket_add_type (h, ESOCKET_EVENT_IN, accept_new_user, NULL, NULL);
   es_type_server =
-    esocket_add_type (h, ESOCKET_EVENT_IN, server_handle_input, server_handle_output, server_error);
+    esocket_add_type (h, ESOCKET_EVENT_IN | ESOCKET_EVENT_EDGE, server_handle_input_event,
+		      server_handle_output_event, server_error);
 
   iplist_init (&lastlist);
 
@@ -715,6 +1148,8 @@ int server_init ()
   banlist_init (&hardbanlist);
   banlist_init (&softbanlist);
 
+  pool_setup (&clientpool, "client", sizeof (client_t), 64);
+
   core_config_init ();
   core_stats_init ();
 
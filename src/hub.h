@@ -43,6 +43,11 @@
 typedef struct hub_statitics {
   unsigned long long TotalBytesSend;
   unsigned long long TotalBytesReceived;
+  unsigned long Accepted;	/* connections accepted */
+  unsigned long AcceptErrors;	/* failed accept calls */
+  unsigned long RejectedHardban;
+  unsigned long RejectedReconnect;	/* reconnected too fast */
+  unsigned long RejectedBusy;	/* out of memory or refused by the protocol */
 } hub_statistics_t;
 
 extern hub_statistics_t hubstats;
@@ -51,6 +56,30 @@ extern hub_statistics_t hubstats;
  *  server private context.
  */
 
+/* per connection accounting */
+typedef struct client_stats {
+  unsigned long long bytesin, bytesout;
+  unsigned long recvs, sends;	/* system calls */
+  unsigned long peak;		/* largest outgoing queue */
+  unsigned long buffering, overflow;	/* ms spent in these states */
+  struct timeval since;		/* last state change */
+} client_stats_t;
+
+/* system calls deferred to the I/O threads, see server_iobatch */
+#define CLIENT_IO_INPUT		1
+#define CLIENT_IO_OUTPUT	2
+#define CLIENT_IO_SENT		4	/* output done, not yet accounted */
+#define CLIENT_IO_LISTED	8
+#define CLIENT_IO_WRITE		16	/* queued by a write batch, not buffering yet */
+
+typedef struct client_io {
+  unsigned int pending;		/* CLIENT_IO_* */
+  unsigned long slot;		/* in the list of pending clients */
+  buffer_t *input;		/* allocated by the main thread */
+  long received, sent;
+  int rerror, serror;
+} client_io_t;
+
 typedef struct client {
   proto_t *proto;
   esocket_t *es;
@@ -59,6 +88,8 @@ typedef struct client {
   unsigned long offset, credit;
   unsigned int state;
   etimer_t	*timer;
+  client_stats_t stats;
+  client_io_t io;
 
   user_t *user;
 } client_t;
@@ -67,6 +98,7 @@ extern unsigned long users;
 
 /*  banlists */
 extern unsigned long buffering;
+extern unsigned long buf_mem;
 extern banlist_t hardbanlist, softbanlist;
 //extern banlist_nick_t nickbanlist;
 
@@ -77,5 +109,10 @@ extern int server_write (client_t *, buffer_t *);
 extern int server_write_credit (client_t *, buffer_t *);
 extern int server_add_port (esocket_handler_t * h, proto_t * proto,  unsigned long address, int port);
 extern int server_isbuffering (client_t *);
+extern void server_setuser (client_t *, user_t *);
+extern unsigned long server_statetime (client_t *, unsigned int);
+extern void server_iobatch ();
+extern void server_writebatch_begin ();
+extern void server_writebatch_end (unsigned long *buffering, unsigned long *failures);
 
 #endif /* _HUB_H_ */
@@ -0,0 +1,234 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#if defined(HAVE_LIBPTHREAD) && !defined(USE_WINDOWS)
+#  define USE_IOTHREADS
+#  include <pthread.h>
+#endif
+
+#include "defaults.h"
+#include "config.h"
+#include "stats.h"
+#include "iothread.h"
+
+#define IOTHREAD_MAX		64
+#define IOTHREAD_MINBATCH	16	/* smaller batches are not worth waking the threads */
+
+#define IOLOCK	 pthread_mutex_lock (&iomutex);
+#define IOUNLOCK	 pthread_mutex_unlock (&iomutex);
+
+typedef struct iothread_queue {
+  void **jobs;
+  unsigned long count, size;
+} iothread_queue_t;
+
+unsigned int IOThreads;
+
+iothread_stats_t iothreadstats;
+
+iothread_queue_t ioqueue[IOTHREAD_MAX];
+unsigned long ioqueued = 0;
+unsigned int iothreads = 0;
+
+#ifdef USE_IOTHREADS
+
+pthread_t iothread[IOTHREAD_MAX];
+unsigned long iostart[IOTHREAD_MAX];
+
+pthread_mutex_t iomutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t iowake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t iodone = PTHREAD_COND_INITIALIZER;
+
+/* protected by iomutex */
+unsigned long iogeneration = 0;
+unsigned int iorunning = 0;
+iothread_handler_t *iohandler = NULL;
+
+/******************************* THREADS *******************************************/
+
+static void *iothread_main (void *arg)
+{
+  unsigned long index = (unsigned long) arg;
+  iothread_queue_t *q = &ioqueue[index];
+  unsigned long seen, i;
+  sigset_t sigset;
+
+  /* signals are for the main thread */
+  sigfillset (&sigset);
+  pthread_sigmask (SIG_SETMASK, &sigset, NULL);
+
+  IOLOCK;
+  seen = iostart[index];
+  for (;;) {
+    while (iogeneration == seen)
+      pthread_cond_wait (&iowake, &iomutex);
+    seen = iogeneration;
+
+    /* the pool shrunk */
+    if (index >= iothreads)
+      break;
+
+    IOUNLOCK;
+    for (i = 0; i < q->count; i++)
+      iohandler (q->jobs[i]);
+    IOLOCK;
+
+    if (!--iorunning)
+      pthread_cond_signal (&iodone);
+  }
+  IOUNLOCK;
+
+  return NULL;
+}
+
+/* wake all threads and wait until they finished their queues */
+static void iothread_kick (iothread_handler_t * handler)
+{
+  IOLOCK;
+  iohandler = handler;
+  iorunning = iothreads;
+  iogeneration++;
+  pthread_cond_broadcast (&iowake);
+  while (iorunning)
+    pthread_cond_wait (&iodone, &iomutex);
+  IOUNLOCK;
+}
+
+static void iothread_nop (void *job)
+{
+}
+
+static void iothread_resize (unsigned int count)
+{
+  unsigned int i, old = iothreads;
+
+  if (count > IOTHREAD_MAX)
+    count = IOTHREAD_MAX;
+
+  /* stop the threads we no longer need */
+  if (count < old) {
+    IOLOCK;
+    iothreads = count;
+    IOUNLOCK;
+    iothread_kick (iothread_nop);
+    for (i = count; i < old; i++)
+      pthread_join (iothread[i], NULL);
+    return;
+  }
+
+  for (i = old; i < count; i++) {
+    iostart[i] = iogeneration;
+    if (pthread_create (&iothread[i], NULL, iothread_main, (void *) (unsigned long) i)) {
+      perror ("pthread_create:");
+      break;
+    }
+  }
+  IOLOCK;
+  iothreads = i;
+  IOUNLOCK;
+
+  /* do not retry every call */
+  IOThreads = i;
+}
+
+#endif
+
+/******************************* BATCHES *******************************************/
+
+unsigned int iothread_active ()
+{
+#ifdef USE_IOTHREADS
+  /* queued jobs are spread over the current threads */
+  if ((IOThreads != iothreads) && !ioqueued)
+    iothread_resize (IOThreads);
+#endif
+  return iothreads;
+}
+
+int iothread_queue (int fd, void *job)
+{
+  iothread_queue_t *q = &ioqueue[iothreads ? (fd % iothreads) : 0];
+  void **jobs;
+
+  if (q->count == q->size) {
+    jobs = realloc (q->jobs, (q->size + 256) * sizeof (void *));
+    if (!jobs)
+      return -1;
+    q->jobs = jobs;
+    q->size += 256;
+  }
+  q->jobs[q->count++] = job;
+  ioqueued++;
+
+  return 0;
+}
+
+void iothread_run (iothread_handler_t * handler)
+{
+  unsigned long i, j, total = ioqueued;
+  unsigned int n = iothreads ? iothreads : 1;
+
+  if (!total)
+    return;
+
+#ifdef USE_IOTHREADS
+  if (iothreads && (total >= IOTHREAD_MINBATCH)) {
+    iothread_kick (handler);
+    iothreadstats.batches++;
+    iothreadstats.jobs += total;
+  } else
+#endif
+  {
+    for (i = 0; i < n; i++)
+      for (j = 0; j < ioqueue[i].count; j++)
+	handler (ioqueue[i].jobs[j]);
+    iothreadstats.inlined += total;
+  }
+
+  for (i = 0; i < n; i++)
+    ioqueue[i].count = 0;
+  ioqueued = 0;
+}
+
+int iothread_init ()
+{
+  memset (&iothreadstats, 0, sizeof (iothread_stats_t));
+  memset (ioqueue, 0, sizeof (ioqueue));
+
+  IOThreads = DEFAULT_IOTHREADS;
+
+  config_register ("hub.IOThreads", CFG_ELEM_UINT, &IOThreads,
+		   _("Number of threads doing the network reads and writes for the main thread. 0 disables them."));
+
+  stats_register ("iothread.batches", VAL_ELEM_ULONG, &iothreadstats.batches,
+		  _("Batches of network calls handed to the I/O threads."));
+  stats_register ("iothread.jobs", VAL_ELEM_ULONG, &iothreadstats.jobs,
+		  _("Network calls done by the I/O threads."));
+  stats_register ("iothread.inline", VAL_ELEM_ULONG, &iothreadstats.inlined,
+		  _("Network calls of batches too small for the I/O threads, done by the main thread."));
+
+  return 0;
+}
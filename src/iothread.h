@@ -0,0 +1,48 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _IOTHREAD_H_
+#define _IOTHREAD_H_
+
+/*
+ * A pool of threads for network system calls. The main thread queues jobs,
+ *  runs the batch and waits until every job is done. Nothing else runs
+ *  during a batch, so a handler may use its job and socket without locking
+ *  but must not touch any other hub state. Jobs for the same socket always
+ *  run on the same thread.
+ */
+
+typedef void (iothread_handler_t) (void *job);
+
+typedef struct iothread_stats {
+  unsigned long batches;	/* batches handed to the threads */
+  unsigned long jobs;		/* jobs run by the threads */
+  unsigned long inlined;	/* jobs of small batches, run on the main thread */
+} iothread_stats_t;
+
+extern iothread_stats_t iothreadstats;
+
+/* number of running threads, 0 if the pool is disabled */
+extern unsigned int iothread_active ();
+extern int iothread_queue (int fd, void *job);
+extern void iothread_run (iothread_handler_t * handler);
+
+extern int iothread_init ();
+
+#endif /* _IOTHREAD_H_ */
@@ -0,0 +1,562 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * The journal is a text file with one record per line. Fields are separated
+ *  by tabs; tabs, newlines and backslashes inside a field are escaped with a
+ *  backslash. Every record describes the complete new state of its object,
+ *  so replaying a record twice does no harm.
+ *
+ *   ban <list> <ip> <netmask> <expire> <nick> <op> <message>
+ *   unban <list> <ip> <netmask> <nick>
+ *   group <name> <rights>
+ *   delgroup <name>
+ *   account <nick> <group> <op> <passwd> <rights> <regged> <lastlogin> <lastip>
+ *   delaccount <nick>
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef USE_WINDOWS
+#  include <unistd.h>
+#  include <sys/types.h>
+#endif
+
+#include "aqtime.h"
+#include "defaults.h"
+#include "journal.h"
+#include "cap.h"
+#include "config.h"
+#include "stats.h"
+#include "hub.h"
+
+unsigned int JournalEnable;
+unsigned int JournalSync;
+
+journal_stats_t journalstats;
+
+FILE *journalfp = NULL;
+unsigned int journalsuspended = 0;
+journal_banlist_t journalbanlists[JOURNAL_MAXBANLISTS];
+buffer_t *journalrights = NULL;
+
+/******************************* UTILITIES *******************************************/
+
+static banlist_t *journal_banlist_find (unsigned char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < JOURNAL_MAXBANLISTS; i++)
+    if (journalbanlists[i].name && !strcmp (journalbanlists[i].name, name))
+      return journalbanlists[i].list;
+
+  return NULL;
+}
+
+static unsigned char *journal_banlist_name (banlist_t * list)
+{
+  unsigned int i;
+
+  for (i = 0; i < JOURNAL_MAXBANLISTS; i++)
+    if (journalbanlists[i].list == list)
+      return journalbanlists[i].name;
+
+  return NULL;
+}
+
+int journal_banlist_register (unsigned char *name, banlist_t * list)
+{
+  unsigned int i;
+
+  for (i = 0; i < JOURNAL_MAXBANLISTS; i++)
+    if (!journalbanlists[i].list)
+      break;
+
+  if (i == JOURNAL_MAXBANLISTS)
+    return -1;
+
+  journalbanlists[i].name = name;
+  journalbanlists[i].list = list;
+
+  return 0;
+}
+
+static void journal_close ()
+{
+  if (!journalfp)
+    return;
+
+  fclose (journalfp);
+  journalfp = NULL;
+}
+
+static int journal_open ()
+{
+  if (journalfp)
+    return 0;
+
+  journalfp = fopen (JOURNAL_FILE, "ab");
+  if (!journalfp)
+    return -1;
+
+  fseek (journalfp, 0, SEEK_END);
+  journalstats.size = ftell (journalfp);
+
+  return 0;
+}
+
+/******************************* WRITING *******************************************/
+
+/* returns 0 if the record should be written */
+static int journal_start (unsigned char *type)
+{
+  if (journalsuspended || !JournalEnable)
+    return -1;
+
+  if (journal_open ())
+    return -1;
+
+  fputs (type, journalfp);
+
+  return 0;
+}
+
+static void journal_string (unsigned char *s)
+{
+  fputc ('\t', journalfp);
+  for (; *s; s++) {
+    switch (*s) {
+      case '\t':
+	fputs ("\\t", journalfp);
+	break;
+      case '\n':
+	fputs ("\\n", journalfp);
+	break;
+      case '\\':
+	fputs ("\\\\", journalfp);
+	break;
+      default:
+	fputc (*s, journalfp);
+    }
+  }
+}
+
+static void journal_ulong (unsigned long value)
+{
+  fprintf (journalfp, "\t%lu", value);
+}
+
+static void journal_rights (unsigned long long rights)
+{
+  bf_clear (journalrights);
+  flags_print ((Capabilities + CAP_PRINT_OFFSET), journalrights, rights);
+  *journalrights->e = '\0';
+  journal_string (journalrights->s);
+}
+
+static void journal_end ()
+{
+  fputc ('\n', journalfp);
+  if (fflush (journalfp) || ferror (journalfp)) {
+    /* try again with a fresh file on the next record */
+    journal_close ();
+    return;
+  }
+#ifndef USE_WINDOWS
+  if (JournalSync)
+    fsync (fileno (journalfp));
+#endif
+
+  journalstats.records++;
+  journalstats.size = ftell (journalfp);
+}
+
+void journal_ban (banlist_t * list, banlist_entry_t * e)
+{
+  unsigned char *name = journal_banlist_name (list);
+
+  if (!name || journal_start ("ban"))
+    return;
+
+  journal_string (name);
+  journal_ulong (e->ip);
+  journal_ulong (e->netmask);
+  journal_ulong (e->expire);
+  journal_string (e->nick);
+  journal_string (e->op);
+  journal_string (e->message->s);
+  journal_end ();
+}
+
+void journal_unban (banlist_t * list, banlist_entry_t * e)
+{
+  unsigned char *name = journal_banlist_name (list);
+
+  if (!name || journal_start ("unban"))
+    return;
+
+  journal_string (name);
+  journal_ulong (e->ip);
+  journal_ulong (e->netmask);
+  journal_string (e->nick);
+  journal_end ();
+}
+
+void journal_group (account_type_t * t)
+{
+  if (journal_start ("group"))
+    return;
+
+  journal_string (t->name);
+  journal_rights (t->rights);
+  journal_end ();
+}
+
+void journal_group_del (account_type_t * t)
+{
+  if (journal_start ("delgroup"))
+    return;
+
+  journal_string (t->name);
+  journal_end ();
+}
+
+void journal_account (account_t * a)
+{
+  if (journal_start ("account"))
+    return;
+
+  journal_string (a->nick);
+  journal_string (a->classp->name);
+  journal_string (a->op);
+  journal_string (a->passwd);
+  journal_rights (a->rights);
+  journal_ulong (a->regged);
+  journal_ulong (a->lastlogin);
+  journal_ulong (a->lastip);
+  journal_end ();
+}
+
+void journal_account_del (account_t * a)
+{
+  if (journal_start ("delaccount"))
+    return;
+
+  journal_string (a->nick);
+  journal_end ();
+}
+
+/* used while the configuration is loaded or saved, changes made then are not new */
+void journal_suspend ()
+{
+  journalsuspended++;
+}
+
+void journal_resume ()
+{
+  if (journalsuspended)
+    journalsuspended--;
+}
+
+/******************************* REPLAY *******************************************/
+
+/* split a record into its fields and unescape them in place */
+static unsigned int journal_split (unsigned char *line, unsigned char **argv)
+{
+  unsigned int argc = 0;
+  unsigned char *s, *d;
+
+  argv[argc++] = d = line;
+  for (s = line; *s; s++) {
+    if (*s == '\t') {
+      if (argc == JOURNAL_MAXFIELDS)
+	return 0;
+      *d++ = '\0';
+      argv[argc++] = d;
+      continue;
+    }
+    if ((*s == '\\') && s[1]) {
+      s++;
+      switch (*s) {
+	case 't':
+	  *d++ = '\t';
+	  break;
+	case 'n':
+	  *d++ = '\n';
+	  break;
+	default:
+	  *d++ = *s;
+      }
+      continue;
+    }
+    *d++ = *s;
+  }
+  *d = '\0';
+
+  return argc;
+}
+
+static int journal_apply (unsigned int argc, unsigned char **argv)
+{
+  banlist_t *list;
+  banlist_entry_t *e;
+  account_type_t *t;
+  account_t *a;
+  unsigned long long rights;
+  unsigned long expire;
+
+  if (!strcmp (argv[0], "ban") && (argc == 8)) {
+    list = journal_banlist_find (argv[1]);
+    if (!list)
+      return -1;
+    expire = strtoul (argv[4], NULL, 10);
+    if (expire && (expire < (unsigned long) now.tv_sec))
+      return 0;
+    banlist_add (list, argv[6], argv[5], strtoul (argv[2], NULL, 10),
+		 strtoul (argv[3], NULL, 10), bf_buffer (argv[7]), expire);
+    return 0;
+  }
+
+  if (!strcmp (argv[0], "unban") && (argc == 5)) {
+    list = journal_banlist_find (argv[1]);
+    if (!list)
+      return -1;
+    e = banlist_find_exact (list, argv[4], strtoul (argv[2], NULL, 10),
+			    strtoul (argv[3], NULL, 10));
+    banlist_del (list, e);
+    return 0;
+  }
+
+  if (!strcmp (argv[0], "group") && (argc == 3)) {
+    rights = 0;
+    xml_value_get (argv[2], XML_TYPE_CAP, &rights);
+    t = account_type_find (argv[1]);
+    if (t) {
+      t->rights = rights;
+    } else {
+      account_type_add (argv[1], rights);
+    }
+    return 0;
+  }
+
+  if (!strcmp (argv[0], "delgroup") && (argc == 2)) {
+    t = account_type_find (argv[1]);
+    if (t && !t->refcnt)
+      account_type_del (t);
+    return 0;
+  }
+
+  if (!strcmp (argv[0], "account") && (argc == 9)) {
+    t = account_type_find (argv[2]);
+    if (!t)
+      return -1;
+    a = account_find (argv[1]);
+    if (!a)
+      a = account_add (t, argv[3], argv[1]);
+    if (a->classp != t)
+      account_set_type (a, t);
+    strncpy (a->op, argv[3], NICKLENGTH);
+    a->op[NICKLENGTH - 1] = 0;
+    strncpy (a->passwd, argv[4], NICKLENGTH);
+    a->passwd[NICKLENGTH - 1] = 0;
+    rights = 0;
+    xml_value_get (argv[5], XML_TYPE_CAP, &rights);
+    a->rights = rights;
+    a->regged = strtoul (argv[6], NULL, 10);
+    a->lastlogin = strtoul (argv[7], NULL, 10);
+    a->lastip = strtoul (argv[8], NULL, 10);
+    return 0;
+  }
+
+  if (!strcmp (argv[0], "delaccount") && (argc == 2)) {
+    a = account_find (argv[1]);
+    if (a)
+      account_del (a);
+    return 0;
+  }
+
+  return -1;
+}
+
+int journal_replay (buffer_t * output)
+{
+  FILE *fp;
+  buffer_t *buf;
+  unsigned char *line, *next, *argv[JOURNAL_MAXFIELDS];
+  unsigned int argc;
+  unsigned long count = 0, errors = 0;
+
+  if (journalfp)
+    fflush (journalfp);
+
+  fp = fopen (JOURNAL_FILE, "rb");
+  if (!fp)
+    return 0;
+
+  buf = xml_load (fp);
+  fclose (fp);
+  if (!buf) {
+    if (output)
+      bf_printf (output, _("Error loading journal %s: %s\n"), JOURNAL_FILE, strerror (errno));
+    return -1;
+  }
+
+  /* a record is only complete once its newline is written */
+  journal_suspend ();
+  for (line = buf->s; (next = strchr (line, '\n')); line = next + 1) {
+    *next = '\0';
+    if (line == next)
+      continue;
+    argc = journal_split (line, argv);
+    if (!argc || journal_apply (argc, argv)) {
+      errors++;
+      continue;
+    }
+    count++;
+  }
+  journal_resume ();
+
+  /* cut off a record that was interrupted by a crash, or the next one would be lost too */
+  if (line != buf->e) {
+    journal_close ();
+#ifndef USE_WINDOWS
+    if (truncate (JOURNAL_FILE, line - buf->s) && output)
+      bf_printf (output, _("Error truncating journal %s: %s\n"), JOURNAL_FILE, strerror (errno));
+#endif
+  }
+
+  journalstats.size = line - buf->s;
+  journalstats.replayed = count;
+
+  bf_free (buf);
+
+  if (errors && output)
+    bf_printf (output, _("Skipped %lu invalid records in journal %s\n"), errors, JOURNAL_FILE);
+
+  return 0;
+}
+
+/******************************* COMPACTION *******************************************/
+
+unsigned long journal_mark ()
+{
+  if (journalfp)
+    fflush (journalfp);
+
+  return journalstats.size;
+}
+
+int journal_compact (unsigned long mark)
+{
+  FILE *in, *out = NULL;
+  unsigned char buf[4096];
+  size_t n;
+  int retval = -1;
+
+  if (!mark || (mark > journalstats.size))
+    return 0;
+
+  if (journalfp)
+    fflush (journalfp);
+
+  in = fopen (JOURNAL_FILE, "rb");
+  if (!in)
+    return 0;
+
+  /* copy the records written after the mark, they are not in the saved file */
+  if (fseek (in, mark, SEEK_SET))
+    goto leave;
+
+  out = fopen (JOURNAL_FILE ".tmp", "wb");
+  if (!out)
+    goto leave;
+
+  while ((n = fread (buf, 1, sizeof (buf), in)))
+    if (fwrite (buf, 1, n, out) != n)
+      goto leave;
+
+  if (ferror (in))
+    goto leave;
+
+  n = fclose (out);
+  out = NULL;
+  if (n)
+    goto leave;
+
+  journal_close ();
+#ifdef USE_WINDOWS
+  unlink (JOURNAL_FILE);
+#endif
+  if (rename (JOURNAL_FILE ".tmp", JOURNAL_FILE))
+    goto leave;
+
+  journalstats.size -= mark;
+  journalstats.compactions++;
+  retval = 0;
+
+leave:
+  if (out)
+    fclose (out);
+  if (retval)
+    unlink (JOURNAL_FILE ".tmp");
+  fclose (in);
+
+  return retval;
+}
+
+/******************************* INIT *******************************************/
+
+int journal_init ()
+{
+  memset (&journalstats, 0, sizeof (journal_stats_t));
+  memset (journalbanlists, 0, sizeof (journalbanlists));
+
+  journalrights = bf_alloc (1024);
+
+  /* nothing is written until the configuration is loaded */
+  journalsuspended = 1;
+
+  JournalEnable = DEFAULT_JOURNAL;
+  JournalSync = DEFAULT_JOURNALSYNC;
+
+  config_register ("Journal", CFG_ELEM_UINT, &JournalEnable,
+		   _("Write ban and account changes to " JOURNAL_FILE
+		     " as they happen, so they survive a crash between saves."));
+  config_register ("JournalSync", CFG_ELEM_UINT, &JournalSync,
+		   _("Flush every journal record to disk before continuing. Safer, but slower."));
+
+  stats_register ("journal.records", VAL_ELEM_ULONG, &journalstats.records,
+		  _("Number of records written to the journal."));
+  stats_register ("journal.size", VAL_ELEM_ULONG, &journalstats.size,
+		  _("Size of the journal in bytes."));
+  stats_register ("journal.replayed", VAL_ELEM_ULONG, &journalstats.replayed,
+		  _("Number of records replayed from the journal at the last load."));
+  stats_register ("journal.compactions", VAL_ELEM_ULONG, &journalstats.compactions,
+		  _("Number of times the journal was compacted after a save."));
+
+  journal_banlist_register ("hard", &hardbanlist);
+  journal_banlist_register ("soft", &softbanlist);
+
+  return 0;
+}
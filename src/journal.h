@@ -0,0 +1,69 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include "defaults.h"
+#include "buffer.h"
+#include "banlist.h"
+#include "user.h"
+
+#define JOURNAL_FILE		HUBSOFT_NAME ".journal"
+#define JOURNAL_MAXBANLISTS	4
+#define JOURNAL_MAXFIELDS	12
+
+typedef struct journal_banlist {
+  unsigned char *name;
+  banlist_t *list;
+} journal_banlist_t;
+
+typedef struct journal_stats {
+  unsigned long records;
+  unsigned long size;
+  unsigned long replayed;
+  unsigned long compactions;
+} journal_stats_t;
+
+extern journal_stats_t journalstats;
+
+/* changes to registered banlists and all accounts and groups are appended
+ *  to the journal as they happen. */
+extern int journal_banlist_register (unsigned char *name, banlist_t * list);
+
+extern void journal_ban (banlist_t * list, banlist_entry_t * e);
+extern void journal_unban (banlist_t * list, banlist_entry_t * e);
+extern void journal_group (account_type_t * t);
+extern void journal_group_del (account_type_t * t);
+extern void journal_account (account_t * a);
+extern void journal_account_del (account_t * a);
+
+extern void journal_suspend ();
+extern void journal_resume ();
+
+/* apply the journal on top of a freshly loaded configuration */
+extern int journal_replay (buffer_t * output);
+
+/* drop everything before mark once the configuration has been saved */
+extern unsigned long journal_mark ();
+extern int journal_compact (unsigned long mark);
+
+extern int journal_init ();
+
+#endif /* _JOURNAL_H_ */
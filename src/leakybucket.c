@@ -56,6 +56,56 @@ __inline__ void init_bucket (leaky_bucket_t * bucket, unsigned long now)
   bucket->tokens = 0;
 }
 
+__inline__ int rate_get_token (leaky_bucket_type_t * type, rate_bucket_t * bucket, time_t now)
+{
+  unsigned long t;
+
+  if (bucket->tokens) {
+    bucket->tokens--;
+    return 1;
+  }
+
+  /* bad setting, but it shouldn't cause a crash */
+  if (!type->period)
+    return 0;
+
+  t = ((uint32_t) ((uint32_t) now - bucket->timestamp)) / type->period;
+  if (!t)
+    return 0;
+
+  bucket->timestamp += type->period * t;
+
+  /* never store more tokens than the burst value */
+  t *= type->refill;
+  if (t > type->burst)
+    t = type->burst;
+  if (t > RATE_TOKENS_MAX)
+    t = RATE_TOKENS_MAX;
+  if (!t)
+    return 0;
+
+  bucket->tokens = t - 1;
+  return 1;
+}
+
+/* would rate_get_token succeed, without taking the token */
+__inline__ int rate_check_token (leaky_bucket_type_t * type, rate_bucket_t * bucket, time_t now)
+{
+  if (bucket->tokens)
+    return 1;
+
+  if (!type->period || !type->refill || !type->burst)
+    return 0;
+
+  return (((uint32_t) ((uint32_t) now - bucket->timestamp)) / type->period) != 0;
+}
+
+__inline__ void rate_init (rate_bucket_t * bucket, time_t now, unsigned long tokens)
+{
+  bucket->timestamp = now;
+  bucket->tokens = (tokens > RATE_TOKENS_MAX) ? RATE_TOKENS_MAX : tokens;
+}
+
 __inline__ void init_bucket_type (leaky_bucket_type_t * type, unsigned long period,
 				  unsigned long burst, unsigned long refill)
 {
@@ -22,12 +22,31 @@
 
 #include <sys/types.h>
 
+#include "../config.h"
+#if HAVE_INTTYPES_H
+# include <inttypes.h>
+#else
+# if HAVE_STDINT_H
+#  include <stdint.h>
+# endif
+#endif
+
 typedef struct leaky_bucket {
   time_t timestamp;
   time_t lasteval;
   unsigned long tokens;
 } leaky_bucket_t;
 
+/* compact bucket for per user state. the timestamp holds the low 32 bits
+ *  of the time, differences are taken modulo 2^32. no lasteval, a refill is
+ *  only calculated when the bucket is empty. */
+#define RATE_TOKENS_MAX		0xFFFF
+
+typedef struct rate_bucket {
+  uint32_t timestamp;
+  uint16_t tokens;
+} rate_bucket_t;
+
 typedef struct leaky_bucket_type {
   unsigned long period;
   unsigned long burst;
@@ -36,6 +55,9 @@ typedef struct leaky_bucket_type {
 
 extern inline int get_token (leaky_bucket_type_t * type, leaky_bucket_t * bucket, time_t now);
 extern inline void init_bucket (leaky_bucket_t * bucket, unsigned long now);
+extern inline int rate_get_token (leaky_bucket_type_t * type, rate_bucket_t * bucket, time_t now);
+extern inline int rate_check_token (leaky_bucket_type_t * type, rate_bucket_t * bucket, time_t now);
+extern inline void rate_init (rate_bucket_t * bucket, time_t now, unsigned long tokens);
 extern inline void init_bucket_type (leaky_bucket_type_t * type, unsigned long period,
 				     unsigned long burst, unsigned long refill);
 
@@ -41,6 +41,10 @@
 #include "config.h"
 #include "stats.h"
 #include "user.h"
+#include "journal.h"
+#include "metrics.h"
+#include "capture.h"
+#include "iothread.h"
 #include "plugin_int.h"
 #include "builtincmd.h"
 #include "commands.h"
@@ -340,9 +344,13 @@ int main (int argc, char **argv)
   stats_init ();
   accounts_init ();
   plugin_init ();
+  journal_init ();
+  metrics_init ();
   command_init ();
   builtincmd_init ();
+  capture_init ();
   server_init ();
+  iothread_init ();
   nmdc_init ();
 
   /* register boottime stat */
@@ -385,6 +393,9 @@ int main (int argc, char **argv)
 
   plugin_config_load (NULL);
 
+  /* from now on, changes are journalled until they are saved */
+  journal_resume ();
+
   /* add lowest member of the statistics */
   gettimeofday (&boottime, NULL);
 
@@ -392,11 +403,12 @@ int main (int argc, char **argv)
   srandom (boottime.tv_sec ^ boottime.tv_usec);
 
   /* setup socket handler */
-  h = esocket_create_handler (5);
+  h = esocket_create_handler (8);
 
   /* setup server */
   server_setup (h);
   nmdc_setup (h);
+  metrics_setup (h);
   command_setup ();
 
 #ifdef PLUGIN_HUBLIST
@@ -425,6 +437,12 @@ int main (int argc, char **argv)
     /* wait until an event */
     ret = esocket_select (h, &to);
 
+    /* do the deferred network calls on the I/O threads */
+    server_iobatch ();
+
+    /* deliver queued events to asynchronous observers */
+    plugin_flush_events ();
+
     /* 1s periodic cache flush */
     gettimeofday (&tnow, NULL);
     if (timercmp (&tnow, &tnext, >=)) {
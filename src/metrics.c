@@ -0,0 +1,689 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Serves the stats registry and the registered histograms over HTTP:
+ *   GET /metrics       Prometheus text format
+ *   GET /metrics.json  JSON
+ * Every request gets a single reply after which the connection is closed.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../config.h"
+#ifndef __USE_W32_SOCKETS
+#  include <sys/socket.h>
+#  ifdef HAVE_NETINET_IN_H
+#    include <netinet/in.h>
+#  endif
+#  ifdef HAVE_ARPA_INET_H
+#    include <arpa/inet.h>
+#  endif
+#endif
+
+#ifdef USE_WINDOWS
+#  include "sys_windows.h"
+#endif
+
+#include "aqtime.h"
+#include "config.h"
+#include "stats.h"
+
+metrics_stats_t metricsstats;
+
+static metrics_histogram_t *histograms = NULL;
+static metrics_client_t clients;
+static unsigned long nclients = 0;
+
+static unsigned int metrics_port;
+static unsigned long metrics_address;
+static unsigned long metrics_timeout;
+static unsigned long metrics_maxclients;
+
+static unsigned int es_type_metrics_listen, es_type_metrics;
+
+/******************************* HISTOGRAMS *******************************************/
+
+int metrics_histogram_register (metrics_histogram_t * h, unsigned char *name,
+				unsigned char *label, unsigned char *value,
+				const unsigned char *help, const unsigned long *bounds,
+				unsigned int buckets)
+{
+  metrics_histogram_t **p;
+
+  if (buckets > METRICS_MAXBUCKETS)
+    buckets = METRICS_MAXBUCKETS;
+
+  memset (h, 0, sizeof (metrics_histogram_t));
+  strncpy (h->name, name, CONFIG_NAMELENGTH - 1);
+  if (label && value) {
+    strncpy (h->label, label, CONFIG_NAMELENGTH - 1);
+    strncpy (h->value, value, CONFIG_NAMELENGTH - 1);
+  }
+  h->help = help;
+  h->bounds = bounds;
+  h->buckets = buckets;
+
+  /* keep histograms with the same name together, they are printed as one family */
+  for (p = &histograms; *p; p = &(*p)->next)
+    if (!strcmp ((*p)->name, h->name))
+      break;
+  for (; *p && !strcmp ((*p)->name, h->name); p = &(*p)->next);
+
+  h->next = *p;
+  *p = h;
+
+  return 0;
+}
+
+int metrics_histogram_unregister (metrics_histogram_t * h)
+{
+  metrics_histogram_t **p;
+
+  for (p = &histograms; *p; p = &(*p)->next) {
+    if (*p != h)
+      continue;
+
+    *p = h->next;
+    h->next = NULL;
+    return 0;
+  }
+
+  return -1;
+}
+
+void metrics_observe (metrics_histogram_t * h, unsigned long value)
+{
+  unsigned int i;
+
+  for (i = 0; (i < h->buckets) && (value > h->bounds[i]); i++);
+
+  h->counts[i]++;
+  h->count++;
+  h->sum += value;
+}
+
+/******************************* FORMATTING *******************************************/
+
+/* prometheus only allows [a-zA-Z0-9_:] in names */
+static unsigned char *metrics_name (unsigned char *name)
+{
+  static unsigned char buf[CONFIG_NAMELENGTH + 16];
+  unsigned char *d = buf, *s;
+
+  d += sprintf (buf, "%s_", HUBSOFT_NAME);
+  for (s = buf; s < d; s++)
+    *s = tolower (*s);
+
+  for (s = name; *s && (d < (buf + sizeof (buf) - 1)); s++, d++)
+    *d = (isalnum (*s) ? *s : '_');
+  *d = '\0';
+
+  return buf;
+}
+
+/* print a string for use in a quoted label, help text or json string */
+static buffer_t *metrics_escape (buffer_t * b, const unsigned char *s, int json)
+{
+  unsigned char *e;
+
+  for (; *s; s = e) {
+    for (e = (unsigned char *) s; *e && (*e != '\\') && (*e != '"') && (*e >= ' '); e++);
+    if (e != s)
+      b = bf_printf_resize (b, "%.*s", (int) (e - s), s);
+    if (!*e)
+      break;
+
+    switch (*e) {
+      case '\n':
+	b = bf_printf_resize (b, "\\n");
+	break;
+      case '"':
+	b = bf_printf_resize (b, "\\\"");
+	break;
+      case '\\':
+	b = bf_printf_resize (b, "\\\\");
+	break;
+      default:
+	if (json)
+	  b = bf_printf_resize (b, "\\u%04x", *e);
+    }
+    e++;
+  }
+
+  return b;
+}
+
+/* returns NULL if the value is not numeric */
+static buffer_t *metrics_value (buffer_t * b, value_element_t * elem)
+{
+  switch (elem->type) {
+    case VAL_ELEM_LONG:
+      return bf_printf_resize (b, "%ld", *elem->val.v_long);
+    case VAL_ELEM_ULONG:
+    case VAL_ELEM_MEMSIZE:
+      return bf_printf_resize (b, "%lu", *elem->val.v_ulong);
+    case VAL_ELEM_INT:
+      return bf_printf_resize (b, "%d", *elem->val.v_int);
+    case VAL_ELEM_UINT:
+      return bf_printf_resize (b, "%u", *elem->val.v_uint);
+    case VAL_ELEM_ULONGLONG:
+    case VAL_ELEM_BYTESIZE:
+#ifndef USE_WINDOWS
+      return bf_printf_resize (b, "%llu", *elem->val.v_ulonglong);
+#else
+      return bf_printf_resize (b, "%I64u", *elem->val.v_ulonglong);
+#endif
+    case VAL_ELEM_DOUBLE:
+      return bf_printf_resize (b, "%f", *elem->val.v_double);
+    default:
+      return NULL;
+  }
+}
+
+int metrics_prometheus (buffer_t * output)
+{
+  value_element_t *elem;
+  metrics_histogram_t *h, *prev = NULL;
+  unsigned long total;
+  unsigned char *name;
+  unsigned int i;
+  buffer_t *b = output;
+
+  for (elem = statvalues->value_sorted.onext; elem != &statvalues->value_sorted;
+       elem = elem->onext) {
+    switch (elem->type) {
+      case VAL_ELEM_PTR:
+      case VAL_ELEM_CAP:
+      case VAL_ELEM_STRING:
+      case VAL_ELEM_IP:
+	continue;
+      default:
+	break;
+    }
+    name = metrics_name (elem->name);
+    if (elem->help) {
+      b = bf_printf_resize (b, "# HELP %s ", name);
+      b = metrics_escape (b, elem->help, 0);
+      b = bf_printf_resize (b, "\n");
+    }
+    b = bf_printf_resize (b, "# TYPE %s untyped\n%s ", name, name);
+    b = metrics_value (b, elem);
+    b = bf_printf_resize (b, "\n");
+  }
+
+  for (h = histograms; h; prev = h, h = h->next) {
+    name = metrics_name (h->name);
+    if (!prev || strcmp (prev->name, h->name)) {
+      if (h->help) {
+	b = bf_printf_resize (b, "# HELP %s ", name);
+	b = metrics_escape (b, h->help, 0);
+	b = bf_printf_resize (b, "\n");
+      }
+      b = bf_printf_resize (b, "# TYPE %s histogram\n", name);
+    }
+
+    /* prometheus buckets are cumulative */
+    total = 0;
+    for (i = 0; i <= h->buckets; i++) {
+      total += h->counts[i];
+      b = bf_printf_resize (b, "%s_bucket{", name);
+      if (*h->label) {
+	b = bf_printf_resize (b, "%s=\"", h->label);
+	b = metrics_escape (b, h->value, 0);
+	b = bf_printf_resize (b, "\",");
+      }
+      if (i < h->buckets) {
+	b = bf_printf_resize (b, "le=\"%lu\"} %lu\n", h->bounds[i], total);
+      } else {
+	b = bf_printf_resize (b, "le=\"+Inf\"} %lu\n", total);
+      }
+    }
+    if (*h->label) {
+      b = bf_printf_resize (b, "%s_sum{%s=\"", name, h->label);
+      b = metrics_escape (b, h->value, 0);
+#ifndef USE_WINDOWS
+      b = bf_printf_resize (b, "\"} %llu\n", h->sum);
+#else
+      b = bf_printf_resize (b, "\"} %I64u\n", h->sum);
+#endif
+      b = bf_printf_resize (b, "%s_count{%s=\"", name, h->label);
+      b = metrics_escape (b, h->value, 0);
+      b = bf_printf_resize (b, "\"} %lu\n", h->count);
+    } else {
+#ifndef USE_WINDOWS
+      b = bf_printf_resize (b, "%s_sum %llu\n", name, h->sum);
+#else
+      b = bf_printf_resize (b, "%s_sum %I64u\n", name, h->sum);
+#endif
+      b = bf_printf_resize (b, "%s_count %lu\n", name, h->count);
+    }
+  }
+
+  return 0;
+}
+
+int metrics_json (buffer_t * output)
+{
+  value_element_t *elem;
+  metrics_histogram_t *h;
+  unsigned int i;
+  buffer_t *b = output;
+  struct in_addr ia;
+  unsigned char *sep = "";
+
+  b = bf_printf_resize (b, "{\n \"stats\": {");
+  for (elem = statvalues->value_sorted.onext; elem != &statvalues->value_sorted;
+       elem = elem->onext) {
+    switch (elem->type) {
+      case VAL_ELEM_PTR:
+      case VAL_ELEM_CAP:
+	continue;
+      default:
+	break;
+    }
+    b = bf_printf_resize (b, "%s\n  \"", sep);
+    b = metrics_escape (b, elem->name, 1);
+    b = bf_printf_resize (b, "\": ");
+    sep = ",";
+
+    switch (elem->type) {
+      case VAL_ELEM_STRING:
+	b = bf_printf_resize (b, "\"");
+	if (*elem->val.v_string)
+	  b = metrics_escape (b, *elem->val.v_string, 1);
+	b = bf_printf_resize (b, "\"");
+	break;
+      case VAL_ELEM_IP:
+	ia.s_addr = *elem->val.v_ip;
+	b = bf_printf_resize (b, "\"%s\"", inet_ntoa (ia));
+	break;
+      default:
+	b = metrics_value (b, elem);
+    }
+  }
+  b = bf_printf_resize (b, "\n },\n \"histograms\": [");
+
+  sep = "";
+  for (h = histograms; h; h = h->next) {
+    b = bf_printf_resize (b, "%s\n  {\"name\": \"", sep);
+    b = metrics_escape (b, h->name, 1);
+    b = bf_printf_resize (b, "\", ");
+    if (*h->label) {
+      b = bf_printf_resize (b, "\"labels\": {\"");
+      b = metrics_escape (b, h->label, 1);
+      b = bf_printf_resize (b, "\": \"");
+      b = metrics_escape (b, h->value, 1);
+      b = bf_printf_resize (b, "\"}, ");
+    }
+    b = bf_printf_resize (b, "\"bounds\": [");
+    for (i = 0; i < h->buckets; i++)
+      b = bf_printf_resize (b, "%s%lu", i ? ", " : "", h->bounds[i]);
+    b = bf_printf_resize (b, "], \"counts\": [");
+    for (i = 0; i <= h->buckets; i++)
+      b = bf_printf_resize (b, "%s%lu", i ? ", " : "", h->counts[i]);
+#ifndef USE_WINDOWS
+    b = bf_printf_resize (b, "], \"sum\": %llu, \"count\": %lu}", h->sum, h->count);
+#else
+    b = bf_printf_resize (b, "], \"sum\": %I64u, \"count\": %lu}", h->sum, h->count);
+#endif
+    sep = ",";
+  }
+  b = bf_printf_resize (b, "\n ]\n}\n");
+
+  return 0;
+}
+
+/******************************* CONNECTIONS *******************************************/
+
+#ifndef USE_IOCP
+
+static int metrics_client_close (metrics_client_t * cl)
+{
+  etimer_cancel (&cl->timer);
+
+  if (cl->es) {
+    esocket_close (cl->es);
+    esocket_remove_socket (cl->es);
+  }
+
+  if (cl->request)
+    bf_free (cl->request);
+  if (cl->reply)
+    bf_free (cl->reply);
+
+  cl->next->prev = cl->prev;
+  cl->prev->next = cl->next;
+  nclients--;
+
+  free (cl);
+
+  return 0;
+}
+
+static int metrics_handle_timeout (metrics_client_t * cl)
+{
+  metricsstats.errors++;
+  return metrics_client_close (cl);
+}
+
+/* write out as much of the reply as possible. returns 1 when the reply is complete */
+static int metrics_client_write (metrics_client_t * cl)
+{
+  buffer_t *b;
+  int n;
+
+  while (cl->reply) {
+    b = cl->reply;
+    if (cl->offset < bf_used (b)) {
+      n = esocket_send (cl->es, b, cl->offset);
+      if (n < 0) {
+	if (errno == EAGAIN)
+	  break;
+	return -1;
+      }
+      cl->offset += n;
+      if (cl->offset < bf_used (b))
+	break;
+    }
+
+    cl->reply = b->next;
+    if (cl->reply)
+      cl->reply->prev = NULL;
+    b->next = NULL;
+    bf_free (b);
+    cl->offset = 0;
+  }
+
+  /* wait until the socket is writable, the request is complete already */
+  if (cl->reply) {
+    esocket_setevents (cl->es, ESOCKET_EVENT_OUT);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int metrics_client_reply (metrics_client_t * cl)
+{
+  unsigned char *method, *path, *e;
+  unsigned char *status = "200 OK", *type = "text/plain; version=0.0.4";
+  buffer_t *header, *body;
+
+  /* request line: <method> <path> <version> */
+  *cl->request->e = '\0';
+  method = cl->request->s;
+  path = strchr (method, ' ');
+  if (path) {
+    *path++ = '\0';
+    e = path + strcspn (path, " \r\n?");
+    *e = '\0';
+  }
+
+  body = bf_alloc (16384);
+  if (!body)
+    return -1;
+
+  if (!path || (strcmp (method, "GET") && strcmp (method, "HEAD"))) {
+    status = "405 Method Not Allowed";
+    bf_printf (body, "Method not allowed.\n");
+    metricsstats.errors++;
+  } else if (!strcmp (path, "/metrics")) {
+    metrics_prometheus (body);
+  } else if (!strcmp (path, "/metrics.json")) {
+    type = "application/json";
+    metrics_json (body);
+  } else {
+    status = "404 Not Found";
+    bf_printf (body, "Try /metrics or /metrics.json.\n");
+    metricsstats.errors++;
+  }
+
+  header = bf_alloc (256);
+  if (!header) {
+    bf_free (body);
+    return -1;
+  }
+  bf_printf (header, "HTTP/1.0 %s\r\nServer: %s/%s\r\nContent-Type: %s\r\n"
+	     "Content-Length: %lu\r\nConnection: close\r\n\r\n", status, HUBSOFT_NAME, VERSION,
+	     type, bf_size (body));
+
+  if (!strcmp (method, "HEAD")) {
+    bf_free (body);
+  } else {
+    bf_append (&header, body);
+  }
+
+  cl->reply = header;
+  cl->offset = 0;
+  metricsstats.requests++;
+
+  return metrics_client_write (cl);
+}
+
+static int metrics_handle_input (esocket_t * s)
+{
+  metrics_client_t *cl = (metrics_client_t *) s->context;
+  int n;
+
+  if (s->state == SOCKSTATE_FREED)
+    return 0;
+
+  /* the reply is already on its way, ignore anything else */
+  if (cl->reply)
+    return 0;
+
+  /* keep one byte for the terminator */
+  n = recv (s->socket, cl->request->e, bf_unused (cl->request) - 1, 0);
+  if (n < 0) {
+    if (errno == EAGAIN)
+      return 0;
+    metricsstats.errors++;
+    return metrics_client_close (cl);
+  }
+  if (!n) {
+    metrics_client_close (cl);
+    return 0;
+  }
+
+  cl->request->e += n;
+  *cl->request->e = '\0';
+  if (!strstr (cl->request->s, "\r\n\r\n") && !strstr (cl->request->s, "\n\n")) {
+    if (bf_unused (cl->request) > 1)
+      return 0;
+    metricsstats.errors++;
+    return metrics_client_close (cl);
+  }
+
+  switch (metrics_client_reply (cl)) {
+    case 0:
+      return 0;
+    case 1:
+      return metrics_client_close (cl);
+    default:
+      metricsstats.errors++;
+      return metrics_client_close (cl);
+  }
+}
+
+static int metrics_handle_output (esocket_t * s)
+{
+  metrics_client_t *cl = (metrics_client_t *) s->context;
+
+  if (s->state == SOCKSTATE_FREED)
+    return 0;
+
+  if (!cl->reply) {
+    esocket_clearevents (s, ESOCKET_EVENT_OUT);
+    return 0;
+  }
+
+  switch (metrics_client_write (cl)) {
+    case 0:
+      return 0;
+    case 1:
+      return metrics_client_close (cl);
+    default:
+      metricsstats.errors++;
+      return metrics_client_close (cl);
+  }
+}
+
+static int metrics_handle_error (esocket_t * s)
+{
+  metrics_client_t *cl = (metrics_client_t *) s->context;
+
+  if (s->state == SOCKSTATE_FREED)
+    return 0;
+
+  metricsstats.errors++;
+  return metrics_client_close (cl);
+}
+
+static int metrics_accept (esocket_t * s)
+{
+  struct sockaddr_in address;
+  metrics_client_t *cl;
+  int r, l;
+
+  for (;;) {
+    l = sizeof (address);
+    r = esocket_accept (s, (struct sockaddr *) &address, &l);
+    if (r == INVALID_SOCKET) {
+      if (errno == EAGAIN)
+	return 0;
+      perror ("metrics accept:");
+      return -1;
+    }
+
+    if (nclients >= metrics_maxclients) {
+      metricsstats.refused++;
+      close (r);
+      continue;
+    }
+
+    cl = malloc (sizeof (metrics_client_t));
+    if (!cl) {
+      close (r);
+      continue;
+    }
+    memset (cl, 0, sizeof (metrics_client_t));
+
+    cl->request = bf_alloc (METRICS_REQUESTSIZE);
+    cl->es = esocket_add_socket (s->handler, es_type_metrics, r, (uintptr_t) cl);
+    if (!cl->request || !cl->es) {
+      if (cl->request)
+	bf_free (cl->request);
+      if (cl->es)
+	esocket_remove_socket (cl->es);
+      else
+	close (r);
+      free (cl);
+      continue;
+    }
+    esocket_update_state (cl->es, SOCKSTATE_CONNECTED);
+
+    etimer_init (&cl->timer, (etimer_handler_t *) metrics_handle_timeout, cl);
+    etimer_set (&cl->timer, metrics_timeout);
+
+    cl->next = clients.next;
+    cl->prev = &clients;
+    cl->next->prev = cl;
+    clients.next = cl;
+    nclients++;
+  }
+
+  return 0;
+}
+
+#endif /* USE_IOCP */
+
+/******************************* INIT *******************************************/
+
+int metrics_setup (esocket_handler_t * h)
+{
+  esocket_t *es;
+  int yes = 1;
+
+#ifndef USE_IOCP
+  es_type_metrics_listen = esocket_add_type (h, ESOCKET_EVENT_IN, metrics_accept, NULL, NULL);
+  es_type_metrics =
+    esocket_add_type (h, ESOCKET_EVENT_IN, metrics_handle_input, metrics_handle_output,
+		      metrics_handle_error);
+
+  if (!metrics_port)
+    return 0;
+
+  es = esocket_new (h, es_type_metrics_listen, AF_INET, SOCK_STREAM, 0, 0);
+  if (!es) {
+    perror ("metrics socket:");
+    return -1;
+  }
+
+  if (setsockopt (es->socket, SOL_SOCKET, SO_REUSEADDR, (char *) &yes, sizeof (yes)) < 0)
+    perror ("setsockopt (SO_REUSEADDR):");
+
+  if (esocket_bind (es, metrics_address, metrics_port)) {
+    esocket_remove_socket (es);
+    return -1;
+  }
+
+  esocket_listen (es, 10, AF_INET, SOCK_STREAM, 0);
+  esocket_update_state (es, SOCKSTATE_CONNECTED);
+  esocket_setevents (es, ESOCKET_EVENT_IN);
+#endif /* the listener relies on non-blocking sockets, IOCP only collects */
+
+  return 0;
+}
+
+int metrics_init ()
+{
+  memset (&metricsstats, 0, sizeof (metricsstats));
+  clients.next = clients.prev = &clients;
+
+  metrics_port = DEFAULT_METRICS_PORT;
+  metrics_address = inet_addr (DEFAULT_METRICS_ADDRESS);
+  metrics_timeout = DEFAULT_METRICS_TIMEOUT;
+  metrics_maxclients = DEFAULT_METRICS_MAXCLIENTS;
+
+  config_register ("Metrics.ListenPort", CFG_ELEM_UINT, &metrics_port,
+		   _("Port of the HTTP metrics listener, 0 disables it. Takes effect after a restart."));
+  config_register ("Metrics.ListenAddress", CFG_ELEM_IP, &metrics_address,
+		   _("IP on which the metrics listener listens. Takes effect after a restart."));
+  config_register ("Metrics.Timeout", CFG_ELEM_ULONG, &metrics_timeout,
+		   _("Metrics requests that are not answered within this many milliseconds are dropped."));
+  config_register ("Metrics.MaxClients", CFG_ELEM_ULONG, &metrics_maxclients,
+		   _("Maximum number of simultaneous connections to the metrics listener."));
+
+  stats_register ("metrics.requests", VAL_ELEM_ULONG, &metricsstats.requests,
+		  _("Requests answered by the metrics listener."));
+  stats_register ("metrics.errors", VAL_ELEM_ULONG, &metricsstats.errors,
+		  _("Failed or invalid requests to the metrics listener."));
+  stats_register ("metrics.refused", VAL_ELEM_ULONG, &metricsstats.refused,
+		  _("Connections to the metrics listener refused because of Metrics.MaxClients."));
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "defaults.h"
+#include "buffer.h"
+#include "esocket.h"
+#include "etimer.h"
+
+#define METRICS_MAXBUCKETS	16
+#define METRICS_REQUESTSIZE	4096
+
+/*
+ * A histogram counts observations in buckets with a fixed upper bound,
+ *  one extra bucket catches everything above the last bound. It can carry
+ *  one label, so related histograms share a name.
+ */
+typedef struct metrics_histogram {
+  struct metrics_histogram *next;
+
+  unsigned char name[CONFIG_NAMELENGTH];
+  unsigned char label[CONFIG_NAMELENGTH];
+  unsigned char value[CONFIG_NAMELENGTH];
+  const unsigned char *help;
+
+  unsigned int buckets;
+  const unsigned long *bounds;
+  unsigned long counts[METRICS_MAXBUCKETS + 1];
+
+  unsigned long count;
+  unsigned long long sum;
+} metrics_histogram_t;
+
+/* a connection to the metrics listener */
+typedef struct metrics_client {
+  struct metrics_client *next, *prev;
+
+  esocket_t *es;
+  buffer_t *request;
+  buffer_t *reply;
+  unsigned long offset;
+  etimer_t timer;
+} metrics_client_t;
+
+typedef struct metrics_stats {
+  unsigned long requests;
+  unsigned long errors;
+  unsigned long refused;
+} metrics_stats_t;
+
+extern metrics_stats_t metricsstats;
+
+extern int metrics_histogram_register (metrics_histogram_t * h, unsigned char *name,
+				       unsigned char *label, unsigned char *value,
+				       const unsigned char *help, const unsigned long *bounds,
+				       unsigned int buckets);
+extern int metrics_histogram_unregister (metrics_histogram_t * h);
+extern void metrics_observe (metrics_histogram_t * h, unsigned long value);
+
+extern int metrics_prometheus (buffer_t * output);
+extern int metrics_json (buffer_t * output);
+
+extern int metrics_init ();
+extern int metrics_setup (esocket_handler_t * h);
+
+#endif /* _METRICS_H_ */
@@ -45,6 +45,8 @@
 #include "defaults.h"
 
 #include "stats.h"
+#include "capture.h"
+#include "pool.h"
 
 /******************************************************************************\
 **                                                                            **
@@ -71,6 +73,23 @@ char key[16 + sizeof (LOCK) + 4 + LOCKLENGTH + 1];
 
 leaky_bucket_t connects;
 nmdc_stats_t nmdc_stats;
+nmdc_metrics_t nmdc_metrics;
+nmdc_flush_record_t nmdc_flushrecord;
+nmdc_governor_t nmdc_governor;
+
+static const unsigned long nmdc_metrics_time[] =
+  { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 };
+static const unsigned long nmdc_metrics_users[] = { 0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+static const unsigned long nmdc_metrics_bytes[] =
+  { 0, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304 };
+
+#define NMDC_METRICS_BUCKETS(b)	(sizeof (b) / sizeof (unsigned long))
+
+nmdc_token_stats_t nmdc_tokenstats[TOKEN_NUM];
+const unsigned long nmdc_token_bounds[NMDC_TOKEN_BUCKETS] = {
+  1000, 2000, 4000, 8000, 16000, 32000, 64000, 128000, 256000, 512000,
+  1024000, 2048000, 4096000, 8192000, 16384000, 32768000
+};
 
 banlist_t reconnectbanlist;
 
@@ -81,6 +100,9 @@ unsigned int searchmaxlength;
 unsigned int srmaxlength;
 unsigned int researchmininterval, researchperiod, researchmaxcount;
 
+unsigned int governor_enable, governor_memory, governor_buffering, governor_flushtime;
+unsigned int governor_relax, governor_nicklist;
+
 unsigned char *defaultbanmessage = NULL;
 
 unsigned char *nickchars;
@@ -94,6 +116,7 @@ config_element_t *cfg_nickchars;
 leaky_bucket_t rate_warnings;
 
 static user_t *freelist = NULL;
+static pool_t userpool, handshakepool;
 hashlist_t hashlist;
 
 unsigned long cachelist_count = 0;
@@ -120,6 +143,7 @@ int proto_nmdc_user_redirect (user_t * u, buffer_t * message);
 int proto_nmdc_user_drop (user_t * u, buffer_t * message);
 user_t *proto_nmdc_user_find (unsigned char *nick);
 user_t *proto_nmdc_user_alloc (void *priv);
+user_t *proto_nmdc_user_promote (user_t * hs);
 int proto_nmdc_user_free (user_t * user);
 
 user_t *proto_nmdc_user_addrobot (unsigned char *nick, unsigned char *description);
@@ -130,6 +154,8 @@ int proto_nmdc_user_send (user_t * u, user_t * target, buffer_t * message);
 int proto_nmdc_user_send_direct (user_t * u, user_t * target, buffer_t * message);
 int proto_nmdc_user_priv (user_t * u, user_t * target, user_t * source, buffer_t * message);
 int proto_nmdc_user_priv_direct (user_t * u, user_t * target, user_t * source, buffer_t * message);
+int proto_nmdc_user_priv_multi (user_t * u, user_t ** targets, unsigned int count, user_t * source,
+				buffer_t * message);
 int proto_nmdc_user_raw (user_t * target, buffer_t * message);
 int proto_nmdc_user_raw_all (buffer_t * message);
 
@@ -170,6 +196,7 @@ proto_t nmdc_proto = {
 	chat_send_direct:	proto_nmdc_user_send_direct,
 	chat_priv:		proto_nmdc_user_priv,
 	chat_priv_direct:	proto_nmdc_user_priv_direct,
+	chat_priv_multi:	proto_nmdc_user_priv_multi,
 	raw_send:		proto_nmdc_user_raw,
 	raw_send_all:		proto_nmdc_user_raw_all,
 	
@@ -315,6 +342,11 @@ void proto_nmdc_user_freelist_clear ()
 
     ASSERT (!o->timer.tovalid);
 
+    if (o->flags & NMDC_FLAG_HANDSHAKE) {
+      pool_free (&handshakepool, o);
+      continue;
+    }
+
     if (o->tthlist)
       free (o->tthlist);
 
@@ -326,7 +358,7 @@ void proto_nmdc_user_freelist_clear ()
     if (o->plugin_priv)
       plugin_del_user ((void *) &o->plugin_priv);
 
-    free (o);
+    pool_free (&userpool, o);
   }
 }
 
@@ -437,6 +469,11 @@ unsigned int proto_nmdc_user_flush (user_t * u)
   for (le = ((nmdc_user_t *) u->pdata)->privatemessages.messages.first; le; le = le->next) {
     /* data and length */
     b = le->data;
+    if (NMDC_PM_SHARED (le)) {
+      bf_strcat (buffer, "$To: ");
+      bf_strcat (buffer, u->nick);
+      bf_strcat (buffer, " ");
+    }
     bf_strncat (buffer, b->s, bf_used (b));
     bf_strcat (buffer, "|");
 
@@ -602,6 +639,57 @@ leave:
   return retval;
 }
 
+/* the body is formatted once and queued for every target, only the $To: differs */
+int proto_nmdc_user_priv_multi (user_t * u, user_t ** targets, unsigned int count, user_t * source,
+				buffer_t * message)
+{
+  unsigned int i;
+  buffer_t *buf;
+  user_t *target;
+
+  buf = bf_alloc (32 + 2 * NICKLENGTH + bf_size (message));
+
+  bf_printf (buf, "From: %s $<%s> ", u->nick, source->nick);
+  for (; message; message = message->next)
+    bf_strncat (buf, message->s, bf_used (message));
+  if (*(buf->e - 1) == '\n')
+    buf->e--;
+  if (buf->e[-1] != '|')
+    bf_strcat (buf, "|");
+
+  for (i = 0; i < count; i++) {
+    target = targets[i];
+
+    if (target->state == PROTO_STATE_DISCONNECTED)
+      continue;
+
+    /* robots get the complete message */
+    if (target->state == PROTO_STATE_VIRTUAL) {
+      buffer_t *b = bf_alloc (8 + NICKLENGTH + bf_used (buf));
+
+      bf_printf (b, "$To: %s ", target->nick);
+      bf_strncat (b, buf->s, bf_used (buf));
+      plugin_send_event (target->plugin_priv, PLUGIN_EVENT_PM_IN, b);
+      bf_free (b);
+      continue;
+    }
+
+    cache_queue (((nmdc_user_t *) target->pdata)->privatemessages, NULL, buf);
+    ((nmdc_user_t *) target->pdata)->privatemessages.length += NMDC_PM_HEADER (target);
+    cache_count (privatemessages, target);
+
+    target->MessageCnt++;
+    target->CacheException++;
+  }
+
+  nmdc_stats.pmmulticast++;
+  nmdc_stats.pmmulticasttargets += count;
+
+  bf_free (buf);
+
+  return 0;
+}
+
 int proto_nmdc_user_raw (user_t * target, buffer_t * message)
 {
   buffer_t *buf;
@@ -675,37 +763,74 @@ user_t *proto_nmdc_user_alloc (void *priv)
     return NULL;
   }
 
-  /* yes, create and init user */
-  user = malloc (sizeof (user_t) + sizeof (nmdc_user_t));
+  /* yes, create a handshake. it becomes a full user at $ValidateNick */
+  user = pool_alloc (&handshakepool);
   if (!user)
     return NULL;
-  memset (user, 0, sizeof (user_t) + sizeof (nmdc_user_t));
+  memset (user, 0, PROTO_HANDSHAKE_SIZE + sizeof (nmdc_handshake_t));
 
   /* protocol private data */
-  user->pdata = ((void *) user) + sizeof (user_t);
-
-  user->tthlist = tth_list_alloc (researchmaxcount);
+  user->pdata = ((void *) user) + PROTO_HANDSHAKE_SIZE;
 
   user->state = PROTO_STATE_INIT;
+  user->flags = NMDC_FLAG_HANDSHAKE;
   user->parent = priv;
 
-  init_bucket (&user->rate_warnings, now.tv_sec);
-  init_bucket (&user->rate_violations, now.tv_sec);
-  init_bucket (&user->rate_chat, now.tv_sec);
-  init_bucket (&user->rate_search, now.tv_sec);
-  init_bucket (&user->rate_myinfo, now.tv_sec);
-  init_bucket (&user->rate_myinfoop, now.tv_sec);
-  init_bucket (&user->rate_getnicklist, now.tv_sec);
-  init_bucket (&user->rate_getinfo, now.tv_sec);
-  init_bucket (&user->rate_downloads, now.tv_sec);
-
-  /* warnings and violationss start with a full token load ! */
-  user->rate_warnings.tokens = rates.warnings.burst;
-  user->rate_violations.tokens = rates.violations.burst;
-
   /* init timer */
   etimer_init (&user->timer, (etimer_handler_t *) proto_nmdc_handle_timeout, user);
 
+  ((nmdc_handshake_t *) user->pdata)->captureid = capture_connect ();
+
+  nmdc_stats.handshakes++;
+  nmdc_stats.userjoin++;
+
+  return user;
+}
+
+/* replace a handshake by a full user. the handshake stays valid until the freelist is cleared */
+user_t *proto_nmdc_user_promote (user_t * hs)
+{
+  user_t *user;
+
+  ASSERT (hs->flags & NMDC_FLAG_HANDSHAKE);
+
+  user = pool_alloc (&userpool);
+  if (!user)
+    return NULL;
+  memset (user, 0, sizeof (user_t) + sizeof (nmdc_user_t));
+
+  user->tthlist = tth_list_alloc (researchmaxcount);
+  if (!user->tthlist) {
+    pool_free (&userpool, user);
+    return NULL;
+  }
+
+  etimer_cancel (&hs->timer);
+  memcpy (user, hs, PROTO_HANDSHAKE_SIZE);
+
+  /* protocol private data */
+  user->pdata = ((void *) user) + sizeof (user_t);
+  ((nmdc_user_t *) user->pdata)->captureid = ((nmdc_handshake_t *) hs->pdata)->captureid;
+  user->flags &= ~NMDC_FLAG_HANDSHAKE;
+
+  rate_init (&user->rate.chat, now.tv_sec, 0);
+  rate_init (&user->rate.search, now.tv_sec, 0);
+  rate_init (&user->rate.myinfo, now.tv_sec, 0);
+  rate_init (&user->rate.myinfoop, now.tv_sec, 0);
+  rate_init (&user->rate.getnicklist, now.tv_sec, 0);
+  rate_init (&user->rate.getinfo, now.tv_sec, 0);
+  rate_init (&user->rate.downloads, now.tv_sec, 0);
+
+  /* warnings, violations and results start with a full token load ! */
+  rate_init (&user->rate.warnings, now.tv_sec, rates.warnings.burst);
+  rate_init (&user->rate.violations, now.tv_sec, rates.violations.burst);
+  rate_init (&user->rate.psresults_in, now.tv_sec, rates.psresults_in.burst);
+  rate_init (&user->rate.psresults_out, now.tv_sec, rates.psresults_out.burst);
+
+  /* restart the timer, it was copied cancelled from the handshake */
+  user->timer.context = user;
+  etimer_set (&user->timer, PROTO_TIMEOUT_WAITNICK);
+
   /* add user to the list... */
   user->next = userlist;
   if (user->next)
@@ -714,7 +839,13 @@ user_t *proto_nmdc_user_alloc (void *priv)
 
   userlist = user;
 
-  nmdc_stats.userjoin++;
+  server_setuser (hs->parent, user);
+
+  ((nmdc_handshake_t *) hs->pdata)->promoted = user;
+  hs->parent = NULL;
+  proto_nmdc_user_freelist_add (hs);
+
+  nmdc_stats.handshakes--;
 
   return user;
 }
@@ -723,6 +854,17 @@ int proto_nmdc_user_free (user_t * user)
 {
   ASSERT (!user->timer.tovalid);
 
+  capture_disconnect (((nmdc_user_t *) user->pdata)->captureid);
+
+  /* a handshake is in no list */
+  if (user->flags & NMDC_FLAG_HANDSHAKE) {
+    user->parent = NULL;
+    proto_nmdc_user_freelist_add (user);
+    nmdc_stats.handshakes--;
+    nmdc_stats.userpart++;
+    return 0;
+  }
+
   /* remove from the current user list */
   if (user->next)
     user->next->prev = user->prev;
@@ -847,7 +989,7 @@ int proto_nmdc_user_forcemove (user_t * u, unsigned char *destination, buffer_t
   DPRINTF ("Redirecting user %s to %s because %.*s\n", u->nick, destination,
 	   (int) bf_used (message), message->s);
 
-  if (u->MessageCnt)
+  if (!(u->flags & NMDC_FLAG_HANDSHAKE) && u->MessageCnt)
     proto_nmdc_user_flush (u);
 
   b = bf_alloc (265 + NICKLENGTH + strlen (destination) + bf_used (message));
@@ -881,7 +1023,7 @@ int proto_nmdc_user_drop (user_t * u, buffer_t * message)
   if (u->state == PROTO_STATE_DISCONNECTED)
     return 0;
 
-  if (u->MessageCnt)
+  if (!(u->flags & NMDC_FLAG_HANDSHAKE) && u->MessageCnt)
     proto_nmdc_user_flush (u);
 
   if (message) {
@@ -914,7 +1056,7 @@ int proto_nmdc_user_redirect (user_t * u, buffer_t * message)
     return 0;
   }
 
-  if (u->MessageCnt)
+  if (!(u->flags & NMDC_FLAG_HANDSHAKE) && u->MessageCnt)
     proto_nmdc_user_flush (u);
 
   b = bf_alloc (265 + NICKLENGTH + strlen (config.Redirect) + bf_used (message));
@@ -947,7 +1089,7 @@ int proto_nmdc_violation (user_t * u, struct timeval *now, char *reason)
   struct in_addr addr;
 
   /* if there are still tokens left, just return */
-  if (get_token (&rates.violations, &u->rate_violations, now->tv_sec))
+  if (rate_get_token (&rates.violations, &u->rate.violations, now->tv_sec))
     return 0;
 
   /* never do this for owners! */
@@ -998,7 +1140,7 @@ int proto_nmdc_user_warn (user_t * u, struct timeval *now, unsigned char *messag
   buffer_t *buf;
   va_list ap;
 
-  if (!get_token (&rates.warnings, &u->rate_warnings, now->tv_sec)) {
+  if (!rate_get_token (&rates.warnings, &u->rate.warnings, now->tv_sec)) {
     return 0;
   }
 
@@ -1052,6 +1194,7 @@ int proto_nmdc_warn (struct timeval *now, unsigned char *message, ...)
 int proto_nmdc_handle_input (user_t * user, buffer_t ** buffers)
 {
   buffer_t *b;
+  int retval;
 
   if (!buffers) {
     etimer_set (&user->timer, PROTO_TIMEOUT_ONLINE);
@@ -1070,9 +1213,17 @@ int proto_nmdc_handle_input (user_t * user, buffer_t ** buffers)
     if (!b)
       break;
 
+    capture_token (((nmdc_user_t *) user->pdata)->captureid, b);
+
     /* process it and free memory */
     errno = 0;			/* make sure this is reset otherwise errno check will cause crashes */
-    if (proto_nmdc_handle_token (user, b) < 0) {
+    retval = proto_nmdc_handle_token (user, b);
+
+    /* the handshake was replaced by a full user */
+    if ((user->flags & NMDC_FLAG_HANDSHAKE) && ((nmdc_handshake_t *) user->pdata)->promoted)
+      user = ((nmdc_handshake_t *) user->pdata)->promoted;
+
+    if (retval < 0) {
       /* This should never happen! On an EPIPE, server_write should do this.
          if (errno == EPIPE)
          server_disconnect_user (user->parent, "EPIPE");
@@ -1158,6 +1309,7 @@ int proto_nmdc_init ()
   unsigned int i, l;
   unsigned char *s, *d;
   unsigned char lock[16 + sizeof (LOCK) + 2 + LOCKLENGTH + 2 + 1];
+  unsigned char name[CONFIG_NAMELENGTH];
   struct timeval now;
 
   /* prepare lock calculation shortcut */
@@ -1188,6 +1340,9 @@ int proto_nmdc_init ()
 
   keylen = l;
 
+  pool_setup (&handshakepool, "nmdc handshake", PROTO_HANDSHAKE_SIZE + sizeof (nmdc_handshake_t), 64);
+  pool_setup (&userpool, "nmdc user", sizeof (user_t) + sizeof (nmdc_user_t), 64);
+
   /* rate limiting stuff */
   memset ((void *) &rates, 0, sizeof (ratelimiting_t));
   init_bucket_type (&rates.chat, 2, 3, 1);
@@ -1317,6 +1472,11 @@ int proto_nmdc_init ()
   init_bucket_type (&cache.results.timertype, 1, 1, 1);
   init_bucket_type (&cache.privatemessages.timertype, 1, 1, 1);
 
+  /* the governor scales these, start relaxed */
+  nmdc_governor.asearch = rates.asearch;
+  nmdc_governor.psearch = rates.psearch;
+  nmdc_governor.update = cache.myinfoupdate.timertype;
+
   gettimeofday (&now, NULL);
 
   init_bucket (&cache.chat.timer, now.tv_sec);
@@ -1374,6 +1534,12 @@ int proto_nmdc_init ()
   researchmaxcount = DEFAULT_RESEARCH_MAXCOUNT;
   defaultbanmessage = strdup ("");
   nickchars = strdup (DEFAULT_NICKCHARS);
+  governor_enable = DEFAULT_GOVERNOR_ENABLE;
+  governor_memory = DEFAULT_GOVERNOR_MEMORY;
+  governor_buffering = DEFAULT_GOVERNOR_BUFFERING;
+  governor_flushtime = DEFAULT_GOVERNOR_FLUSHTIME;
+  governor_relax = DEFAULT_GOVERNOR_RELAX;
+  governor_nicklist = DEFAULT_GOVERNOR_NICKLIST;
 
   config_register ("hub.allowcloning", CFG_ELEM_UINT, &cloning,
 		   _("Allow multiple users from the same IP address."));
@@ -1391,6 +1557,19 @@ int proto_nmdc_init ()
   config_register ("nmdc.researchmaxcount", CFG_ELEM_UINT, &researchmaxcount,
 		   _("Maximum number of searches cached."));
 
+  config_register ("nmdc.governor", CFG_ELEM_UINT, &governor_enable,
+		   _("Tighten the search rates, delay MyINFO updates and defer nicklists when the hub is under pressure."));
+  config_register ("nmdc.governor.memory", CFG_ELEM_UINT, &governor_memory,
+		   _("Percentage of hub.BufferTotalLimit in use at which the governor raises its level. Every doubling adds a level."));
+  config_register ("nmdc.governor.buffering", CFG_ELEM_UINT, &governor_buffering,
+		   _("Percentage of buffering users at which the governor raises its level. Every doubling adds a level."));
+  config_register ("nmdc.governor.flushtime", CFG_ELEM_UINT, &governor_flushtime,
+		   _("Duration of the cache flush in milliseconds at which the governor raises its level. Every doubling adds a level."));
+  config_register ("nmdc.governor.relax", CFG_ELEM_UINT, &governor_relax,
+		   _("Number of calm cache flushes before the governor drops a level."));
+  config_register ("nmdc.governor.nicklist", CFG_ELEM_UINT, &governor_nicklist,
+		   _("Governor level at which $GetNickList requests are deferred. 0 never defers them."));
+
   config_register ("nmdc.defaultbanmessage", CFG_ELEM_STRING, &defaultbanmessage,
 		   _("This message is send to all banned users when they try to join."));
 
@@ -1411,6 +1590,22 @@ int proto_nmdc_init ()
 
   memset (&nmdc_stats, 0, sizeof (nmdc_stats_t));
 
+  memset (nmdc_tokenstats, 0, sizeof (nmdc_tokenstats));
+  for (i = 0; i < TOKEN_NUM; i++) {
+    snprintf (name, sizeof (name), "nmdc.token.%s.count", TokenNames[i]);
+    stats_register (name, VAL_ELEM_ULONG, &nmdc_tokenstats[i].count,
+		    _("Number of tokens of this type processed."));
+    snprintf (name, sizeof (name), "nmdc.token.%s.time", TokenNames[i]);
+    stats_register (name, VAL_ELEM_ULONGLONG, &nmdc_tokenstats[i].total,
+		    _("Total time spent processing tokens of this type, in nanoseconds."));
+    snprintf (name, sizeof (name), "nmdc.token.%s.max", TokenNames[i]);
+    stats_register (name, VAL_ELEM_ULONG, &nmdc_tokenstats[i].max,
+		    _("Longest time spent on a single token of this type, in nanoseconds."));
+    metrics_histogram_register (&nmdc_tokenstats[i].histogram, "nmdc.token_time", "token",
+				TokenNames[i], _("Token processing time in nanoseconds."),
+				nmdc_token_bounds, NMDC_TOKEN_BUCKETS);
+  }
+
   banlist_init (&reconnectbanlist);
 
   memset (nmdc_forbiddenchars, 1, sizeof (nmdc_forbiddenchars));
@@ -1421,6 +1616,22 @@ int proto_nmdc_init ()
 
   /* *INDENT-OFF* */
   stats_register ("nmdc.cacherebuild",		VAL_ELEM_ULONG, &nmdc_stats.cacherebuild,  "rebuild of nick list cache.");
+  stats_register ("nmdc.handshakes",		VAL_ELEM_ULONG, &nmdc_stats.handshakes,    "connections that did not send $ValidateNick yet.");
+  stats_register ("nmdc.pmmulticast",		VAL_ELEM_ULONG, &nmdc_stats.pmmulticast,   "private messages sent to many users at once.");
+  stats_register ("nmdc.pmmulticasttargets",	VAL_ELEM_ULONG, &nmdc_stats.pmmulticasttargets, "targets of the private messages sent to many users at once.");
+  stats_register ("nmdc.governor.level",	VAL_ELEM_UINT,  &nmdc_governor.level,      "current load governor level, 0 is relaxed.");
+  stats_register ("nmdc.governor.pressure",	VAL_ELEM_UINT,  &nmdc_governor.pressure,   "level asked for by the last cache flush.");
+  stats_register ("nmdc.governor.memory",	VAL_ELEM_UINT,  &nmdc_governor.memory,     "level asked for by the buffer memory.");
+  stats_register ("nmdc.governor.buffering",	VAL_ELEM_UINT,  &nmdc_governor.buffering,  "level asked for by the buffering users.");
+  stats_register ("nmdc.governor.flushtime",	VAL_ELEM_UINT,  &nmdc_governor.flushtime,  "level asked for by the cache flush duration.");
+  stats_register ("nmdc.governor.raised",	VAL_ELEM_ULONG, &nmdc_governor.raised,     "times the governor level was raised.");
+  stats_register ("nmdc.governor.relaxed",	VAL_ELEM_ULONG, &nmdc_governor.relaxed,    "times the governor level was dropped.");
+  stats_register ("nmdc.governor.activesearchperiod", VAL_ELEM_ULONG, &nmdc_governor.asearch.period, "effective period of active searches.");
+  stats_register ("nmdc.governor.passivesearchperiod", VAL_ELEM_ULONG, &nmdc_governor.psearch.period, "effective period of passive searches.");
+  stats_register ("nmdc.governor.updateperiod", VAL_ELEM_ULONG, &nmdc_governor.update.period, "effective period of the MyINFO update flush.");
+  stats_register ("nmdc.governor.searchshed",	VAL_ELEM_ULONG, &nmdc_governor.searchshed, "searches dropped by the tightened search rates.");
+  stats_register ("nmdc.governor.nicklistdeferred", VAL_ELEM_ULONG, &nmdc_governor.nicklistdeferred, "nicklist requests deferred.");
+  stats_register ("nmdc.governor.nicklistsent", VAL_ELEM_ULONG, &nmdc_governor.nicklistsent, "deferred nicklists sent.");
   stats_register ("nmdc.userjoin",		VAL_ELEM_ULONG, &nmdc_stats.userjoin, 	   "all user joins.");
   stats_register ("nmdc.userpart",		VAL_ELEM_ULONG, &nmdc_stats.userpart,      "all user parts.");
   stats_register ("nmdc.userviolate",		VAL_ELEM_ULONG, &nmdc_stats.userviolate,   "all user that are kicked for rate violations.");
@@ -1509,6 +1720,16 @@ int proto_nmdc_init ()
   
   stats_register ("nicklistcache_infolistupdate_bytes", VAL_ELEM_ULONG, &cache.infolistupdate_bytes, "current bytes send in infolist updates.");
 
+  metrics_histogram_register (&nmdc_metrics.flushtime, "nmdc.flush_time", NULL, NULL, "duration of the cache flush in microseconds", nmdc_metrics_time, NMDC_METRICS_BUCKETS (nmdc_metrics_time));
+  metrics_histogram_register (&nmdc_metrics.buffering, "nmdc.flush_buffering", NULL, NULL, "buffering users after a cache flush", nmdc_metrics_users, NMDC_METRICS_BUCKETS (nmdc_metrics_users));
+  metrics_histogram_register (&nmdc_metrics.myinfo,       "nmdc.flush_bytes", "class", "myinfo",       "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.myinfoupdate, "nmdc.flush_bytes", "class", "myinfoupdate", "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.chat,         "nmdc.flush_bytes", "class", "chat",         "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.asearch,      "nmdc.flush_bytes", "class", "asearch",      "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.psearch,      "nmdc.flush_bytes", "class", "psearch",      "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.messages,     "nmdc.flush_bytes", "class", "messages",     "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+  metrics_histogram_register (&nmdc_metrics.results,      "nmdc.flush_bytes", "class", "results",      "bytes per cache flush", nmdc_metrics_bytes, NMDC_METRICS_BUCKETS (nmdc_metrics_bytes));
+
   /* *INDENT-ON* */
 
   return 0;
@@ -53,20 +53,33 @@ extern unsigned int searchmaxlength;
 extern unsigned int srmaxlength;
 extern unsigned int researchmininterval, researchperiod, researchmaxcount;
 
+extern unsigned int governor_enable, governor_memory, governor_buffering, governor_flushtime;
+extern unsigned int governor_relax, governor_nicklist;
+
 extern unsigned char *defaultbanmessage;
 
+/*
+ * The bodies of multicast PMs are shared by all targets and get their
+ *  "$To: <nick> " when they are flushed. They are the only private message
+ *  queue entries without a user.
+ */
+#define NMDC_PM_SHARED(le)	(!(le)->user)
+#define NMDC_PM_HEADER(u)	(6 + strlen ((u)->nick))
+
 /* function prototypes */
 extern int proto_nmdc_setup ();
 extern int proto_nmdc_init ();
 extern int proto_nmdc_handle_token (user_t * u, buffer_t * b);
 extern int proto_nmdc_handle_input (user_t * user, buffer_t ** buffers);
 extern void proto_nmdc_flush_cache ();
+extern void proto_nmdc_governor_update (nmdc_flush_record_t * r);
 extern int proto_nmdc_user_disconnect (user_t * u, char *);
 extern int proto_nmdc_user_forcemove (user_t * u, unsigned char *destination, buffer_t * message);
 extern int proto_nmdc_user_redirect (user_t * u, buffer_t * message);
 extern int proto_nmdc_user_drop (user_t * u, buffer_t * message);
 extern user_t *proto_nmdc_user_find (unsigned char *nick);
 extern user_t *proto_nmdc_user_alloc (void *priv);
+extern user_t *proto_nmdc_user_promote (user_t * hs);
 extern int proto_nmdc_user_free (user_t * user);
 
 extern user_t *proto_nmdc_user_addrobot (unsigned char *nick, unsigned char *description);
@@ -81,7 +81,8 @@ int nicklistcache_adduser (user_t * u)
   cache.usercount++;
 
   if (!(u->supports & NMDC_SUPPORTS_NoGetINFO))
-    u->rate_getinfo.tokens += cache.usercount;
+    u->rate.getinfo.tokens = ((u->rate.getinfo.tokens + cache.usercount) > RATE_TOKENS_MAX) ?
+      RATE_TOKENS_MAX : (u->rate.getinfo.tokens + cache.usercount);
 
   if (u->op) {
     cache.length_estimate_op += l;
@@ -360,8 +361,8 @@ int nicklistcache_sendnicklist (user_t * target)
       b = bf_copy (cache.infolistupdate, 0);
 
     server_write_credit (target->parent, b);
-    bf_free (b);
     cache.infolistupdate_bytes += bf_used (b);
+    bf_free (b);
   } else {
     server_write_credit (target->parent, cache.hellolist);
     cache.hellolist_count++;
@@ -24,6 +24,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
+#include <time.h>
 
 #include "../config.h"
 #ifndef __USE_W32_SOCKETS
@@ -735,16 +737,7 @@ int proto_nmdc_state_hello (user_t * u, token_t * tkn, buffer_t * b)
     /* restore some values */
     if (existing_user) {
       /* restore rates */
-      u->rate_warnings = existing_user->rate_warnings;
-      u->rate_chat = existing_user->rate_chat;
-      u->rate_search = existing_user->rate_search;
-      u->rate_myinfo = existing_user->rate_myinfo;
-      u->rate_myinfoop = existing_user->rate_myinfoop;
-      u->rate_getnicklist = existing_user->rate_getnicklist;
-      u->rate_getinfo = existing_user->rate_getinfo;
-      u->rate_downloads = existing_user->rate_downloads;
-      u->rate_psresults_in = existing_user->rate_psresults_in;
-      u->rate_psresults_out = existing_user->rate_psresults_out;
+      u->rate = existing_user->rate;
 
       /* restore the tthlist if old user has one, otherwise keep new */
       if (u->tthlist && existing_user->tthlist)
@@ -813,7 +806,7 @@ int proto_nmdc_state_hello (user_t * u, token_t * tkn, buffer_t * b)
       u->flags &= ~NMDC_FLAG_DELAYEDNICKLIST;
       nicklistcache_sendnicklist (u);
     } else {
-      u->rate_getnicklist.tokens = 1;
+      u->rate.getnicklist.tokens = 1;
     }
 
     if (u->state != PROTO_STATE_ONLINE)
@@ -851,7 +844,8 @@ int proto_nmdc_state_online_chat (user_t * u, token_t * tkn, buffer_t * output,
     }
 
     /* check quota */
-    if ((!(u->rights & CAP_SPAM)) && (!get_token (&rates.chat, &u->rate_chat, now.tv_sec))) {
+    if ((!(u->rights & CAP_SPAM))
+	&& (!rate_get_token (&rates.chat, &u->rate.chat, now.tv_sec))) {
       proto_nmdc_user_warn (u, &now, __ ("Think before you talk and don't spam."));
       nmdc_stats.chatoverflow++;
       retval = proto_nmdc_violation (u, &now, "Chat");
@@ -1004,7 +998,7 @@ int proto_nmdc_state_online_myinfo (user_t * u, token_t * tkn, buffer_t * output
       break;
 
     /* ops get the full tag immediately */
-    if (get_token (&rates.myinfoop, &u->rate_myinfoop, now.tv_sec)) {
+    if (rate_get_token (&rates.myinfoop, &u->rate.myinfoop, now.tv_sec)) {
       cache_purge (cache.myinfoupdateop, u);
       cache_queue (cache.myinfoupdateop, u, b);
     } else {
@@ -1020,7 +1014,7 @@ int proto_nmdc_state_online_myinfo (user_t * u, token_t * tkn, buffer_t * output
     }
 
     /* check quota */
-    if (!get_token (&rates.myinfo, &u->rate_myinfo, now.tv_sec)) {
+    if (!rate_get_token (&rates.myinfo, &u->rate.myinfo, now.tv_sec)) {
       string_list_entry_t *entry;
 
       /* if no entry in the stringlist yet, exit */
@@ -1070,15 +1064,23 @@ int proto_nmdc_state_online_search (user_t * u, token_t * tkn, buffer_t * output
       break;
     }
 
-    /* check quota */
-    if (!get_token (u->active ? &rates.asearch : &rates.psearch, &u->rate_search, now.tv_sec)
+    /* check quota, the governor tightens the rates when the hub is under pressure */
+    if (!rate_get_token
+	(u->active ? &nmdc_governor.asearch : &nmdc_governor.psearch, &u->rate.search, now.tv_sec)
 	&& (!(u->rights & CAP_NOSRCHLIMIT))) {
       if (u->active) {
 	proto_nmdc_user_warn (u, &now, __ ("Active searches are limited to %u every %u seconds."),
-			      rates.asearch.refill, rates.asearch.period);
+			      nmdc_governor.asearch.refill, nmdc_governor.asearch.period);
       } else {
 	proto_nmdc_user_warn (u, &now, __ ("Passive searches are limited to %u every %u seconds."),
-			      rates.psearch.refill, rates.psearch.period);
+			      nmdc_governor.psearch.refill, nmdc_governor.psearch.period);
+      }
+      /* only the configured rates count as a violation */
+      if (nmdc_governor.level
+	  && rate_check_token (u->active ? &rates.asearch : &rates.psearch, &u->rate.search,
+			       now.tv_sec)) {
+	nmdc_governor.searchshed++;
+	break;
       }
       retval = proto_nmdc_violation (u, &now, "Search");
       nmdc_stats.searchoverflow++;
@@ -1158,7 +1160,7 @@ int proto_nmdc_state_online_search (user_t * u, token_t * tkn, buffer_t * output
 	    /* search dropped because researched too quickly */
 	    proto_nmdc_user_warn (u, &now, __ ("Do not repeat searches within %d seconds."),
 				  researchmininterval);
-	    u->rate_search.tokens++;
+	    u->rate.search.tokens++;
 	    nmdc_stats.researchdrop++;
 	    break;
 	  }
@@ -1210,7 +1212,7 @@ int proto_nmdc_state_online_sr (user_t * u, token_t * tkn, buffer_t * output, bu
 
   do {
     /* check quota */
-    if (!get_token (&rates.psresults_out, &u->rate_psresults_out, now.tv_sec)) {
+    if (!rate_get_token (&rates.psresults_out, &u->rate.psresults_out, now.tv_sec)) {
       nmdc_stats.sroverflow++;
       break;
     }
@@ -1267,7 +1269,7 @@ int proto_nmdc_state_online_sr (user_t * u, token_t * tkn, buffer_t * output, bu
       break;
 
     /* check quota */
-    if (!get_token (&rates.psresults_in, &t->rate_psresults_in, now.tv_sec)) {
+    if (!rate_get_token (&rates.psresults_in, &t->rate.psresults_in, now.tv_sec)) {
       nmdc_stats.sroverflow++;
       break;
     }
@@ -1303,7 +1305,7 @@ int proto_nmdc_state_online_getinfo (user_t * u, token_t * tkn, buffer_t * outpu
 
   do {
     /* check quota */
-    if (!get_token (&rates.getinfo, &u->rate_getinfo, now.tv_sec))
+    if (!rate_get_token (&rates.getinfo, &u->rate.getinfo, now.tv_sec))
       break;
 
     c = tkn->argument;
@@ -1343,7 +1345,7 @@ int proto_nmdc_state_online_ctm (user_t * u, token_t * tkn, buffer_t * output, b
     }
 
     /* check quota */
-    if (!get_token (&rates.downloads, &u->rate_downloads, now.tv_sec)) {
+    if (!rate_get_token (&rates.downloads, &u->rate.downloads, now.tv_sec)) {
       nmdc_stats.ctmoverflow++;
       break;
     }
@@ -1422,7 +1424,7 @@ int proto_nmdc_state_online_rctm (user_t * u, token_t * tkn, buffer_t * output,
     }
 
     /* check quota */
-    if (!get_token (&rates.downloads, &u->rate_downloads, now.tv_sec)) {
+    if (!rate_get_token (&rates.downloads, &u->rate.downloads, now.tv_sec)) {
       nmdc_stats.rctmoverflow++;
       break;
     }
@@ -1463,8 +1465,8 @@ int proto_nmdc_state_online_rctm (user_t * u, token_t * tkn, buffer_t * output,
 
     if (t->state == PROTO_STATE_ONLINE) {
       /* don't penitalize users for serving passive users: */
-      if (t->rate_downloads.tokens <= rates.downloads.burst)
-	t->rate_downloads.tokens++;
+      if (t->rate.downloads.tokens <= rates.downloads.burst)
+	t->rate.downloads.tokens++;
 
       /* queue search result with the correct user */
       cache_queue (((nmdc_user_t *) t->pdata)->privatemessages, u, b);
@@ -1496,7 +1498,8 @@ int proto_nmdc_state_online_to (user_t * u, token_t * tkn, buffer_t * output, bu
       break;
 
     /* check quota */
-    if ((!(u->rights & CAP_SPAM)) && (!get_token (&rates.chat, &u->rate_chat, now.tv_sec))) {
+    if ((!(u->rights & CAP_SPAM))
+	&& (!rate_get_token (&rates.chat, &u->rate.chat, now.tv_sec))) {
       proto_nmdc_user_warn (u, &now, __ ("Don't send private messages so fast."));
       nmdc_stats.pmoverflow++;
       retval = proto_nmdc_violation (u, &now, "PM");
@@ -1755,7 +1758,8 @@ int proto_nmdc_state_online_botinfo (user_t * u, token_t * tkn, buffer_t * outpu
   do {
     /* we reuse the warning rate here. Should not affect pingers (since they don't do much) and
      * prevents the need for yet another leaky bucket. */
-    if ((!(u->rights & CAP_SPAM)) && (!get_token (&rates.warnings, &u->rate_warnings, now.tv_sec))) {
+    if ((!(u->rights & CAP_SPAM))
+	&& (!rate_get_token (&rates.warnings, &u->rate.warnings, now.tv_sec))) {
       proto_nmdc_user_warn (u, &now, __ ("Think before you ask HubINFO and don't spam.\n"));
       retval = proto_nmdc_violation (u, &now, "HubINFO");
       break;
@@ -1821,13 +1825,21 @@ int proto_nmdc_state_online (user_t * u, token_t * tkn, buffer_t * b)
       break;
     case TOKEN_GETNICKLIST:
       /* check quota */
-      if (!get_token (&rates.getnicklist, &u->rate_getnicklist, now.tv_sec)) {
+      if (!rate_get_token (&rates.getnicklist, &u->rate.getnicklist, now.tv_sec)) {
 	proto_nmdc_user_warn (u, &now, __ ("Userlist request denied. Maximum 1 reload per %ds."),
 			      rates.getnicklist.period);
 	retval = proto_nmdc_violation (u, &now, "GetNickList");
 	break;
       }
 
+      /* under pressure, the governor sends it when the hub caught up */
+      if (governor_nicklist && (nmdc_governor.level >= governor_nicklist)) {
+	u->flags |= NMDC_FLAG_DELAYEDNICKLIST;
+	nmdc_governor.nicklistpending = 1;
+	nmdc_governor.nicklistdeferred++;
+	break;
+      }
+
       nicklistcache_sendnicklist (u);
       break;
     case TOKEN_GETINFO:
@@ -1869,9 +1881,62 @@ int proto_nmdc_state_online (user_t * u, token_t * tkn, buffer_t * b)
 **                             PROTOCOL HANDLING                              **
 **                                                                            **
 \******************************************************************************/
+/* monotonic clock in nanoseconds, only used for differences */
+__inline__ unsigned long long proto_nmdc_clock ()
+{
+#if defined(CLOCK_MONOTONIC) && !defined(USE_WINDOWS)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+void proto_nmdc_token_account (user_t * u, unsigned int type, unsigned long length,
+			       unsigned long long start)
+{
+  nmdc_token_stats_t *stats = &nmdc_tokenstats[type];
+  nmdc_token_sample_t *sample;
+  unsigned long long delta;
+  unsigned long nsec;
+  int i;
+
+  delta = proto_nmdc_clock () - start;
+  nsec = (delta > ULONG_MAX) ? ULONG_MAX : (unsigned long) delta;
+
+  nmdc_stats.tokens++;
+  stats->count++;
+  stats->total += nsec;
+  if (nsec > stats->max)
+    stats->max = nsec;
+  metrics_observe (&stats->histogram, nsec);
+
+  /* keep the slowest samples, this is the only expensive part and it is rare */
+  if (nsec <= stats->slowest[NMDC_TOKEN_SLOWEST - 1].nsec)
+    return;
+
+  for (i = NMDC_TOKEN_SLOWEST - 1; (i > 0) && (stats->slowest[i - 1].nsec < nsec); i--)
+    stats->slowest[i] = stats->slowest[i - 1];
+
+  sample = &stats->slowest[i];
+  sample->nsec = nsec;
+  sample->stamp = now.tv_sec;
+  sample->length = length;
+  strncpy (sample->nick, u->nick, NICKLENGTH);
+  sample->nick[NICKLENGTH - 1] = '\0';
+}
+
 int proto_nmdc_handle_token (user_t * u, buffer_t * b)
 {
   token_t tkn;
+  unsigned long long start;
+  unsigned long length;
+  int retval = 0;
 
   /* this functions is called without token to initialize the connection */
   if (!b) {
@@ -1881,33 +1946,58 @@ int proto_nmdc_handle_token (user_t * u, buffer_t * b)
     return proto_nmdc_state_init (u, NULL);
   }
 
+  start = proto_nmdc_clock ();
+  length = bf_used (b);
+
   /* parse token. if it is unknown just reset the timeout and leave */
   if (token_parse (&tkn, b->s) == TOKEN_UNIDENTIFIED) {
     if (u->state == PROTO_STATE_ONLINE)
       etimer_set (&u->timer, PROTO_TIMEOUT_ONLINE);
+    proto_nmdc_token_account (u, TOKEN_UNIDENTIFIED, length, start);
     return 0;
   }
 
+  /* a connection gets its full user when it sends a nick */
+  if ((u->flags & NMDC_FLAG_HANDSHAKE) && (u->state == PROTO_STATE_WAITNICK)
+      && (tkn.type == TOKEN_VALIDATENICK)) {
+    user_t *full = proto_nmdc_user_promote (u);
+
+    if (!full) {
+      server_disconnect_user (u->parent, _("Out of memory."));
+      return -1;
+    }
+    u = full;
+  }
+
   /* handle token depending on state */
   switch (u->state) {
     case PROTO_STATE_INIT:	/* initial creation state */
-      return proto_nmdc_state_init (u, &tkn);
+      retval = proto_nmdc_state_init (u, &tkn);
+      break;
     case PROTO_STATE_SENDLOCK:	/* waiting for user $Key */
-      return proto_nmdc_state_sendlock (u, &tkn);
+      retval = proto_nmdc_state_sendlock (u, &tkn);
+      break;
     case PROTO_STATE_WAITNICK:	/* waiting for user $ValidateNick */
-      return proto_nmdc_state_waitnick (u, &tkn);
+      retval = proto_nmdc_state_waitnick (u, &tkn);
+      break;
     case PROTO_STATE_WAITPASS:	/* waiting for user $Passwd */
-      return proto_nmdc_state_waitpass (u, &tkn);
+      retval = proto_nmdc_state_waitpass (u, &tkn);
+      break;
     case PROTO_STATE_HELLO:	/* waiting for user $MyInfo */
-      return proto_nmdc_state_hello (u, &tkn, b);
+      retval = proto_nmdc_state_hello (u, &tkn, b);
+      break;
     case PROTO_STATE_ONLINE:
-      return proto_nmdc_state_online (u, &tkn, b);
+      retval = proto_nmdc_state_online (u, &tkn, b);
+      break;
     case PROTO_STATE_DISCONNECTED:
       /* not supposed to happen !! */
       ASSERT (0);
   }
 
-  return 0;
+  /* the user is only freed when all input has been handled */
+  proto_nmdc_token_account (u, tkn.type, length, start);
+
+  return retval;
 }
 
 
@@ -2025,6 +2115,15 @@ unsigned int proto_nmdc_build_buffer (buffer_t * buffer, user_t * u, unsigned in
       b = le->data;
       l = bf_used (b);
 
+      /* a multicast body still needs its header */
+      if (NMDC_PM_SHARED (le)) {
+	memcpy (t, "$To: ", 5);
+	t += 5;
+	strcpy (t, u->nick);
+	t += strlen (u->nick);
+	*t++ = ' ';
+      }
+
       /* copy data */
       memcpy (t, b->s, l);
       t += l;
@@ -2042,15 +2141,16 @@ unsigned int proto_nmdc_build_buffer (buffer_t * buffer, user_t * u, unsigned in
   return bf_used (buffer);
 }
 
-inline int proto_nmdc_add_element (cache_element_t * elem, buffer_t * buf, buffer_t * buf2,
-				   unsigned long now)
+/* add the element if a token of type is available */
+inline int proto_nmdc_add_element_rate (cache_element_t * elem, leaky_bucket_type_t * type,
+					buffer_t * buf, buffer_t * buf2, unsigned long now)
 {
   register buffer_t *b;
   register unsigned char *t = NULL;
   register string_list_entry_t *le;
   register unsigned int l;
 
-  if (elem->messages.count && get_token (&elem->timertype, &elem->timer, now)) {
+  if (elem->messages.count && get_token (type, &elem->timer, now)) {
     t = buf->e;
     for (le = elem->messages.first; le; le = le->next) {
       /* data and length */
@@ -2078,6 +2178,109 @@ inline int proto_nmdc_add_element (cache_element_t * elem, buffer_t * buf, buffe
   return 0;
 }
 
+inline int proto_nmdc_add_element (cache_element_t * elem, buffer_t * buf, buffer_t * buf2,
+				   unsigned long now)
+{
+  return proto_nmdc_add_element_rate (elem, &elem->timertype, buf, buf2, now);
+}
+
+/* server_write that keeps the flush record up to date */
+__inline__ int proto_nmdc_flush_write (user_t * u, buffer_t * b)
+{
+  int buffering, retval;
+
+  buffering = server_isbuffering (u->parent);
+  nmdc_flushrecord.bytes += bf_used (b);
+
+  retval = server_write (u->parent, b);
+  if (retval < 0) {
+    nmdc_flushrecord.failures++;
+  } else if (!buffering && server_isbuffering (u->parent)) {
+    nmdc_flushrecord.buffering++;
+  }
+
+  return retval;
+}
+
+/* number of doublings of threshold that value reached */
+static unsigned int proto_nmdc_governor_level (unsigned long value, unsigned long threshold)
+{
+  unsigned int level = 0;
+
+  if (!threshold)
+    return 0;
+
+  while ((value >= threshold) && (level < NMDC_GOVERNOR_MAXLEVEL)) {
+    level++;
+    threshold <<= 1;
+  }
+
+  return level;
+}
+
+void proto_nmdc_governor_update (nmdc_flush_record_t * r)
+{
+  nmdc_governor_t *g = &nmdc_governor;
+  unsigned int pending = 0;
+  user_t *u;
+
+  if (governor_enable) {
+    g->memory =
+      proto_nmdc_governor_level (buf_mem, config.BufferTotalLimit / 100 * governor_memory);
+    g->buffering =
+      r->users ? proto_nmdc_governor_level (buffering * 100 / r->users, governor_buffering) : 0;
+    g->flushtime = proto_nmdc_governor_level (r->total, governor_flushtime * 1000);
+  } else {
+    g->memory = g->buffering = g->flushtime = 0;
+  }
+
+  g->pressure = g->memory;
+  if (g->buffering > g->pressure)
+    g->pressure = g->buffering;
+  if (g->flushtime > g->pressure)
+    g->pressure = g->flushtime;
+
+  /* rise at once, drop one level at a time */
+  if (g->pressure > g->level) {
+    g->level = g->pressure;
+    g->calm = 0;
+    g->raised++;
+  } else if ((g->pressure < g->level) && (++g->calm >= governor_relax)) {
+    g->level--;
+    g->calm = 0;
+    g->relaxed++;
+  } else if (g->pressure == g->level) {
+    g->calm = 0;
+  }
+
+  /* every level doubles the search period and the MyINFO update flush period */
+  g->asearch = rates.asearch;
+  g->asearch.period <<= g->level;
+  g->psearch = rates.psearch;
+  g->psearch.period <<= g->level;
+  g->update = cache.myinfoupdate.timertype;
+  g->update.period <<= g->level;
+
+  /* send the deferred nicklists to the users that are not buffering */
+  if (!g->nicklistpending || (governor_nicklist && (g->level >= governor_nicklist)))
+    return;
+
+  for (u = userlist; u; u = u->next) {
+    if (!(u->flags & NMDC_FLAG_DELAYEDNICKLIST) || (u->state != PROTO_STATE_ONLINE))
+      continue;
+
+    if (server_isbuffering (u->parent)) {
+      pending++;
+      continue;
+    }
+
+    u->flags &= ~NMDC_FLAG_DELAYEDNICKLIST;
+    nicklistcache_sendnicklist (u);
+    g->nicklistsent++;
+  }
+  g->nicklistpending = pending;
+}
+
 void proto_nmdc_flush_cache ()
 {
   buffer_t *b;
@@ -2095,6 +2298,9 @@ void proto_nmdc_flush_cache ()
 
   buffer_t *buf_aresearch, *buf_presearch;
 
+  struct timeval start, stamp;
+  nmdc_flush_record_t *r = &nmdc_flushrecord;
+
 #ifdef ZLINES
   buffer_t *buf_zlinepassive = NULL, *buf_zlineactive = NULL;
   buffer_t *buf_zpipepassive = NULL, *buf_zpipeactive = NULL;
@@ -2102,6 +2308,11 @@ void proto_nmdc_flush_cache ()
   buffer_t *buf_zpipepassive_op = NULL, *buf_zpipeactive_op = NULL;
 #endif
 
+  gettimeofday (&start, NULL);
+  stamp = start;
+  memset (r, 0, sizeof (nmdc_flush_record_t));
+  r->stamp = now.tv_sec;
+
   /*
    * generate necessary buffers 
    */
@@ -2143,7 +2354,9 @@ void proto_nmdc_flush_cache ()
 
   /* Exception buffer */
   mi = proto_nmdc_add_element (&cache.myinfo, buf_exception, buf_passive, now.tv_sec);
-  miu = proto_nmdc_add_element (&cache.myinfoupdate, buf_exception, buf_passive, now.tv_sec);
+  miu =
+    proto_nmdc_add_element_rate (&cache.myinfoupdate, &nmdc_governor.update, buf_exception,
+				 buf_passive, now.tv_sec);
   miuo =
     proto_nmdc_add_element (&cache.myinfoupdateop, buf_exception_op, buf_passive_op, now.tv_sec);
 
@@ -2195,6 +2408,8 @@ void proto_nmdc_flush_cache ()
   BF_VERIFY (buf_aresearch);
   BF_VERIFY (buf_presearch);
 
+  r->build = plugin_latency_since (&stamp);
+
 #ifdef ZLINES
   if ((cache.ZlineSupporters > 0) || (cache.ZpipeSupporters > 0)) {
     zline (buf_passive, cache.ZpipeSupporters ? &buf_zpipepassive : NULL,
@@ -2215,23 +2430,45 @@ void proto_nmdc_flush_cache ()
   BF_VERIFY (buf_zlineactive_op);
   BF_VERIFY (buf_zpipepassive_op);
   BF_VERIFY (buf_zlinepassive_op);
+
+  r->zline = plugin_latency_since (&stamp);
 #endif
 
-  if (mi)
-    nmdc_stats.cache_myinfo += cache.myinfo.length + cache.myinfo.messages.count;
-  if (miu)
-    nmdc_stats.cache_myinfoupdate += cache.myinfoupdate.length + cache.myinfoupdate.messages.count;
-  if (ch)
-    nmdc_stats.cache_chat += cache.chat.length + cache.chat.messages.count;
-  if (as)
-    nmdc_stats.cache_asearch += cache.asearch.length + cache.asearch.messages.count;
-  if (ps)
-    nmdc_stats.cache_psearch += cache.psearch.length + cache.psearch.messages.count;
-  if (pm)
-    nmdc_stats.cache_messages +=
-      cache.privatemessages.length + cache.privatemessages.messages.count;
-  if (res)
-    nmdc_stats.cache_results += cache.results.length + cache.results.messages.count;
+  if (mi) {
+    t = cache.myinfo.length + cache.myinfo.messages.count;
+    nmdc_stats.cache_myinfo += t;
+    metrics_observe (&nmdc_metrics.myinfo, t);
+  }
+  if (miu) {
+    t = cache.myinfoupdate.length + cache.myinfoupdate.messages.count;
+    nmdc_stats.cache_myinfoupdate += t;
+    metrics_observe (&nmdc_metrics.myinfoupdate, t);
+  }
+  if (ch) {
+    t = cache.chat.length + cache.chat.messages.count;
+    nmdc_stats.cache_chat += t;
+    metrics_observe (&nmdc_metrics.chat, t);
+  }
+  if (as) {
+    t = cache.asearch.length + cache.asearch.messages.count;
+    nmdc_stats.cache_asearch += t;
+    metrics_observe (&nmdc_metrics.asearch, t);
+  }
+  if (ps) {
+    t = cache.psearch.length + cache.psearch.messages.count;
+    nmdc_stats.cache_psearch += t;
+    metrics_observe (&nmdc_metrics.psearch, t);
+  }
+  if (pm) {
+    t = cache.privatemessages.length + cache.privatemessages.messages.count;
+    nmdc_stats.cache_messages += t;
+    metrics_observe (&nmdc_metrics.messages, t);
+  }
+  if (res) {
+    t = cache.results.length + cache.results.messages.count;
+    nmdc_stats.cache_results += t;
+    metrics_observe (&nmdc_metrics.results, t);
+  }
 
   DPRINTF
     ("//////// %10lu //////// Cache Flush \\\\\\\\\\\\\\\\\\\\\\ %7lu \\\\\\\\\\\\\\\\\\\\\\\n"
@@ -2247,6 +2484,9 @@ void proto_nmdc_flush_cache ()
    * write out buffers 
    */
 
+  /* with I/O threads, the writes are only queued and sent at the end in parallel */
+  server_writebatch_begin ();
+
   if (userlist) {
     for (u = userlist; u; u = n) {
       n = u->next;
@@ -2263,6 +2503,8 @@ void proto_nmdc_flush_cache ()
 
       ASSERT ((u->ChatCnt + u->SearchCnt + u->ResultCnt + u->MessageCnt) == u->CacheException);
 
+      r->users++;
+
       /* get buffer -- only create exception buffer if really, really necessary */
       if (u->CacheException
 	  && ((u->SearchCnt && (u->active ? as : ps)) || (u->ChatCnt && ch) || (u->ResultCnt && res)
@@ -2286,8 +2528,11 @@ void proto_nmdc_flush_cache ()
 		 ((nmdc_user_t *) u->pdata)->privatemessages.messages.count,
 		 bf_used (buf_exception), bf_used (b), buf_exception->size);
 
+	r->exceptions++;
+	r->exceptionbytes += bf_used (b);
+
 	if (bf_used (b))
-	  if (server_write (u->parent, b) > 0)
+	  if (proto_nmdc_flush_write (u, b) > 0)
 	    etimer_set (&u->timer, PROTO_TIMEOUT_ONLINE);
 
 	bf_free (b);
@@ -2318,17 +2563,20 @@ void proto_nmdc_flush_cache ()
 	}
 #endif
 	if (bf_used (b))
-	  if (server_write (u->parent, b) > 0)
+	  if (proto_nmdc_flush_write (u, b) > 0)
 	    etimer_set (&u->timer, PROTO_TIMEOUT_ONLINE);
       }
       /* write out researches to recent clients */
       if (ars || (u->active && prs)) {
 	if (u->joinstamp > deadline) {
-	  server_write (u->parent, (u->active ? buf_aresearch : buf_presearch));
+	  proto_nmdc_flush_write (u, (u->active ? buf_aresearch : buf_presearch));
 	}
       }
     };
   }
+  server_writebatch_end (&r->buffering, &r->failures);
+  r->write = plugin_latency_since (&stamp);
+
 #ifdef ZLINES
   if (buf_zpipepassive && (buf_zpipepassive != buf_passive))
     bf_free (buf_zpipepassive);
@@ -2383,5 +2631,11 @@ void proto_nmdc_flush_cache ()
 
   proto_nmdc_user_cachelist_clear ();
 
+  r->total = plugin_latency_since (&start);
+  metrics_observe (&nmdc_metrics.flushtime, r->total);
+  metrics_observe (&nmdc_metrics.buffering, buffering);
+
+  proto_nmdc_governor_update (r);
+
   plugin_send_event (NULL, PLUGIN_EVENT_CACHEFLUSH, NULL);
 }
@@ -24,6 +24,8 @@
 #include "cap.h"
 #include "leakybucket.h"
 #include "nmdc_nicklistcache.h"
+#include "metrics.h"
+#include "nmdc_token.h"
 
 /*
  * Adress is local if: 10.0.0.0/8, 192.168.0.0/16, 169.254.0.0/16 172.16.0.0/16 or 127.0.0.1
@@ -50,6 +52,7 @@
 #define NMDC_FLAG_DELAYEDNICKLIST	0x00010000
 #define NMDC_FLAG_BOT			0x00020000
 #define NMDC_FLAG_CACHED		0x00040000
+#define NMDC_FLAG_HANDSHAKE		0x00080000	/* only PROTO_HANDSHAKE_SIZE of the user_t */
 #define NMDC_FLAG_WASKICKED		0x40000000
 #define NMDC_FLAG_WASONLINE		0x80000000
 
@@ -73,12 +76,20 @@ typedef struct ratelimiting {
 extern ratelimiting_t rates;
 
 typedef struct nmdc_user {
+  unsigned long captureid;	/* first, shared with nmdc_handshake_t */
   cache_element_t privatemessages;
   cache_element_t results;
 } nmdc_user_t;
 
+/* protocol data of a connection until its $ValidateNick */
+typedef struct nmdc_handshake {
+  unsigned long captureid;
+  user_t *promoted;		/* the full user that replaced it */
+} nmdc_handshake_t;
+
 typedef struct {
   unsigned long cacherebuild;	/* rebuild of nick list cache */
+  unsigned long handshakes;	/* connections that did not send $ValidateNick yet */
   unsigned long userjoin;	/* all user joins */
   unsigned long userpart;	/* all user parts */
   unsigned long userviolate;	/* all user that are kicked for rate violations */
@@ -129,6 +140,8 @@ typedef struct {
   unsigned long pmbadtarget;
   unsigned long pmbadsource;
   unsigned long pminevent;
+  unsigned long pmmulticast;	/* private messages sent to many users at once */
+  unsigned long pmmulticasttargets;
   unsigned long botinfo;
   unsigned long cache_quit;
   unsigned long cache_myinfo;
@@ -141,6 +154,72 @@ typedef struct {
 } nmdc_stats_t;
 extern nmdc_stats_t nmdc_stats;
 
+/* histograms of the cache flush, exported by the metrics listener */
+typedef struct nmdc_metrics {
+  metrics_histogram_t flushtime;	/* microseconds */
+  metrics_histogram_t buffering;	/* buffering users after the flush */
+  metrics_histogram_t myinfo, myinfoupdate, chat, asearch, psearch, messages, results;	/* bytes */
+} nmdc_metrics_t;
+extern nmdc_metrics_t nmdc_metrics;
+
+/* profile of the last cache flush, valid during PLUGIN_EVENT_CACHEFLUSH. times in microseconds */
+typedef struct nmdc_flush_record {
+  unsigned long stamp;
+  unsigned long build;		/* generating the buffers */
+  unsigned long zline;		/* compressing them */
+  unsigned long write;		/* the per-user write loop */
+  unsigned long total;
+  unsigned long users;		/* users written to */
+  unsigned long bytes;		/* bytes handed to server_write */
+  unsigned long exceptions;	/* users that needed an exception buffer */
+  unsigned long exceptionbytes;
+  unsigned long buffering;	/* users that started buffering */
+  unsigned long failures;	/* failed server_write calls */
+} nmdc_flush_record_t;
+extern nmdc_flush_record_t nmdc_flushrecord;
+
+/* load governor, evaluated after every cache flush. the level rises with the worst of
+ *  the pressure signals and drops one step after a number of calm flushes. */
+#define NMDC_GOVERNOR_MAXLEVEL	3
+
+typedef struct nmdc_governor {
+  unsigned int level;		/* current level, 0 is relaxed */
+  unsigned int pressure;	/* level asked for by the last flush */
+  unsigned int memory, buffering, flushtime;	/* level per signal */
+  unsigned int calm;		/* flushes below the current level */
+  unsigned long raised, relaxed;	/* level changes */
+
+  leaky_bucket_type_t asearch, psearch;	/* effective search rates */
+  leaky_bucket_type_t update;	/* effective rate of the MyINFO update flush */
+  unsigned long searchshed;	/* searches dropped by the tightened rates */
+
+  unsigned int nicklistpending;
+  unsigned long nicklistdeferred, nicklistsent;
+} nmdc_governor_t;
+extern nmdc_governor_t nmdc_governor;
+
+/* processing time per token type, in nanoseconds */
+#define NMDC_TOKEN_BUCKETS	16	/* 1us, 2us, 4us, ... 32ms */
+#define NMDC_TOKEN_SLOWEST	5
+
+typedef struct nmdc_token_sample {
+  unsigned long nsec;
+  unsigned long stamp;
+  unsigned long length;
+  unsigned char nick[NICKLENGTH];
+} nmdc_token_sample_t;
+
+typedef struct nmdc_token_stats {
+  unsigned long count;
+  unsigned long long total;
+  unsigned long max;
+  metrics_histogram_t histogram;
+  nmdc_token_sample_t slowest[NMDC_TOKEN_SLOWEST];	/* slowest first */
+} nmdc_token_stats_t;
+
+extern nmdc_token_stats_t nmdc_tokenstats[TOKEN_NUM];
+extern const unsigned long nmdc_token_bounds[NMDC_TOKEN_BUCKETS];
+
 /*
  *  This stuff includes and defines the protocol structure to be exported.
  */
@@ -53,6 +53,14 @@ struct token_definition Tokens[] = {
 	{ TOKEN_BOTINFO,		 8, "$BotINFO"},
 	{ TOKEN_NUM, 			 0, NULL}
 };
+
+/* indexed by token type */
+unsigned char *TokenNames[] = {
+	"unidentified", "chat", "myinfo", "mypass", "mynick", "multisearch", "multiconnecttome",
+	"search", "sr", "supports", "lock", "key", "kick", "hello", "getnicklist", "getinfo",
+	"connecttome", "revconnecttome", "to", "quit", "opforcemove", "validatenick", "botinfo",
+	NULL
+};
 /* *INDENT-ON* */
 
 /* local tables */
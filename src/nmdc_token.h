@@ -59,6 +59,7 @@ typedef struct token {
 } token_t;
 
 extern struct token_definition Tokens[];
+extern unsigned char *TokenNames[];
 
 void token_init ();
 int token_parse (struct token *token, unsigned char *string);
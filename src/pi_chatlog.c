@@ -114,7 +114,7 @@ int pi_chatlog_init ()
 
   string_list_init (&chatlog);
 
-  plugin_request (plugin_chatlog, PLUGIN_EVENT_CHAT, &pi_chatlog_handler_chat);
+  plugin_observe (plugin_chatlog, PLUGIN_EVENT_CHAT, &pi_chatlog_handler_chat);
 
   config_register ("chatlog.lines", CFG_ELEM_ULONG, &chatlogmax,
 		   _("Maximum number of chat history lines."));
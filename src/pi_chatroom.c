@@ -170,19 +170,20 @@ unsigned int chatroom_del (chatroom_t * room)
   return 0;
 }
 
-unsigned int chatroom_save (xml_node_t * node)
+unsigned int chatroom_save (xml_writer_t * w)
 {
   chatroom_t *room;
 
-  node = xml_node_add (node, "ChatRooms");
+  xml_writer_start (w, "ChatRooms");
   for (room = chatrooms.next; (room != &chatrooms); room = room->next) {
-    node = xml_node_add (node, "Room");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, room->name);
-    xml_node_add_value (node, "Flags", XML_TYPE_ULONG, &room->flags);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &room->rights);
-    xml_node_add_value (node, "Desc", XML_TYPE_STRING, room->description);
-    node = xml_parent (node);
+    xml_writer_start (w, "Room");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, room->name);
+    xml_writer_value (w, "Flags", XML_TYPE_ULONG, &room->flags);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &room->rights);
+    xml_writer_value (w, "Desc", XML_TYPE_STRING, room->description);
+    xml_writer_end (w);
   }
+  xml_writer_end (w);
 
   return 0;
 }
@@ -480,6 +481,8 @@ unsigned long pi_chatroom_event_pm (plugin_user_t * user, void *dummy, unsigned
   unsigned char *n;
   plugin_user_t *source;
   chatroom_member_t *m, *member;
+  plugin_user_t **targets;
+  unsigned int count;
   buffer_t *buf;
 
   /* only interested in PMs */
@@ -548,11 +551,19 @@ unsigned long pi_chatroom_event_pm (plugin_user_t * user, void *dummy, unsigned
     }
   }
 
-  /* send as pm to all users */
+  /* send as one pm to all users */
+  targets = malloc (room->count * sizeof (plugin_user_t *));
+  if (!targets)
+    goto leave;
+
+  count = 0;
   for (m = room->members.next; m != &(room->members); m = m->next)
-    if (m->user != source) {
-      plugin_user_priv (room->user, m->user, source, buf, 0);
-    }
+    if (m->user != source)
+      targets[count++] = m->user;
+
+  plugin_user_priv_multi (room->user, targets, count, source, buf);
+
+  free (targets);
 
 leave:
   /* free the buffer */
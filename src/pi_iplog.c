@@ -149,7 +149,7 @@ int pi_iplog_init ()
 
   config_register ("iplog.length", CFG_ELEM_UINT, &iplog_length, _("Number of IPs to remember."));
 
-  plugin_request (plugin_iplog, PLUGIN_EVENT_LOGOUT,
+  plugin_observe (plugin_iplog, PLUGIN_EVENT_LOGOUT,
 		  (plugin_event_handler_t *) & pi_iplog_event_logout);
 
   command_register ("iplog", &pi_iplog_handler_clientlist, CAP_KEY, _("List iplogs."));
@@ -40,8 +40,10 @@
 #include "utils.h"
 #include "commands.h"
 #include "user.h"
+#include "journal.h"
 #include "cap.h"
 #include "config.h"
+#include "stats.h"
 
 extern account_t *accounts;
 
@@ -93,6 +95,21 @@ typedef struct lua_robot_context {
  * script contexts
  */
 
+#define PI_LUA_PROFILE_SIZE		64
+#define PI_LUA_PROFILE_NAMELENGTH	96
+
+typedef struct pi_lua_profile_entry {
+  unsigned char name[PI_LUA_PROFILE_NAMELENGTH];
+  unsigned long samples;
+} pi_lua_profile_entry_t;
+
+typedef struct pi_lua_profile {
+  unsigned long samples;
+  unsigned long dropped;	/* samples of functions that did not fit in the table */
+  unsigned int count;
+  pi_lua_profile_entry_t entry[PI_LUA_PROFILE_SIZE];
+} pi_lua_profile_t;
+
 unsigned int lua_ctx_cnt, lua_ctx_peak;
 typedef struct lua_context {
   struct lua_context *next, *prev;
@@ -100,8 +117,21 @@ typedef struct lua_context {
   lua_State *l;
   unsigned char *name;
   unsigned long long eventmap;
+  int eventrefs[PLUGIN_EVENT_NUMBER];	/* registry references to the event handlers */
+  unsigned int usertable;	/* pass a user table instead of the nick to event handlers */
 
   lua_robot_context_t robots;
+
+  plugin_latency_t latency;	/* time spent in the event handlers of this script */
+
+  /* execution budget */
+  unsigned int disabled;
+  unsigned int overrun;
+  unsigned long overruns;
+  unsigned long instructions;	/* executed by the current call */
+  struct timeval start;		/* start of the current call */
+
+  pi_lua_profile_t *profile;	/* sampling profiler, NULL if not profiling */
 } lua_context_t;
 
 lua_context_t lua_list;
@@ -116,10 +146,164 @@ unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
 				    unsigned long event, buffer_t * token);
 
 
+/******************************************************************************************
+ *  Execution budget and profiler
+ */
+
+#define PI_LUA_HOOK_COUNT	1000	/* instructions between hook calls */
+
+unsigned long pi_lua_budget_instructions;
+unsigned long pi_lua_budget_time;
+unsigned long pi_lua_budget_strikes;
+unsigned long pi_lua_overruns;
+
+/* script that is currently executing */
+lua_context_t *pi_lua_running = NULL;
+
+/* the address is the registry key of a script's context */
+static int pi_lua_contextkey;
+
+/* coroutines run on threads of their own, but they share the registry of their script.
+ *  only use this on a state that is executing, a closed state cannot be asked. */
+lua_context_t *pi_lua_state_context (lua_State * l)
+{
+  lua_context_t *ctx;
+
+  lua_pushlightuserdata (l, &pi_lua_contextkey);
+  lua_rawget (l, LUA_REGISTRYINDEX);
+  ctx = lua_touserdata (l, -1);
+  lua_pop (l, 1);
+
+  return ctx;
+}
+
+lua_context_t *pi_lua_find_context (lua_State * l)
+{
+  lua_context_t *ctx;
+
+  for (ctx = lua_list.next; ctx != &lua_list; ctx = ctx->next)
+    if (ctx->l == l)
+      return ctx;
+
+  return NULL;
+}
+
+void pi_lua_profile_sample (lua_context_t * ctx, lua_State * l, lua_Debug * ar)
+{
+  unsigned int i;
+  unsigned char name[PI_LUA_PROFILE_NAMELENGTH];
+  pi_lua_profile_t *p = ctx->profile;
+
+  p->samples++;
+
+  if (!lua_getinfo (l, "Sn", ar))
+    return;
+
+  snprintf (name, sizeof (name), "%s:%d %s", ar->short_src, ar->linedefined,
+	    ar->name ? ar->name : "?");
+
+  for (i = 0; i < p->count; i++)
+    if (!strcmp (p->entry[i].name, name))
+      break;
+
+  if (i == p->count) {
+    if (p->count == PI_LUA_PROFILE_SIZE) {
+      p->dropped++;
+      return;
+    }
+    strcpy (p->entry[i].name, name);
+    p->entry[i].samples = 0;
+    p->count++;
+  }
+
+  p->entry[i].samples++;
+}
+
+/* called every PI_LUA_HOOK_COUNT instructions */
+void pi_lua_hook (lua_State * l, lua_Debug * ar)
+{
+  lua_context_t *ctx = pi_lua_running;
+  struct timeval t, diff;
+
+  if (!ctx || (pi_lua_state_context (l) != ctx))
+    return;
+
+  if (ctx->profile)
+    pi_lua_profile_sample (ctx, l, ar);
+
+  ctx->instructions += PI_LUA_HOOK_COUNT;
+  if (pi_lua_budget_instructions && (ctx->instructions > pi_lua_budget_instructions))
+    goto overrun;
+
+  if (pi_lua_budget_time) {
+    gettimeofday (&t, NULL);
+    timersub (&t, &ctx->start, &diff);
+    if ((diff.tv_sec * 1000 + diff.tv_usec / 1000) > pi_lua_budget_time)
+      goto overrun;
+  }
+
+  return;
+
+overrun:
+  /* keeps erroring until the call returns, even if the script catches it */
+  ctx->overrun = 1;
+  lua_pushstring (l, "execution budget exceeded");
+  lua_error (l);
+}
+
+/* lua_pcall with the execution budget applied */
+int pi_lua_pcall (lua_context_t * ctx, int nargs, int nresults)
+{
+  int result;
+  lua_context_t *running = pi_lua_running;
+  unsigned long instructions;
+  struct timeval start;
+
+  if (ctx->disabled) {
+    lua_pop (ctx->l, nargs + 1);
+    lua_pushstring (ctx->l, "script disabled: execution budget exceeded too often");
+    return LUA_ERRRUN;
+  }
+
+  /* we might interrupt a call to the same script */
+  instructions = ctx->instructions;
+  start = ctx->start;
+
+  pi_lua_running = ctx;
+  ctx->instructions = 0;
+  ctx->overrun = 0;
+  gettimeofday (&ctx->start, NULL);
+
+  result = lua_pcall (ctx->l, nargs, nresults, 0);
+
+  pi_lua_running = running;
+  ctx->instructions = instructions;
+  ctx->start = start;
+
+  if (ctx->overrun) {
+    ctx->overrun = 0;
+    ctx->overruns++;
+    pi_lua_overruns++;
+
+    if (pi_lua_budget_strikes && (ctx->overruns >= pi_lua_budget_strikes)) {
+      buffer_t *buf = bf_alloc (128 + strlen (ctx->name));
+
+      ctx->disabled = 1;
+      bf_printf (buf, _("LUA: script '%s' exceeded its execution budget %lu times and is disabled. Reload it to enable it again.\n"),
+		 ctx->name, ctx->overruns);
+      plugin_report (buf);
+      bf_free (buf);
+    }
+  }
+
+  return result;
+}
+
 #define PLUGIN_USER_FIND(arg) 	( (pi_lua_eventuser && !strcmp(arg, pi_lua_eventuser->nick)) ? pi_lua_eventuser : plugin_user_find (arg) )
 
 #define PUSH_TABLE_ENTRY(ctx, name, entry)  { lua_pushstring (ctx, name); lua_pushstring (ctx, entry); lua_settable(ctx, -3); }
 #define PUSH_TABLE_ENTRY_NUMBER(ctx, name, entry)  { lua_pushstring (ctx, name); lua_pushnumber (ctx, entry); lua_settable(ctx, -3); }
+#define PUSH_TABLE_ENTRY_BOOLEAN(ctx, name, entry)  { lua_pushstring (ctx, name); lua_pushboolean (ctx, entry); lua_settable(ctx, -3); }
 
 
 /******************************* LUA INTERFACE *******************************************/
@@ -1460,6 +1644,7 @@ int pi_lua_account_setrights (lua_State * lua)
 
   acc->rights |= caps;
   acc->rights &= ~ncaps;
+  journal_account (acc);
 
   retval = 1;
 leave:
@@ -1522,6 +1707,7 @@ int pi_lua_group_setrights (lua_State * lua)
 
   grp->rights |= caps;
   grp->rights &= ~ncaps;
+  journal_group (grp);
 
   retval = 1;
 leave:
@@ -1621,6 +1807,9 @@ unsigned long pi_lua_robot_event_handler (plugin_user_t * user, void *dummy,
   ASSERT (ctx != &lua_list);
   ASSERT (robot != &ctx->robots);
 
+  if (ctx->disabled)
+    return result;
+
   /* clear stack */
   lua_settop (ctx->l, 0);
 
@@ -1645,7 +1834,7 @@ unsigned long pi_lua_robot_event_handler (plugin_user_t * user, void *dummy,
   lua_pushstring (ctx->l, pi_lua_eventnames[event]);
 
   /* call funtion. */
-  result = lua_pcall (ctx->l, 3, 1, 0);
+  result = pi_lua_pcall (ctx, 3, 1);
   if (result) {
     unsigned char *error = (unsigned char *) luaL_checkstring (ctx->l, 1);
     buffer_t *buf;
@@ -1790,11 +1979,21 @@ pi_lua_timer_context_t timerlist;
 unsigned long pi_lua_handle_timeout (pi_lua_timer_context_t * ctx)
 {
   lua_State *lua = ctx->lua;
+  lua_context_t *script;
   int retval = 0, result;
 
+  /* the script is gone, so is its state */
+  script = pi_lua_find_context (lua);
+  if (!script) {
+    ctx->prev->next = ctx->next;
+    ctx->next->prev = ctx->prev;
+    free (ctx);
+    return 0;
+  }
+
   lua_rawgeti (lua, LUA_REGISTRYINDEX, ctx->funcref);
   lua_rawgeti (lua, LUA_REGISTRYINDEX, ctx->dataref);
-  result = lua_pcall (lua, 1, 1, 0);
+  result = pi_lua_pcall (script, 1, 1);
   if (result) {
     unsigned char *error = (unsigned char *) luaL_checkstring (ctx->lua, 1);
     buffer_t *buf;
@@ -1926,6 +2125,7 @@ unsigned long handler_luacommand (plugin_user_t * user, buffer_t * output, void
 {
   unsigned int i, result;
   pi_lua_command_context_t *ctx;
+  lua_context_t *script;
 
   /* find command */
   for (ctx = pi_lua_command_list.next; ctx != &pi_lua_command_list; ctx = ctx->next)
@@ -1935,6 +2135,10 @@ unsigned long handler_luacommand (plugin_user_t * user, buffer_t * output, void
   /* registered command that was deleted? */
   ASSERT (ctx->name);
 
+  script = pi_lua_find_context (ctx->lua);
+  if (!script)
+    return 0;
+
   lua_settop (ctx->lua, 0);
 
   /* specify function to call */
@@ -1960,7 +2164,7 @@ unsigned long handler_luacommand (plugin_user_t * user, buffer_t * output, void
   }
 
   /* call funtion. */
-  result = lua_pcall (ctx->lua, 2, 1, 0);
+  result = pi_lua_pcall (script, 2, 1);
   if (result) {
     unsigned char *error = (unsigned char *) luaL_checkstring (ctx->lua, 1);
     buffer_t *buf;
@@ -2258,9 +2462,105 @@ static void openlualibs (lua_State * l)
  *  LUA script handling utilities
  */
 
+void pi_lua_latency_register (lua_context_t * ctx)
+{
+  unsigned char prefix[PLUGIN_LATENCY_PREFIX];
+
+  snprintf (prefix, sizeof (prefix), "lua.%s", ctx->name);
+  plugin_latency_register (prefix, &ctx->latency);
+}
+
+void pi_lua_latency_unregister (lua_context_t * ctx)
+{
+  unsigned char prefix[PLUGIN_LATENCY_PREFIX];
+
+  snprintf (prefix, sizeof (prefix), "lua.%s", ctx->name);
+  plugin_latency_unregister (prefix);
+}
+
+/******************************************************************************************
+ *  Event handler globals
+ *
+ *  The Event* handlers are kept in the registry instead of the globals table. The globals
+ *  table gets a metatable so that reading an Event* global returns the handler and assigning
+ *  one, at any time, updates the reference used for dispatch.
+ */
+
+int pi_lua_eventindex (lua_State * l, int idx)
+{
+  const char *key;
+  int i;
+
+  if (lua_type (l, idx) != LUA_TSTRING)
+    return -1;
+
+  key = lua_tostring (l, idx);
+  if (strncmp (key, "Event", 5))
+    return -1;
+
+  for (i = 0; pi_lua_eventnames[i] != NULL; i++)
+    if (!strcmp (key, pi_lua_eventnames[i]))
+      return i;
+
+  return -1;
+}
+
+void pi_lua_eventset (lua_context_t * ctx, int i)
+{
+  luaL_unref (ctx->l, LUA_REGISTRYINDEX, ctx->eventrefs[i]);
+  ctx->eventrefs[i] = LUA_NOREF;
+  ctx->eventmap &= ~(1 << i);
+
+  /* takes the handler from the top of the stack */
+  if (lua_isnil (ctx->l, -1)) {
+    lua_pop (ctx->l, 1);
+    return;
+  }
+
+  ctx->eventrefs[i] = luaL_ref (ctx->l, LUA_REGISTRYINDEX);
+  ctx->eventmap |= (1 << i);
+
+  /* if not register yet, now register the event handler for this event. 
+   *  events are only released when a script is closed: this may run inside a handler. */
+  if (!(pi_lua_eventmap & (1 << i))) {
+    plugin_request (plugin_lua, i, (plugin_event_handler_t *) & pi_lua_event_handler);
+    pi_lua_eventmap |= (1 << i);
+  }
+}
+
+int pi_lua_globals_index (lua_State * l)
+{
+  lua_context_t *ctx = pi_lua_state_context (l);
+  int i = pi_lua_eventindex (l, 2);
+
+  if (!ctx || (i < 0) || (ctx->eventrefs[i] == LUA_NOREF)) {
+    lua_pushnil (l);
+    return 1;
+  }
+
+  lua_rawgeti (l, LUA_REGISTRYINDEX, ctx->eventrefs[i]);
+  return 1;
+}
+
+int pi_lua_globals_newindex (lua_State * l)
+{
+  lua_context_t *ctx = pi_lua_state_context (l);
+  int i = pi_lua_eventindex (l, 2);
+
+  lua_settop (l, 3);
+  if (!ctx || (i < 0)) {
+    lua_rawset (l, 1);
+    return 0;
+  }
+
+  pi_lua_eventset (ctx, i);
+
+  return 0;
+}
+
 unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
 {
-  int result, i;
+  int result, i, hooked;
   lua_State *l;
   lua_context_t *ctx;
 
@@ -2282,6 +2582,7 @@ unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
   luaL_openlibs (l);
 #endif
   pi_lua_register_functions (l);	/* register lua commands */
+  lua_sethook (l, pi_lua_hook, LUA_MASKCOUNT, PI_LUA_HOOK_COUNT);
 
   /* load the file */
   result = luaL_loadfile (l, name);
@@ -2298,6 +2599,19 @@ unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
   ctx->l = l;
   ctx->name = strdup (name);
   ctx->eventmap = 0;
+  for (i = 0; i < PLUGIN_EVENT_NUMBER; i++)
+    ctx->eventrefs[i] = LUA_NOREF;
+  ctx->usertable = 0;
+  memset (&ctx->latency, 0, sizeof (plugin_latency_t));
+  ctx->disabled = 0;
+  ctx->overrun = 0;
+  ctx->overruns = 0;
+  ctx->instructions = 0;
+  ctx->profile = NULL;
+
+  lua_pushlightuserdata (l, &pi_lua_contextkey);
+  lua_pushlightuserdata (l, ctx);
+  lua_rawset (l, LUA_REGISTRYINDEX);
 
   /* add into list */
   ctx->next = &lua_list;
@@ -2310,7 +2624,10 @@ unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
   if (lua_ctx_peak > lua_ctx_cnt)
     lua_ctx_peak = lua_ctx_cnt;
 
-  result = lua_pcall (l, 0, LUA_MULTRET, 0);
+  pi_lua_latency_register (ctx);
+
+  /* the initial chunk is exempt from the execution budget, start-up work may take a while */
+  result = lua_pcall (ctx->l, 0, LUA_MULTRET, 0);
   if (result) {
     unsigned char *error = (unsigned char *) luaL_checkstring (l, 1);
 
@@ -2319,20 +2636,52 @@ unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
     goto late_error;
   }
 
-  /* determine eventhandlers */
+  /* determine eventhandlers and keep a reference to them, so we don't look them up for every
+   *  event. if the script did not set a metatable on the globals, move the handlers out of the
+   *  globals table and hook it, so later assignments are seen. otherwise the handlers stay
+   *  global and are looked up by name on each event. */
+  lua_pushvalue (ctx->l, LUA_GLOBALSINDEX);
+  hooked = !lua_getmetatable (ctx->l, -1);
+  if (!hooked)
+    lua_pop (ctx->l, 1);
   for (i = 0; pi_lua_eventnames[i] != NULL; i++) {
     lua_pushstring (ctx->l, pi_lua_eventnames[i]);
-    lua_gettable (ctx->l, LUA_GLOBALSINDEX);
-    if (!lua_isnil (ctx->l, -1)) {
+    lua_rawget (ctx->l, -2);
+    if (lua_isnil (ctx->l, -1)) {
+      lua_pop (ctx->l, 1);
+      continue;
+    }
+    if (hooked) {
+      pi_lua_eventset (ctx, i);
+      lua_pushstring (ctx->l, pi_lua_eventnames[i]);
+      lua_pushnil (ctx->l);
+      lua_rawset (ctx->l, -3);
+    } else {
+      lua_pop (ctx->l, 1);
       ctx->eventmap |= (1 << i);
-      /* if not register yet, now register the event handler for this event */
       if (!(pi_lua_eventmap & (1 << i))) {
 	plugin_request (plugin_lua, i, (plugin_event_handler_t *) & pi_lua_event_handler);
 	pi_lua_eventmap |= (1 << i);
       }
     }
-    lua_remove (ctx->l, -1);
   }
+  if (hooked) {
+    lua_newtable (ctx->l);
+    lua_pushstring (ctx->l, "__index");
+    lua_pushcfunction (ctx->l, pi_lua_globals_index);
+    lua_rawset (ctx->l, -3);
+    lua_pushstring (ctx->l, "__newindex");
+    lua_pushcfunction (ctx->l, pi_lua_globals_newindex);
+    lua_rawset (ctx->l, -3);
+    lua_setmetatable (ctx->l, -2);
+  }
+  lua_settop (ctx->l, 0);
+
+  /* does the script want a user table instead of a nick? */
+  lua_pushstring (ctx->l, "EventUserTable");
+  lua_gettable (ctx->l, LUA_GLOBALSINDEX);
+  ctx->usertable = lua_toboolean (ctx->l, -1);
+  lua_remove (ctx->l, -1);
 
   /* add global variables */
   /* hub version */
@@ -2346,11 +2695,14 @@ unsigned int pi_lua_load (buffer_t * output, unsigned char *name)
   return 1;
 
 late_error:
+  pi_lua_latency_unregister (ctx);
   ctx->next->prev = ctx->prev;
   ctx->prev->next = ctx->next;
   pi_lua_purgebots (ctx);
   pi_lua_cmdclean (l);
   pi_lua_timerclear (l);
+  if (ctx->profile)
+    free (ctx->profile);
   free (ctx->name);
   free (ctx);
   lua_ctx_cnt--;
@@ -2373,6 +2725,7 @@ unsigned int pi_lua_close (unsigned char *name)
     pi_lua_timerclear (ctx->l);
     pi_lua_cmdclean (ctx->l);
     pi_lua_purgebots (ctx);
+    pi_lua_latency_unregister (ctx);
 
     lua_close (ctx->l);
     free (ctx->name);
@@ -2386,9 +2739,9 @@ unsigned int pi_lua_close (unsigned char *name)
       eventmap |= ctx2->eventmap;
     }
 
-    /* determine events only used by this script */
-    ASSERT ((pi_lua_eventmap & ~eventmap) == (ctx->eventmap & ~eventmap));
-    eventmap = ctx->eventmap & ~eventmap;
+    /* determine events no longer used by any script. a handler a script has cleared keeps its
+     *  event registered until the script is closed. */
+    eventmap = pi_lua_eventmap & ~eventmap;
 
     /* free those events */
     for (i = 0; pi_lua_eventnames[i] != NULL; i++) {
@@ -2399,6 +2752,8 @@ unsigned int pi_lua_close (unsigned char *name)
     }
 
     /* free the context */
+    if (ctx->profile)
+      free (ctx->profile);
     free (ctx);
     lua_ctx_cnt--;
 
@@ -2428,7 +2783,21 @@ unsigned long handler_luastat (plugin_user_t * user, buffer_t * output, void *pr
   bf_printf (output, _("\nRunning LUA scripts:\n"));
 
   for (ctx = lua_list.next; ctx != &lua_list; ctx = ctx->next) {
-    bf_printf (output, " %s (%s)\n", ctx->name, format_size (lua_getgccount (ctx->l) * 1024));
+    bf_printf (output, _(" %s (%s) overruns: %lu%s\n"), ctx->name,
+	       format_size (lua_getgccount (ctx->l) * 1024), ctx->overruns,
+	       ctx->disabled ? _(" DISABLED") : "");
+  }
+
+  bf_printf (output, _("\nEvent handler time (us):\n%-32s %8s %10s %7s %6s  %s\n"), _("Script"),
+	     _("Calls"), _("Total"), _("Max"), _("Avg"), _("<10us/<100us/<1ms/<10ms/<100ms/more"));
+  for (ctx = lua_list.next; ctx != &lua_list; ctx = ctx->next) {
+    if (bf_unused (output) < 256) {
+      buffer_t *b = bf_alloc (10000);
+
+      bf_append (&output, b);
+      output = b;
+    }
+    plugin_latency_print (output, ctx->name, &ctx->latency);
   }
 
   return 1;
@@ -2470,15 +2839,131 @@ unsigned long handler_luaclose (plugin_user_t * user, buffer_t * output, void *p
 }
 
 
+int pi_lua_profile_compare (const void *a, const void *b)
+{
+  unsigned long sa = ((pi_lua_profile_entry_t *) a)->samples;
+  unsigned long sb = ((pi_lua_profile_entry_t *) b)->samples;
+
+  return (sa < sb) ? 1 : ((sa > sb) ? -1 : 0);
+}
+
+unsigned long handler_luaprofile (plugin_user_t * user, buffer_t * output, void *priv,
+				  unsigned int argc, unsigned char **argv)
+{
+  unsigned int i;
+  lua_context_t *ctx;
+  pi_lua_profile_t *p;
+  pi_lua_profile_entry_t *sorted;
+
+  if ((argc < 2) || (argc > 3)) {
+    bf_printf (output, _("Usage: %s <script> [on|off]\n"), argv[0]);
+    return 0;
+  }
+
+  for (ctx = lua_list.next; ctx != &lua_list; ctx = ctx->next)
+    if (!strcmp (argv[1], ctx->name))
+      break;
+
+  if (ctx == &lua_list) {
+    bf_printf (output, _("Lua script '%s' not found.\n"), argv[1]);
+    return 0;
+  }
+
+  if (argc == 3) {
+    if (!strcmp (argv[2], "on")) {
+      if (!ctx->profile) {
+	ctx->profile = malloc (sizeof (pi_lua_profile_t));
+	memset (ctx->profile, 0, sizeof (pi_lua_profile_t));
+      }
+      bf_printf (output, _("Profiling of Lua script '%s' started.\n"), ctx->name);
+    } else if (!strcmp (argv[2], "off")) {
+      if (ctx->profile) {
+	free (ctx->profile);
+	ctx->profile = NULL;
+      }
+      bf_printf (output, _("Profiling of Lua script '%s' stopped.\n"), ctx->name);
+    } else {
+      bf_printf (output, _("Usage: %s <script> [on|off]\n"), argv[0]);
+    }
+    return 0;
+  }
+
+  p = ctx->profile;
+  if (!p) {
+    bf_printf (output, _("Lua script '%s' is not being profiled.\n"), ctx->name);
+    return 0;
+  }
+
+  if (!p->samples) {
+    bf_printf (output, _("No samples for Lua script '%s' yet.\n"), ctx->name);
+    return 0;
+  }
+
+  /* sort a copy, the profiler keeps adding to the original */
+  sorted = malloc (sizeof (pi_lua_profile_entry_t) * p->count);
+  memcpy (sorted, p->entry, sizeof (pi_lua_profile_entry_t) * p->count);
+  qsort (sorted, p->count, sizeof (pi_lua_profile_entry_t), pi_lua_profile_compare);
+
+  bf_printf (output, _("Profile of Lua script '%s': %lu samples of %d instructions, %lu untracked\n"),
+	     ctx->name, p->samples, PI_LUA_HOOK_COUNT, p->dropped);
+  for (i = 0; (i < p->count) && (i < 20); i++)
+    bf_printf (output, " %5.1f%% %8lu %s\n", (100.0 * sorted[i].samples) / p->samples,
+	       sorted[i].samples, sorted[i].name);
+
+  free (sorted);
+
+  return 0;
+}
+
 /******************************************************************************************
  * lua function - event 
  */
 
+/* push a table with the commonly used user fields, so scripts don't have to look them up one by one */
+void pi_lua_pushuser (lua_State * l, plugin_user_t * user)
+{
+  struct in_addr ia;
+
+  if (!user) {
+    lua_pushnil (l);
+    return;
+  }
+
+  lua_newtable (l);
+
+  PUSH_TABLE_ENTRY (l, "nick", user->nick);
+  ia.s_addr = user->ipaddress;
+  PUSH_TABLE_ENTRY (l, "ip", inet_ntoa (ia));
+  PUSH_TABLE_ENTRY (l, "client", user->client);
+  PUSH_TABLE_ENTRY (l, "clientversion", user->versionstring);
+  PUSH_TABLE_ENTRY_NUMBER (l, "share", user->share);
+  PUSH_TABLE_ENTRY_NUMBER (l, "slots", user->slots);
+
+  lua_pushstring (l, "hubs");
+  lua_newtable (l);
+  lua_pushnumber (l, 1);
+  lua_pushnumber (l, user->hubs[0]);
+  lua_settable (l, -3);
+  lua_pushnumber (l, 2);
+  lua_pushnumber (l, user->hubs[1]);
+  lua_settable (l, -3);
+  lua_pushnumber (l, 3);
+  lua_pushnumber (l, user->hubs[2]);
+  lua_settable (l, -3);
+  lua_settable (l, -3);
+
+  PUSH_TABLE_ENTRY_BOOLEAN (l, "active", user->active);
+  PUSH_TABLE_ENTRY_BOOLEAN (l, "op", user->op);
+  PUSH_TABLE_ENTRY_BOOLEAN (l, "registered", (user->flags & PLUGIN_FLAG_REGISTERED));
+  PUSH_TABLE_ENTRY_BOOLEAN (l, "zombie", (user->flags & PLUGIN_FLAG_ZOMBIE));
+}
+
 unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
 				    unsigned long event, buffer_t * token)
 {
   int result = PLUGIN_RETVAL_CONTINUE;
   lua_context_t *ctx;
+  struct timeval start;
 
   pi_lua_eventuser = user;
   for (ctx = lua_list.next; (ctx != &lua_list) && (!result); ctx = ctx->next) {
@@ -2486,20 +2971,29 @@ unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
     if (!(ctx->eventmap & (1 << event)))
       continue;
 
+    /* script was disabled for exceeding its budget */
+    if (ctx->disabled)
+      continue;
+
+    gettimeofday (&start, NULL);
+
     /* clear stack */
     lua_settop (ctx->l, 0);
 
     /* specify function to call */
-    /* lua 5.1 
-       lua_getfield (ctx->l, LUA_GLOBALSINDEX, command);
-     */
-
-    /* lua 5.0 */
-    lua_pushstring (ctx->l, pi_lua_eventnames[event]);
-    lua_gettable (ctx->l, LUA_GLOBALSINDEX);
+    if (ctx->eventrefs[event] != LUA_NOREF) {
+      lua_rawgeti (ctx->l, LUA_REGISTRYINDEX, ctx->eventrefs[event]);
+    } else {
+      lua_pushstring (ctx->l, pi_lua_eventnames[event]);
+      lua_gettable (ctx->l, LUA_GLOBALSINDEX);
+    }
 
     /* push arguments */
-    lua_pushstring (ctx->l, (user ? user->nick : (unsigned char *) ""));
+    if (ctx->usertable) {
+      pi_lua_pushuser (ctx->l, user);
+    } else {
+      lua_pushstring (ctx->l, (user ? user->nick : (unsigned char *) ""));
+    }
     if (event == PLUGIN_EVENT_CONFIG) {
       config_element_t *elem = (config_element_t *) token;
 
@@ -2509,7 +3003,7 @@ unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
     }
 
     /* call funtion. */
-    result = lua_pcall (ctx->l, 2, 1, 0);
+    result = pi_lua_pcall (ctx, 2, 1);
     if (result) {
       unsigned char *error = (unsigned char *) luaL_checkstring (ctx->l, 1);
       buffer_t *buf;
@@ -2533,6 +3027,8 @@ unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
       result = lua_toboolean (ctx->l, -1);
       lua_remove (ctx->l, -1);
     }
+
+    plugin_latency_add (&ctx->latency, plugin_latency_since (&start));
   }
   pi_lua_eventuser = NULL;
 
@@ -2542,12 +3038,13 @@ unsigned long pi_lua_event_handler (plugin_user_t * user, buffer_t * output,
 
 unsigned long pi_lua_event_save (plugin_user_t * user, void *dummy, unsigned long event, void *arg)
 {
-  xml_node_t *node = arg;
+  xml_writer_t *w = arg;
   lua_context_t *ctx;
 
-  node = xml_node_add (node, "Lua");
+  xml_writer_start (w, "Lua");
   for (ctx = lua_list.next; (ctx != &lua_list); ctx = ctx->next)
-    xml_node_add_value (node, "LuaScript", XML_TYPE_STRING, ctx->name);
+    xml_writer_value (w, "LuaScript", XML_TYPE_STRING, ctx->name);
+  xml_writer_end (w);
 
   return PLUGIN_RETVAL_CONTINUE;
 }
@@ -2662,6 +3159,23 @@ int pi_lua_init ()
   command_register ("luastat", &handler_luastat, CAP_CONFIG, _("Show lua stats."));
   command_register ("luaload", &handler_luaload, CAP_CONFIG, _("Load a lua script."));
   command_register ("luaremove", &handler_luaclose, CAP_CONFIG, _("Remove a lua script."));
+  command_register ("luaprofile", &handler_luaprofile, CAP_CONFIG,
+		    _("Turn the sampling profiler of a lua script on or off, or show its hottest functions."));
+
+  pi_lua_budget_instructions = DEFAULT_LUABUDGETINSTRUCTIONS;
+  pi_lua_budget_time = DEFAULT_LUABUDGETTIME;
+  pi_lua_budget_strikes = DEFAULT_LUABUDGETSTRIKES;
+  pi_lua_overruns = 0;
+
+  config_register ("lua.budget.instructions", CFG_ELEM_ULONG, &pi_lua_budget_instructions,
+		   _("Maximum number of instructions a lua script may execute in a single call. 0 disables the limit."));
+  config_register ("lua.budget.time", CFG_ELEM_ULONG, &pi_lua_budget_time,
+		   _("Maximum time in milliseconds a lua script may run in a single call. 0 disables the limit."));
+  config_register ("lua.budget.strikes", CFG_ELEM_ULONG, &pi_lua_budget_strikes,
+		   _("Number of budget overruns after which a lua script is disabled. 0 never disables."));
+
+  stats_register ("lua.overruns", VAL_ELEM_ULONG, &pi_lua_overruns,
+		  _("Number of lua calls aborted for exceeding their execution budget."));
 
   pi_lua_event_load (NULL, NULL, 0, NULL);
 
@@ -256,34 +256,35 @@ rrd_ctxt_t *pi_rrd_find (unsigned char *name)
   return NULL;
 }
 
-int pi_rrd_save (xml_node_t * base)
+int pi_rrd_save (xml_writer_t * w)
 {
-  xml_node_t *node;
   rrd_ctxt_t *rrd;
   rrd_ctxt_datapoint_t *dp;
 
-  base = xml_node_add (base, "RRDs");
+  xml_writer_start (w, "RRDs");
 
   for (rrd = rrdlist.next; rrd != &rrdlist; rrd = rrd->next) {
-    node = xml_node_add (base, "RRD");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, rrd->name);
-    xml_node_add_value (node, "File", XML_TYPE_STRING, rrd->filename);
-    xml_node_add_value (node, "Period", XML_TYPE_ULONG, &rrd->period);
+    xml_writer_start (w, "RRD");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, rrd->name);
+    xml_writer_value (w, "File", XML_TYPE_STRING, rrd->filename);
+    xml_writer_value (w, "Period", XML_TYPE_ULONG, &rrd->period);
 
-    node = xml_node_add (node, "DataPoints");
+    xml_writer_start (w, "DataPoints");
     for (dp = rrd->points.next; dp != &rrd->points; dp = dp->next) {
-      node = xml_node_add (node, "DataPoint");
-      xml_node_add_value (node, "Name", XML_TYPE_STRING, dp->elem->name);
-      xml_node_add_value (node, "Specification", XML_TYPE_STRING, dp->spec);
-      node = xml_parent (node);
+      xml_writer_start (w, "DataPoint");
+      xml_writer_value (w, "Name", XML_TYPE_STRING, dp->elem->name);
+      xml_writer_value (w, "Specification", XML_TYPE_STRING, dp->spec);
+      xml_writer_end (w);
     }
-    node = xml_parent (node);
+    xml_writer_end (w);
 
-    node = xml_node_add (node, "RRAs");
+    xml_writer_start (w, "RRAs");
     for (dp = rrd->rras.next; dp != &rrd->rras; dp = dp->next)
-      xml_node_add_value (node, "RRA", XML_TYPE_STRING, dp->spec);
-    node = xml_parent (node);
+      xml_writer_value (w, "RRA", XML_TYPE_STRING, dp->spec);
+    xml_writer_end (w);
+    xml_writer_end (w);
   }
+  xml_writer_end (w);
   return 0;
 }
 
@@ -1362,31 +1362,32 @@ unsigned long pi_rss_handle_save (plugin_user_t * user, void *ctxt, unsigned lon
 {
   rss_feed_t *feed;
   rss_element_t *elem;
-  xml_node_t *node = (xml_node_t *) token;
+  xml_writer_t *w = (xml_writer_t *) token;
 
-  if (!node)
+  if (!w)
     return 0;
 
-  node = xml_node_add (node, "RSS");
+  xml_writer_start (w, "RSS");
 
   /* show all included tags for all feeds. */
   for (feed = feedlist.next; feed != &feedlist; feed = feed->next) {
-    node = xml_node_add (node, "Feed");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, feed->name);
-    xml_node_add_value (node, "Address", XML_TYPE_STRING, feed->address);
-    xml_node_add_value (node, "Port", XML_TYPE_UINT, &feed->port);
-    xml_node_add_value (node, "Path", XML_TYPE_STRING, feed->path);
-    xml_node_add_value (node, "User", XML_TYPE_STRING, feed->user);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &feed->rights);
-    xml_node_add_value (node, "Interval", XML_TYPE_LONG, &feed->interval);
-    node = xml_node_add (node, "Includes");
+    xml_writer_start (w, "Feed");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, feed->name);
+    xml_writer_value (w, "Address", XML_TYPE_STRING, feed->address);
+    xml_writer_value (w, "Port", XML_TYPE_UINT, &feed->port);
+    xml_writer_value (w, "Path", XML_TYPE_STRING, feed->path);
+    xml_writer_value (w, "User", XML_TYPE_STRING, feed->user);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &feed->rights);
+    xml_writer_value (w, "Interval", XML_TYPE_LONG, &feed->interval);
+    xml_writer_start (w, "Includes");
     if (feed->includes.next != &feed->includes) {
       for (elem = feed->includes.next; elem != &feed->includes; elem = elem->next)
-	xml_node_add_value (node, "Include", XML_TYPE_STRING, elem->entry->s);
+	xml_writer_value (w, "Include", XML_TYPE_STRING, elem->entry->s);
     }
-    node = xml_parent (node);
-    node = xml_parent (node);
+    xml_writer_end (w);
+    xml_writer_end (w);
   }
+  xml_writer_end (w);
   return 0;
 }
 
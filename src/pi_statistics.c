@@ -20,6 +20,8 @@
 #include "hub.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -41,6 +43,7 @@
 #include "utils.h"
 #include "nmdc_protocol.h"
 #include "stats.h"
+#include "pool.h"
 
 #ifdef USE_WINDOWS
 #  include "sys_windows.h"
@@ -561,6 +564,99 @@ unsigned int bandwidth_printf (buffer_t * buf)
 }
 
 
+/************************* FLUSH PROFILE ******************************************/
+
+/* one record per cache flush, the flush runs every second */
+#define STATS_FLUSH_RECORDS	300
+
+nmdc_flush_record_t flushrecords[STATS_FLUSH_RECORDS];
+unsigned int flushcurrent = 0, flushcount = 0;
+
+typedef struct flush_field {
+  unsigned char *name;
+  unsigned char *column;	/* short name for the record list */
+  size_t offset;
+} flush_field_t;
+
+flush_field_t flushfields[] = {
+  {"build (us)", "build", offsetof (nmdc_flush_record_t, build)},
+#ifdef ZLINES
+  {"zline (us)", "zline", offsetof (nmdc_flush_record_t, zline)},
+#endif
+  {"write (us)", "write", offsetof (nmdc_flush_record_t, write)},
+  {"total (us)", "total", offsetof (nmdc_flush_record_t, total)},
+  {"users", "users", offsetof (nmdc_flush_record_t, users)},
+  {"bytes", "bytes", offsetof (nmdc_flush_record_t, bytes)},
+  {"exceptions", "except", offsetof (nmdc_flush_record_t, exceptions)},
+  {"exception bytes", "exbytes", offsetof (nmdc_flush_record_t, exceptionbytes)},
+  {"new buffering", "buffer", offsetof (nmdc_flush_record_t, buffering)},
+  {"write failures", "failed", offsetof (nmdc_flush_record_t, failures)},
+  {NULL, NULL, 0}
+};
+
+#define FLUSH_FIELD(record, field) (*(unsigned long *) (((char *) (record)) + (field)->offset))
+
+int flush_compare (const void *a, const void *b)
+{
+  unsigned long x = *(unsigned long *) a, y = *(unsigned long *) b;
+
+  return (x > y) - (x < y);
+}
+
+int flush_printf (buffer_t * buf, unsigned int last)
+{
+  unsigned int i;
+  unsigned long long total;
+  unsigned long values[STATS_FLUSH_RECORDS];
+  flush_field_t *field;
+  nmdc_flush_record_t *r;
+  buffer_t *b;
+
+  if (!flushcount)
+    return bf_printf (buf, _("No cache flushes recorded yet.\n"));
+
+  bf_printf (buf, _("Cache flush profile over the last %u flushes:\n%-16s %10s %10s %10s %10s %10s\n"),
+	     flushcount, _("Field"), _("Avg"), _("50%"), _("90%"), _("99%"), _("Max"));
+
+  for (field = flushfields; field->name; field++) {
+    total = 0;
+    for (i = 0; i < flushcount; i++) {
+      values[i] = FLUSH_FIELD (&flushrecords[i], field);
+      total += values[i];
+    }
+    qsort (values, flushcount, sizeof (unsigned long), flush_compare);
+
+    bf_printf (buf, "%-16s %10llu %10lu %10lu %10lu %10lu\n", field->name, total / flushcount,
+	       values[(flushcount - 1) * 50 / 100], values[(flushcount - 1) * 90 / 100],
+	       values[(flushcount - 1) * 99 / 100], values[flushcount - 1]);
+  }
+
+  if (last > flushcount)
+    last = flushcount;
+  if (!last)
+    return 0;
+
+  bf_printf (buf, _("\nLast %u flushes (newest first):\n%8s"), last, _("Age"));
+  for (field = flushfields; field->name; field++)
+    bf_printf (buf, " %8s", field->column);
+  bf_printf (buf, "\n");
+
+  for (i = 1; i <= last; i++) {
+    r = &flushrecords[(flushcurrent + STATS_FLUSH_RECORDS - i) % STATS_FLUSH_RECORDS];
+    if (bf_unused (buf) < 256) {
+      b = bf_alloc (10000);
+      bf_append (&buf, b);
+      buf = b;
+    }
+    bf_printf (buf, "%8lu", now.tv_sec - r->stamp);
+    for (field = flushfields; field->name; field++)
+      bf_printf (buf, " %8lu", FLUSH_FIELD (r, field));
+    bf_printf (buf, "\n");
+  }
+
+  return 0;
+}
+
 /****************************************************************************************/
 unsigned long pi_statistics_event_cacheflush (plugin_user_t * user, void *dummy,
 					      unsigned long event, buffer_t * token)
@@ -569,6 +665,12 @@ unsigned long pi_statistics_event_cacheflush (plugin_user_t * user, void *dummy,
   memoryinfo = mallinfo ();
 #endif
   cpu_measure ();
+
+  flushrecords[flushcurrent] = nmdc_flushrecord;
+  flushcurrent = (flushcurrent + 1) % STATS_FLUSH_RECORDS;
+  if (flushcount < STATS_FLUSH_RECORDS)
+    flushcount++;
+
   return bandwidth_measure ();
 }
 
@@ -615,6 +717,13 @@ unsigned long pi_statistics_handler_statcache (plugin_user_t * user, buffer_t *
   return 0;
 }
 
+unsigned long pi_statistics_handler_statflush (plugin_user_t * user, buffer_t * output,
+					       void *dummy, unsigned int argc, unsigned char **argv)
+{
+  flush_printf (output, (argc > 1) ? strtoul (argv[1], NULL, 10) : 0);
+  return 0;
+}
+
 unsigned long pi_statistics_handler_statbw (plugin_user_t * user, buffer_t * output, void *dummy,
 					    unsigned int argc, unsigned char **argv)
 {
@@ -691,6 +800,150 @@ unsigned long pi_statistics_handler_statbuffer (plugin_user_t * user, buffer_t *
   return 0;
 }
 
+#define STATTOP_MAX	50
+
+typedef unsigned long long (stattop_value_t) (client_t * cl);
+
+unsigned long long stattop_in (client_t * cl)
+{
+  return cl->stats.bytesin;
+}
+unsigned long long stattop_out (client_t * cl)
+{
+  return cl->stats.bytesout;
+}
+unsigned long long stattop_peak (client_t * cl)
+{
+  return cl->stats.peak;
+}
+unsigned long long stattop_buffering (client_t * cl)
+{
+  return server_statetime (cl, HUB_STATE_BUFFERING);
+}
+unsigned long long stattop_overflow (client_t * cl)
+{
+  return server_statetime (cl, HUB_STATE_OVERFLOW);
+}
+unsigned long long stattop_recvs (client_t * cl)
+{
+  return cl->stats.recvs;
+}
+unsigned long long stattop_sends (client_t * cl)
+{
+  return cl->stats.sends;
+}
+
+struct {
+  unsigned char *name;
+  unsigned char *help;
+  stattop_value_t *value;
+} stattop_metrics[] = {
+  {"in", "bytes received", stattop_in},
+  {"out", "bytes sent", stattop_out},
+  {"peak", "largest output queue in bytes", stattop_peak},
+  {"buffering", "ms spent buffering", stattop_buffering},
+  {"overflow", "ms spent in overflow", stattop_overflow},
+  {"recvs", "receive calls", stattop_recvs},
+  {"sends", "send calls", stattop_sends},
+  {NULL, NULL, NULL}
+};
+
+buffer_t *stattop_printf (buffer_t * output, unsigned int metric, unsigned int max)
+{
+  user_t *u, *top[STATTOP_MAX];
+  unsigned long long value, values[STATTOP_MAX];
+  unsigned int i, j, count = 0;
+
+  /* keep a sorted list of the largest values */
+  for (u = userlist; u; u = u->next) {
+    if (!u->parent)
+      continue;
+
+    value = stattop_metrics[metric].value ((client_t *) u->parent);
+    if (!value)
+      continue;
+
+    for (i = count; i && (values[i - 1] < value); i--);
+    if (i >= max)
+      continue;
+
+    j = (count < max) ? count++ : count - 1;
+    for (; j > i; j--) {
+      values[j] = values[j - 1];
+      top[j] = top[j - 1];
+    }
+    values[i] = value;
+    top[i] = u;
+  }
+
+  if (bf_unused (output) < 256) {
+    buffer_t *b = bf_alloc (10000);
+
+    bf_append (&output, b);
+    output = b;
+  }
+
+  bf_printf (output, _("Top %u by %s (%s):\n"), max, stattop_metrics[metric].name,
+	     stattop_metrics[metric].help);
+  if (!count)
+    bf_printf (output, _(" None.\n"));
+  for (i = 0; i < count; i++) {
+    if (bf_unused (output) < 256) {
+      buffer_t *b = bf_alloc (10000);
+
+      bf_append (&output, b);
+      output = b;
+    }
+    bf_printf (output, " %2u. %-24s %12llu  (online: %s)\n", i + 1, top[i]->nick, values[i],
+	       time_print (now.tv_sec - top[i]->joinstamp));
+  }
+
+  return output;
+}
+
+unsigned long pi_statistics_handler_stattop (plugin_user_t * user, buffer_t * output,
+					     void *dummy, unsigned int argc, unsigned char **argv)
+{
+  unsigned int i, metric, max = 5;
+  unsigned char *what = NULL;
+
+  for (i = 1; i < argc; i++) {
+    if ((*argv[i] >= '0') && (*argv[i] <= '9')) {
+      max = strtoul (argv[i], NULL, 10);
+    } else {
+      what = argv[i];
+    }
+  }
+  if (!max)
+    max = 1;
+  if (max > STATTOP_MAX)
+    max = STATTOP_MAX;
+
+  if (what) {
+    for (metric = 0; stattop_metrics[metric].name; metric++)
+      if (!strcmp (what, stattop_metrics[metric].name))
+	break;
+
+    if (!stattop_metrics[metric].name) {
+      bf_printf (output, _("Unknown metric %s, use one of:"), what);
+      for (metric = 0; stattop_metrics[metric].name; metric++)
+	bf_printf (output, " %s", stattop_metrics[metric].name);
+      bf_printf (output, "\n");
+      return 0;
+    }
+
+    stattop_printf (output, metric, max);
+    return 0;
+  }
+
+  for (metric = 0; stattop_metrics[metric].name; metric++) {
+    output = stattop_printf (output, metric, max);
+    bf_printf (output, "\n");
+  }
+
+  return 0;
+}
+
 unsigned long pi_statistics_handler_statcpu (plugin_user_t * user, buffer_t * output, void *dummy,
 					     unsigned int argc, unsigned char **argv)
 {
@@ -782,6 +1035,19 @@ unsigned long pi_statistics_handler_statmem (plugin_user_t * user, buffer_t * ou
   bf_printf (output, _("%s stats:\n"), HUBSOFT_NAME);
   bf_printf (output, _(" Buffering memory: %lu\n"), buf_mem);
   bf_printf (output, _(" Cachelist size: %lu\n"), cachelist_count);
+
+  if (pools) {
+    pool_t *p;
+
+    bf_printf (output, _("\nObject pools:\n%-16s %6s %8s %8s %8s %6s %10s %12s\n"),
+	       _("Pool"), _("Size"), _("In use"), _("Free"), _("Peak"), _("Slabs"), _("Allocs"),
+	       _("Memory"));
+    for (p = pools; p; p = p->next)
+      bf_printf (output, "%-16s %6lu %8lu %8lu %8lu %6lu %10lu %12s\n", p->name, p->size,
+		 p->inuse, p->slabcount * p->perslab - p->inuse, p->peak, p->slabcount, p->allocs,
+		 format_size (p->slabcount * p->perslab * p->size));
+  }
+
   return 0;
 }
 
@@ -799,9 +1065,73 @@ unsigned long pi_statistics_handler_uptime (plugin_user_t * user, buffer_t * out
 }
 
 #include "nmdc_protocol.h"
+
+#define STATLATENCY_GROW(output) \
+	if (bf_unused (output) < 256) { \
+	  buffer_t *b = bf_alloc (10000); \
+	  bf_append (&output, b); \
+	  output = b; \
+	}
+
+/* only tokens that were seen, the full report adds histogram and slowest samples */
+buffer_t *pi_statistics_statnmdc_tokens (buffer_t * output, int full)
+{
+  unsigned int i, j;
+  unsigned long total;
+  nmdc_token_stats_t *stats;
+  nmdc_token_sample_t *sample;
+
+  STATLATENCY_GROW (output);
+  bf_printf (output, _("Token processing time (ns):\n%-18s %10s %10s %10s\n"), _("Token"),
+	     _("Count"), _("Avg"), _("Max"));
+
+  for (i = 0; i < TOKEN_NUM; i++) {
+    stats = &nmdc_tokenstats[i];
+    if (!stats->count)
+      continue;
+
+    STATLATENCY_GROW (output);
+    bf_printf (output, "%-18s %10lu %10llu %10lu\n", TokenNames[i], stats->count,
+	       stats->total / stats->count, stats->max);
+    if (!full)
+      continue;
+
+    total = 0;
+    bf_printf (output, "  ");
+    for (j = 0; j <= stats->histogram.buckets; j++) {
+      total += stats->histogram.counts[j];
+      if (!stats->histogram.counts[j])
+	continue;
+      if (j < stats->histogram.buckets) {
+	bf_printf (output, "<=%luus: %lu  ", stats->histogram.bounds[j] / 1000,
+		   stats->histogram.counts[j]);
+      } else {
+	bf_printf (output, _("more: %lu"), stats->histogram.counts[j]);
+      }
+    }
+    bf_printf (output, "\n");
+
+    for (j = 0; j < NMDC_TOKEN_SLOWEST; j++) {
+      sample = &stats->slowest[j];
+      if (!sample->nsec)
+	break;
+      STATLATENCY_GROW (output);
+      bf_printf (output, _("  %10lu ns  %s, %lu bytes, %s ago\n"), sample->nsec, sample->nick,
+		 sample->length, time_print (now.tv_sec - sample->stamp));
+    }
+  }
+
+  return output;
+}
+
 unsigned long pi_statistics_handler_statnmdc (plugin_user_t * user, buffer_t * output, void *dummy,
 					      unsigned int argc, unsigned char **argv)
 {
+  if ((argc > 1) && !strcmp (argv[1], "tokens")) {
+    pi_statistics_statnmdc_tokens (output, 1);
+    return 0;
+  }
+
   bf_printf (output, " cacherebuild : %lu\n", nmdc_stats.cacherebuild);
   bf_printf (output, " userjoin : %lu\n", nmdc_stats.userjoin);
   bf_printf (output, " userpart : %lu\n", nmdc_stats.userpart);
@@ -861,6 +1191,35 @@ unsigned long pi_statistics_handler_statnmdc (plugin_user_t * user, buffer_t * o
   bf_printf (output, " cache_messages : %lu\n", nmdc_stats.cache_messages);
   bf_printf (output, " cache_results : %lu\n", nmdc_stats.cache_results);
 
+  pi_statistics_statnmdc_tokens (output, 0);
+
+  return 0;
+}
+
+unsigned long pi_statistics_handler_statlatency (plugin_user_t * user, buffer_t * output,
+						 void *dummy, unsigned int argc,
+						 unsigned char **argv)
+{
+  command_t *cmd;
+  unsigned char *what = (argc > 1) ? argv[1] : (unsigned char *) "";
+
+  bf_printf (output, _("Handler time (us):\n%-32s %8s %10s %7s %6s  %s\n"), _("Name"), _("Calls"),
+	     _("Total"), _("Max"), _("Avg"), _("<10us/<100us/<1ms/<10ms/<100ms/more"));
+
+  output = plugin_latency_report (output, what);
+
+  if (!*what || !strcmp (what, "commands")) {
+    bf_printf (output, _("Commands:\n"));
+    STATLATENCY_GROW (output);
+    plugin_latency_print (output, _("(all)"), &cmd_latency);
+    for (cmd = cmd_sorted.onext; cmd != &cmd_sorted; cmd = cmd->onext) {
+      if (!cmd->latency.calls)
+	continue;
+      STATLATENCY_GROW (output);
+      plugin_latency_print (output, cmd->name, &cmd->latency);
+    }
+  }
+
   return 0;
 }
 
@@ -883,13 +1242,19 @@ int pi_statistics_init ()
 
   command_register ("statbuffer", &pi_statistics_handler_statbuffer, CAP_CONFIG,
 		    _("Show buffer stats."));
+  command_register ("stattop", &pi_statistics_handler_stattop, CAP_CONFIG,
+		    _("Show the users with the most traffic, buffering or system calls. Optional arguments: a metric (in, out, peak, buffering, overflow, recvs or sends) and the number of users."));
   command_register ("statcache", &pi_statistics_handler_statcache, 0, _("Show cache stats."));
+  command_register ("statflush", &pi_statistics_handler_statflush, CAP_CONFIG,
+		    _("Show a profile of the cache flushes. Optional argument: number of recent flushes to list."));
   command_register ("statbw", &pi_statistics_handler_statbw, 0, _("Show bandwidth stats."));
   command_register ("statcpu", &pi_statistics_handler_statcpu, 0, _("Show cpu usage stats."));
   command_register ("statnmdc", &pi_statistics_handler_statnmdc, 0,
-		    _("Show nmdc protocol stats. Experts only."));
+		    _("Show nmdc protocol stats. Experts only. Use \"statnmdc tokens\" for the token timing details."));
   command_register ("statmem", &pi_statistics_handler_statmem, 0, _("Show memory usage stats."));
   command_register ("statconn", &pi_statistics_handler_statconn, 0, _("Show connection stats."));
+  command_register ("statlatency", &pi_statistics_handler_statlatency, CAP_CONFIG,
+		    _("Show time spent in plugins, event handlers and commands. Optional argument: plugins, events, handlers or commands."));
   command_register ("uptime", &pi_statistics_handler_uptime, 0, _("Show uptime."));
 
 #ifdef USE_WINDOWS
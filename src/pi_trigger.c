@@ -526,69 +526,71 @@ void trigger_rule_delete (trigger_rule_t * rule)
   free (rule);
 }
 
-int trigger_save (xml_node_t * node)
+int trigger_save (xml_writer_t * w)
 {
   trigger_t *trigger;
   trigger_rule_t *rule;
 
-  node = xml_node_add (node, "TriggerConfig");
+  xml_writer_start (w, "TriggerConfig");
 
-  node = xml_node_add (node, "Triggers");
+  xml_writer_start (w, "Triggers");
   for (trigger = triggerList.next; trigger != &triggerList; trigger = trigger->next) {
-    node = xml_node_add (node, "Trigger");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, trigger->name);
-    xml_node_add_value (node, "Type", XML_TYPE_ULONG, &trigger->type);
+    xml_writer_start (w, "Trigger");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, trigger->name);
+    xml_writer_value (w, "Type", XML_TYPE_ULONG, &trigger->type);
     switch (trigger->type) {
       case TRIGGER_TYPE_FILE:
-	xml_node_add_value (node, "File", XML_TYPE_STRING, trigger->file);
+	xml_writer_value (w, "File", XML_TYPE_STRING, trigger->file);
 	break;
       case TRIGGER_TYPE_TEXT:
-	xml_node_add_value (node, "Text", XML_TYPE_STRING, trigger->text->s);
+	xml_writer_value (w, "Text", XML_TYPE_STRING, trigger->text->s);
 	break;
       case TRIGGER_TYPE_COMMAND:
 	break;
     }
-    node = xml_parent (node);
+    xml_writer_end (w);
   }
-  node = xml_parent (node);
+  xml_writer_end (w);
 
-  node = xml_node_add (node, "Rules");
+  xml_writer_start (w, "Rules");
 
-  node = xml_node_add (node, "LoginRules");
+  xml_writer_start (w, "LoginRules");
   for (rule = ruleListLogin.next; rule != &ruleListLogin; rule = rule->next) {
-    node = xml_node_add (node, "Rule");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, rule->trigger->name);
-    xml_node_add_value (node, "Type", XML_TYPE_ULONG, &rule->type);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &rule->cap);
-    xml_node_add_value (node, "Flags", XML_TYPE_ULONG, &rule->flags);
-    node = xml_parent (node);
+    xml_writer_start (w, "Rule");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, rule->trigger->name);
+    xml_writer_value (w, "Type", XML_TYPE_ULONG, &rule->type);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &rule->cap);
+    xml_writer_value (w, "Flags", XML_TYPE_ULONG, &rule->flags);
+    xml_writer_end (w);
   }
-  node = xml_parent (node);
+  xml_writer_end (w);
 
-  node = xml_node_add (node, "CommandRules");
+  xml_writer_start (w, "CommandRules");
   for (rule = ruleListCommand.next; rule != &ruleListCommand; rule = rule->next) {
-    node = xml_node_add (node, "Rule");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, rule->trigger->name);
-    xml_node_add_value (node, "Type", XML_TYPE_ULONG, &rule->type);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &rule->cap);
-    xml_node_add_value (node, "Flags", XML_TYPE_ULONG, &rule->flags);
-    xml_node_add_value (node, "Command", XML_TYPE_STRING, rule->arg);
-    xml_node_add_value (node, "Help", XML_TYPE_STRING, rule->help ? (char *) rule->help : "");
-    node = xml_parent (node);
+    xml_writer_start (w, "Rule");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, rule->trigger->name);
+    xml_writer_value (w, "Type", XML_TYPE_ULONG, &rule->type);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &rule->cap);
+    xml_writer_value (w, "Flags", XML_TYPE_ULONG, &rule->flags);
+    xml_writer_value (w, "Command", XML_TYPE_STRING, rule->arg);
+    xml_writer_value (w, "Help", XML_TYPE_STRING, rule->help ? (char *) rule->help : "");
+    xml_writer_end (w);
   }
-  node = xml_parent (node);
+  xml_writer_end (w);
 
-  node = xml_node_add (node, "TimerRules");
+  xml_writer_start (w, "TimerRules");
   for (rule = ruleListTimer.next; rule != &ruleListTimer; rule = rule->next) {
-    node = xml_node_add (node, "Rule");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, rule->trigger->name);
-    xml_node_add_value (node, "Type", XML_TYPE_ULONG, &rule->type);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &rule->cap);
-    xml_node_add_value (node, "Flags", XML_TYPE_ULONG, &rule->flags);
-    xml_node_add_value (node, "Interval", XML_TYPE_ULONG, &rule->interval);
-    node = xml_parent (node);
+    xml_writer_start (w, "Rule");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, rule->trigger->name);
+    xml_writer_value (w, "Type", XML_TYPE_ULONG, &rule->type);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &rule->cap);
+    xml_writer_value (w, "Flags", XML_TYPE_ULONG, &rule->flags);
+    xml_writer_value (w, "Interval", XML_TYPE_ULONG, &rule->interval);
+    xml_writer_end (w);
   }
-  node = xml_parent (node);
+  xml_writer_end (w);
+  xml_writer_end (w);
+  xml_writer_end (w);
 
   return 0;
 }
@@ -50,6 +50,9 @@ typedef struct slotratio {
 banlist_t sourcelist;
 banlist_client_t clientbanlist;
 
+banlist_parser_t sourceparser;
+banlist_client_parser_t clientbanparser;
+
 unsigned char *ClientBanFileName;
 
 plugin_t *plugin_user = NULL;
@@ -442,22 +445,22 @@ unsigned long pi_user_handler_clientunban (plugin_user_t * user, buffer_t * outp
 
 unsigned long pi_user_event_save (plugin_user_t * user, void *dummy, unsigned long event, void *arg)
 {
-  xml_node_t *node = arg;
+  xml_writer_t *w = arg;
 
-  banlist_client_save (&clientbanlist, node);
-  banlist_save (&sourcelist, xml_node_add (node, "SourceList"));
+  /* the client bans may be in the binary snapshot */
+  if (!plugin_config_binary ())
+    banlist_client_save (&clientbanlist, w);
+  xml_writer_start (w, "SourceList");
+  banlist_save (&sourcelist, w);
+  xml_writer_end (w);
 
   return PLUGIN_RETVAL_CONTINUE;
 }
 
 unsigned long pi_user_event_load (plugin_user_t * user, void *dummy, unsigned long event, void *arg)
 {
-  if (arg) {
-    banlist_client_clear (&clientbanlist);
-    banlist_client_load (&clientbanlist, arg);
-    if ((arg = xml_node_find (arg, "SourceList")))
-      banlist_load (&sourcelist, arg);
-  } else {
+  /* the xml configuration is loaded by the parsers registered in pi_user_init */
+  if (!arg) {
     banlist_client_clear (&clientbanlist);
     banlist_client_load_old (&clientbanlist, ClientBanFileName);
     banlist_load_old (&sourcelist, PI_USER_RESTRICTFILE);
@@ -584,6 +587,12 @@ int pi_user_init ()
   plugin_request (plugin_user, PLUGIN_EVENT_INFOUPDATE, (plugin_event_handler_t *) &pi_user_event_infoupdate);
 
   plugin_request (plugin_user, PLUGIN_EVENT_LOAD,  (plugin_event_handler_t *)&pi_user_event_load);
+  plugin_config_loader_register ("ClientBanList", banlist_client_parser (&clientbanparser, &clientbanlist));
+  plugin_config_loader_register ("SourceList",    banlist_parser (&sourceparser, &sourcelist));
+  plugin_config_snapshot_register ("ClientBanList",
+				   (plugin_snapshot_handler_t *) banlist_client_snapshot_save,
+				   (plugin_snapshot_handler_t *) banlist_client_snapshot_load,
+				   &clientbanlist);
   plugin_request (plugin_user, PLUGIN_EVENT_SAVE,  (plugin_event_handler_t *)&pi_user_event_save);
   
   plugin_request (plugin_user, PLUGIN_EVENT_CONFIG,  (plugin_event_handler_t *) &pi_user_event_config);
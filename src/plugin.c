@@ -17,6 +17,11 @@
  *  
  */
 
+/* close_range */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include "hub.h"
 
 #include "plugin_int.h"
@@ -30,12 +35,22 @@
 #  endif
 #endif
 
+#ifndef USE_WINDOWS
+#  include <unistd.h>
+#  include <signal.h>
+#  include <sys/stat.h>
+#  include <sys/wait.h>
+#  include <dirent.h>
+#endif
+
 #include "aqtime.h"
 #include "utils.h"
 #include "banlist.h"
 #include "user.h"
 #include "core_config.h"
 #include "hashlist_func.h"
+#include "stats.h"
+#include "journal.h"
 
 unsigned char *ConfigFile;
 unsigned char *HardBanFile;
@@ -51,6 +66,45 @@ extern user_t *userlist;
 plugin_manager_t *manager;
 unsigned long pluginIDs;
 
+unsigned long AsyncQueueMax;
+plugin_async_stats_t asyncstats;
+
+plugin_save_stats_t savestats;
+#ifndef USE_WINDOWS
+pid_t savepid = 0;
+struct timeval savestart;
+unsigned long savemark = 0;
+FILE *savepart = NULL;		/* output of the SAVE event handlers, written before the fork */
+#endif
+
+plugin_config_loader_t *configloaders = NULL;
+plugin_config_snapshot_t *configsnapshots = NULL;
+unsigned int BinarySnapshot;
+banlist_parser_t hardbanparser, softbanparser;
+
+const unsigned char *plugin_eventnames[] = {
+  "login",
+  "search",
+  "chat",
+  "pmout",
+  "pmin",
+  "logout",
+  "kick",
+  "ban",
+  "infoupdate",
+  "sr",
+  "update",
+  "redirect",
+  "prelogin",
+  "cacheflush",
+  "load",
+  "save",
+  "config",
+  "disconnect",
+  "zombie",
+  NULL
+};
+
 flag_t plugin_supports[] = {
   {"NoGetINFO", 1, ""},
   {"NoHello", 2, ""},
@@ -102,9 +156,20 @@ int plugin_report (buffer_t * message)
 
 /******************************* UTILITIES: USER MANAGEMENT **************************************/
 
+/* async observers get copies of users without private data. those are no users the hub can act
+ *  on, the utilities refuse them. */
+#define PLUGIN_USER_SNAPSHOT(user)	(!(user)->private)
+
 int plugin_user_next (plugin_user_t ** user)
 {
-  user_t *u = *user ? ((plugin_private_t *) (*user)->private)->parent->next : userlist;
+  user_t *u;
+
+  if (*user && PLUGIN_USER_SNAPSHOT (*user)) {
+    *user = NULL;
+    return 0;
+  }
+
+  u = *user ? ((plugin_private_t *) (*user)->private)->parent->next : userlist;
 
   while (u && (u->state != PROTO_STATE_ONLINE))
     u = u->next;
@@ -127,7 +192,12 @@ plugin_user_t *plugin_user_find (unsigned char *name)
 
 plugin_user_t *plugin_user_find_ip (plugin_user_t * last, unsigned long ip)
 {
-  user_t *u = last ? ((plugin_private_t *) (last)->private)->parent : NULL;
+  user_t *u;
+
+  if (last && PLUGIN_USER_SNAPSHOT (last))
+    return NULL;
+
+  u = last ? ((plugin_private_t *) (last)->private)->parent : NULL;
 
   u = hash_find_ip_next (&hashlist, u, ip);
   if (!u)
@@ -138,7 +208,12 @@ plugin_user_t *plugin_user_find_ip (plugin_user_t * last, unsigned long ip)
 
 plugin_user_t *plugin_user_find_net (plugin_user_t * last, unsigned long ip, unsigned long netmask)
 {
-  user_t *u = last ? ((plugin_private_t *) (last)->private)->parent : NULL;
+  user_t *u;
+
+  if (last && PLUGIN_USER_SNAPSHOT (last))
+    return NULL;
+
+  u = last ? ((plugin_private_t *) (last)->private)->parent : NULL;
 
   u = hash_find_net_next (&hashlist, u, ip, netmask);
   if (!u)
@@ -149,6 +224,9 @@ plugin_user_t *plugin_user_find_net (plugin_user_t * last, unsigned long ip, uns
 
 buffer_t *plugin_user_getmyinfo (plugin_user_t * user)
 {
+  if (PLUGIN_USER_SNAPSHOT (user))
+    return NULL;
+
   return ((user_t *) ((plugin_private_t *) user->private)->parent)->MyINFO;
 }
 
@@ -158,7 +236,7 @@ int plugin_user_drop (plugin_user_t * user, buffer_t * message)
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -175,7 +253,7 @@ int plugin_user_kick (plugin_user_t * op, plugin_user_t * user, buffer_t * messa
   buffer_t *b;
   unsigned int retval;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -208,7 +286,7 @@ int plugin_user_banip (plugin_user_t * op, plugin_user_t * user, buffer_t * mess
   buffer_t *b;
   unsigned int retval;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -238,7 +316,7 @@ int plugin_user_unban (plugin_user_t * user)
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -254,7 +332,7 @@ int plugin_user_zombie (plugin_user_t * user)
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -269,7 +347,7 @@ int plugin_user_unzombie (plugin_user_t * user)
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -338,7 +416,7 @@ int plugin_user_banip_hard (plugin_user_t * op, plugin_user_t * user, buffer_t *
   buffer_t *b;
   unsigned int retval;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -371,7 +449,7 @@ int plugin_user_bannick (plugin_user_t * op, plugin_user_t * user, buffer_t * me
   buffer_t *b;
   unsigned int retval;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -404,7 +482,7 @@ int plugin_user_ban (plugin_user_t * op, plugin_user_t * user, buffer_t * messag
   buffer_t *b;
   unsigned int retval;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -578,6 +656,9 @@ int plugin_user_setrights (plugin_user_t * user, unsigned long long cap, unsigne
 {
   user_t *u;
 
+  if (PLUGIN_USER_SNAPSHOT (user))
+    return 0;
+
   u = ((plugin_private_t *) user->private)->parent;
 
   user->rights |= cap;
@@ -607,7 +688,7 @@ int plugin_user_redirect (plugin_user_t * user, buffer_t * message)
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -622,7 +703,7 @@ int plugin_user_forcemove (plugin_user_t * user, unsigned char *destination, buf
 {
   user_t *u;
 
-  if (!user)
+  if (!user || PLUGIN_USER_SNAPSHOT (user))
     return 0;
 
   u = ((plugin_private_t *) user->private)->parent;
@@ -642,6 +723,9 @@ int plugin_user_say (plugin_user_t * src, buffer_t * message)
 {
   user_t *u;
 
+  if (src && PLUGIN_USER_SNAPSHOT (src))
+    return 0;
+
   if (src) {
     u = ((plugin_private_t *) src->private)->parent;
   } else {
@@ -660,7 +744,7 @@ int plugin_user_raw (plugin_user_t * tgt, buffer_t * message)
 {
   user_t *u;
 
-  if (!tgt)
+  if (!tgt || PLUGIN_USER_SNAPSHOT (tgt))
     return 0;
 
   u = ((plugin_private_t *) tgt->private)->parent;
@@ -691,6 +775,9 @@ int plugin_user_sayto (plugin_user_t * src, plugin_user_t * target, buffer_t * m
   buffer_t *b;
   user_t *u, *t;
 
+  if ((src && PLUGIN_USER_SNAPSHOT (src)) || PLUGIN_USER_SNAPSHOT (target))
+    return 0;
+
   if (src) {
     u = ((plugin_private_t *) src->private)->parent;
   } else {
@@ -721,6 +808,10 @@ int plugin_user_priv (plugin_user_t * src, plugin_user_t * target, plugin_user_t
   buffer_t *b;
   user_t *u, *t, *s;
 
+  if ((src && PLUGIN_USER_SNAPSHOT (src)) || PLUGIN_USER_SNAPSHOT (target)
+      || (user && PLUGIN_USER_SNAPSHOT (user)))
+    return 0;
+
   if (src) {
     u = ((plugin_private_t *) src->private)->parent;
   } else {
@@ -748,6 +839,65 @@ int plugin_user_priv (plugin_user_t * src, plugin_user_t * target, plugin_user_t
     : ((plugin_private_t *) target->private)->proto->chat_priv (u, t, s, message);
 }
 
+/* one private message to many users. the protocol formats the message once and shares it */
+int plugin_user_priv_multi (plugin_user_t * src, plugin_user_t ** targets, unsigned int count,
+			    plugin_user_t * user, buffer_t * message)
+{
+  buffer_t *b;
+  user_t *u, *s, **t;
+  proto_t *proto;
+  unsigned int i, j;
+  int retval = 0;
+
+  if (!count)
+    return 0;
+
+  if ((src && PLUGIN_USER_SNAPSHOT (src)) || (user && PLUGIN_USER_SNAPSHOT (user)))
+    return -1;
+  for (i = 0; i < count; i++)
+    if (PLUGIN_USER_SNAPSHOT (targets[i]))
+      return -1;
+
+  if (src) {
+    u = ((plugin_private_t *) src->private)->parent;
+  } else {
+    u = HubSec;
+  }
+
+  if (user) {
+    s = ((plugin_private_t *) user->private)->parent;
+  } else {
+    s = HubSec;
+  }
+
+  /* delete trailing \n */
+  b = message;
+  while (b->next)
+    b = b->next;
+  if (bf_used (b) && (b->s[bf_used (b) - 1] == '\n')) {
+    b->s[bf_used (b) - 1] = '\0';
+    b->e--;
+  }
+
+  t = malloc (count * sizeof (user_t *));
+  if (!t)
+    return -1;
+
+  /* hand each run of targets with the same protocol over at once */
+  for (i = 0; i < count; i = j) {
+    proto = ((plugin_private_t *) targets[i]->private)->proto;
+    for (j = i; (j < count) && (((plugin_private_t *) targets[j]->private)->proto == proto); j++)
+      t[j - i] = ((plugin_private_t *) targets[j]->private)->parent;
+
+    if (proto->chat_priv_multi (u, t, j - i, s, message) < 0)
+      retval = -1;
+  }
+
+  free (t);
+
+  return retval;
+}
+
 int plugin_user_printf (plugin_user_t * user, const char *format, ...)
 {
   va_list ap;
@@ -820,6 +970,9 @@ int plugin_parse (plugin_user_t * user, buffer_t * buf)
 {
   user_t *u;
 
+  if (PLUGIN_USER_SNAPSHOT (user))
+    return -1;
+
   u = ((plugin_private_t *) user->private)->parent;
 
   ((plugin_private_t *) user->private)->proto->handle_token (u, buf);
@@ -874,12 +1027,281 @@ int plugin_ignore (plugin_t * plugin, unsigned long event, plugin_event_handler_
   return 0;
 }
 
+/******************************* ACCOUNTING *******************************************/
+
+unsigned long plugin_latency_since (struct timeval *start)
+{
+  struct timeval stop;
+  unsigned long usec;
+
+  gettimeofday (&stop, NULL);
+  usec = (stop.tv_sec - start->tv_sec) * 1000000 + (stop.tv_usec - start->tv_usec);
+
+  /* chain measurements: the next one starts here */
+  *start = stop;
+
+  /* clock went backwards */
+  if (usec > 1000000000)
+    return 0;
+
+  return usec;
+}
+
+void plugin_latency_add (plugin_latency_t * latency, unsigned long usec)
+{
+  unsigned int i;
+  unsigned long limit;
+
+  latency->calls++;
+  latency->total += usec;
+  if (usec > latency->max)
+    latency->max = usec;
+
+  for (i = 0, limit = 10; (i < (PLUGIN_LATENCY_BUCKETS - 1)) && (usec >= limit); i++)
+    limit *= 10;
+
+  latency->histogram[i]++;
+}
+
+int plugin_latency_print (buffer_t * output, const unsigned char *name, plugin_latency_t * latency)
+{
+  return bf_printf (output, "%-32s %8lu %10llu %7lu %6llu  %lu/%lu/%lu/%lu/%lu/%lu\n", name,
+		    latency->calls, latency->total, latency->max,
+		    latency->calls ? latency->total / latency->calls : 0ULL,
+		    latency->histogram[0], latency->histogram[1], latency->histogram[2],
+		    latency->histogram[3], latency->histogram[4], latency->histogram[5]);
+}
+
+int plugin_latency_register (unsigned char *prefix, plugin_latency_t * latency)
+{
+  unsigned char name[CONFIG_NAMELENGTH];
+
+  snprintf (name, sizeof (name), "%.*s.calls", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_register (name, VAL_ELEM_ULONG, &latency->calls, _("Number of handler calls."));
+  snprintf (name, sizeof (name), "%.*s.time", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_register (name, VAL_ELEM_ULONGLONG, &latency->total,
+		  _("Total time spent in the handlers, in microseconds."));
+  snprintf (name, sizeof (name), "%.*s.max", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_register (name, VAL_ELEM_ULONG, &latency->max,
+		  _("Longest single handler call, in microseconds."));
+
+  return 0;
+}
+
+int plugin_latency_unregister (unsigned char *prefix)
+{
+  unsigned char name[CONFIG_NAMELENGTH];
+
+  snprintf (name, sizeof (name), "%.*s.calls", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_unregister (name);
+  snprintf (name, sizeof (name), "%.*s.time", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_unregister (name);
+  snprintf (name, sizeof (name), "%.*s.max", PLUGIN_LATENCY_PREFIX - 1, prefix);
+  stats_unregister (name);
+
+  return 0;
+}
+
+#define PLUGIN_LATENCY_GROW(output) \
+	if (bf_unused (output) < 256) { \
+	  buffer_t *b = bf_alloc (10000); \
+	  bf_append (&output, b); \
+	  output = b; \
+	}
+
+/* print the handler times of the plugins, events or event handlers, selected by what.
+ *  an empty string prints all of them. returns the last buffer of the output chain. */
+buffer_t *plugin_latency_report (buffer_t * output, unsigned char *what)
+{
+  unsigned int i;
+  unsigned char name[128];
+  plugin_t *plugin;
+  plugin_event_request_t *r;
+
+  if (!*what || !strcmp (what, "plugins")) {
+    bf_printf (output, _("Plugins:\n"));
+    for (plugin = manager->plugins.next; plugin != &manager->plugins; plugin = plugin->next) {
+      PLUGIN_LATENCY_GROW (output);
+      plugin_latency_print (output, plugin->name, &plugin->latency);
+    }
+  }
+
+  if (!*what || !strcmp (what, "events")) {
+    bf_printf (output, _("Events:\n"));
+    for (i = 0; i < PLUGIN_EVENT_NUMBER; i++) {
+      PLUGIN_LATENCY_GROW (output);
+      plugin_latency_print (output, plugin_eventnames[i], &manager->eventlatency[i]);
+    }
+  }
+
+  if (!*what || !strcmp (what, "handlers")) {
+    bf_printf (output, _("Handlers:\n"));
+    for (i = 0; i < PLUGIN_EVENT_NUMBER; i++) {
+      for (r = manager->eventhandles[i].next; r != &manager->eventhandles[i]; r = r->next) {
+	PLUGIN_LATENCY_GROW (output);
+	snprintf (name, sizeof (name), "%s/%s", plugin_eventnames[i],
+		  r->plugin ? r->plugin->name : "core");
+	plugin_latency_print (output, name, &r->latency);
+      }
+      for (r = manager->observers[i].next; r != &manager->observers[i]; r = r->next) {
+	PLUGIN_LATENCY_GROW (output);
+	snprintf (name, sizeof (name), "%s/%s (async)", plugin_eventnames[i],
+		  r->plugin ? r->plugin->name : "core");
+	plugin_latency_print (output, name, &r->latency);
+      }
+    }
+  }
+
+  return output;
+}
+
+/******************************* ASYNC OBSERVERS *******************************************/
+
+int plugin_observe (plugin_t * plugin, unsigned long event, plugin_event_handler_t * handler)
+{
+  plugin_event_request_t *request;
+
+  if (event >= PLUGIN_EVENT_NUMBER)
+    return -1;
+
+  /* these tokens are not buffers and do not survive the event */
+  if ((event == PLUGIN_EVENT_LOAD) || (event == PLUGIN_EVENT_SAVE)
+      || (event == PLUGIN_EVENT_CONFIG))
+    return -1;
+
+  request = malloc (sizeof (plugin_event_request_t));
+  memset (request, 0, sizeof (plugin_event_request_t));
+  request->plugin = plugin;
+  request->handler = handler;
+
+  /* observers are called in order of registration */
+  request->prev = manager->observers[event].prev;
+  request->prev->next = request;
+  request->next = &manager->observers[event];
+  manager->observers[event].prev = request;
+
+  if (plugin)
+    plugin->events++;
+
+  return 0;
+}
+
+int plugin_unobserve (plugin_t * plugin, unsigned long event, plugin_event_handler_t * handler)
+{
+  plugin_event_request_t *request;
+
+  for (request = manager->observers[event].next; request != &manager->observers[event];
+       request = request->next)
+    if ((request->plugin == plugin) && (request->handler == handler))
+      break;
+
+  if (request == &manager->observers[event])
+    return 0;
+
+  request->next->prev = request->prev;
+  request->prev->next = request->next;
+
+  free (request);
+  if (plugin)
+    plugin->events--;
+
+  return 0;
+}
+
+static void plugin_queue_event (plugin_private_t * priv, unsigned long event, buffer_t * token)
+{
+  plugin_event_record_t *rec;
+
+  if (manager->queued >= AsyncQueueMax) {
+    asyncstats.dropped++;
+    return;
+  }
+
+  rec = malloc (sizeof (plugin_event_record_t));
+  if (!rec) {
+    asyncstats.dropped++;
+    return;
+  }
+
+  rec->next = NULL;
+  rec->event = event;
+  rec->hasuser = (priv != NULL);
+  if (priv) {
+    rec->user = priv->user;
+    rec->user.private = NULL;
+  }
+  rec->token = bf_keep (token);
+  gettimeofday (&rec->stamp, NULL);
+
+  *manager->queuetail = rec;
+  manager->queuetail = &rec->next;
+
+  manager->queued++;
+  asyncstats.queued++;
+  if (manager->queued > asyncstats.peak)
+    asyncstats.peak = manager->queued;
+}
+
+unsigned long plugin_flush_events ()
+{
+  unsigned long count = 0, delay;
+  plugin_event_record_t *rec, *next;
+  plugin_event_request_t *r, *e;
+  struct timeval start, stop;
+
+  if (!manager->queue)
+    return 0;
+
+  /* detach the batch: observers may generate new events */
+  rec = manager->queue;
+  manager->queue = NULL;
+  manager->queuetail = &manager->queue;
+  manager->queued = 0;
+
+  gettimeofday (&start, NULL);
+  stop = start;
+  for (; rec; rec = next) {
+    next = rec->next;
+
+    delay = (start.tv_sec - rec->stamp.tv_sec) * 1000000 + (start.tv_usec - rec->stamp.tv_usec);
+    if (delay > asyncstats.maxdelay)
+      asyncstats.maxdelay = delay;
+
+    e = &manager->observers[rec->event];
+    for (r = e->next; r != e; r = r->next) {
+      r->handler (rec->hasuser ? &rec->user : NULL, NULL, rec->event, rec->token);
+
+      delay = plugin_latency_since (&stop);
+      plugin_latency_add (&r->latency, delay);
+      if (r->plugin)
+	plugin_latency_add (&r->plugin->latency, delay);
+    }
+
+    if (rec->token)
+      bf_free (rec->token);
+    free (rec);
+    count++;
+  }
+  gettimeofday (&stop, NULL);
+
+  delay = (stop.tv_sec - start.tv_sec) * 1000000 + (stop.tv_usec - start.tv_usec);
+  if (delay > asyncstats.maxflush)
+    asyncstats.maxflush = delay;
+
+  asyncstats.delivered += count;
+
+  return count;
+}
+
 /******************************* CLAIM/RELEASE *******************************************/
 
 int plugin_claim (plugin_t * plugin, plugin_user_t * user, void *cntxt)
 {
   plugin_private_t *priv = user->private;
 
+  if (!priv)
+    return -1;
+
   ASSERT (!priv->store[plugin->id]);
   priv->store[plugin->id] = cntxt;
 
@@ -892,6 +1314,9 @@ int plugin_release (plugin_t * plugin, plugin_user_t * user)
 {
   plugin_private_t *priv = user->private;
 
+  if (!priv)
+    return -1;
+
   priv->store[plugin->id] = NULL;
 
   plugin->privates--;
@@ -903,6 +1328,9 @@ void *plugin_retrieve (plugin_t * plugin, plugin_user_t * user)
 {
   plugin_private_t *priv = user->private;
 
+  if (!priv)
+    return NULL;
+
   return priv->store[plugin->id];
 }
 
@@ -913,6 +1341,7 @@ void *plugin_retrieve (plugin_t * plugin, plugin_user_t * user)
 plugin_t *plugin_register (const char *name)
 {
   plugin_t *plugin;
+  unsigned char prefix[PLUGIN_LATENCY_PREFIX];
 
   plugin = malloc (sizeof (plugin_t));
   if (!plugin)
@@ -930,12 +1359,17 @@ plugin_t *plugin_register (const char *name)
   plugin->next->prev = plugin;
   manager->plugins.next = plugin;
 
+  /* export handler accounting */
+  snprintf (prefix, sizeof (prefix), "plugin.%.*s", PLUGIN_LATENCY_PREFIX - 8, plugin->name);
+  plugin_latency_register (prefix, &plugin->latency);
+
   return plugin;
 }
 
 int plugin_unregister (plugin_t * plugin)
 {
   plugin_private_t *p;
+  unsigned char prefix[PLUGIN_LATENCY_PREFIX];
 
   /* force clearing of all private data */
   for (p = manager->privates.next; p != &manager->privates; p = p->next)
@@ -950,6 +1384,9 @@ int plugin_unregister (plugin_t * plugin)
   ASSERT (!plugin->events);
   ASSERT (!plugin->robots);
 
+  snprintf (prefix, sizeof (prefix), "plugin.%.*s", PLUGIN_LATENCY_PREFIX - 8, plugin->name);
+  plugin_latency_unregister (prefix);
+
   /* unlink and free */
   plugin->next->prev = plugin->prev;
   plugin->prev->next = plugin->next;
@@ -962,36 +1399,64 @@ int plugin_unregister (plugin_t * plugin)
 
 unsigned long plugin_user_event (plugin_user_t * user, unsigned long event, void *token)
 {
+  if (user && PLUGIN_USER_SNAPSHOT (user))
+    return PLUGIN_RETVAL_CONTINUE;
+
   return plugin_send_event (user ? ((plugin_private_t *) user->private) : NULL, event, token);
 }
 
 unsigned long plugin_send_event (plugin_private_t * priv, unsigned long event, void *token)
 {
-  unsigned long retval = PLUGIN_RETVAL_CONTINUE;
+  unsigned long retval = PLUGIN_RETVAL_CONTINUE, usec, total = 0;
   plugin_event_request_t *r, *e;
+  struct timeval t;
 
   e = &manager->eventhandles[event];
   r = manager->eventhandles[event].next;
+  gettimeofday (&t, NULL);
   if (priv) {
-    if (priv->handler)
+    if (priv->handler) {
       retval = priv->handler (&priv->user, NULL, event, token);
+      total += plugin_latency_since (&t);
+    }
 
     if (retval)
-      return retval;
+      goto leave;
 
     for (; r != e; r = r->next) {
       retval = r->handler (&priv->user, priv->store[r->plugin->id], event, token);
+
+      usec = plugin_latency_since (&t);
+      plugin_latency_add (&r->latency, usec);
+      plugin_latency_add (&r->plugin->latency, usec);
+      total += usec;
+
       if (retval)
 	break;
     }
   } else {
     for (; r != e; r = r->next) {
       retval = r->handler (NULL, NULL, event, token);
+
+      usec = plugin_latency_since (&t);
+      plugin_latency_add (&r->latency, usec);
+      if (r->plugin)
+	plugin_latency_add (&r->plugin->latency, usec);
+      total += usec;
+
       if (retval)
 	break;
     }
   }
 
+  /* only events that were not dropped reach the observers */
+  if ((retval == PLUGIN_RETVAL_CONTINUE)
+      && (manager->observers[event].next != &manager->observers[event]))
+    plugin_queue_event (priv, event, token);
+
+leave:
+  plugin_latency_add (&manager->eventlatency[event], total);
+
   return retval;
 }
 
@@ -1062,57 +1527,531 @@ unsigned long plugin_del_user (plugin_private_t ** priv)
 
 /******************************* INIT *******************************************/
 
-int plugin_config_xml (xml_node_t * node)
+int plugin_config_xml (xml_writer_t * w)
 {
   int retval = 0;
 
   /* add configvalues */
-  retval = cap_save (node);
-  retval = config_save (node);
-  retval = accounts_save (node);
-  retval = banlist_save (&hardbanlist, xml_node_add (node, "HardBanList"));
-  retval = banlist_save (&softbanlist, xml_node_add (node, "SoftBanList"));
+  retval = cap_save (w);
+  retval = config_save (w);
+  if (BinarySnapshot) {
+    /* the tables are in the snapshot, loading it depends on this reference */
+    xml_writer_value (w, "Snapshot", XML_TYPE_STRING, DEFAULT_SNAPSHOTFILE);
+  } else {
+    retval = accounts_save (w);
+    xml_writer_start (w, "HardBanList");
+    retval = banlist_save (&hardbanlist, w);
+    xml_writer_end (w);
+    xml_writer_start (w, "SoftBanList");
+    retval = banlist_save (&softbanlist, w);
+    xml_writer_end (w);
+  }
 
-  plugin_send_event (NULL, PLUGIN_EVENT_SAVE, node);
+#ifndef USE_WINDOWS
+  if (savepart) {
+    xml_writer_copy (w, savepart);
+    return retval;
+  }
+#endif
+  plugin_send_event (NULL, PLUGIN_EVENT_SAVE, w);
 
   return retval;
 }
 
-int plugin_config_save (buffer_t * output)
+int plugin_config_binary ()
+{
+  return BinarySnapshot;
+}
+
+/* write the binary snapshot to a temporary file and move it in place. returns the size written. */
+static unsigned long plugin_config_snapshot_write (buffer_t * output)
 {
   FILE *fp;
-  int retval = 0;
-  xml_node_t *node;
+  snapshot_t *s;
+  plugin_config_snapshot_t *t;
+  unsigned long size = 0;
+  int err;
 
-  /* write to file */
-  fp = fopen (HUBSOFT_NAME ".xml", "w+");
+  fp = fopen (DEFAULT_SNAPSHOTFILE ".tmp", "wb");
   if (!fp) {
-    bf_printf (output, _("Error saving configuration to %s: %s\n"), HUBSOFT_NAME ".xml",
-	       strerror (errno));
-    goto leave;
+    if (output)
+      bf_printf (output, _("Error saving snapshot to %s: %s\n"), DEFAULT_SNAPSHOTFILE ".tmp",
+		 strerror (errno));
+    return 0;
+  }
+
+  s = snapshot_create (fp);
+  if (s) {
+    for (t = configsnapshots; t; t = t->next)
+      t->save (s, t->name, t->ctxt);
+    size = snapshot_finish (s);
+  }
+
+  err = ferror (fp);
+  err |= fclose (fp);
+  if (!size || err) {
+    if (output)
+      bf_printf (output, _("Error saving snapshot to %s: %s\n"), DEFAULT_SNAPSHOTFILE ".tmp",
+		 strerror (errno));
+    unlink (DEFAULT_SNAPSHOTFILE ".tmp");
+    return 0;
   }
 
-  /* start tree */
-  node = xml_node_add (NULL, HUBSOFT_NAME);
+#ifdef USE_WINDOWS
+  unlink (DEFAULT_SNAPSHOTFILE);
+#endif
+  if (rename (DEFAULT_SNAPSHOTFILE ".tmp", DEFAULT_SNAPSHOTFILE)) {
+    if (output)
+      bf_printf (output, _("Error saving snapshot to %s: %s\n"), DEFAULT_SNAPSHOTFILE,
+		 strerror (errno));
+    unlink (DEFAULT_SNAPSHOTFILE ".tmp");
+    return 0;
+  }
 
-  retval = plugin_config_xml (node);
+  return size;
+}
 
-  xml_write (fp, node);
-  fclose (fp);
+/* write the configuration to a temporary file and move it in place. returns the size written. */
+unsigned long plugin_config_write (buffer_t * output)
+{
+  FILE *fp;
+  xml_writer_t *w;
+  unsigned long size = 0, snapshot = 0;
+  int err;
+
+  /* the snapshot goes first: it is only used once the new xml file refers to it */
+  if (BinarySnapshot) {
+    snapshot = plugin_config_snapshot_write (output);
+    if (!snapshot)
+      return 0;
+  }
+
+  fp = fopen (HUBSOFT_NAME ".xml.tmp", "w+");
+  if (!fp) {
+    if (output)
+      bf_printf (output, _("Error saving configuration to %s: %s\n"), HUBSOFT_NAME ".xml.tmp",
+		 strerror (errno));
+    return 0;
+  }
+
+  /* elements are written as they are emitted */
+  w = xml_writer_open (fp);
+  if (w) {
+    xml_writer_start (w, HUBSOFT_NAME);
+    plugin_config_xml (w);
+    size = xml_writer_close (w);
+  }
+
+  /* always close the file, even if the write failed */
+  err = ferror (fp);
+  err |= fclose (fp);
+  if (!size || err) {
+    if (output)
+      bf_printf (output, _("Error saving configuration to %s: %s\n"), HUBSOFT_NAME ".xml.tmp",
+		 strerror (errno));
+    unlink (HUBSOFT_NAME ".xml.tmp");
+    return 0;
+  }
+
+  /* only replace the old file once the new one is complete */
+#ifdef USE_WINDOWS
+  unlink (HUBSOFT_NAME ".xml");
+#endif
+  if (rename (HUBSOFT_NAME ".xml.tmp", HUBSOFT_NAME ".xml")) {
+    if (output)
+      bf_printf (output, _("Error saving configuration to %s: %s\n"), HUBSOFT_NAME ".xml",
+		 strerror (errno));
+    unlink (HUBSOFT_NAME ".xml.tmp");
+    return 0;
+  }
+
+  /* nothing refers to an older snapshot anymore */
+  if (!BinarySnapshot)
+    unlink (DEFAULT_SNAPSHOTFILE);
+
+  return size + snapshot;
+}
+
+static void plugin_config_saved (struct timeval *start, unsigned long size)
+{
+  unsigned long duration = plugin_latency_since (start) / 1000;
+
+  if (!size) {
+    savestats.failed++;
+    return;
+  }
+
+  savestats.count++;
+  savestats.size = size;
+  savestats.duration = duration;
+  if (duration > savestats.maxduration)
+    savestats.maxduration = duration;
+}
+
+int plugin_config_save (buffer_t * output)
+{
+  struct timeval start;
+  unsigned long size, mark;
+
+#ifndef USE_WINDOWS
+  /* a running background save would overwrite us with older data */
+  if (savepid) {
+    kill (savepid, SIGKILL);
+    waitpid (savepid, NULL, 0);
+    savepid = 0;
+  }
+#endif
+
+  gettimeofday (&start, NULL);
+  mark = journal_mark ();
+  size = plugin_config_write (output);
+  plugin_config_saved (&start, size);
+
+  /* the journalled changes are in the saved file now */
+  if (size)
+    journal_compact (mark);
+
+  return 0;
+}
+
+#ifndef USE_WINDOWS
+/* close all descriptors above stderr except keep. only the fds that are open are visited. */
+static void plugin_closefds (int keep)
+{
+  DIR *dir;
+  struct dirent *entry;
+  int fd, maxfd;
+
+#ifdef CLOSE_RANGE_UNSHARE
+  if (!close_range (keep + 1, ~0U, 0) && ((keep <= 3) || !close_range (3, keep - 1, 0)))
+    return;
+#endif
+
+  dir = opendir ("/proc/self/fd");
+  if (dir) {
+    while ((entry = readdir (dir)))
+      if (((fd = atoi (entry->d_name)) > 2) && (fd != keep) && (fd != dirfd (dir)))
+	close (fd);
+    closedir (dir);
+    return;
+  }
+
+  /* no close_range and no /proc */
+  maxfd = sysconf (_SC_OPEN_MAX);
+  for (fd = 3; fd < maxfd; fd++)
+    if (fd != keep)
+      close (fd);
+}
+#endif
+
+/* save from a forked copy of the hub, so the main loop doesn't wait for it */
+int plugin_config_save_background (buffer_t * output)
+{
+#ifndef USE_WINDOWS
+  pid_t pid;
+  xml_writer_t *w;
+
+  if (savepid) {
+    bf_printf (output, _("Previous background save is still running.\n"));
+    return -1;
+  }
+
+  gettimeofday (&savestart, NULL);
+  savemark = journal_mark ();
+
+  /* the SAVE event handlers may update their own state, so they run here.
+   *  the child only writes the files. */
+  savepart = tmpfile ();
+  if (!savepart) {
+    bf_printf (output, _("Cannot start background save: %s\n"), strerror (errno));
+    return plugin_config_save (output);
+  }
+  w = xml_writer_open_part (savepart, 1);
+  if (w) {
+    plugin_send_event (NULL, PLUGIN_EVENT_SAVE, w);
+    xml_writer_close (w);
+  }
+
+  /* don't let the child write our buffered output */
+  fflush (NULL);
+
+  if (!w || ferror (savepart)) {
+    fclose (savepart);
+    savepart = NULL;
+    bf_printf (output, _("Cannot start background save: %s\n"), strerror (errno));
+    return plugin_config_save (output);
+  }
+
+  pid = fork ();
+  if (pid < 0) {
+    fclose (savepart);
+    savepart = NULL;
+    bf_printf (output, _("Cannot start background save: %s\n"), strerror (errno));
+    return plugin_config_save (output);
+  }
+
+  if (!pid) {
+    /* the child has a private copy of all data. it must not keep the connections
+     *  open, and it leaves without cleaning up. */
+    plugin_closefds (fileno (savepart));
+    journal_suspend ();
+    _exit (plugin_config_write (NULL) ? 0 : 1);
+  }
+
+  fclose (savepart);
+  savepart = NULL;
+
+  savepid = pid;
+  savestats.background++;
+  savestats.forktime = plugin_latency_since (&savestart);
+
+  return 0;
+#else
+  return plugin_config_save (output);
+#endif
+}
+
+/* collect the result of a background save. returns 1 if it is still running. */
+int plugin_config_save_check (buffer_t * output)
+{
+#ifndef USE_WINDOWS
+  int status;
+  pid_t pid;
+  struct stat st, sst;
+
+  if (!savepid)
+    return 0;
+
+  pid = waitpid (savepid, &status, WNOHANG);
+  if (!pid)
+    return 1;
+
+  savepid = 0;
+
+  if ((pid < 0) || !WIFEXITED (status) || WEXITSTATUS (status)
+      || stat (HUBSOFT_NAME ".xml", &st)) {
+    bf_printf (output, _("Background save of %s failed.\n"), HUBSOFT_NAME ".xml");
+    plugin_config_saved (&savestart, 0);
+    return 0;
+  }
 
-  /* clear tree */
-  xml_free (node);
+  if (BinarySnapshot && !stat (DEFAULT_SNAPSHOTFILE, &sst))
+    st.st_size += sst.st_size;
+
+  plugin_config_saved (&savestart, st.st_size);
+
+  /* only changes made since the fork are still needed */
+  journal_compact (savemark);
+#endif
+  return 0;
+}
+
+/* elements with a registered loader are passed to it while the file is parsed,
+ *  no tree is built for them. */
+int plugin_config_loader_register (unsigned char *name, xml_parser_t * parser)
+{
+  plugin_config_loader_t *l;
+
+  l = malloc (sizeof (plugin_config_loader_t));
+  if (!l)
+    return -1;
+
+  l->name = strdup (name);
+  l->parser = parser;
+  l->next = configloaders;
+  configloaders = l;
+
+  return 0;
+}
+
+int plugin_config_loader_unregister (unsigned char *name)
+{
+  plugin_config_loader_t *l, **p;
+
+  for (p = &configloaders; *p; p = &(*p)->next)
+    if (!strcmp ((*p)->name, name))
+      break;
+
+  if (!*p)
+    return -1;
+
+  l = *p;
+  *p = l->next;
+  free (l->name);
+  free (l);
+
+  return 0;
+}
+
+int plugin_config_snapshot_register (unsigned char *name, plugin_snapshot_handler_t * save,
+				     plugin_snapshot_handler_t * load, void *ctxt)
+{
+  plugin_config_snapshot_t *t;
+
+  t = malloc (sizeof (plugin_config_snapshot_t));
+  if (!t)
+    return -1;
+
+  t->name = strdup (name);
+  t->save = save;
+  t->load = load;
+  t->ctxt = ctxt;
+  t->next = configsnapshots;
+  configsnapshots = t;
+
+  return 0;
+}
+
+int plugin_config_snapshot_unregister (unsigned char *name)
+{
+  plugin_config_snapshot_t *t, **p;
+
+  for (p = &configsnapshots; *p; p = &(*p)->next)
+    if (!strcmp ((*p)->name, name))
+      break;
+
+  if (!*p)
+    return -1;
+
+  t = *p;
+  *p = t->next;
+  free (t->name);
+  free (t);
+
+  return 0;
+}
+
+static int plugin_config_snapshot_load (buffer_t * output)
+{
+  snapshot_t *s;
+  plugin_config_snapshot_t *t;
+  int retval = 0;
+
+  s = snapshot_open (DEFAULT_SNAPSHOTFILE, output);
+  if (!s)
+    goto leave;
+
+  for (t = configsnapshots; t; t = t->next) {
+    if (!t->load (s, t->name, t->ctxt))
+      continue;
+    if (output)
+      bf_printf (output, _("Snapshot %s has an invalid %s section.\n"), DEFAULT_SNAPSHOTFILE,
+		 t->name);
+    retval = -1;
+  }
+
+  snapshot_close (s);
+
+  if (!retval)
+    return 0;
 
 leave:
+  /* keep the damaged file, the next save would replace it */
+  rename (DEFAULT_SNAPSHOTFILE, DEFAULT_SNAPSHOTFILE ".bad");
+  return -1;
+}
+
+/* routes the parse events to the loaders and builds a tree of everything else */
+typedef struct plugin_config_parser {
+  xml_parser_t parser;
+
+  xml_node_t *tree, *node;
+  xml_parser_t *loader;		/* loader of the current element */
+} plugin_config_parser_t;
+
+static int plugin_config_parse_start (xml_parser_t * parser, unsigned char *name)
+{
+  plugin_config_parser_t *p = (plugin_config_parser_t *) parser;
+  plugin_config_loader_t *l;
+
+  if (!parser->depth) {
+    if (strcmp (name, HUBSOFT_NAME))
+      return -1;
+    p->tree = p->node = xml_node_add (NULL, name);
+    return 0;
+  }
+
+  if (!p->loader && (parser->depth == 1)) {
+    for (l = configloaders; l; l = l->next)
+      if (!strcmp (l->name, name))
+	break;
+    if (l)
+      p->loader = l->parser;
+  }
+
+  if (p->loader) {
+    p->loader->depth = parser->depth - 1;
+    return p->loader->start ? p->loader->start (p->loader, name) : 0;
+  }
+
+  p->node = xml_node_add (p->node, name);
+
   return 0;
+}
 
+static int plugin_config_parse_value (xml_parser_t * parser, unsigned char *name,
+				      unsigned char *value)
+{
+  plugin_config_parser_t *p = (plugin_config_parser_t *) parser;
+
+  if (p->loader) {
+    p->loader->depth = parser->depth - 1;
+    return p->loader->value ? p->loader->value (p->loader, name, value) : 0;
+  }
+
+  if (p->node)
+    xml_node_add_value (p->node, name, XML_TYPE_STRING, value);
+
+  return 0;
+}
+
+static int plugin_config_parse_end (xml_parser_t * parser, unsigned char *name)
+{
+  plugin_config_parser_t *p = (plugin_config_parser_t *) parser;
+  xml_parser_t *loader = p->loader;
+
+  if (loader) {
+    if (parser->depth == 1)
+      p->loader = NULL;
+    loader->depth = parser->depth - 1;
+    return loader->end ? loader->end (loader, name) : 0;
+  }
+
+  if (parser->depth)
+    p->node = xml_parent (p->node);
+
+  return 0;
+}
+
+/* the loaders only collect while parsing: apply or drop that once the document is done */
+static void plugin_config_loaders_finish (int ok)
+{
+  plugin_config_loader_t *l, *o;
+
+  for (l = configloaders; l; l = l->next) {
+    if (!l->parser->finish)
+      continue;
+    /* a parser can be registered for several elements */
+    for (o = configloaders; o != l; o = o->next)
+      if (o->parser == l->parser)
+	break;
+    if (o == l)
+      l->parser->finish (l->parser, ok);
+  }
 }
 
 int plugin_config_load (buffer_t * output)
 {
   int retval = 0;
   FILE *fp;
-  xml_node_t *node, *list;
+  buffer_t *buf;
+  plugin_config_parser_t parser;
+  struct timeval start;
+
+  gettimeofday (&start, NULL);
+
+  /* loading recreates everything, none of it needs to be journalled again */
+  journal_suspend ();
 
   fp = fopen (HUBSOFT_NAME ".xml", "r+");
   if (!fp) {
@@ -1122,29 +2061,45 @@ int plugin_config_load (buffer_t * output)
     goto leave;
   }
 
-  node = xml_read (fp);
+  buf = xml_load (fp);
 
   fclose (fp);
 
-  if (!node)
+  if (!buf)
     goto leave;
 
-  if (strcmp (node->name, HUBSOFT_NAME)) {
-    xml_free (node);
+  /* the file is parsed in place, names and values point into buf */
+  memset (&parser, 0, sizeof (plugin_config_parser_t));
+  parser.parser.start = plugin_config_parse_start;
+  parser.parser.value = plugin_config_parse_value;
+  parser.parser.end = plugin_config_parse_end;
+
+  if (xml_parse (&parser.parser, buf->s, buf->e) || !parser.tree) {
+    if (output)
+      bf_printf (output, _("Error parsing configuration from %s\n"), HUBSOFT_NAME ".xml");
+    plugin_config_loaders_finish (0);
+    if (parser.tree)
+      xml_free (parser.tree);
+    bf_free (buf);
     goto leave;
   }
+  plugin_config_loaders_finish (1);
+  bf_free (buf);
+
+  if (xml_node_find (parser.tree, "Snapshot"))
+    plugin_config_snapshot_load (output);
 
-  cap_load (node);
-  config_load (node);
-  accounts_load (node);
-  list = xml_node_find (node, "HardBanList");
-  banlist_load (&hardbanlist, list);
-  list = xml_node_find (node, "SoftBanList");
-  banlist_load (&softbanlist, list);
+  config_load (parser.tree);
 
-  plugin_send_event (NULL, PLUGIN_EVENT_LOAD, node);
+  plugin_send_event (NULL, PLUGIN_EVENT_LOAD, parser.tree);
 
-  xml_free (node);
+  xml_free (parser.tree);
+
+  /* add the changes made since the file was saved */
+  journal_replay (output);
+  journal_resume ();
+
+  savestats.loadduration = plugin_latency_since (&start) / 1000;
 
   return 0;
 leave:
@@ -1156,6 +2111,9 @@ leave:
 
   plugin_send_event (NULL, PLUGIN_EVENT_LOAD, NULL);
 
+  journal_replay (output);
+  journal_resume ();
+
   return retval;
 }
 
@@ -1164,6 +2122,7 @@ leave:
 int plugin_init ()
 {
   int i;
+  xml_parser_t *parser;
 
   pluginIDs = 0;
 
@@ -1178,7 +2137,10 @@ int plugin_init ()
   for (i = 0; i < PLUGIN_EVENT_NUMBER; i++) {
     manager->eventhandles[i].next = &manager->eventhandles[i];
     manager->eventhandles[i].prev = &manager->eventhandles[i];
+    manager->observers[i].next = &manager->observers[i];
+    manager->observers[i].prev = &manager->observers[i];
   }
+  manager->queuetail = &manager->queue;
   manager->num = PLUGIN_MAX_PLUGINS;
 
   ConfigFile = strdup (DEFAULT_SAVEFILE);
@@ -1186,5 +2148,69 @@ int plugin_init ()
   SoftBanFile = strdup (DEFAULT_SOFTBANFILE);
   AccountsFile = strdup (DEFAULT_ACCOUNTSFILE);
 
+  plugin_config_loader_register ("CustomRights", cap_parser ());
+  parser = accounts_parser ();
+  plugin_config_loader_register ("Groups", parser);
+  plugin_config_loader_register ("Accounts", parser);
+  plugin_config_loader_register ("HardBanList", banlist_parser (&hardbanparser, &hardbanlist));
+  plugin_config_loader_register ("SoftBanList", banlist_parser (&softbanparser, &softbanlist));
+
+  BinarySnapshot = DEFAULT_BINARYSNAPSHOT;
+  config_register ("BinarySnapshot", CFG_ELEM_UINT, &BinarySnapshot,
+		   _("Save accounts and bans to " DEFAULT_SNAPSHOTFILE " in a binary format instead of the xml file. It loads much faster, but only on the same platform."));
+
+  plugin_config_snapshot_register ("Accounts", accounts_snapshot_save, accounts_snapshot_load,
+				   NULL);
+  plugin_config_snapshot_register ("HardBanList",
+				   (plugin_snapshot_handler_t *) banlist_snapshot_save,
+				   (plugin_snapshot_handler_t *) banlist_snapshot_load, &hardbanlist);
+  plugin_config_snapshot_register ("SoftBanList",
+				   (plugin_snapshot_handler_t *) banlist_snapshot_save,
+				   (plugin_snapshot_handler_t *) banlist_snapshot_load, &softbanlist);
+
+  for (i = 0; i < PLUGIN_EVENT_NUMBER; i++) {
+    unsigned char prefix[CONFIG_NAMELENGTH];
+
+    snprintf (prefix, sizeof (prefix), "plugin.event.%s", plugin_eventnames[i]);
+    plugin_latency_register (prefix, &manager->eventlatency[i]);
+  }
+
+  AsyncQueueMax = DEFAULT_ASYNCQUEUEMAX;
+  memset (&asyncstats, 0, sizeof (plugin_async_stats_t));
+
+  config_register ("plugin.asyncqueue", CFG_ELEM_ULONG, &AsyncQueueMax,
+		   _("Maximum number of events queued for asynchronous observers. Events beyond this are not delivered to them."));
+
+  stats_register ("plugin.async.queued", VAL_ELEM_ULONG, &asyncstats.queued,
+		  _("Number of events queued for asynchronous observers."));
+  stats_register ("plugin.async.delivered", VAL_ELEM_ULONG, &asyncstats.delivered,
+		  _("Number of events delivered to asynchronous observers."));
+  stats_register ("plugin.async.dropped", VAL_ELEM_ULONG, &asyncstats.dropped,
+		  _("Number of events not delivered because the queue was full."));
+  stats_register ("plugin.async.peak", VAL_ELEM_ULONG, &asyncstats.peak,
+		  _("Maximum number of events queued in a single loop iteration."));
+  stats_register ("plugin.async.maxdelay", VAL_ELEM_ULONG, &asyncstats.maxdelay,
+		  _("Maximum delay in microseconds between queueing and delivery of an event."));
+  memset (&savestats, 0, sizeof (plugin_save_stats_t));
+  stats_register ("load.duration", VAL_ELEM_ULONG, &savestats.loadduration,
+		  _("Time in milliseconds it took to load the configuration file."));
+  stats_register ("save.count", VAL_ELEM_ULONG, &savestats.count,
+		  _("Number of times the configuration was saved."));
+  stats_register ("save.background", VAL_ELEM_ULONG, &savestats.background,
+		  _("Number of saves done by a background process."));
+  stats_register ("save.failed", VAL_ELEM_ULONG, &savestats.failed,
+		  _("Number of failed saves."));
+  stats_register ("save.size", VAL_ELEM_ULONG, &savestats.size,
+		  _("Size in bytes of the last saved configuration."));
+  stats_register ("save.duration", VAL_ELEM_ULONG, &savestats.duration,
+		  _("Duration of the last save in milliseconds. Background saves are collected once per second."));
+  stats_register ("save.maxduration", VAL_ELEM_ULONG, &savestats.maxduration,
+		  _("Longest save in milliseconds."));
+  stats_register ("save.forktime", VAL_ELEM_ULONG, &savestats.forktime,
+		  _("Time in microseconds the hub was blocked starting the last background save."));
+
+  stats_register ("plugin.async.maxflush", VAL_ELEM_ULONG, &asyncstats.maxflush,
+		  _("Maximum time in microseconds spent delivering a single batch."));
+
   return 0;
 }
@@ -23,6 +23,8 @@
 #include "config.h"
 #include "buffer.h"
 #include "cap.h"
+#include "aqtime.h"
+#include "snapshot.h"
 
 #define	PLUGIN_EVENT_LOGIN	  0
 #define	PLUGIN_EVENT_SEARCH	  1
@@ -85,6 +87,28 @@ extern flag_t plugin_supports[];
 typedef unsigned long (plugin_event_handler_t) (plugin_user_t *, void *, unsigned long event,
 						buffer_t * token);
 
+/* handler call accounting. all times are in microseconds. */
+#define PLUGIN_LATENCY_BUCKETS	6
+
+typedef struct plugin_latency {
+  unsigned long calls;
+  unsigned long long total;
+  unsigned long max;
+  unsigned long histogram[PLUGIN_LATENCY_BUCKETS];	/* <10us, <100us, <1ms, <10ms, <100ms, slower */
+} plugin_latency_t;
+
+/* longest stat prefix that still leaves room for ".calls", ".time" and ".max" */
+#define PLUGIN_LATENCY_PREFIX	(CONFIG_NAMELENGTH - 6)
+
+extern const unsigned char *plugin_eventnames[];
+
+extern unsigned long plugin_latency_since (struct timeval *start);
+extern void plugin_latency_add (plugin_latency_t *, unsigned long usec);
+extern int plugin_latency_print (buffer_t * output, const unsigned char *name, plugin_latency_t *);
+extern int plugin_latency_register (unsigned char *prefix, plugin_latency_t *);
+extern int plugin_latency_unregister (unsigned char *prefix);
+extern buffer_t *plugin_latency_report (buffer_t * output, unsigned char *what);
+
 /* register plugin */
 extern plugin_t *plugin_register (const char *name);
 extern int plugin_unregister (plugin_t *);
@@ -93,6 +117,13 @@ extern int plugin_unregister (plugin_t *);
 extern int plugin_request (plugin_t *, unsigned long event, plugin_event_handler_t *);
 extern int plugin_ignore (plugin_t *, unsigned long event, plugin_event_handler_t *);
 
+/* request asynchronous observer per event. observers are called after the current loop
+ * iteration with a snapshot of the user (no private data) and cannot drop the event.
+ * the plugin_user_* utilities and plugin_claim/release/retrieve refuse such a snapshot;
+ * to act on a user that is still online, look it up again with plugin_user_find (nick). */
+extern int plugin_observe (plugin_t *, unsigned long event, plugin_event_handler_t *);
+extern int plugin_unobserve (plugin_t *, unsigned long event, plugin_event_handler_t *);
+
 /* this stores or releases the private pointer of a plugin. */
 extern int plugin_claim (plugin_t *, plugin_user_t *, void *);
 extern int plugin_release (plugin_t *, plugin_user_t *);
@@ -137,6 +168,8 @@ extern int plugin_user_sayto (plugin_user_t * src, plugin_user_t * target,
 				       buffer_t * message,int direct);
 extern int plugin_user_priv (plugin_user_t * src, plugin_user_t * target,
 				      plugin_user_t * source, buffer_t * message, int direct);
+extern int plugin_user_priv_multi (plugin_user_t * src, plugin_user_t ** targets,
+				   unsigned int count, plugin_user_t * source, buffer_t * message);
 extern int plugin_user_printf (plugin_user_t * user, const char *format, ...);
 extern int plugin_user_redirect (plugin_user_t * user, buffer_t * message);
 extern int plugin_user_forcemove (plugin_user_t * user, unsigned char *destination,
@@ -163,8 +196,21 @@ extern int plugin_right_destroy (unsigned char *name);
 
 extern int plugin_report (buffer_t * message);
 extern int plugin_perror (unsigned char *format, ...);
-extern int plugin_config_load ();
+extern int plugin_config_load (buffer_t * output);
+/* loaders should only apply what they parsed when their finish handler says so */
+extern int plugin_config_loader_register (unsigned char *name, xml_parser_t * parser);
+extern int plugin_config_loader_unregister (unsigned char *name);
+
+/* tables that can be saved in the binary snapshot instead of the xml file */
+typedef int (plugin_snapshot_handler_t) (snapshot_t * s, unsigned char *name, void *ctxt);
+
+extern int plugin_config_snapshot_register (unsigned char *name, plugin_snapshot_handler_t * save,
+					    plugin_snapshot_handler_t * load, void *ctxt);
+extern int plugin_config_snapshot_unregister (unsigned char *name);
+extern int plugin_config_binary ();
 extern int plugin_config_save (buffer_t * output);
+extern int plugin_config_save_background (buffer_t * output);
+extern int plugin_config_save_check (buffer_t * output);
 
 extern unsigned long plugin_user_event (plugin_user_t * user, unsigned long event, void *token);
 
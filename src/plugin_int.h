@@ -25,6 +25,7 @@ typedef struct plugin_private plugin_private_t;
 #include "plugin.h"
 #include "hub.h"
 #include "proto.h"
+#include "aqtime.h"
 
 /* main data storage per plugin.*/
 struct plugin {
@@ -36,6 +37,8 @@ struct plugin {
   unsigned long privates;
   unsigned long events;
   unsigned long robots;
+
+  plugin_latency_t latency;	/* time spent in the handlers of this plugin */
 };
 
 /* plugin callback info */
@@ -44,8 +47,21 @@ typedef struct plugin_event_request {
 
   plugin_t *plugin;
   plugin_event_handler_t *handler;
+
+  plugin_latency_t latency;
 } plugin_event_request_t;
 
+/* queued event for asynchronous observers. */
+typedef struct plugin_event_record {
+  struct plugin_event_record *next;
+
+  unsigned long event;
+  unsigned int hasuser;
+  plugin_user_t user;		/* snapshot of the user at the time of the event */
+  buffer_t *token;		/* claimed reference to the token */
+  struct timeval stamp;		/* time the event was queued */
+} plugin_event_record_t;
+
 /* this struct stores private pointers of the modules for each user.
  * each module is only allowed a single pointer.
  * this approach does't limit the user sizes but makes handling runtime modules a 
@@ -70,8 +86,59 @@ typedef struct plugin_manager {
   unsigned long num;		/* number of loaded plugins */
 
   plugin_event_request_t eventhandles[PLUGIN_EVENT_NUMBER];	/* all handlers, per event */
+  plugin_event_request_t observers[PLUGIN_EVENT_NUMBER];	/* all async observers, per event */
+  plugin_latency_t eventlatency[PLUGIN_EVENT_NUMBER];	/* synchronous dispatch time, per event */
+
+  plugin_event_record_t *queue, **queuetail;	/* pending records for the observers */
+  unsigned long queued;				/* number of pending records */
 } plugin_manager_t;
 
+/* async observer statistics */
+typedef struct plugin_async_stats {
+  unsigned long queued;
+  unsigned long delivered;
+  unsigned long dropped;
+  unsigned long peak;
+  unsigned long maxdelay;	/* usec between queueing and delivery */
+  unsigned long maxflush;	/* usec spent in a single flush */
+} plugin_async_stats_t;
+
+extern plugin_async_stats_t asyncstats;
+
+/* configuration save statistics */
+typedef struct plugin_save_stats {
+  unsigned long count;
+  unsigned long background;
+  unsigned long failed;
+  unsigned long size;		/* bytes */
+  unsigned long duration;	/* msec */
+  unsigned long maxduration;	/* msec */
+  unsigned long forktime;	/* usec spent in fork() for the last background save */
+  unsigned long loadduration;	/* msec */
+} plugin_save_stats_t;
+
+/* streaming loaders for elements directly below the root of the configuration */
+typedef struct plugin_config_loader {
+  struct plugin_config_loader *next;
+
+  unsigned char *name;
+  xml_parser_t *parser;
+} plugin_config_loader_t;
+
+/* tables in the binary snapshot, a section per table */
+typedef struct plugin_config_snapshot {
+  struct plugin_config_snapshot *next;
+
+  unsigned char *name;
+  plugin_snapshot_handler_t *save;
+  plugin_snapshot_handler_t *load;
+  void *ctxt;
+} plugin_config_snapshot_t;
+
+extern plugin_save_stats_t savestats;
+
+extern plugin_manager_t *manager;
+
 
 /* internal entrypoints */
 
@@ -79,6 +146,7 @@ extern unsigned long plugin_send_event (plugin_private_t *, unsigned long, void
 extern unsigned long plugin_new_user (plugin_private_t **, user_t * u, proto_t * p);
 extern unsigned long plugin_del_user (plugin_private_t **);
 extern unsigned long plugin_update_user (user_t * u);
+extern unsigned long plugin_flush_events ();
 extern int plugin_init ();
 
 #endif
@@ -0,0 +1,94 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "../config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defaults.h"
+#include "pool.h"
+
+pool_t *pools = NULL;
+
+void pool_setup (pool_t * pool, const unsigned char *name, unsigned long size,
+		 unsigned long perslab)
+{
+  memset (pool, 0, sizeof (pool_t));
+
+  pool->name = name;
+  pool->size = (size + POOL_CACHELINE - 1) & ~(POOL_CACHELINE - 1);
+  pool->perslab = perslab ? perslab : 1;
+
+  pool->next = pools;
+  pools = pool;
+}
+
+static int pool_grow (pool_t * pool)
+{
+  pool_slab_t *slab;
+  unsigned char *o;
+  unsigned long i;
+
+  /* room for the header and the alignment of the first object */
+  slab = malloc (sizeof (pool_slab_t) + POOL_CACHELINE - 1 + pool->size * pool->perslab);
+  if (!slab)
+    return -1;
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->slabcount++;
+
+  o = (unsigned char *) (((unsigned long) (slab + 1) + POOL_CACHELINE - 1)
+			 & ~(unsigned long) (POOL_CACHELINE - 1));
+
+  /* push from the end so the objects are handed out in address order */
+  for (i = pool->perslab; i-- > 0;) {
+    *(void **) (o + i * pool->size) = pool->free;
+    pool->free = o + i * pool->size;
+  }
+
+  return 0;
+}
+
+void *pool_alloc (pool_t * pool)
+{
+  void *o;
+
+  if (!pool->free && pool_grow (pool))
+    return NULL;
+
+  o = pool->free;
+  pool->free = *(void **) o;
+
+  pool->allocs++;
+  if (++pool->inuse > pool->peak)
+    pool->peak = pool->inuse;
+
+  return o;
+}
+
+void pool_free (pool_t * pool, void *object)
+{
+  ASSERT (pool->inuse);
+
+  *(void **) object = pool->free;
+  pool->free = object;
+  pool->inuse--;
+}
@@ -0,0 +1,57 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/*
+ * Typed object pools for the structures every connection allocates. Objects
+ *  are carved from slabs, each object starts on a cache line. Freed objects
+ *  go back on the pool freelist, slabs are only returned at exit.
+ */
+
+#define POOL_CACHELINE		64
+
+typedef struct pool_slab {
+  struct pool_slab *next;
+} pool_slab_t;
+
+typedef struct pool {
+  struct pool *next;		/* all pools, for statmem */
+  const unsigned char *name;
+
+  unsigned long size;		/* object size, rounded up to a cache line */
+  unsigned long perslab;
+
+  void *free;			/* free objects, linked through their first word */
+  pool_slab_t *slabs;
+
+  unsigned long slabcount;
+  unsigned long inuse, peak;
+  unsigned long allocs;		/* objects handed out */
+} pool_t;
+
+extern pool_t *pools;
+
+extern void pool_setup (pool_t * pool, const unsigned char *name, unsigned long size,
+			unsigned long perslab);
+extern void *pool_alloc (pool_t * pool);
+extern void pool_free (pool_t * pool, void *object);
+
+#endif /* _POOL_H_ */
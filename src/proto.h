@@ -28,6 +28,8 @@
 #  include "arpa/inet.h"
 #endif
 
+#include <stddef.h>
+
 #include "hashlist.h"
 #include "buffer.h"
 #include "config.h"
@@ -57,6 +59,21 @@
 #define PROTO_FLAG_REGISTERED		2
 #define PROTO_FLAG_ZOMBIE		4
 
+/* rate limiting counters of a user, restored with a single copy */
+typedef struct rate_block {
+  rate_bucket_t warnings;
+  rate_bucket_t violations;
+  rate_bucket_t chat;
+  rate_bucket_t search;
+  rate_bucket_t myinfo;
+  rate_bucket_t myinfoop;
+  rate_bucket_t getnicklist;
+  rate_bucket_t getinfo;
+  rate_bucket_t downloads;
+  rate_bucket_t psresults_in;
+  rate_bucket_t psresults_out;
+} rate_block_t;
+
 /* FIXME split of nmdc specific fields */
 typedef struct user {
   hashlist_entry_t hash;
@@ -66,40 +83,39 @@ typedef struct user {
 
   unsigned char nick[NICKLENGTH];
   unsigned long supports;
+  unsigned long ipaddress;	/* ip address */
+  unsigned int flags;
+
+  etimer_t	timer;
+
+  /* user data */
+  unsigned char lock[LOCKLENGTH];
+
+  /* plugin private user data */
+  void *plugin_priv;
+
+  /* pointer for protocol private data */
+  void *pdata;
+
+  /* back linking pointer for parent */
+  void *parent;
+
+  /* a connection that is still logging in may only have the fields above, see PROTO_HANDSHAKE_SIZE */
 
   unsigned long long share;	/* share size */
   int active;			/* active? 1: active, 0: passive, -1: invalid */
   unsigned int slots;		/* slots user have open */
   unsigned int hubs[3];		/* hubs user is in */
-  unsigned long ipaddress;	/* ip address */
   unsigned char client[64];	/* client used */
   unsigned char versionstring[64];	/* client version */
   double version;
   unsigned int op;
-  unsigned int flags;
   unsigned long long rights;
 
-  etimer_t	timer;
-
-  /* user data */
-  unsigned char lock[LOCKLENGTH];
   unsigned long joinstamp;
 
-  /* plugin private user data */
-  void *plugin_priv;
-
   /* rate limiting counters */
-  leaky_bucket_t rate_warnings;
-  leaky_bucket_t rate_violations;
-  leaky_bucket_t rate_chat;
-  leaky_bucket_t rate_search;
-  leaky_bucket_t rate_myinfo;
-  leaky_bucket_t rate_myinfoop;
-  leaky_bucket_t rate_getnicklist;
-  leaky_bucket_t rate_getinfo;
-  leaky_bucket_t rate_downloads;
-  leaky_bucket_t rate_psresults_in;
-  leaky_bucket_t rate_psresults_out;
+  rate_block_t rate;
 
   /* cache counters */
   unsigned int ChatCnt, SearchCnt, ResultCnt, MessageCnt;
@@ -110,14 +126,11 @@ typedef struct user {
 
   /* cache data */
   buffer_t *MyINFO;
-
-  /* pointer for protocol private data */
-  void *pdata;
-
-  /* back linking pointer for parent */
-  void *parent;
 } user_t;
 
+/* size of the part of user_t a protocol can allocate for a connection still logging in */
+#define PROTO_HANDSHAKE_SIZE	offsetof (user_t, share)
+
 typedef struct {
   int (*init) (void);
   int (*setup) (void);
@@ -144,6 +157,7 @@ typedef struct {
   int (*chat_send_direct) (user_t *, user_t *, buffer_t *);
   int (*chat_priv) (user_t *, user_t *, user_t *, buffer_t *);
   int (*chat_priv_direct) (user_t *, user_t *, user_t *, buffer_t *);
+  int (*chat_priv_multi) (user_t *, user_t **, unsigned int, user_t *, buffer_t *);
   int (*raw_send) (user_t *, buffer_t *);
   int (*raw_send_all) (buffer_t *);
 
@@ -0,0 +1,343 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifndef USE_WINDOWS
+#  include <unistd.h>
+#  include <sys/mman.h>
+#else
+#  include "sys_windows.h"
+#endif
+
+/* adler32, sums start at 1 */
+uint32_t snapshot_checksum (uint32_t sum, const unsigned char *data, unsigned long length)
+{
+  uint32_t a = sum & 0xffff, b = sum >> 16;
+  unsigned long n;
+
+  while (length) {
+    n = (length < 5552) ? length : 5552;
+    length -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+/******************************* WRITING *******************************************/
+
+snapshot_t *snapshot_create (FILE * fp)
+{
+  snapshot_t *s;
+  snapshot_header_t header;
+
+  s = malloc (sizeof (snapshot_t));
+  if (!s)
+    return NULL;
+
+  memset (s, 0, sizeof (snapshot_t));
+  s->fp = fp;
+
+  /* the header is written again once the directory is known */
+  memset (&header, 0, sizeof (snapshot_header_t));
+  if (fwrite (&header, sizeof (snapshot_header_t), 1, fp) != 1)
+    s->error = 1;
+  s->offset = sizeof (snapshot_header_t);
+
+  return s;
+}
+
+static void snapshot_pad (snapshot_t * s)
+{
+  static const unsigned char zero[SNAPSHOT_ALIGN];
+  unsigned long pad;
+
+  pad = (SNAPSHOT_ALIGN - (s->offset % SNAPSHOT_ALIGN)) % SNAPSHOT_ALIGN;
+  if (pad && (fwrite (zero, pad, 1, s->fp) != 1))
+    s->error = 1;
+  s->offset += pad;
+}
+
+int snapshot_section_start (snapshot_t * s, unsigned char *name)
+{
+  snapshot_section_t *sections;
+  size_t l;
+
+  if (s->current)
+    return -1;
+
+  if (s->count == s->size) {
+    sections = realloc (s->sections, (s->size + 8) * sizeof (snapshot_section_t));
+    if (!sections) {
+      s->error = 1;
+      return -1;
+    }
+    s->sections = sections;
+    s->size += 8;
+  }
+
+  s->current = &s->sections[s->count++];
+  memset (s->current, 0, sizeof (snapshot_section_t));
+  l = strlen ((char *) name);
+  if (l >= SNAPSHOT_NAMELENGTH)
+    l = SNAPSHOT_NAMELENGTH - 1;
+  memcpy (s->current->name, name, l);
+  s->current->name[l] = 0;
+  s->current->offset = s->offset;
+  s->current->checksum = 1;
+
+  return 0;
+}
+
+int snapshot_write (snapshot_t * s, const void *data, unsigned long length)
+{
+  if (!s->current)
+    return -1;
+
+  if (length && (fwrite (data, length, 1, s->fp) != 1)) {
+    s->error = 1;
+    return -1;
+  }
+
+  s->current->checksum = snapshot_checksum (s->current->checksum, data, length);
+  s->current->length += length;
+  s->offset += length;
+
+  return 0;
+}
+
+int snapshot_section_end (snapshot_t * s, unsigned long count)
+{
+  if (!s->current)
+    return -1;
+
+  s->current->count = count;
+  s->current = NULL;
+
+  snapshot_pad (s);
+
+  return 0;
+}
+
+/* write the directory and the header. returns the size of the file or 0 on error. */
+unsigned long snapshot_finish (snapshot_t * s)
+{
+  snapshot_header_t header;
+  unsigned long size = 0;
+
+  if (s->current)
+    snapshot_section_end (s, 0);
+
+  memset (&header, 0, sizeof (snapshot_header_t));
+  memcpy (header.magic, SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byteorder = SNAPSHOT_BYTEORDER;
+  header.sections = s->count;
+  header.directory = s->offset;
+  header.checksum =
+    snapshot_checksum (1, (unsigned char *) s->sections, s->count * sizeof (snapshot_section_t));
+
+  if (s->count
+      && (fwrite (s->sections, sizeof (snapshot_section_t), s->count, s->fp) != s->count))
+    s->error = 1;
+  s->offset += s->count * sizeof (snapshot_section_t);
+
+  if (fseek (s->fp, 0, SEEK_SET)
+      || (fwrite (&header, sizeof (snapshot_header_t), 1, s->fp) != 1) || fflush (s->fp))
+    s->error = 1;
+
+  if (!s->error)
+    size = s->offset;
+
+  if (s->sections)
+    free (s->sections);
+  free (s);
+
+  return size;
+}
+
+/******************************* READING *******************************************/
+
+static int snapshot_verify (snapshot_t * s, buffer_t * output, unsigned char *filename)
+{
+  snapshot_header_t *header = (snapshot_header_t *) s->base;
+  snapshot_section_t *section;
+  unsigned int i;
+
+  if ((s->length < sizeof (snapshot_header_t))
+      || memcmp (header->magic, SNAPSHOT_MAGIC, sizeof (header->magic))) {
+    if (output)
+      bf_printf (output, _("%s is not a snapshot.\n"), filename);
+    return -1;
+  }
+
+  if (header->byteorder != SNAPSHOT_BYTEORDER) {
+    if (output)
+      bf_printf (output, _("Snapshot %s was written on a host with a different byte order.\n"),
+		 filename);
+    return -1;
+  }
+
+  if (header->version != SNAPSHOT_VERSION) {
+    if (output)
+      bf_printf (output, _("Snapshot %s has unsupported version %u.\n"), filename,
+		 header->version);
+    return -1;
+  }
+
+  if ((header->directory > s->length)
+      || (header->sections > ((s->length - header->directory) / sizeof (snapshot_section_t)))
+      || (header->directory % SNAPSHOT_ALIGN)) {
+    if (output)
+      bf_printf (output, _("Snapshot %s is truncated.\n"), filename);
+    return -1;
+  }
+
+  section = (snapshot_section_t *) (s->base + header->directory);
+  if (snapshot_checksum (1, (unsigned char *) section,
+			 header->sections * sizeof (snapshot_section_t)) != header->checksum) {
+    if (output)
+      bf_printf (output, _("Snapshot %s has a corrupt directory.\n"), filename);
+    return -1;
+  }
+
+  for (i = 0; i < header->sections; i++, section++) {
+    if ((section->offset > header->directory)
+	|| (section->length > (header->directory - section->offset))
+	|| (section->offset % SNAPSHOT_ALIGN)
+	|| (snapshot_checksum (1, s->base + section->offset, section->length) !=
+	    section->checksum)) {
+      if (output)
+	bf_printf (output, _("Snapshot %s has a corrupt section %.*s.\n"), filename,
+		   SNAPSHOT_NAMELENGTH, section->name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* map the file and check it completely, sections can be used without further checks */
+snapshot_t *snapshot_open (unsigned char *filename, buffer_t * output)
+{
+  snapshot_t *s;
+  struct stat st;
+  int fd;
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0) {
+    if (output)
+      bf_printf (output, _("Error loading snapshot %s: %s\n"), filename, strerror (errno));
+    return NULL;
+  }
+
+  s = malloc (sizeof (snapshot_t));
+  if (!s) {
+    close (fd);
+    return NULL;
+  }
+  memset (s, 0, sizeof (snapshot_t));
+
+  if (fstat (fd, &st))
+    goto error;
+
+  s->length = st.st_size;
+  if (!s->length)
+    goto invalid;
+
+#ifndef USE_WINDOWS
+  s->base = mmap (NULL, s->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (s->base == MAP_FAILED) {
+    s->base = NULL;
+    goto error;
+  }
+  s->mapped = 1;
+#else
+  s->base = malloc (s->length);
+  if (!s->base)
+    goto error;
+  if (read (fd, s->base, s->length) != s->length)
+    goto error;
+#endif
+  close (fd);
+  fd = -1;
+
+  if (snapshot_verify (s, output, filename))
+    goto leave;
+
+  return s;
+
+error:
+  if (output)
+    bf_printf (output, _("Error loading snapshot %s: %s\n"), filename, strerror (errno));
+  goto leave;
+invalid:
+  if (output)
+    bf_printf (output, _("%s is not a snapshot.\n"), filename);
+leave:
+  if (fd >= 0)
+    close (fd);
+  snapshot_close (s);
+  return NULL;
+}
+
+void *snapshot_section (snapshot_t * s, unsigned char *name, unsigned long *length)
+{
+  snapshot_header_t *header = (snapshot_header_t *) s->base;
+  snapshot_section_t *section;
+  unsigned int i;
+
+  section = (snapshot_section_t *) (s->base + header->directory);
+  for (i = 0; i < header->sections; i++, section++) {
+    if (strncmp (section->name, name, SNAPSHOT_NAMELENGTH))
+      continue;
+
+    *length = section->length;
+    return s->base + section->offset;
+  }
+
+  return NULL;
+}
+
+void snapshot_close (snapshot_t * s)
+{
+  if (s->base) {
+#ifndef USE_WINDOWS
+    if (s->mapped)
+      munmap (s->base, s->length);
+#else
+    free (s->base);
+#endif
+  }
+
+  free (s);
+}
@@ -0,0 +1,92 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "../config.h"
+#if HAVE_INTTYPES_H
+# include <inttypes.h>
+#else
+# if HAVE_STDINT_H
+#  include <stdint.h>
+# endif
+#endif
+
+#include <stdio.h>
+
+#include "defaults.h"
+#include "buffer.h"
+
+#define SNAPSHOT_MAGIC		"AQSNAP\r\n"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BYTEORDER	0x01020304
+#define SNAPSHOT_NAMELENGTH	32
+#define SNAPSHOT_ALIGN		8
+
+/*
+ * A snapshot file starts with a header and ends with a directory of its
+ *  sections. The data of every section is aligned, so fixed size records
+ *  can be used straight from the mapped file. The file is only valid on
+ *  hosts with the same byte order and structure layout.
+ */
+typedef struct snapshot_header {
+  unsigned char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t sections;		/* entries in the directory */
+  uint32_t checksum;		/* of the directory */
+  uint64_t directory;		/* offset of the directory */
+} snapshot_header_t;
+
+typedef struct snapshot_section {
+  unsigned char name[SNAPSHOT_NAMELENGTH];
+  uint64_t offset;
+  uint64_t length;
+  uint32_t count;		/* number of records, informational */
+  uint32_t checksum;
+} snapshot_section_t;
+
+typedef struct snapshot {
+  /* writing */
+  FILE *fp;
+  uint64_t offset;
+  snapshot_section_t *sections, *current;
+  unsigned int count, size;
+  int error;
+
+  /* reading */
+  unsigned char *base;
+  unsigned long length;
+  int mapped;
+} snapshot_t;
+
+extern uint32_t snapshot_checksum (uint32_t sum, const unsigned char *data, unsigned long length);
+
+extern snapshot_t *snapshot_create (FILE * fp);
+extern int snapshot_section_start (snapshot_t * s, unsigned char *name);
+extern int snapshot_write (snapshot_t * s, const void *data, unsigned long length);
+extern int snapshot_section_end (snapshot_t * s, unsigned long count);
+extern unsigned long snapshot_finish (snapshot_t * s);
+
+extern snapshot_t *snapshot_open (unsigned char *filename, buffer_t * output);
+extern void *snapshot_section (snapshot_t * s, unsigned char *name, unsigned long *length);
+extern void snapshot_close (snapshot_t * s);
+
+#endif /* _SNAPSHOT_H_ */
@@ -42,9 +42,9 @@ void *stats_retrieve (unsigned char *name)
   return value_retrieve (statvalues, name);
 }
 
-int stats_save (xml_node_t * base)
+int stats_save (xml_writer_t * w)
 {
-  return value_save (statvalues, base);
+  return value_save (statvalues, w);
 }
 
 int stats_load (xml_node_t * node)
@@ -34,7 +34,7 @@ extern stats_element_t *stats_register (unsigned char *name, value_type_t type,
 extern int stats_unregister (unsigned char *name);
 extern stats_element_t *stats_find (unsigned char *name);
 extern void *stats_retrieve (unsigned char *name);
-extern int stats_save (xml_node_t *);
+extern int stats_save (xml_writer_t *);
 extern int stats_load (xml_node_t *);
 
 #endif /* _STATS_H_ */
@@ -29,6 +29,7 @@
 
 #include "user.h"
 #include "cap.h"
+#include "journal.h"
 
 #ifndef USE_WINDOWS
 #  ifdef HAVE_CRYPT_H
@@ -66,6 +67,8 @@ account_type_t *account_type_add (unsigned char *name, unsigned long long rights
 
   t->refcnt = 0;
 
+  journal_group (t);
+
   return t;
 }
 
@@ -93,6 +96,8 @@ account_type_t *account_type_find_byid (unsigned long id)
 
 unsigned int account_type_del (account_type_t * t)
 {
+  journal_group_del (t);
+
   if (t->next)
     t->next->prev = t->prev;
   if (t->prev) {
@@ -133,6 +138,8 @@ account_t *account_add (account_type_t * type, unsigned char *op, unsigned char
 
   account_count++;
 
+  journal_account (a);
+
   return a;
 }
 
@@ -153,6 +160,9 @@ int account_pwd_set (account_t * account, unsigned char *pwd)
 #else
   strncpy (account->passwd, pwd, NICKLENGTH);
 #endif /* HAVE_CRYPT_H */
+
+  journal_account (account);
+
   return 0;
 }
 
@@ -189,6 +199,8 @@ unsigned int account_set_type (account_t * a, account_type_t * new)
   a->class = new->id;
   a->classp = new;
 
+  journal_account (a);
+
   /* return old id. */
   return old->id;
 }
@@ -197,6 +209,8 @@ unsigned int account_del (account_t * a)
 {
   account_type_t *t;
 
+  journal_account_del (a);
+
   account_count--;
 
   t = account_type_find_byid (a->class);
@@ -297,40 +311,299 @@ unsigned int accounts_load (xml_node_t * base)
   return 0;
 }
 
-unsigned int accounts_save (xml_node_t * base)
+/* streaming loader for <Groups> and <Accounts>. the entries are collected in the snapshot
+ *  record format and only replace the accounts once the whole configuration parsed. */
+#define ACCOUNTS_PARSE_NAME	1
+#define ACCOUNTS_PARSE_PASSWD	2
+#define ACCOUNTS_PARSE_RIGHTS	4
+#define ACCOUNTS_PARSE_GROUP	8
+#define ACCOUNTS_PARSE_CREATOR	16
+#define ACCOUNTS_PARSE_REGDATE	32
+#define ACCOUNTS_PARSE_LASTLOGIN	64
+
+#define ACCOUNTS_PARSE_GROUPENTRY	(ACCOUNTS_PARSE_NAME | ACCOUNTS_PARSE_RIGHTS)
+#define ACCOUNTS_PARSE_ACCOUNT		127
+
+typedef struct accounts_parser {
+  xml_parser_t parser;
+
+  unsigned int found;
+  account_snapshot_t entry;
+
+  account_type_snapshot_t *types;
+  account_snapshot_t *accounts;
+  unsigned long typecount, typesize, accountcount, accountsize;
+} accounts_parser_t;
+
+static accounts_parser_t accountsparser;
+
+/* replace all groups and accounts. both lists are built by prepending, so go backwards */
+static void accounts_apply (account_type_snapshot_t * type, unsigned long types,
+			    account_snapshot_t * account, unsigned long count)
+{
+  account_type_t *t;
+  account_t *a;
+  unsigned long i;
+
+  accounts_clear ();
+
+  for (i = types; i--;)
+    account_type_add (type[i].name, type[i].rights);
+
+  for (i = count; i--;) {
+    t = account_type_find (account[i].group);
+    if (!t)
+      continue;
+    a = account_add (t, account[i].op, account[i].nick);
+    memcpy (a->passwd, account[i].passwd, NICKLENGTH);
+    a->rights = account[i].rights;
+    a->regged = account[i].regged;
+    a->lastlogin = account[i].lastlogin;
+    a->lastip = account[i].lastip;
+  }
+}
+
+/* copy a value into a record field, truncated like account_add does */
+static void accounts_parse_copy (unsigned char *dest, unsigned char *value)
+{
+  strncpy (dest, value, NICKLENGTH);
+  dest[NICKLENGTH - 1] = 0;
+}
+
+static int accounts_parse_start (xml_parser_t * parser, unsigned char *name)
+{
+  accounts_parser_t *p = (accounts_parser_t *) parser;
+
+  if (!parser->depth)
+    return 0;
+
+  p->found = 0;
+  memset (&p->entry, 0, sizeof (account_snapshot_t));
+
+  return 0;
+}
+
+static int accounts_parse_value (xml_parser_t * parser, unsigned char *name, unsigned char *value)
+{
+  accounts_parser_t *p = (accounts_parser_t *) parser;
+  unsigned long long rights = 0;
+  unsigned long ulong = 0;
+
+  if (!strcmp (name, "Name")) {
+    accounts_parse_copy (p->entry.nick, value);
+    p->found |= ACCOUNTS_PARSE_NAME;
+  } else if (!strcmp (name, "Passwd")) {
+    accounts_parse_copy (p->entry.passwd, value);
+    p->found |= ACCOUNTS_PARSE_PASSWD;
+  } else if (!strcmp (name, "Rights")) {
+    xml_value_get (value, XML_TYPE_CAP, &rights);
+    p->entry.rights = rights;
+    p->found |= ACCOUNTS_PARSE_RIGHTS;
+  } else if (!strcmp (name, "Group")) {
+    accounts_parse_copy (p->entry.group, value);
+    p->found |= ACCOUNTS_PARSE_GROUP;
+  } else if (!strcmp (name, "Creator")) {
+    accounts_parse_copy (p->entry.op, value);
+    p->found |= ACCOUNTS_PARSE_CREATOR;
+  } else if (!strcmp (name, "RegDate")) {
+    xml_value_get (value, XML_TYPE_ULONG, &ulong);
+    p->entry.regged = ulong;
+    p->found |= ACCOUNTS_PARSE_REGDATE;
+  } else if (!strcmp (name, "LastLogin")) {
+    xml_value_get (value, XML_TYPE_ULONG, &ulong);
+    p->entry.lastlogin = ulong;
+    p->found |= ACCOUNTS_PARSE_LASTLOGIN;
+  } else if (!strcmp (name, "LastIP")) {
+    /* optional for now */
+    xml_value_get (value, XML_TYPE_IP, &ulong);
+    p->entry.lastip = ulong;
+  }
+
+  return 0;
+}
+
+static int accounts_parse_end (xml_parser_t * parser, unsigned char *name)
+{
+  accounts_parser_t *p = (accounts_parser_t *) parser;
+  void *grown;
+
+  if (!strcmp (name, "Group")) {
+    if ((p->found & ACCOUNTS_PARSE_GROUPENTRY) != ACCOUNTS_PARSE_GROUPENTRY)
+      return 0;
+
+    if (p->typecount == p->typesize) {
+      grown = realloc (p->types, (p->typesize + 16) * sizeof (account_type_snapshot_t));
+      if (!grown)
+	return -1;
+      p->types = grown;
+      p->typesize += 16;
+    }
+    memset (&p->types[p->typecount], 0, sizeof (account_type_snapshot_t));
+    memcpy (p->types[p->typecount].name, p->entry.nick, NICKLENGTH);
+    p->types[p->typecount++].rights = p->entry.rights;
+    return 0;
+  }
+
+  if (strcmp (name, "Account") || (p->found != ACCOUNTS_PARSE_ACCOUNT))
+    return 0;
+
+  if (p->accountcount == p->accountsize) {
+    grown = realloc (p->accounts, (p->accountsize * 2 + 64) * sizeof (account_snapshot_t));
+    if (!grown)
+      return -1;
+    p->accounts = grown;
+    p->accountsize = p->accountsize * 2 + 64;
+  }
+  p->accounts[p->accountcount++] = p->entry;
+
+  return 0;
+}
+
+/* the configuration always replaces the accounts, even if it has none */
+static int accounts_parse_finish (xml_parser_t * parser, int ok)
+{
+  accounts_parser_t *p = (accounts_parser_t *) parser;
+
+  if (ok)
+    accounts_apply (p->types, p->typecount, p->accounts, p->accountcount);
+
+  free (p->types);
+  free (p->accounts);
+  p->types = NULL;
+  p->accounts = NULL;
+  p->typecount = p->typesize = p->accountcount = p->accountsize = 0;
+
+  return 0;
+}
+
+xml_parser_t *accounts_parser ()
+{
+  memset (&accountsparser, 0, sizeof (accounts_parser_t));
+
+  accountsparser.parser.start = accounts_parse_start;
+  accountsparser.parser.value = accounts_parse_value;
+  accountsparser.parser.end = accounts_parse_end;
+  accountsparser.parser.finish = accounts_parse_finish;
+
+  return &accountsparser.parser;
+}
+
+unsigned int accounts_save (xml_writer_t * w)
 {
-  xml_node_t *node;
   account_type_t *t;
   account_t *a;
 
-  node = xml_node_add (base, "Groups");
+  xml_writer_start (w, "Groups");
 
   for (t = accountTypes; t; t = t->next) {
-    node = xml_node_add (node, "Group");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, t->name);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &t->rights);
-    node = xml_parent (node);
+    xml_writer_start (w, "Group");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, t->name);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &t->rights);
+    xml_writer_end (w);
   }
 
-  node = xml_node_add (base, "Accounts");
+  xml_writer_end (w);
+
+  xml_writer_start (w, "Accounts");
 
   for (a = accounts; a; a = a->next) {
-    node = xml_node_add (node, "Account");
-    xml_node_add_value (node, "Name", XML_TYPE_STRING, &a->nick);
-    xml_node_add_value (node, "Passwd", XML_TYPE_STRING, &a->passwd);
-    xml_node_add_value (node, "Rights", XML_TYPE_CAP, &a->rights);
-    xml_node_add_value (node, "Group", XML_TYPE_STRING, &a->classp->name);
-    xml_node_add_value (node, "Creator", XML_TYPE_STRING, &a->op);
-    xml_node_add_value (node, "RegDate", XML_TYPE_ULONG, &a->regged);
-    xml_node_add_value (node, "LastLogin", XML_TYPE_ULONG, &a->lastlogin);
-    xml_node_add_value (node, "LastIP", XML_TYPE_IP, &a->lastip);
-    node = xml_parent (node);
+    xml_writer_start (w, "Account");
+    xml_writer_value (w, "Name", XML_TYPE_STRING, &a->nick);
+    xml_writer_value (w, "Passwd", XML_TYPE_STRING, &a->passwd);
+    xml_writer_value (w, "Rights", XML_TYPE_CAP, &a->rights);
+    xml_writer_value (w, "Group", XML_TYPE_STRING, &a->classp->name);
+    xml_writer_value (w, "Creator", XML_TYPE_STRING, &a->op);
+    xml_writer_value (w, "RegDate", XML_TYPE_ULONG, &a->regged);
+    xml_writer_value (w, "LastLogin", XML_TYPE_ULONG, &a->lastlogin);
+    xml_writer_value (w, "LastIP", XML_TYPE_IP, &a->lastip);
+    xml_writer_end (w);
   }
 
+  xml_writer_end (w);
+
   return 0;
 }
 
 
+int accounts_snapshot_save (snapshot_t * s, unsigned char *name, void *dummy)
+{
+  accounts_snapshot_t header;
+  account_type_snapshot_t type;
+  account_snapshot_t account;
+  account_type_t *t;
+  account_t *a;
+
+  memset (&header, 0, sizeof (accounts_snapshot_t));
+  header.typesize = sizeof (account_type_snapshot_t);
+  header.accountsize = sizeof (account_snapshot_t);
+  for (t = accountTypes; t; t = t->next)
+    header.types++;
+  for (a = accounts; a; a = a->next)
+    header.accounts++;
+
+  snapshot_section_start (s, name);
+  snapshot_write (s, &header, sizeof (accounts_snapshot_t));
+
+  for (t = accountTypes; t; t = t->next) {
+    memset (&type, 0, sizeof (account_type_snapshot_t));
+    memcpy (type.name, t->name, NICKLENGTH);
+    type.rights = t->rights;
+    snapshot_write (s, &type, sizeof (account_type_snapshot_t));
+  }
+
+  for (a = accounts; a; a = a->next) {
+    memset (&account, 0, sizeof (account_snapshot_t));
+    memcpy (account.nick, a->nick, NICKLENGTH);
+    memcpy (account.passwd, a->passwd, NICKLENGTH);
+    memcpy (account.op, a->op, NICKLENGTH);
+    memcpy (account.group, a->classp->name, NICKLENGTH);
+    account.rights = a->rights;
+    account.regged = a->regged;
+    account.lastlogin = a->lastlogin;
+    account.lastip = a->lastip;
+    snapshot_write (s, &account, sizeof (account_snapshot_t));
+  }
+
+  return snapshot_section_end (s, header.types + header.accounts);
+}
+
+int accounts_snapshot_load (snapshot_t * s, unsigned char *name, void *dummy)
+{
+  accounts_snapshot_t *header;
+  account_type_snapshot_t *type;
+  account_snapshot_t *account;
+  unsigned long length, i;
+
+  header = snapshot_section (s, name, &length);
+  if (!header)
+    return 0;
+
+  if ((length < sizeof (accounts_snapshot_t))
+      || (header->typesize != sizeof (account_type_snapshot_t))
+      || (header->accountsize != sizeof (account_snapshot_t))
+      || (header->types > ((length - sizeof (accounts_snapshot_t)) / sizeof (account_type_snapshot_t)))
+      || (header->accounts >
+	  ((length - sizeof (accounts_snapshot_t) - header->types * sizeof (account_type_snapshot_t))
+	   / sizeof (account_snapshot_t))))
+    return -1;
+
+  /* check every record before the current accounts are replaced */
+  type = (account_type_snapshot_t *) (header + 1);
+  for (i = 0; i < header->types; i++)
+    if (!memchr (type[i].name, 0, NICKLENGTH))
+      return -1;
+
+  account = (account_snapshot_t *) (type + header->types);
+  for (i = 0; i < header->accounts; i++)
+    if (!memchr (account[i].nick, 0, NICKLENGTH) || !memchr (account[i].passwd, 0, NICKLENGTH)
+	|| !memchr (account[i].op, 0, NICKLENGTH) || !memchr (account[i].group, 0, NICKLENGTH))
+      return -1;
+
+  accounts_apply (type, header->types, account, header->accounts);
+
+  return 0;
+}
+
 unsigned int accounts_load_old (const unsigned char *filename)
 {
   FILE *fp;
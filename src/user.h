@@ -21,6 +21,7 @@
 #define _USER_H_
 
 #include "config.h"
+#include "snapshot.h"
 
 typedef struct account_type {
   struct account_type *next, *prev;
@@ -66,7 +67,36 @@ extern int account_pwd_set (account_t * account, unsigned char *pwd);
 extern int account_pwd_check (account_t * account, unsigned char *pwd);
 
 extern unsigned int accounts_load (xml_node_t *);
-extern unsigned int accounts_save (xml_node_t *);
+extern xml_parser_t *accounts_parser ();
+extern unsigned int accounts_save (xml_writer_t *);
+
+/* binary snapshot section: a header, the groups and then the accounts */
+typedef struct accounts_snapshot {
+  uint32_t typesize;
+  uint32_t accountsize;
+  uint32_t types;
+  uint32_t accounts;
+} accounts_snapshot_t;
+
+typedef struct account_type_snapshot {
+  unsigned char name[NICKLENGTH];
+  uint64_t rights;
+} account_type_snapshot_t;
+
+typedef struct account_snapshot {
+  unsigned char nick[NICKLENGTH];
+  unsigned char passwd[NICKLENGTH];
+  unsigned char op[NICKLENGTH];
+  unsigned char group[NICKLENGTH];
+  uint64_t rights;
+  int64_t regged;
+  int64_t lastlogin;
+  uint32_t lastip;
+  uint32_t reserved;
+} account_snapshot_t;
+
+extern int accounts_snapshot_save (snapshot_t * s, unsigned char *name, void *dummy);
+extern int accounts_snapshot_load (snapshot_t * s, unsigned char *name, void *dummy);
 
 extern unsigned int accounts_init ();
 
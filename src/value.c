@@ -166,22 +166,22 @@ void *value_retrieve (value_collection_t * collection, unsigned char *name)
 
 
 
-int value_save (value_collection_t * collection, xml_node_t * base)
+int value_save (value_collection_t * collection, xml_writer_t * w)
 {
-  xml_node_t *node;
   value_element_t *elem;
 
-  node = xml_node_add (base, "Config");
+  xml_writer_start (w, "Config");
 
   for (elem = collection->value_sorted.onext; elem != &collection->value_sorted; elem = elem->onext) {
     switch (elem->type) {
       case VAL_ELEM_STRING:
-	xml_node_add_value (node, elem->name, elem->type, *elem->val.v_string);
+	xml_writer_value (w, elem->name, elem->type, *elem->val.v_string);
 	break;
       default:
-	xml_node_add_value (node, elem->name, elem->type, elem->val.v_ptr);
+	xml_writer_value (w, elem->name, elem->type, elem->val.v_ptr);
     }
   }
+  xml_writer_end (w);
   return 0;
 }
 
@@ -72,7 +72,7 @@ extern value_element_t *value_register (value_collection_t *collection, unsigned
 extern int value_unregister (value_collection_t *collection, unsigned char *name);
 extern value_element_t *value_find (value_collection_t *collection, unsigned char *name);
 extern void *value_retrieve (value_collection_t *collection, unsigned char *name);
-extern int value_save (value_collection_t *collection, xml_node_t *);
+extern int value_save (value_collection_t *collection, xml_writer_t *);
 extern int value_load (value_collection_t *collection, xml_node_t *);
 
 #endif /* _CONFIG_H_ */
@@ -322,6 +322,9 @@ xml_node_t *xml_node_find (xml_node_t * parent, char *name)
   xml_node_t *node;
 
   node = parent->children;
+  if (!node)
+    return NULL;
+
   do {
     if (!strcmp (name, node->name))
       return node;
@@ -349,22 +352,29 @@ xml_node_t *xml_node_find_next (xml_node_t * sibling, char *name)
 
 xml_node_t *xml_node_get (xml_node_t * node, xml_type_t type, void *value)
 {
+  xml_value_get (node->value, type, value);
 
+  return node;
+};
+
+/* convert the text of a value. strings are duplicated, the old one is freed. */
+int xml_value_get (unsigned char *text, xml_type_t type, void *value)
+{
   switch (type) {
     case XML_TYPE_PTR:
-      sscanf (node->value, "%p", (void **) value);
+      sscanf (text, "%p", (void **) value);
       break;
     case XML_TYPE_LONG:
-      sscanf (node->value, "%ld", (long *) value);
+      sscanf (text, "%ld", (long *) value);
       break;
     case XML_TYPE_ULONG:
-      sscanf (node->value, "%lu", (unsigned long *) value);
+      sscanf (text, "%lu", (unsigned long *) value);
       break;
     case XML_TYPE_ULONGLONG:
 #ifndef USE_WINDOWS
-      sscanf (node->value, "%Lu", (unsigned long long *) value);
+      sscanf (text, "%Lu", (unsigned long long *) value);
 #else
-      sscanf (node->value, "%I64u", (unsigned long long *) value);
+      sscanf (text, "%I64u", (unsigned long long *) value);
 #endif
       break;
     case XML_TYPE_CAP:
@@ -372,7 +382,7 @@ xml_node_t *xml_node_get (xml_node_t * node, xml_type_t type, void *value)
 	unsigned long long cap = 0, ncap = 0;
 	unsigned char *argv[2];
 
-	argv[0] = node->value;
+	argv[0] = text;
 	argv[1] = NULL;
 
 	flags_parse (Capabilities, NULL, 1, argv, 0, &cap, &ncap);
@@ -382,24 +392,24 @@ xml_node_t *xml_node_get (xml_node_t * node, xml_type_t type, void *value)
       }
       break;
     case XML_TYPE_INT:
-      sscanf (node->value, "%d", (int *) value);
+      sscanf (text, "%d", (int *) value);
       break;
     case XML_TYPE_UINT:
-      sscanf (node->value, "%u", (unsigned int *) value);
+      sscanf (text, "%u", (unsigned int *) value);
       break;
     case XML_TYPE_DOUBLE:
-      sscanf (node->value, "%lf", (double *) value);
+      sscanf (text, "%lf", (double *) value);
       break;
     case XML_TYPE_STRING:
       if (*((unsigned char **) value))
 	free (*((unsigned char **) value));
-      *((unsigned char **) value) = strdup (node->value);
+      *((unsigned char **) value) = strdup (text);
       break;
     case XML_TYPE_IP:
       {
 	struct in_addr ia;
 
-	if (!inet_aton (node->value, &ia))
+	if (!inet_aton (text, &ia))
 	  break;
 
 	*((unsigned long *) value) = ia.s_addr;
@@ -407,7 +417,7 @@ xml_node_t *xml_node_get (xml_node_t * node, xml_type_t type, void *value)
       break;
     case XML_TYPE_MEMSIZE:
       {
-	unsigned long long tmp = parse_size (node->value);
+	unsigned long long tmp = parse_size (text);
 
 	if (tmp > ULONG_MAX)
 	  break;
@@ -416,11 +426,11 @@ xml_node_t *xml_node_get (xml_node_t * node, xml_type_t type, void *value)
       }
       break;
     case XML_TYPE_BYTESIZE:
-      *((unsigned long long *) value) = parse_size (node->value);
+      *((unsigned long long *) value) = parse_size (text);
       break;
   }
-  return node;
-};
+  return 0;
+}
 
 xml_node_t *xml_child_get (xml_node_t * parent, char *name, xml_type_t type, void *value)
 {
@@ -663,6 +673,180 @@ xml_node_t *xml_import (buffer_t * buf)
   return tree;
 };
 
+/*
+ * event driven parser
+ */
+
+/* unescape in place, the result is never longer than the source */
+static void xml_unescape_inplace (unsigned char *s)
+{
+  unsigned char *d = s, *e;
+
+  for (; *s; s++) {
+    if (*s != '&') {
+      *d++ = *s;
+      continue;
+    }
+    if (!strncmp (s, "&lt;", 4)) {
+      *d++ = '<';
+      s += 3;
+    } else if (!strncmp (s, "&gt;", 4)) {
+      *d++ = '>';
+      s += 3;
+    } else if (!strncmp (s, "&amp;", 5)) {
+      *d++ = '&';
+      s += 4;
+    } else if (!strncmp (s, "&quot;", 6)) {
+      *d++ = '"';
+      s += 5;
+    } else if (!strncmp (s, "&apos;", 6)) {
+      *d++ = '\'';
+      s += 5;
+    } else if ((s[1] == '#') && (e = strchr (s, ';'))) {
+      *d++ = atoi (s + 2);
+      s = e;
+    } else {
+      *d++ = *s;
+    }
+  }
+  *d = '\0';
+}
+
+/* verify the closing tag at c. returns the first byte after it. */
+static unsigned char *xml_parse_close (unsigned char *c, unsigned char *end, unsigned char *name)
+{
+  unsigned int l = strlen (name);
+
+  if ((end - c) < (l + 3))
+    return NULL;
+  if ((c[0] != '<') || (c[1] != '/'))
+    return NULL;
+  c += 2;
+  if (strncmp (c, name, l))
+    return NULL;
+  c += l;
+  while ((c != end) && isspace (*c))
+    c++;
+  if ((c == end) || (*c != '>'))
+    return NULL;
+
+  return c + 1;
+}
+
+int xml_parse (xml_parser_t * parser, unsigned char *c, unsigned char *end)
+{
+  unsigned char *stack[XML_PARSER_DEPTH];
+  unsigned char *name, *e, *value;
+
+  parser->depth = 0;
+
+  for (;;) {
+    while ((c != end) && isspace (*c))
+      c++;
+    if ((c == end) || !*c)
+      break;
+
+    if (*c != '<')
+      return -1;
+
+    /* skip comments and processing instructions */
+    if (!strncmp (c, "<!--", 4)) {
+      c = strstr (c, "-->");
+      if (!c)
+	return -1;
+      c += 3;
+      continue;
+    }
+    if (c[1] == '?') {
+      c = strstr (c, "?>");
+      if (!c)
+	return -1;
+      c += 2;
+      continue;
+    }
+
+    /* end of a tree element */
+    if (c[1] == '/') {
+      if (!parser->depth)
+	return -1;
+      name = stack[parser->depth - 1];
+      c = xml_parse_close (c, end, name);
+      if (!c)
+	return -1;
+      parser->depth--;
+      if (parser->end && parser->end (parser, name))
+	return -1;
+      continue;
+    }
+
+    /* find end of tag */
+    e = ++c;
+    while ((e != end) && (*e != '>'))
+      e++;
+    if (e == end)
+      return -1;
+
+    /* element name: attributes are ignored */
+    name = c;
+    while ((c != e) && !isspace (*c) && (*c != '/'))
+      c++;
+
+    /* element without contents */
+    if (*(e - 1) == '/') {
+      *c = '\0';
+      if (parser->start && parser->start (parser, name))
+	return -1;
+      if (parser->end && parser->end (parser, name))
+	return -1;
+      c = e + 1;
+      continue;
+    }
+    *c = '\0';
+
+    /* look at the contents */
+    c = e + 1;
+    while ((c != end) && isspace (*c))
+      c++;
+    if (c == end)
+      return -1;
+
+    /* tree element */
+    if ((*c == '<') && (c[1] != '/') && strncmp (c, "<![CDATA[", 9)) {
+      if (parser->depth >= XML_PARSER_DEPTH)
+	return -1;
+      if (parser->start && parser->start (parser, name))
+	return -1;
+      stack[parser->depth++] = name;
+      continue;
+    }
+
+    /* data element */
+    if (!strncmp (c, "<![CDATA[", 9)) {
+      value = c + 9;
+      c = strstr (value, "]]>");
+      if (!c)
+	return -1;
+      *c = '\0';
+      c = xml_parse_close (c + 3, end, name);
+    } else {
+      value = c;
+      while ((c != end) && (*c != '<'))
+	c++;
+      e = c;
+      c = xml_parse_close (c, end, name);
+      *e = '\0';
+      xml_unescape_inplace (value);
+    }
+    if (!c)
+      return -1;
+
+    if (parser->value && parser->value (parser, name, value))
+      return -1;
+  }
+
+  return parser->depth ? -1 : 0;
+}
+
 buffer_t *xml_export_element (xml_node_t * node, buffer_t * buf, int level)
 {
   xml_node_t *child;
@@ -730,6 +914,28 @@ xml_node_t *xml_read (FILE * fp)
   return node;
 };
 
+/* read the rest of the file into a buffer for xml_parse. the data is terminated,
+ *  the end of the buffer points at the terminator. */
+buffer_t *xml_load (FILE * fp)
+{
+  buffer_t *buf;
+  unsigned long offset, length;
+
+  offset = ftell (fp);
+  fseek (fp, 0, SEEK_END);
+  length = ftell (fp) - offset;
+  fseek (fp, offset, SEEK_SET);
+
+  buf = bf_alloc (length + 1);
+  if (!buf)
+    return NULL;
+
+  buf->e += fread (buf->s, 1, length, fp);
+  *buf->e = 0;
+
+  return buf;
+}
+
 unsigned long xml_write (FILE * fp, xml_node_t * tree)
 {
   unsigned long l = 0;
@@ -748,3 +954,271 @@ unsigned long xml_write (FILE * fp, xml_node_t * tree)
 
   return l;
 };
+
+/*
+ * streaming writer
+ */
+
+static void xml_writer_flush (xml_writer_t * w)
+{
+  unsigned long l = bf_used (w->buf);
+
+  if (!l)
+    return;
+
+  if (fwrite (w->buf->s, 1, l, w->fp) != l)
+    w->error = 1;
+  w->written += l;
+  bf_clear (w->buf);
+}
+
+static void xml_writer_raw (xml_writer_t * w, unsigned char *data, unsigned long length)
+{
+  unsigned long l;
+
+  while (length) {
+    if (!bf_unused (w->buf))
+      xml_writer_flush (w);
+
+    l = bf_unused (w->buf);
+    if (l > length)
+      l = length;
+
+    memcpy (w->buf->e, data, l);
+    w->buf->e += l;
+    data += l;
+    length -= l;
+  }
+}
+
+#define xml_writer_str(w, s)	xml_writer_raw (w, (unsigned char *) (s), strlen (s))
+
+/* escape straight into the output buffer */
+static void xml_writer_escape (xml_writer_t * w, unsigned char *src)
+{
+  for (; *src; src++) {
+    /* room for the longest escape sequence */
+    if (bf_unused (w->buf) < 5)
+      xml_writer_flush (w);
+
+    switch (*src) {
+      case '<':
+	memcpy (w->buf->e, "&lt;", 4);
+	w->buf->e += 4;
+	break;
+      case '>':
+	memcpy (w->buf->e, "&gt;", 4);
+	w->buf->e += 4;
+	break;
+      case '&':
+	memcpy (w->buf->e, "&amp;", 5);
+	w->buf->e += 5;
+	break;
+      default:
+	*w->buf->e++ = *src;
+    }
+  }
+}
+
+static void xml_writer_indent (xml_writer_t * w)
+{
+  unsigned int i;
+
+  for (i = 0; i < w->depth; i++)
+    xml_writer_raw (w, "  ", 2);
+}
+
+/* finish the start tag of the parent element, it has contents */
+static void xml_writer_content (xml_writer_t * w)
+{
+  if (!w->open)
+    return;
+
+  xml_writer_raw (w, ">\n", 2);
+  w->open = 0;
+}
+
+xml_writer_t *xml_writer_open (FILE * fp)
+{
+  xml_writer_t *w;
+
+  w = malloc (sizeof (xml_writer_t));
+  if (!w)
+    return NULL;
+
+  memset (w, 0, sizeof (xml_writer_t));
+  w->fp = fp;
+  w->buf = bf_alloc (XML_WRITER_BUFSIZE);
+  w->scratch = bf_alloc (10240);
+
+  xml_writer_str (w, "<?xml version=\"1.1\" ?>\n");
+
+  return w;
+}
+
+/* writer for a part of a document that is copied in later with xml_writer_copy.
+ *  no declaration, elements start at depth. */
+xml_writer_t *xml_writer_open_part (FILE * fp, unsigned int depth)
+{
+  xml_writer_t *w;
+
+  w = malloc (sizeof (xml_writer_t));
+  if (!w)
+    return NULL;
+
+  memset (w, 0, sizeof (xml_writer_t));
+  w->fp = fp;
+  w->buf = bf_alloc (XML_WRITER_BUFSIZE);
+  w->scratch = bf_alloc (10240);
+  w->depth = w->base = depth;
+
+  return w;
+}
+
+/* copy a part written at the current depth of w from the start of fp */
+int xml_writer_copy (xml_writer_t * w, FILE * fp)
+{
+  size_t l;
+
+  xml_writer_content (w);
+  xml_writer_flush (w);
+
+  rewind (fp);
+  while ((l = fread (w->buf->e, 1, bf_unused (w->buf), fp)) > 0) {
+    w->buf->e += l;
+    xml_writer_flush (w);
+  }
+  if (ferror (fp))
+    w->error = 1;
+
+  return w->error;
+}
+
+/* ends all open elements and flushes the output. returns the number of bytes written. */
+unsigned long xml_writer_close (xml_writer_t * w)
+{
+  unsigned long l;
+
+  while (w->depth > w->base)
+    xml_writer_end (w);
+
+  xml_writer_flush (w);
+
+  l = w->error ? 0 : w->written;
+
+  bf_free (w->scratch);
+  bf_free (w->buf);
+  free (w);
+
+  return l;
+}
+
+void xml_writer_start (xml_writer_t * w, char *name)
+{
+  if (w->depth >= XML_WRITER_DEPTH) {
+    w->error = 1;
+    return;
+  }
+
+  xml_writer_content (w);
+  xml_writer_indent (w);
+  xml_writer_raw (w, "<", 1);
+  xml_writer_str (w, name);
+
+  w->stack[w->depth++] = name;
+  w->open = 1;
+}
+
+void xml_writer_end (xml_writer_t * w)
+{
+  if (w->depth <= w->base)
+    return;
+
+  w->depth--;
+
+  /* element without contents */
+  if (w->open) {
+    xml_writer_raw (w, " />\n", 4);
+    w->open = 0;
+    return;
+  }
+
+  xml_writer_indent (w);
+  xml_writer_raw (w, "</", 2);
+  xml_writer_str (w, w->stack[w->depth]);
+  xml_writer_raw (w, ">\n", 2);
+}
+
+void xml_writer_value (xml_writer_t * w, char *name, xml_type_t type, void *value)
+{
+  unsigned char tmp[64];
+
+  xml_writer_content (w);
+  xml_writer_indent (w);
+  xml_writer_raw (w, "<", 1);
+  xml_writer_str (w, name);
+  xml_writer_raw (w, ">", 1);
+
+  switch (type) {
+    case XML_TYPE_PTR:
+      snprintf (tmp, sizeof (tmp), "%p", value);
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_LONG:
+      snprintf (tmp, sizeof (tmp), "%ld", *((long *) value));
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_ULONG:
+    case XML_TYPE_MEMSIZE:
+      snprintf (tmp, sizeof (tmp), "%lu", *((unsigned long *) value));
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_BYTESIZE:
+    case XML_TYPE_ULONGLONG:
+#ifndef USE_WINDOWS
+      snprintf (tmp, sizeof (tmp), "%llu", *((unsigned long long *) value));
+#else
+      snprintf (tmp, sizeof (tmp), "%I64u", *((unsigned long long *) value));
+#endif
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_CAP:
+      bf_clear (w->scratch);
+      flags_print ((Capabilities + CAP_PRINT_OFFSET), w->scratch,
+		   *((unsigned long long *) value));
+      *w->scratch->e = '\0';
+      xml_writer_escape (w, w->scratch->s);
+      break;
+    case XML_TYPE_INT:
+      snprintf (tmp, sizeof (tmp), "%d", *((int *) value));
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_UINT:
+      snprintf (tmp, sizeof (tmp), "%u", *((unsigned int *) value));
+      xml_writer_str (w, tmp);
+      break;
+    case XML_TYPE_DOUBLE:
+      bf_clear (w->scratch);
+      bf_printf (w->scratch, "%lf", *((double *) value));
+      xml_writer_raw (w, w->scratch->s, bf_used (w->scratch));
+      break;
+    case XML_TYPE_STRING:
+      if (value)
+	xml_writer_escape (w, value);
+      break;
+    case XML_TYPE_IP:
+      {
+	struct in_addr ia;
+
+	ia.s_addr = *((unsigned long *) value);
+	xml_writer_str (w, inet_ntoa (ia));
+      }
+      break;
+    default:
+      xml_writer_escape (w, _("!Unknown Type!\n"));
+  }
+
+  xml_writer_raw (w, "</", 2);
+  xml_writer_str (w, name);
+  xml_writer_raw (w, ">\n", 2);
+}
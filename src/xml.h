@@ -57,6 +57,43 @@ typedef struct xml_node {
   char *value;
 } xml_node_t;
 
+/* streaming writer: elements are written out as they are emitted, no tree is built. */
+#define XML_WRITER_BUFSIZE	65536
+#define XML_WRITER_DEPTH	32
+
+typedef struct xml_writer {
+  FILE *fp;
+  buffer_t *buf;		/* output staging buffer */
+  buffer_t *scratch;		/* for values that need formatting first */
+
+  unsigned long written;
+  unsigned int depth;
+  unsigned int base;		/* depth of a part writer, it cannot end elements below it */
+  unsigned int open;		/* start tag of innermost element is not finished yet */
+  int error;
+
+  char *stack[XML_WRITER_DEPTH];	/* element names, must remain valid until the element is ended */
+} xml_writer_t;
+
+/* event driven parser: names and values are terminated and unescaped in place in the
+ *  parsed buffer, they are only valid until that buffer is released.
+ *  value is called for data elements, start and end for all other elements.
+ *  depth is the number of enclosing elements. a handler returning non-zero aborts the parse.
+ *  finish is not called by xml_parse: the owner of a parser calls it once the whole document
+ *  is parsed, ok tells it to apply what it collected or to drop it.
+ */
+#define XML_PARSER_DEPTH	32
+
+typedef struct xml_parser {
+  int (*start) (struct xml_parser *, unsigned char *name);
+  int (*value) (struct xml_parser *, unsigned char *name, unsigned char *value);
+  int (*end) (struct xml_parser *, unsigned char *name);
+  int (*finish) (struct xml_parser *, int ok);
+
+  void *ctxt;
+  unsigned int depth;
+} xml_parser_t;
+
 extern xml_node_t *xml_node_add (xml_node_t *parent, char *name);
 extern xml_node_t *xml_node_add_value (xml_node_t *parent, char *name, xml_type_t type, void *);
 extern xml_node_t *xml_parent (xml_node_t *parent);
@@ -80,4 +117,16 @@ extern unsigned long xml_write (FILE *, xml_node_t *);
 
 extern unsigned int xml_free (xml_node_t *tree);
 
+extern buffer_t *xml_load (FILE *);
+extern int xml_parse (xml_parser_t *, unsigned char *start, unsigned char *end);
+extern int xml_value_get (unsigned char *value, xml_type_t type, void *);
+
+extern xml_writer_t *xml_writer_open (FILE *);
+extern xml_writer_t *xml_writer_open_part (FILE *, unsigned int depth);
+extern int xml_writer_copy (xml_writer_t *, FILE *);
+extern unsigned long xml_writer_close (xml_writer_t *);
+extern void xml_writer_start (xml_writer_t *, char *name);
+extern void xml_writer_end (xml_writer_t *);
+extern void xml_writer_value (xml_writer_t *, char *name, xml_type_t type, void *);
+
 #endif
@@ -0,0 +1,834 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Synthetic NMDC load. Opens a number of client connections to a hub, logs
+ *  them all in and lets them send a mix of chat, searches, search results,
+ *  connect requests and private messages. Reports login time and the time
+ *  between sending a chat line or pm and receiving it back, in microseconds.
+ *
+ *   make aqload
+ *   ./aqload -n 2000 -r 200 -t 120 -m chat=2,asearch=6,psearch=6,sr=4,ctm=2,pm=1
+ *
+ *  Rates are actions per online client per minute. Runs with the same seed
+ *  send the same traffic. The hub has to let the clients in and let them talk:
+ *  set hub.allowcloning (or spread the clients over loopback addresses with -i),
+ *  hub.reconnectperiod and hub.ReconnectBantime to 0, raise rate.connect.* and
+ *  give user.defaultrights the pm right. The rate.* limits of the users still
+ *  apply, so high rates get dropped by the hub.
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_WAIT)
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+#else
+#  include <poll.h>
+#endif
+
+#define LOAD_BUFFERSIZE		4096
+#define LOAD_MAXEVENTS		256
+#define LOAD_TICK		10	/* ms */
+#define LOAD_MARKER		"aqload"
+
+#define STATE_FREE		0
+#define STATE_CONNECTING	1
+#define STATE_LOCK		2	/* waiting for $Lock */
+#define STATE_LOGIN		3	/* waiting for our own $MyINFO */
+#define STATE_ONLINE		4
+#define STATE_FAILED		5
+
+typedef unsigned long long usec_t;
+
+typedef struct load_buffer {
+  unsigned char *s;
+  unsigned long length, size;
+} load_buffer_t;
+
+typedef struct load_client {
+  int fd, state, active, writing;
+  unsigned int index;
+  unsigned long address;
+  unsigned char nick[32];
+  usec_t start;
+  load_buffer_t in, out;
+} load_client_t;
+
+/* an action is something an online client sends */
+typedef struct load_action {
+  unsigned char *name;
+  double rate;			/* per client per minute */
+  double pending;
+  unsigned long sent;
+  void (*send) (load_client_t *);
+} load_action_t;
+
+/* latency samples, sorted when the report is printed */
+typedef struct load_samples {
+  unsigned char *name;
+  usec_t *values;
+  unsigned long count, size;
+} load_samples_t;
+
+/* options */
+unsigned char *host = "127.0.0.1";
+unsigned int port = 411;
+unsigned long sourcebase = 0x7f000001;
+unsigned int sources = 1;
+unsigned int clients = 100;
+unsigned int connectrate = 100;
+unsigned int duration = 60;
+unsigned int activepct = 50;
+unsigned char *prefix = "load";
+unsigned char *password = NULL;
+unsigned long long share = 10ULL * 1024 * 1024 * 1024;
+unsigned int seed = 1;
+
+load_client_t *client;
+load_client_t **online;
+unsigned int onlinecount = 0, connected = 0, failed = 0, started = 0;
+unsigned long long bytesin = 0, bytesout = 0;
+unsigned long chatsreceived = 0, pmsreceived = 0, sequence = 0;
+
+load_samples_t logintime = { "login", NULL, 0, 0 };
+load_samples_t chatlatency = { "chat", NULL, 0, 0 };
+load_samples_t pmlatency = { "pm", NULL, 0, 0 };
+
+volatile int stop = 0;
+
+#ifdef USE_EPOLL
+int epfd;
+#endif
+
+usec_t load_now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((usec_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+void load_sample (load_samples_t * s, usec_t value)
+{
+  usec_t *values;
+
+  if (s->count == s->size) {
+    values = realloc (s->values, (s->size + 4096) * sizeof (usec_t));
+    if (!values)
+      return;
+    s->values = values;
+    s->size += 4096;
+  }
+  s->values[s->count++] = value;
+}
+
+int load_compare (const void *a, const void *b)
+{
+  usec_t x = *(usec_t *) a, y = *(usec_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+void load_samples_print (load_samples_t * s)
+{
+  usec_t total = 0;
+  unsigned long i;
+
+  if (!s->count) {
+    printf ("%-8s no samples\n", s->name);
+    return;
+  }
+
+  qsort (s->values, s->count, sizeof (usec_t), load_compare);
+  for (i = 0; i < s->count; i++)
+    total += s->values[i];
+
+  printf ("%-8s %8lu samples, avg %8llu, 50%% %8llu, 90%% %8llu, 99%% %8llu, max %8llu\n",
+	  s->name, s->count, total / s->count, s->values[(s->count - 1) * 50 / 100],
+	  s->values[(s->count - 1) * 90 / 100], s->values[(s->count - 1) * 99 / 100],
+	  s->values[s->count - 1]);
+}
+
+/******************************* BUFFERS *******************************************/
+
+int load_buffer_reserve (load_buffer_t * b, unsigned long length)
+{
+  unsigned char *s;
+  unsigned long size;
+
+  if (b->length + length <= b->size)
+    return 0;
+
+  size = b->size ? b->size : LOAD_BUFFERSIZE;
+  while (size < b->length + length)
+    size *= 2;
+
+  s = realloc (b->s, size);
+  if (!s)
+    return -1;
+
+  b->s = s;
+  b->size = size;
+  return 0;
+}
+
+void load_buffer_consume (load_buffer_t * b, unsigned long length)
+{
+  if (length < b->length)
+    memmove (b->s, b->s + length, b->length - length);
+  b->length -= length;
+}
+
+/******************************* CONNECTIONS *******************************************/
+
+void load_events (load_client_t * c, int out)
+{
+#ifdef USE_EPOLL
+  struct epoll_event ev;
+
+  if (c->writing == out)
+    return;
+  c->writing = out;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl (epfd, EPOLL_CTL_MOD, c->fd, &ev);
+#endif
+}
+
+void load_close (load_client_t * c, int state)
+{
+  unsigned int i;
+
+  if (c->state == STATE_ONLINE) {
+    for (i = 0; i < onlinecount; i++)
+      if (online[i] == c)
+	break;
+    online[i] = online[--onlinecount];
+  }
+  if (state == STATE_FAILED)
+    failed++;
+
+  close (c->fd);
+  c->fd = -1;
+  c->state = state;
+  c->in.length = 0;
+  c->out.length = 0;
+}
+
+void load_flush (load_client_t * c)
+{
+  int n;
+
+  while (c->out.length) {
+    n = send (c->fd, c->out.s, c->out.length, 0);
+    if (n < 0) {
+      if (errno == EAGAIN)
+	break;
+      load_close (c, STATE_FAILED);
+      return;
+    }
+    bytesout += n;
+    load_buffer_consume (&c->out, n);
+  }
+
+  load_events (c, c->out.length != 0);
+}
+
+void load_send (load_client_t * c, const char *format, ...)
+{
+  va_list ap;
+  int n;
+
+  if (c->fd < 0)
+    return;
+
+  for (;;) {
+    va_start (ap, format);
+    n = vsnprintf (c->out.s + c->out.length, c->out.size - c->out.length, format, ap);
+    va_end (ap);
+    if ((n >= 0) && ((unsigned long) n < c->out.size - c->out.length))
+      break;
+    if (load_buffer_reserve (&c->out, (n >= 0) ? n + 1 : LOAD_BUFFERSIZE))
+      return;
+  }
+  c->out.length += n;
+
+  /* only write directly if nothing is waiting */
+  if (c->out.length == (unsigned long) n)
+    load_flush (c);
+}
+
+int load_connect (load_client_t * c)
+{
+  struct sockaddr_in sa;
+  int yes = 1;
+
+  c->fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (c->fd < 0) {
+    perror ("socket");
+    return -1;
+  }
+  fcntl (c->fd, F_SETFL, O_NONBLOCK);
+  setsockopt (c->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof (yes));
+
+  if (sources > 1) {
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl (c->address);
+    if (bind (c->fd, (struct sockaddr *) &sa, sizeof (sa)))
+      perror ("bind");
+  }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = inet_addr (host);
+
+  c->start = load_now ();
+  c->state = STATE_CONNECTING;
+  if (connect (c->fd, (struct sockaddr *) &sa, sizeof (sa)) && (errno != EINPROGRESS)) {
+    load_close (c, STATE_FAILED);
+    return -1;
+  }
+
+#ifdef USE_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl (epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->writing = 1;
+  }
+#endif
+
+  return 0;
+}
+
+/******************************* PROTOCOL *******************************************/
+
+/* the key is sent with the bytes 0, 5, 36, 96, 124 and 126 escaped */
+void load_key (load_client_t * c, unsigned char *lock, unsigned long length)
+{
+  unsigned char key[1024], out[1024 * 10 + 1];
+  unsigned long i, l;
+
+  if (length > sizeof (key))
+    length = sizeof (key);
+  if (length < 3)
+    return;
+
+  for (i = 1; i < length; i++)
+    key[i] = lock[i] ^ lock[i - 1];
+  key[0] = lock[0] ^ lock[length - 1] ^ lock[length - 2] ^ 5;
+
+  for (i = 0, l = 0; i < length; i++) {
+    key[i] = ((key[i] << 4) & 0xf0) | ((key[i] >> 4) & 0x0f);
+    switch (key[i]) {
+      case 0:
+      case 5:
+      case 36:
+      case 96:
+      case 124:
+      case 126:
+	l += sprintf (out + l, "/%%DCN%03d%%/", key[i]);
+	break;
+      default:
+	out[l++] = key[i];
+    }
+  }
+  out[l] = 0;
+
+  load_send (c, "$Supports NoGetINFO NoHello|$Key %s|$ValidateNick %s|", out, c->nick);
+}
+
+void load_myinfo (load_client_t * c)
+{
+  load_send (c, "$Version 1,0091|$GetNickList|$MyINFO $ALL %s " LOAD_MARKER
+	     "<++ V:0.706,M:%c,H:1/0/0,S:3>$ $DSL\x01$$%llu$|", c->nick, c->active ? 'A' : 'P',
+	     share);
+}
+
+void load_online (load_client_t * c)
+{
+  load_sample (&logintime, load_now () - c->start);
+  c->state = STATE_ONLINE;
+  online[onlinecount++] = c;
+}
+
+/* handle one message, without the trailing | */
+void load_message (load_client_t * c, unsigned char *s, unsigned long l)
+{
+  unsigned char *p;
+  usec_t stamp;
+  unsigned long nl = strlen (c->nick);
+
+  /* chat: <nick> aqload <sequence> <stamp> */
+  if (*s == '<') {
+    if ((l > nl + 2) && !strncmp (s + 1, c->nick, nl) && (s[nl + 1] == '>')) {
+      p = strstr (s, LOAD_MARKER " ");
+      if (!p)
+	return;
+      p = strchr (p + sizeof (LOAD_MARKER), ' ');
+      if (!p)
+	return;
+      stamp = strtoull (p + 1, NULL, 10);
+      load_sample (&chatlatency, load_now () - stamp);
+      chatsreceived++;
+    }
+    return;
+  }
+
+  if (*s != '$')
+    return;
+
+  switch (c->state) {
+    case STATE_LOCK:
+      if (!strncmp (s, "$Lock ", 6)) {
+	p = strstr (s, " Pk=");
+	load_key (c, s + 6, (p ? p : s + l) - (s + 6));
+	c->state = STATE_LOGIN;
+      }
+      return;
+    case STATE_LOGIN:
+      if (!strncmp (s, "$GetPass", 8)) {
+	if (!password) {
+	  fprintf (stderr, "%s: hub asks for a password, use -w\n", c->nick);
+	  load_close (c, STATE_FAILED);
+	  return;
+	}
+	load_send (c, "$MyPass %s|", password);
+	return;
+      }
+      if (!strncmp (s, "$Hello ", 7) && !strncmp (s + 7, c->nick, nl)) {
+	load_myinfo (c);
+	return;
+      }
+      if (!strncmp (s, "$LogedIn", 8))
+	return;
+      if (!strncmp (s, "$ValidateDenide", 15) || !strncmp (s, "$BadPass", 8)
+	  || !strncmp (s, "$HubIsFull", 10) || !strncmp (s, "$ForceMove", 10)) {
+	load_close (c, STATE_FAILED);
+	return;
+      }
+      /* the hub echoes our own MyINFO when the login is complete */
+      if (!strncmp (s, "$MyINFO $ALL ", 13) && !strncmp (s + 13, c->nick, nl)
+	  && (s[13 + nl] == ' ')) {
+	load_online (c);
+	return;
+      }
+      return;
+  }
+
+  /* $To: nick From: other $<other> aqload <sequence> <stamp> */
+  if (!strncmp (s, "$To: ", 5)) {
+    p = strstr (s, "> " LOAD_MARKER " ");
+    if (!p)
+      return;
+    p = strchr (p + 2 + sizeof (LOAD_MARKER), ' ');
+    if (!p)
+      return;
+    stamp = strtoull (p + 1, NULL, 10);
+    load_sample (&pmlatency, load_now () - stamp);
+    pmsreceived++;
+    return;
+  }
+  if (!strncmp (s, "$ForceMove", 10)) {
+    load_close (c, STATE_FAILED);
+    return;
+  }
+}
+
+void load_input (load_client_t * c)
+{
+  unsigned char *s, *e;
+  int n;
+
+  for (;;) {
+    if (load_buffer_reserve (&c->in, LOAD_BUFFERSIZE))
+      return;
+    n = recv (c->fd, c->in.s + c->in.length, c->in.size - c->in.length - 1, 0);
+    if (n == 0) {
+      load_close (c, STATE_FAILED);
+      return;
+    }
+    if (n < 0) {
+      if (errno != EAGAIN)
+	load_close (c, STATE_FAILED);
+      return;
+    }
+    bytesin += n;
+    c->in.length += n;
+    c->in.s[c->in.length] = 0;
+
+    /* handle all complete messages */
+    s = c->in.s;
+    while ((e = memchr (s, '|', c->in.length - (s - c->in.s)))) {
+      *e = 0;
+      load_message (c, s, e - s);
+      if (c->fd < 0)
+	return;
+      s = e + 1;
+    }
+    load_buffer_consume (&c->in, s - c->in.s);
+  }
+}
+
+void load_output (load_client_t * c)
+{
+  int err = 0;
+  socklen_t len = sizeof (err);
+
+  if (c->state == STATE_CONNECTING) {
+    if (getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+      load_close (c, STATE_FAILED);
+      return;
+    }
+    connected++;
+    c->state = STATE_LOCK;
+  }
+
+  load_flush (c);
+}
+
+/******************************* ACTIONS *******************************************/
+
+load_client_t *load_random ()
+{
+  return online[rand () % onlinecount];
+}
+
+void load_chat (load_client_t * c)
+{
+  load_send (c, "<%s> " LOAD_MARKER " %lu %llu|", c->nick, ++sequence, load_now ());
+}
+
+void load_search_active (load_client_t * c)
+{
+  struct in_addr ia;
+
+  ia.s_addr = htonl (c->address);
+  load_send (c, "$Search %s:%u F?T?0?1?" LOAD_MARKER "$%lu|", inet_ntoa (ia),
+	     10000 + c->index, ++sequence);
+}
+
+void load_search_passive (load_client_t * c)
+{
+  load_send (c, "$Search Hub:%s F?T?0?1?" LOAD_MARKER "$%lu|", c->nick, ++sequence);
+}
+
+void load_result (load_client_t * c)
+{
+  load_client_t *target = load_random ();
+
+  sequence++;
+  load_send (c, "$SR %s share\\" LOAD_MARKER "\\file%lu.bin\x05%lu 1/3\x05"
+	     "TTH:AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA (%s:%u)\x05%s|", c->nick, sequence,
+	     sequence * 1024, host, port, target->nick);
+}
+
+void load_ctm (load_client_t * c)
+{
+  load_client_t *target = load_random ();
+  struct in_addr ia;
+
+  ia.s_addr = htonl (c->address);
+  load_send (c, "$ConnectToMe %s %s:%u|", target->nick, inet_ntoa (ia), 10000 + c->index);
+}
+
+void load_pm (load_client_t * c)
+{
+  load_client_t *target = load_random ();
+
+  load_send (c, "$To: %s From: %s $<%s> " LOAD_MARKER " %lu %llu|", target->nick, c->nick,
+	     c->nick, ++sequence, load_now ());
+}
+
+load_action_t actions[] = {
+  {"chat", 1, 0, 0, load_chat},
+  {"asearch", 2, 0, 0, load_search_active},
+  {"psearch", 2, 0, 0, load_search_passive},
+  {"sr", 2, 0, 0, load_result},
+  {"ctm", 1, 0, 0, load_ctm},
+  {"pm", 1, 0, 0, load_pm},
+  {NULL, 0, 0, 0, NULL}
+};
+
+int load_mix (unsigned char *mix)
+{
+  unsigned char *s, *e, *v;
+  load_action_t *a;
+
+  for (s = mix; s && *s; s = e) {
+    e = strchr (s, ',');
+    if (e)
+      *e++ = 0;
+    v = strchr (s, '=');
+    if (!v)
+      return -1;
+    *v++ = 0;
+    for (a = actions; a->name; a++)
+      if (!strcmp (a->name, s))
+	break;
+    if (!a->name)
+      return -1;
+    a->rate = strtod (v, NULL);
+  }
+  return 0;
+}
+
+/* spread the actions over the online clients */
+void load_actions (double seconds)
+{
+  load_action_t *a;
+  load_client_t *c;
+
+  if (!onlinecount)
+    return;
+
+  for (a = actions; a->name; a++) {
+    a->pending += a->rate * onlinecount * seconds / 60;
+    while ((a->pending >= 1) && onlinecount) {
+      a->pending -= 1;
+      c = load_random ();
+      a->send (c);
+      a->sent++;
+    }
+  }
+}
+
+/******************************* MAIN *******************************************/
+
+void load_report (usec_t start, int final)
+{
+  load_action_t *a;
+
+  printf ("%6.1fs online %u/%u, failed %u, in %llu KiB, out %llu KiB, chat %lu, pm %lu\n",
+	  (load_now () - start) / 1000000.0, onlinecount, clients, failed, bytesin / 1024,
+	  bytesout / 1024, chatsreceived, pmsreceived);
+  if (!final)
+    return;
+
+  printf ("\nSent:");
+  for (a = actions; a->name; a++)
+    printf (" %s %lu", a->name, a->sent);
+  printf ("\n\nLatency in microseconds:\n");
+  load_samples_print (&logintime);
+  load_samples_print (&chatlatency);
+  load_samples_print (&pmlatency);
+}
+
+void load_signal (int sig)
+{
+  stop = 1;
+}
+
+void usage (char *name)
+{
+  load_action_t *a;
+
+  printf ("%s [options]\n"
+	  " -h host       hub address (%s)\n"
+	  " -p port       hub port (%u)\n"
+	  " -n clients    number of connections (%u)\n"
+	  " -r rate       new connections per second (%u)\n"
+	  " -t seconds    duration of the test (%u)\n"
+	  " -a percent    share of active clients (%u)\n"
+	  " -i count      spread clients over this many source addresses from 127.0.0.1 (%u)\n"
+	  " -N prefix     nick prefix (%s)\n"
+	  " -w password   password for registered nicks\n"
+	  " -s seed       random seed (%u)\n"
+	  " -m mix        actions per client per minute, defaults:",
+	  name, host, port, clients, connectrate, duration, activepct, sources, prefix, seed);
+  for (a = actions; a->name; a++)
+    printf ("%s%s=%g", (a == actions) ? " " : ",", a->name, a->rate);
+  printf ("\n");
+}
+
+int main (int argc, char **argv)
+{
+  int opt, n, i;
+  unsigned int j, next = 0;
+  usec_t start, now, last, report;
+  load_client_t *c;
+
+#ifdef USE_EPOLL
+  struct epoll_event events[LOAD_MAXEVENTS];
+#else
+  struct pollfd *pfd;
+  load_client_t **pc;
+#endif
+
+  while ((opt = getopt (argc, argv, "h:p:n:r:t:a:i:N:w:s:m:")) != -1) {
+    switch (opt) {
+      case 'h':
+	host = optarg;
+	break;
+      case 'p':
+	port = atoi (optarg);
+	break;
+      case 'n':
+	clients = atoi (optarg);
+	break;
+      case 'r':
+	connectrate = atoi (optarg);
+	break;
+      case 't':
+	duration = atoi (optarg);
+	break;
+      case 'a':
+	activepct = atoi (optarg);
+	break;
+      case 'i':
+	sources = atoi (optarg);
+	break;
+      case 'N':
+	prefix = optarg;
+	break;
+      case 'w':
+	password = optarg;
+	break;
+      case 's':
+	seed = atoi (optarg);
+	break;
+      case 'm':
+	if (load_mix (optarg)) {
+	  fprintf (stderr, "Bad mix: %s\n", optarg);
+	  return 1;
+	}
+	break;
+      default:
+	usage (argv[0]);
+	return 1;
+    }
+  }
+
+  if (!clients || !connectrate || !sources) {
+    usage (argv[0]);
+    return 1;
+  }
+
+  client = calloc (clients, sizeof (load_client_t));
+  online = calloc (clients, sizeof (load_client_t *));
+  if (!client || !online) {
+    perror ("calloc");
+    return 1;
+  }
+
+  srand (seed);
+  for (j = 0; j < clients; j++) {
+    client[j].fd = -1;
+    client[j].index = j;
+    client[j].address = sourcebase + (j % sources);
+    client[j].active = (unsigned int) (rand () % 100) < activepct;
+    snprintf (client[j].nick, sizeof (client[j].nick), "%s%05u", prefix, j);
+  }
+
+#ifdef USE_EPOLL
+  epfd = epoll_create (clients);
+  if (epfd < 0) {
+    perror ("epoll_create");
+    return 1;
+  }
+#else
+  pfd = calloc (clients, sizeof (struct pollfd));
+  pc = calloc (clients, sizeof (load_client_t *));
+  if (!pfd || !pc) {
+    perror ("calloc");
+    return 1;
+  }
+#endif
+
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGINT, load_signal);
+  signal (SIGTERM, load_signal);
+
+  start = last = report = load_now ();
+  while (!stop) {
+    now = load_now ();
+    if (now - start >= duration * 1000000ULL)
+      break;
+
+    /* open new connections at the configured rate */
+    while ((next < clients) && (next < (now - start) * connectrate / 1000000 + 1)) {
+      started++;
+      load_connect (&client[next++]);
+    }
+
+    load_actions ((now - last) / 1000000.0);
+    last = now;
+
+    if (now - report >= 1000000) {
+      load_report (start, 0);
+      report = now;
+    }
+#ifdef USE_EPOLL
+    n = epoll_wait (epfd, events, LOAD_MAXEVENTS, LOAD_TICK);
+    for (i = 0; i < n; i++) {
+      c = events[i].data.ptr;
+      if ((c->fd >= 0) && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+	load_output (c);
+      if ((c->fd >= 0) && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+	load_input (c);
+    }
+#else
+    for (j = 0, n = 0; j < next; j++) {
+      if (client[j].fd < 0)
+	continue;
+      pfd[n].fd = client[j].fd;
+      pfd[n].events = POLLIN;
+      if ((client[j].state == STATE_CONNECTING) || client[j].out.length)
+	pfd[n].events |= POLLOUT;
+      pc[n++] = &client[j];
+    }
+    if (poll (pfd, n, LOAD_TICK) <= 0)
+      continue;
+    for (i = 0; i < n; i++) {
+      c = pc[i];
+      if ((c->fd >= 0) && (pfd[i].revents & (POLLOUT | POLLERR | POLLHUP)))
+	load_output (c);
+      if ((c->fd >= 0) && (pfd[i].revents & (POLLIN | POLLERR | POLLHUP)))
+	load_input (c);
+    }
+#endif
+  }
+
+  load_report (start, 1);
+
+  return 0;
+}
@@ -0,0 +1,659 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Replays a traffic capture made with the "capture" command into a hub.
+ *  Every captured connection is opened again and its tokens are sent with
+ *  the recorded timing, divided by the speed factor. Nothing is sent before
+ *  the hub's $Lock arrived and the $Key is computed for the new lock.
+ *  Everything the hub sends is read and thrown away.
+ *
+ *   make aqreplay
+ *   ./aqreplay -x 4 capture-friday
+ *
+ *  The test hub needs the same connect, reconnect and cloning settings as
+ *  for tools/aqload. Registered users only get in if the capture includes
+ *  passwords and the test hub has a copy of the accounts.
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_WAIT)
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+#else
+#  include <poll.h>
+#endif
+
+#include "../src/capture.h"
+
+#define REPLAY_BUFFERSIZE	4096
+#define REPLAY_MAXEVENTS	256
+#define REPLAY_MAXWAIT		100	/* ms */
+
+#define STATE_NONE		0
+#define STATE_CONNECTING	1
+#define STATE_LOCK		2	/* waiting for $Lock */
+#define STATE_READY		3
+#define STATE_CLOSED		4
+
+typedef unsigned long long usec_t;
+
+typedef struct replay_buffer {
+  unsigned char *s;
+  unsigned long length, size;
+} replay_buffer_t;
+
+typedef struct replay_connection {
+  int fd, state, writing, closing;
+  unsigned long id;
+  unsigned char *lock;
+  unsigned long locklength;
+
+  /* records that arrived before the $Lock */
+  capture_record_t **queue;
+  unsigned long queued, queuesize;
+
+  replay_buffer_t in, out;
+} replay_connection_t;
+
+/* options */
+unsigned char *host = "127.0.0.1";
+unsigned int port = 411;
+unsigned long sourcebase = 0x7f000001;
+unsigned int sources = 1;
+double speed = 1.0;
+
+replay_connection_t *connection;
+unsigned long connections = 0;
+
+unsigned long opened = 0, active = 0, refused = 0, dropped = 0, tokens = 0, skipped = 0;
+unsigned long long bytesin = 0, bytesout = 0;
+
+volatile int stop = 0;
+
+#ifdef USE_EPOLL
+int epfd;
+#endif
+
+usec_t replay_now ()
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return ((usec_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/******************************* BUFFERS *******************************************/
+
+int replay_buffer_append (replay_buffer_t * b, unsigned char *data, unsigned long length)
+{
+  unsigned char *s;
+  unsigned long size;
+
+  if (b->length + length > b->size) {
+    size = b->size ? b->size : REPLAY_BUFFERSIZE;
+    while (size < b->length + length)
+      size *= 2;
+    s = realloc (b->s, size);
+    if (!s)
+      return -1;
+    b->s = s;
+    b->size = size;
+  }
+
+  memcpy (b->s + b->length, data, length);
+  b->length += length;
+
+  return 0;
+}
+
+void replay_buffer_consume (replay_buffer_t * b, unsigned long length)
+{
+  if (length < b->length)
+    memmove (b->s, b->s + length, b->length - length);
+  b->length -= length;
+}
+
+/******************************* CONNECTIONS *******************************************/
+
+void replay_events (replay_connection_t * c, int out)
+{
+#ifdef USE_EPOLL
+  struct epoll_event ev;
+
+  if (c->writing == out)
+    return;
+  c->writing = out;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+  ev.data.ptr = c;
+  epoll_ctl (epfd, EPOLL_CTL_MOD, c->fd, &ev);
+#else
+  c->writing = out;
+#endif
+}
+
+void replay_close (replay_connection_t * c, int byhub)
+{
+  if (c->fd < 0)
+    return;
+
+  if (byhub)
+    refused++;
+
+  close (c->fd);
+  c->fd = -1;
+  c->state = STATE_CLOSED;
+  active--;
+
+  dropped += c->queued;
+  c->queued = 0;
+  free (c->lock);
+  c->lock = NULL;
+  free (c->in.s);
+  free (c->out.s);
+  memset (&c->in, 0, sizeof (replay_buffer_t));
+  memset (&c->out, 0, sizeof (replay_buffer_t));
+}
+
+void replay_flush (replay_connection_t * c)
+{
+  int n;
+
+  while (c->out.length) {
+    n = send (c->fd, c->out.s, c->out.length, 0);
+    if (n < 0) {
+      if (errno == EAGAIN)
+	break;
+      replay_close (c, 1);
+      return;
+    }
+    bytesout += n;
+    replay_buffer_consume (&c->out, n);
+  }
+
+  if (!c->out.length && c->closing) {
+    replay_close (c, 0);
+    return;
+  }
+
+  replay_events (c, c->out.length != 0);
+}
+
+void replay_connect (replay_connection_t * c)
+{
+  struct sockaddr_in sa;
+  int yes = 1;
+
+  c->fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (c->fd < 0) {
+    perror ("socket");
+    c->state = STATE_CLOSED;
+    return;
+  }
+  fcntl (c->fd, F_SETFL, O_NONBLOCK);
+  setsockopt (c->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof (yes));
+  opened++;
+  active++;
+
+  if (sources > 1) {
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl (sourcebase + (c->id % sources));
+    if (bind (c->fd, (struct sockaddr *) &sa, sizeof (sa)))
+      perror ("bind");
+  }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons (port);
+  sa.sin_addr.s_addr = inet_addr (host);
+
+  c->state = STATE_CONNECTING;
+  if (connect (c->fd, (struct sockaddr *) &sa, sizeof (sa)) && (errno != EINPROGRESS)) {
+    replay_close (c, 1);
+    return;
+  }
+#ifdef USE_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl (epfd, EPOLL_CTL_ADD, c->fd, &ev);
+  }
+#endif
+  c->writing = 1;
+}
+
+/******************************* PROTOCOL *******************************************/
+
+/* the key is sent with the bytes 0, 5, 36, 96, 124 and 126 escaped */
+void replay_key (replay_connection_t * c)
+{
+  unsigned char key[1024], out[1024 * 10 + 6];
+  unsigned long i, l, length = c->locklength;
+  unsigned char *lock = c->lock;
+
+  if (length > sizeof (key))
+    length = sizeof (key);
+  if (length < 3)
+    return;
+
+  for (i = 1; i < length; i++)
+    key[i] = lock[i] ^ lock[i - 1];
+  key[0] = lock[0] ^ lock[length - 1] ^ lock[length - 2] ^ 5;
+
+  l = sprintf (out, "$Key ");
+  for (i = 0; i < length; i++) {
+    key[i] = ((key[i] << 4) & 0xf0) | ((key[i] >> 4) & 0x0f);
+    switch (key[i]) {
+      case 0:
+      case 5:
+      case 36:
+      case 96:
+      case 124:
+      case 126:
+	l += sprintf (out + l, "/%%DCN%03d%%/", key[i]);
+	break;
+      default:
+	out[l++] = key[i];
+    }
+  }
+  out[l++] = '|';
+
+  replay_buffer_append (&c->out, out, l);
+}
+
+/* send a record on a connection that has its lock */
+void replay_record (replay_connection_t * c, capture_record_t * r)
+{
+  unsigned char *data = (unsigned char *) (r + 1);
+
+  if (r->type == CAPTURE_DISCONNECT) {
+    c->closing = 1;
+    replay_flush (c);
+    return;
+  }
+
+  tokens++;
+  if ((r->length >= 5) && !strncmp (data, "$Key ", 5)) {
+    replay_key (c);
+  } else {
+    replay_buffer_append (&c->out, data, r->length);
+    replay_buffer_append (&c->out, "|", 1);
+  }
+}
+
+void replay_dispatch (capture_record_t * r)
+{
+  replay_connection_t *c;
+  capture_record_t **queue;
+
+  if (!r->id || (r->id > connections)) {
+    skipped++;
+    return;
+  }
+  c = &connection[r->id - 1];
+
+  switch (r->type) {
+    case CAPTURE_CONNECT:
+      if (c->state == STATE_NONE)
+	replay_connect (c);
+      return;
+    case CAPTURE_TOKEN:
+    case CAPTURE_DISCONNECT:
+      break;
+    default:
+      skipped++;
+      return;
+  }
+
+  switch (c->state) {
+    case STATE_NONE:
+    case STATE_CLOSED:
+      if (r->type == CAPTURE_TOKEN)
+	dropped++;
+      return;
+    case STATE_CONNECTING:
+    case STATE_LOCK:
+      if (c->queued == c->queuesize) {
+	queue = realloc (c->queue, (c->queuesize + 16) * sizeof (capture_record_t *));
+	if (!queue) {
+	  dropped++;
+	  return;
+	}
+	c->queue = queue;
+	c->queuesize += 16;
+      }
+      c->queue[c->queued++] = r;
+      return;
+  }
+
+  replay_record (c, r);
+  if (c->fd >= 0)
+    replay_flush (c);
+}
+
+void replay_ready (replay_connection_t * c)
+{
+  unsigned long i, n = c->queued;
+
+  c->state = STATE_READY;
+  c->queued = 0;
+  for (i = 0; (i < n) && (c->fd >= 0); i++)
+    replay_record (c, c->queue[i]);
+
+  free (c->queue);
+  c->queue = NULL;
+  c->queuesize = 0;
+
+  if (c->fd >= 0)
+    replay_flush (c);
+}
+
+void replay_input (replay_connection_t * c)
+{
+  unsigned char buf[16384], *s, *e;
+  int n;
+
+  for (;;) {
+    n = recv (c->fd, buf, sizeof (buf), 0);
+    if (n == 0) {
+      replay_close (c, !c->closing);
+      return;
+    }
+    if (n < 0) {
+      if (errno != EAGAIN)
+	replay_close (c, 1);
+      return;
+    }
+    bytesin += n;
+
+    if (c->state != STATE_LOCK)
+      continue;
+
+    /* keep data until the lock is complete */
+    replay_buffer_append (&c->in, buf, n);
+    e = memchr (c->in.s, '|', c->in.length);
+    if (!e)
+      continue;
+
+    if ((c->in.length > 6) && !strncmp (c->in.s, "$Lock ", 6)) {
+      s = c->in.s + 6;
+      for (e = s; (*e != ' ') && (*e != '|'); e++);
+      c->lock = malloc (e - s);
+      if (c->lock) {
+	memcpy (c->lock, s, e - s);
+	c->locklength = e - s;
+      }
+    }
+    free (c->in.s);
+    memset (&c->in, 0, sizeof (replay_buffer_t));
+
+    if (!c->lock) {
+      replay_close (c, 1);
+      return;
+    }
+    replay_ready (c);
+    if (c->fd < 0)
+      return;
+  }
+}
+
+void replay_output (replay_connection_t * c)
+{
+  int err = 0;
+  socklen_t len = sizeof (err);
+
+  if (c->state == STATE_CONNECTING) {
+    if (getsockopt (c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+      replay_close (c, 1);
+      return;
+    }
+    c->state = STATE_LOCK;
+  }
+
+  replay_flush (c);
+}
+
+/******************************* MAIN *******************************************/
+
+void replay_signal (int sig)
+{
+  stop = 1;
+}
+
+void replay_report (usec_t start, usec_t position, usec_t lag)
+{
+  printf ("%7.1fs capture %7.1fs, lag %6llu ms, open %lu, opened %lu, refused %lu, "
+	  "tokens %lu, dropped %lu, in %llu KiB, out %llu KiB\n",
+	  (replay_now () - start) / 1000000.0, position / 1000000.0, lag / 1000, active, opened,
+	  refused, tokens, dropped, bytesin / 1024, bytesout / 1024);
+}
+
+void usage (char *name)
+{
+  printf ("%s [options] <capture>\n"
+	  " -h host       hub address (%s)\n"
+	  " -p port       hub port (%u)\n"
+	  " -x speed      replay speed, 2 is twice as fast as recorded (%g)\n"
+	  " -i count      spread connections over this many source addresses from 127.0.0.1 (%u)\n",
+	  name, host, port, speed, sources);
+}
+
+int main (int argc, char **argv)
+{
+  int opt, fd, n, i;
+  struct stat st;
+  unsigned char *base, *p, *end;
+  capture_header_t *header;
+  capture_record_t *r;
+  usec_t start, now, due, position, total, report, lag;
+  replay_connection_t *c;
+  unsigned long j;
+
+#ifdef USE_EPOLL
+  struct epoll_event events[REPLAY_MAXEVENTS];
+#else
+  struct pollfd *pfd;
+  replay_connection_t **pc;
+#endif
+
+  while ((opt = getopt (argc, argv, "h:p:x:i:")) != -1) {
+    switch (opt) {
+      case 'h':
+	host = optarg;
+	break;
+      case 'p':
+	port = atoi (optarg);
+	break;
+      case 'x':
+	speed = strtod (optarg, NULL);
+	break;
+      case 'i':
+	sources = atoi (optarg);
+	break;
+      default:
+	usage (argv[0]);
+	return 1;
+    }
+  }
+  if ((optind >= argc) || (speed <= 0) || !sources) {
+    usage (argv[0]);
+    return 1;
+  }
+
+  /* map and check the capture */
+  fd = open (argv[optind], O_RDONLY);
+  if ((fd < 0) || fstat (fd, &st)) {
+    perror (argv[optind]);
+    return 1;
+  }
+  if (st.st_size < (off_t) sizeof (capture_header_t)) {
+    fprintf (stderr, "%s: not a capture\n", argv[optind]);
+    return 1;
+  }
+  base = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    perror ("mmap");
+    return 1;
+  }
+  close (fd);
+  end = base + st.st_size;
+
+  header = (capture_header_t *) base;
+  if (memcmp (header->magic, CAPTURE_MAGIC, sizeof (header->magic))
+      || (header->byteorder != CAPTURE_BYTEORDER) || (header->version != CAPTURE_VERSION)) {
+    fprintf (stderr, "%s: not a capture of this version and byte order\n", argv[optind]);
+    return 1;
+  }
+
+  /* count connections and the duration, a truncated last record is ignored */
+  total = 0;
+  for (p = base + sizeof (capture_header_t); p + sizeof (capture_record_t) <= end;
+       p += sizeof (capture_record_t) + r->length) {
+    r = (capture_record_t *) p;
+    if (r->length > end - p - sizeof (capture_record_t))
+      break;
+    total += r->delta;
+    if (r->id > connections)
+      connections = r->id;
+  }
+  end = p;
+
+  printf ("%s: %lu connections, %.1f seconds, replaying at %gx\n", argv[optind], connections,
+	  total / 1000000.0, speed);
+
+  connection = calloc (connections ? connections : 1, sizeof (replay_connection_t));
+  if (!connection) {
+    perror ("calloc");
+    return 1;
+  }
+  for (j = 0; j < connections; j++) {
+    connection[j].fd = -1;
+    connection[j].id = j + 1;
+  }
+
+#ifdef USE_EPOLL
+  epfd = epoll_create (1024);
+  if (epfd < 0) {
+    perror ("epoll_create");
+    return 1;
+  }
+#else
+  pfd = calloc (connections ? connections : 1, sizeof (struct pollfd));
+  pc = calloc (connections ? connections : 1, sizeof (replay_connection_t *));
+  if (!pfd || !pc) {
+    perror ("calloc");
+    return 1;
+  }
+#endif
+
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGINT, replay_signal);
+  signal (SIGTERM, replay_signal);
+
+  p = base + sizeof (capture_header_t);
+  position = 0;
+  lag = 0;
+  start = report = replay_now ();
+  while (!stop && ((p < end) || active)) {
+    now = replay_now ();
+
+    /* send everything that is due */
+    while (p < end) {
+      r = (capture_record_t *) p;
+      due = start + (usec_t) ((position + r->delta) / speed);
+      if (due > now)
+	break;
+      lag = now - due;
+      position += r->delta;
+      replay_dispatch (r);
+      p += sizeof (capture_record_t) + r->length;
+    }
+
+    if (now - report >= 1000000) {
+      replay_report (start, position, lag);
+      report = now;
+    }
+
+    n = REPLAY_MAXWAIT;
+    if (p < end) {
+      r = (capture_record_t *) p;
+      due = start + (usec_t) ((position + r->delta) / speed);
+      if (due <= now)
+	n = 0;
+      else if ((due - now) / 1000 < REPLAY_MAXWAIT)
+	n = (due - now) / 1000;
+    }
+#ifdef USE_EPOLL
+    n = epoll_wait (epfd, events, REPLAY_MAXEVENTS, n);
+    for (i = 0; i < n; i++) {
+      c = events[i].data.ptr;
+      if ((c->fd >= 0) && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+	replay_output (c);
+      if ((c->fd >= 0) && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+	replay_input (c);
+    }
+#else
+    for (j = 0, i = 0; j < connections; j++) {
+      if (connection[j].fd < 0)
+	continue;
+      pfd[i].fd = connection[j].fd;
+      pfd[i].events = POLLIN | (connection[j].writing ? POLLOUT : 0);
+      pc[i++] = &connection[j];
+    }
+    if (poll (pfd, i, n) <= 0)
+      continue;
+    for (n = i, i = 0; i < n; i++) {
+      c = pc[i];
+      if ((c->fd >= 0) && (pfd[i].revents & (POLLOUT | POLLERR | POLLHUP)))
+	replay_output (c);
+      if ((c->fd >= 0) && (pfd[i].revents & (POLLIN | POLLERR | POLLHUP)))
+	replay_input (c);
+    }
+#endif
+  }
+
+  replay_report (start, position, lag);
+  if (skipped)
+    printf ("Skipped %lu unknown records.\n", skipped);
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *  (C) Copyright 2006 Johan Verrept (jove@users.berlios.de)
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Compares the save paths of the hub: building a DOM and exporting it (dom)
+ *  against the streaming writer (stream). Run each mode in its own process,
+ *  the peak RSS reported is that of the whole process.
+ *
+ *   make xmlbench
+ *   ./xmlbench dom 100000 /tmp/bans.xml
+ *   ./xmlbench stream 100000 /tmp/bans.xml
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "../src/xml.h"
+#include "../src/flags.h"
+
+/* xml.c prints rights through the capability table of the hub */
+flag_t Capabilities[] = {
+  {0, 0, 0}
+};
+
+typedef struct bench_ban {
+  unsigned long ip, netmask, expire;
+  unsigned char nick[64], op[64], message[128];
+} bench_ban_t;
+
+bench_ban_t *bench_generate (unsigned long count)
+{
+  unsigned long i;
+  bench_ban_t *bans;
+
+  bans = malloc (count * sizeof (bench_ban_t));
+  if (!bans)
+    return NULL;
+
+  for (i = 0; i < count; i++) {
+    bans[i].ip = i;
+    bans[i].netmask = 0xffffffff;
+    bans[i].expire = i * 60;
+    snprintf (bans[i].nick, sizeof (bans[i].nick), "nick%lu", i);
+    snprintf (bans[i].op, sizeof (bans[i].op), "operator%lu", i % 16);
+    snprintf (bans[i].message, sizeof (bans[i].message),
+	      "Banned for <spamming> & flooding the main chat (#%lu)", i);
+  }
+
+  return bans;
+}
+
+unsigned long bench_dom (FILE * fp, bench_ban_t * bans, unsigned long count)
+{
+  unsigned long i, l;
+  xml_node_t *tree, *node;
+
+  tree = xml_node_add (NULL, "Aquila");
+  node = xml_node_add (tree, "HardBanList");
+  node = xml_node_add (node, "BanList");
+  for (i = 0; i < count; i++) {
+    node = xml_node_add (node, "Ban");
+    xml_node_add_value (node, "IP", XML_TYPE_IP, &bans[i].ip);
+    xml_node_add_value (node, "Netmask", XML_TYPE_IP, &bans[i].netmask);
+    xml_node_add_value (node, "Nick", XML_TYPE_STRING, bans[i].nick);
+    xml_node_add_value (node, "OP", XML_TYPE_STRING, bans[i].op);
+    xml_node_add_value (node, "Expire", XML_TYPE_ULONG, &bans[i].expire);
+    xml_node_add_value (node, "Message", XML_TYPE_STRING, bans[i].message);
+    node = xml_parent (node);
+  }
+
+  l = xml_write (fp, tree);
+  xml_free (tree);
+
+  return l;
+}
+
+unsigned long bench_stream (FILE * fp, bench_ban_t * bans, unsigned long count)
+{
+  unsigned long i;
+  xml_writer_t *w;
+
+  w = xml_writer_open (fp);
+  if (!w)
+    return 0;
+
+  xml_writer_start (w, "Aquila");
+  xml_writer_start (w, "HardBanList");
+  xml_writer_start (w, "BanList");
+  for (i = 0; i < count; i++) {
+    xml_writer_start (w, "Ban");
+    xml_writer_value (w, "IP", XML_TYPE_IP, &bans[i].ip);
+    xml_writer_value (w, "Netmask", XML_TYPE_IP, &bans[i].netmask);
+    xml_writer_value (w, "Nick", XML_TYPE_STRING, bans[i].nick);
+    xml_writer_value (w, "OP", XML_TYPE_STRING, bans[i].op);
+    xml_writer_value (w, "Expire", XML_TYPE_ULONG, &bans[i].expire);
+    xml_writer_value (w, "Message", XML_TYPE_STRING, bans[i].message);
+    xml_writer_end (w);
+  }
+
+  return xml_writer_close (w);
+}
+
+int main (int argc, char **argv)
+{
+  unsigned long count, size;
+  bench_ban_t *bans;
+  struct timeval start, end;
+  struct rusage usage;
+  long base;
+  FILE *fp;
+
+  if (argc < 3) {
+    printf ("%s <dom|stream> <entries> [<filename>]\n", argv[0]);
+    return 0;
+  }
+
+  count = strtoul (argv[2], NULL, 0);
+  bans = bench_generate (count);
+  if (!bans) {
+    perror ("Error: ");
+    return 1;
+  }
+
+  fp = fopen (argc > 3 ? argv[3] : "/dev/null", "w");
+  if (!fp) {
+    perror ("Error: ");
+    return 1;
+  }
+
+  /* the dataset itself is not part of the save cost */
+  getrusage (RUSAGE_SELF, &usage);
+  base = usage.ru_maxrss;
+
+  gettimeofday (&start, NULL);
+  if (!strcmp (argv[1], "dom")) {
+    size = bench_dom (fp, bans, count);
+  } else if (!strcmp (argv[1], "stream")) {
+    size = bench_stream (fp, bans, count);
+  } else {
+    printf ("Unknown mode %s\n", argv[1]);
+    return 1;
+  }
+  fclose (fp);
+  gettimeofday (&end, NULL);
+
+  getrusage (RUSAGE_SELF, &usage);
+
+  printf ("%s: %lu entries, %lu bytes, %lu ms, peak RSS %ld kB (+%ld kB over the dataset)\n",
+	  argv[1], count, size,
+	  (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000,
+	  usage.ru_maxrss, usage.ru_maxrss - base);
+
+  free (bans);
+
+  return 0;
+}